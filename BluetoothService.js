@@ -1,4 +1,9 @@
 import { Alert, PermissionsAndroid, Platform } from 'react-native';
+import AsyncStorage from '@react-native-async-storage/async-storage';
+import { decodeCbor, isCborPayload } from './CborDecoder';
+import { decodeBinaryRecord, isBinaryPayload } from './RecordSchema';
+import { CaptureCollector } from './CaptureDecoder';
+import { SpectrogramCollector } from './SpectrogramDecoder';
 
 // Try to import BLE manager with fallback
 let BleManager;
@@ -20,10 +25,47 @@ class BluetoothService {
     this.isMonitoring = false; // Track monitoring state
     this.monitoringSubscription = null; // Store subscription reference
     this.dataProcessingTimeout = null; // Timeout for partial data recovery
+
+    // Store-and-forward: readings replayed on the history stream, stored
+    // and then acknowledged in batches
+    this.historySubscription = null;
+    this.historyPending = [];
+    this.historyAckTimeout = null;
+    this.historyStore = Promise.resolve(); // Stores run one after another
+    this.HISTORY_STORAGE_KEY = 'sensorHistory';
+    this.HISTORY_MAX_RECORDS = 2000;
+    this.HISTORY_ACK_BATCH = 32;   // Records stored per acknowledgement
+    this.HISTORY_ACK_DELAY = 500;  // ms without records before a partial batch is stored
+
+    // Diagnostic capture reports, collected message by message; the device
+    // holds a finished report until the capture stream is subscribed
+    this.captureSubscription = null;
+    this.captureCollector = null;
+
+    // Live spectrogram, only subscribed while a screen shows it: the device
+    // computes spectra only while the stream is subscribed
+    this.spectrogramSubscription = null;
+    this.spectrogramCollector = null;
     
     // UUIDs for ESP32 Water Sensor (must match Arduino code)
     this.SERVICE_UUID = "12345678-1234-1234-1234-123456789abc";
     this.CHARACTERISTIC_UUID = "87654321-4321-4321-4321-cba987654321";
+
+    // Largest ATT MTU the firmware accepts (517 on the ESP32); asked for
+    // on connect so whole records fit one notification
+    this.REQUESTED_MTU = 512;
+
+    // Per-stream characteristics (PlatformIO firmware); each notifies at its own rate
+    this.STREAM_UUIDS = {
+      live: "87654322-4321-4321-4321-cba987654321",
+      vibration: "87654323-4321-4321-4321-cba987654321",
+      alerts: "87654324-4321-4321-4321-cba987654321",
+      stats: "87654325-4321-4321-4321-cba987654321",
+      diagnostics: "87654326-4321-4321-4321-cba987654321",
+      history: "87654327-4321-4321-4321-cba987654321", // Missed readings after a reconnect; write acks here
+      capture: "87654329-4321-4321-4321-cba987654321", // Diagnostic capture report; write [seconds, flags] to start
+      spectrogram: "8765432a-4321-4321-4321-cba987654321" // Live spectra; write settings here
+    };
     
     // Only create BLE manager if available
     if (BleManager) {
@@ -85,6 +127,9 @@ class BluetoothService {
         }
         
         // Reset internal state
+        this.stopHistorySync();
+        this.stopCaptureSync();
+        this.stopSpectrogram();
         this.device = null;
         this.characteristic = null;
         this.isConnected = false;
@@ -377,6 +422,19 @@ class BluetoothService {
           console.log('🔍 Discovering services...');
           await this.device.discoverAllServicesAndCharacteristics();
           console.log('✅ Services discovered');
+
+          // Records go out as single notifications of at most MTU - 3
+          // bytes, and the device refuses longer ones; the default 23-byte
+          // MTU fits none of the JSON records. Android negotiates on
+          // request, iOS on its own.
+          if (Platform.OS === 'android') {
+            try {
+              this.device = await this.device.requestMTU(this.REQUESTED_MTU);
+              console.log('📏 MTU:', this.device.mtu);
+            } catch (mtuError) {
+              console.warn('⚠️ MTU request failed (ignoring):', mtuError.message);
+            }
+          }
           
           this.isConnected = true;
           
@@ -407,9 +465,17 @@ class BluetoothService {
         this.lastConnectionEvent = now;
       }
       
+      // Collect readings missed while disconnected, and any capture
+      // report that finished meanwhile
+      this.startHistorySync();
+      this.startCaptureSync();
+
       // Monitor connection status with debouncing for disconnection events
       this.device.onDisconnected((error, device) => {
         console.log('Device disconnected:', error);
+        this.stopHistorySync();
+        this.stopCaptureSync();
+        this.stopSpectrogram();
         
         // Debounce disconnection events to prevent duplicates
         const now = Date.now();
@@ -707,6 +773,7 @@ class BluetoothService {
     const qualityMatch = this.jsonBuffer.match(/"quality":\s*"([^"]+)"/);
     const vibrationMatch = this.jsonBuffer.match(/"vibration":\s*([0-9.]+)/);
     const timestampMatch = this.jsonBuffer.match(/"timestamp":\s*([0-9]+)/);
+    const batteryMatch = this.jsonBuffer.match(/"batteryLevel":\s*([0-9]+)/);
     
     if (tdsMatch || vibrationMatch) {
       // Construct a valid JSON from extracted values
@@ -716,7 +783,7 @@ class BluetoothService {
         vibration: vibrationMatch ? parseFloat(vibrationMatch[1]) : null,
         timestamp: timestampMatch ? parseInt(timestampMatch[1]) : Date.now(),
         deviceId: "ESP32-Water-Sensor",
-        batteryLevel: 100,
+        batteryLevel: batteryMatch ? parseInt(batteryMatch[1]) : 100,
         recovered: true // Flag to indicate this was reconstructed
       };
       
@@ -852,6 +919,9 @@ class BluetoothService {
   async disconnect() {
     if (this.device) {
       try {
+        this.stopHistorySync();
+        this.stopCaptureSync();
+        this.stopSpectrogram();
         await this.device.cancelConnection();
         console.log('Disconnected from device');
         this.isConnected = false;
@@ -949,8 +1019,10 @@ class BluetoothService {
         vibration: parsed.vibration !== null ? parseFloat(parsed.vibration) || 0 : 0,
         timestamp: new Date().toISOString(), // Use current time for React Native
         deviceTimestamp: parseInt(parsed.timestamp) || Date.now(), // ESP32 millis()
+        seq: parseInt(parsed.seq) || 0, // History sequence number (0 on older firmware)
         deviceId: parsed.deviceId || 'ESP32-Water-Sensor',
-        batteryLevel: parseInt(parsed.batteryLevel) || 100,
+        batteryLevel: Number.isFinite(parseInt(parsed.batteryLevel)) ? parseInt(parsed.batteryLevel) : 100, // 100 from firmware without battery sensing
+        batteryVoltage: parsed.batteryVoltage !== undefined ? parseFloat(parsed.batteryVoltage) : null,
         signalStrength: this.device?.rssi || 0, // Add signal strength if available
         connectionTime: this.lastConnectionEvent ? new Date(this.lastConnectionEvent).toISOString() : null,
         recovered: parsed.recovered || false // Flag if data was reconstructed from fragments
@@ -1017,6 +1089,264 @@ class BluetoothService {
     }
   }
 
+  // Decode a per-stream characteristic value; the firmware sends JSON,
+  // CBOR or binary (selected on the device) with the same field names
+  decodeStreamPayload(base64String) {
+    const text = this.base64ToText(base64String);
+    const bytes = this.textToBytes(text);
+    // Binary records start with 0xB1, which CBOR would also accept as a map
+    if (isBinaryPayload(bytes)) {
+      return decodeBinaryRecord(bytes);
+    }
+    if (isCborPayload(bytes)) {
+      return decodeCbor(bytes);
+    }
+    return JSON.parse(text);
+  }
+
+  textToBytes(text) {
+    return Uint8Array.from(text, char => char.charCodeAt(0) & 0xff);
+  }
+
+  // Subscribe to the history stream. After a reconnect the device replays
+  // every reading since the last acknowledgement, oldest first, before
+  // live notifications resume; each is stored and then acknowledged.
+  startHistorySync() {
+    if (!this.device || this.historySubscription) {
+      return;
+    }
+    this.historySubscription = this.device.monitorCharacteristicForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.history,
+      (error, characteristic) => {
+        if (error) {
+          console.log('History stream unavailable:', error.message);
+          return;
+        }
+        if (!characteristic || !characteristic.value) {
+          return;
+        }
+        try {
+          const record = this.decodeStreamPayload(characteristic.value);
+          this.historyPending.push(record);
+          this.notifySubscribers('historyReceived', { data: record });
+          this.scheduleHistoryStore();
+        } catch (error) {
+          console.error('Error decoding history record:', error);
+        }
+      }
+    );
+  }
+
+  stopHistorySync() {
+    if (this.historyAckTimeout) {
+      clearTimeout(this.historyAckTimeout);
+      this.historyAckTimeout = null;
+    }
+    if (this.historySubscription) {
+      try {
+        this.historySubscription.remove();
+      } catch (error) {
+        console.warn('⚠️ History subscription remove failed (ignoring):', error.message);
+      }
+      this.historySubscription = null;
+    }
+    // Keep what arrived; without an ack the device sends it again anyway
+    this.storeHistory(false);
+  }
+
+  scheduleHistoryStore() {
+    if (this.historyAckTimeout) {
+      clearTimeout(this.historyAckTimeout);
+      this.historyAckTimeout = null;
+    }
+    if (this.historyPending.length >= this.HISTORY_ACK_BATCH) {
+      this.storeHistory(true);
+    } else {
+      this.historyAckTimeout = setTimeout(() => {
+        this.historyAckTimeout = null;
+        this.storeHistory(true);
+      }, this.HISTORY_ACK_DELAY);
+    }
+  }
+
+  // Append the pending records to the stored history (newest
+  // HISTORY_MAX_RECORDS kept), then acknowledge them. Records arrive in
+  // sequence order, and numbers the device skips were lost there, so the
+  // newest stored record is the highest sequence number held without gaps.
+  // Stores are chained: each read-modify-write of the stored history
+  // starts after the previous one has finished, so none overwrites
+  // another's records, and a sequence number is only acknowledged once
+  // the write holding it is done.
+  storeHistory(acknowledge) {
+    const records = this.historyPending;
+    if (records.length === 0) {
+      return this.historyStore;
+    }
+    this.historyPending = [];
+    this.historyStore = this.historyStore.then(() => this.writeHistory(records, acknowledge));
+    return this.historyStore;
+  }
+
+  async writeHistory(records, acknowledge) {
+    try {
+      const stored = await AsyncStorage.getItem(this.HISTORY_STORAGE_KEY);
+      const history = (stored ? JSON.parse(stored) : []).concat(records);
+      await AsyncStorage.setItem(
+        this.HISTORY_STORAGE_KEY,
+        JSON.stringify(history.slice(-this.HISTORY_MAX_RECORDS))
+      );
+    } catch (error) {
+      // Not stored: put them back ahead of newer records, so no later
+      // acknowledgement covers them until they are
+      console.error('Error storing history:', error);
+      this.historyPending = records.concat(this.historyPending);
+      return;
+    }
+    if (acknowledge) {
+      try {
+        await this.acknowledgeSequence(records[records.length - 1].seq);
+      } catch (error) {
+        // Stored anyway; the device replays them and the next ack covers them
+        console.warn('⚠️ History acknowledgement failed:', error.message);
+      }
+    }
+  }
+
+  // Tell the device every reading up to `seq` is stored, so only later
+  // ones are replayed on the history stream after the next reconnect.
+  // Ack the highest sequence number held without gaps.
+  async acknowledgeSequence(seq) {
+    if (!this.device || !seq) {
+      return;
+    }
+    const bytes = [seq & 0xff, (seq >>> 8) & 0xff, (seq >>> 16) & 0xff, (seq >>> 24) & 0xff];
+    const base64 = btoa(String.fromCharCode(...bytes));
+    await this.device.writeCharacteristicWithResponseForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.history,
+      base64
+    );
+  }
+
+  // Subscribe to the capture stream. Each report arrives as a header,
+  // per-axis statistics and spectra, TDS statistics and raw frames (if
+  // requested), then an end message; the collected report goes to the
+  // subscribers as 'captureReceived'.
+  startCaptureSync() {
+    if (!this.device || this.captureSubscription) {
+      return;
+    }
+    this.captureSubscription = this.device.monitorCharacteristicForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.capture,
+      (error, characteristic) => {
+        if (error) {
+          console.log('Capture stream unavailable:', error.message);
+          return;
+        }
+        if (!characteristic || !characteristic.value) {
+          return;
+        }
+        try {
+          const bytes = this.textToBytes(this.base64ToText(characteristic.value));
+          // Raw frames stream while the capture runs, before its header
+          if (!this.captureCollector || this.captureCollector.done) {
+            this.captureCollector = new CaptureCollector();
+          }
+          this.captureCollector.add(bytes);
+          if (this.captureCollector.done) {
+            this.notifySubscribers('captureReceived', { data: this.captureCollector });
+          }
+        } catch (error) {
+          console.error('Error decoding capture message:', error);
+        }
+      }
+    );
+  }
+
+  stopCaptureSync() {
+    if (this.captureSubscription) {
+      try {
+        this.captureSubscription.remove();
+      } catch (error) {
+        console.warn('⚠️ Capture subscription remove failed (ignoring):', error.message);
+      }
+      this.captureSubscription = null;
+    }
+    this.captureCollector = null;
+  }
+
+  // Start a diagnostic capture on the device (seconds 0 = its default),
+  // optionally streaming raw frames; stop = true ends a running one early
+  async requestCapture(seconds = 0, raw = false, stop = false) {
+    if (!this.device) {
+      throw new Error('Not connected');
+    }
+    const flags = (raw ? 0x01 : 0) | (stop ? 0x80 : 0);
+    await this.device.writeCharacteristicWithResponseForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.capture,
+      btoa(String.fromCharCode(seconds & 0xff, flags))
+    );
+  }
+
+  // Subscribe to the live spectrogram; each notification's spectra go to
+  // the subscribers as 'spectrogramReceived' along with the collector,
+  // which holds the newest maxSpectra and counts dropped ones
+  startSpectrogram(maxSpectra = 256) {
+    if (!this.device || this.spectrogramSubscription) {
+      return;
+    }
+    this.spectrogramCollector = new SpectrogramCollector(maxSpectra);
+    this.spectrogramSubscription = this.device.monitorCharacteristicForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.spectrogram,
+      (error, characteristic) => {
+        if (error) {
+          console.log('Spectrogram stream unavailable:', error.message);
+          return;
+        }
+        if (!characteristic || !characteristic.value || !this.spectrogramCollector) {
+          return;
+        }
+        try {
+          const bytes = this.textToBytes(this.base64ToText(characteristic.value));
+          const message = this.spectrogramCollector.add(bytes);
+          this.notifySubscribers('spectrogramReceived', { data: message, collector: this.spectrogramCollector });
+        } catch (error) {
+          console.error('Error decoding spectrogram:', error);
+        }
+      }
+    );
+  }
+
+  stopSpectrogram() {
+    if (this.spectrogramSubscription) {
+      try {
+        this.spectrogramSubscription.remove();
+      } catch (error) {
+        console.warn('⚠️ Spectrogram subscription remove failed (ignoring):', error.message);
+      }
+      this.spectrogramSubscription = null;
+    }
+    this.spectrogramCollector = null;
+  }
+
+  // Change (and save on the device) the spectrogram settings: FFT size as
+  // log2 (4-8), bins sent, overlap %, axis (0-2 X/Y/Z, 3 magnitude) and
+  // whether to sample at 1 kHz
+  async configureSpectrogram({ fftSizeLog2 = 6, bins = 32, overlapPercent = 50, axis = 3, highRate = false } = {}) {
+    if (!this.device) {
+      throw new Error('Not connected');
+    }
+    await this.device.writeCharacteristicWithResponseForService(
+      this.SERVICE_UUID,
+      this.STREAM_UUIDS.spectrogram,
+      btoa(String.fromCharCode(fftSizeLog2, bins, overlapPercent, axis, highRate ? 0x01 : 0))
+    );
+  }
+
   // Manual base64 decoding for React Native
   manualBase64Decode(base64String) {
     try {
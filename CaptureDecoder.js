@@ -0,0 +1,101 @@
+// Decoder for diagnostic capture messages from the ESP32 firmware (see
+// src/diag_capture.h). Feed every notification of the capture
+// characteristic to a CaptureCollector; the capture is complete once
+// `done` is true.
+
+export const CAPTURE_AXES = ['x', 'y', 'z'];
+
+const MSG_HEADER = 1;
+const MSG_AXIS = 2;
+const MSG_SPECTRUM = 3;
+const MSG_TDS = 4;
+const MSG_RAW = 5;
+const MSG_END = 6;
+
+// One spectrum byte (1/8 octave steps of 16 x magnitude) back to counts
+export function spectrumByteToMagnitude(value) {
+  return value === 0 ? 0 : Math.pow(2, value / 8) / 16;
+}
+
+export class CaptureCollector {
+  constructor() {
+    this.header = null;
+    this.axes = {};              // 'unit/axis' -> statistics and spectrum
+    this.tds = [];               // Per probe, in ppm
+    this.raw = [[], []];         // Per unit: [frame, x, y, z] in counts
+    this.done = false;
+    this.stopped = false;
+  }
+
+  axis(key) {
+    if (!this.axes[key]) this.axes[key] = { spectrum: [] };
+    return this.axes[key];
+  }
+
+  // Decode one message from a Uint8Array
+  add(bytes) {
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    switch (bytes[0]) {
+      case MSG_HEADER:
+        this.header = {
+          raw: (bytes[1] & 1) !== 0,
+          durationMs: view.getUint32(2, true),
+          sampleRateHz: view.getUint16(6, true) / 10,
+          fftSize: view.getUint16(8, true),
+          segments: view.getUint16(10, true),
+          units: bytes[12],
+          probes: bytes[13],
+          countScale: view.getUint16(14, true) / 1e6,
+          rawDropped: view.getUint32(16, true),
+        };
+        break;
+      case MSG_AXIS: {
+        const stats = this.axis(`${bytes[1] >> 2}/${CAPTURE_AXES[bytes[1] & 3]}`);
+        stats.samples = view.getUint32(2, true);
+        stats.mean = view.getInt16(6, true);
+        stats.rms = view.getUint16(8, true);
+        stats.min = view.getInt16(10, true);
+        stats.max = view.getInt16(12, true);
+        stats.peakBin = view.getUint16(14, true);
+        break;
+      }
+      case MSG_SPECTRUM: {
+        const stats = this.axis(`${bytes[1] >> 2}/${CAPTURE_AXES[bytes[1] & 3]}`);
+        for (let i = 3; i < bytes.length; i++) {
+          stats.spectrum[bytes[2] + i - 3] = spectrumByteToMagnitude(bytes[i]);
+        }
+        break;
+      }
+      case MSG_TDS:
+        this.tds[bytes[1]] = {
+          scans: view.getUint16(2, true),
+          mean: view.getUint16(4, true) / 10,
+          std: view.getUint16(6, true) / 10,
+          min: view.getUint16(8, true) / 10,
+          max: view.getUint16(10, true) / 10,
+        };
+        break;
+      case MSG_RAW: {
+        const frames = this.raw[bytes[1]];
+        let frame = view.getUint32(2, true);
+        for (let offset = 6; offset + 6 <= bytes.length; offset += 6, frame++) {
+          frames.push([frame, view.getInt16(offset, true), view.getInt16(offset + 2, true), view.getInt16(offset + 4, true)]);
+        }
+        break;
+      }
+      case MSG_END:
+        this.done = true;
+        this.stopped = bytes[1] === 1;
+        break;
+      default:
+        throw new Error(`Unknown capture message ${bytes[0]}`);
+    }
+  }
+
+  // Frequency of a spectrum bin in Hz
+  binHz(bin) {
+    return this.header ? (bin * this.header.sampleRateHz) / this.header.fftSize : 0;
+  }
+}
+
+export default { CaptureCollector, spectrumByteToMagnitude, CAPTURE_AXES };
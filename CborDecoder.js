@@ -0,0 +1,121 @@
+// Minimal CBOR (RFC 8949) decoder for payloads from the ESP32 firmware.
+// Supports the item types the firmware emits (integers, text/byte strings,
+// arrays, definite and indefinite-length maps, booleans, null, floats and
+// decimal fractions).
+
+const BREAK = Symbol('break');
+
+function halfToFloat(half) {
+  const exponent = (half >> 10) & 0x1f;
+  const mantissa = half & 0x3ff;
+  const sign = half & 0x8000 ? -1 : 1;
+  if (exponent === 0) return sign * mantissa * Math.pow(2, -24);
+  if (exponent === 31) return mantissa ? NaN : sign * Infinity;
+  return sign * (1 + mantissa / 1024) * Math.pow(2, exponent - 15);
+}
+
+class CborReader {
+  constructor(bytes) {
+    this.bytes = bytes;
+    this.view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    this.offset = 0;
+  }
+
+  readArgument(info) {
+    if (info < 24) return info;
+    const offset = this.offset;
+    switch (info) {
+      case 24: this.offset += 1; return this.view.getUint8(offset);
+      case 25: this.offset += 2; return this.view.getUint16(offset);
+      case 26: this.offset += 4; return this.view.getUint32(offset);
+      case 27: {
+        this.offset += 8;
+        return this.view.getUint32(offset) * 4294967296 + this.view.getUint32(offset + 4);
+      }
+      case 31: return -1; // Indefinite length
+      default: throw new Error(`Invalid CBOR additional info ${info}`);
+    }
+  }
+
+  readItem() {
+    if (this.offset >= this.bytes.length) {
+      throw new Error('Unexpected end of CBOR data');
+    }
+    const initial = this.bytes[this.offset++];
+    const major = initial >> 5;
+    const info = initial & 0x1f;
+
+    if (major === 7) {
+      switch (info) {
+        case 20: return false;
+        case 21: return true;
+        case 22: return null;
+        case 23: return undefined;
+        case 25: { const v = this.view.getUint16(this.offset); this.offset += 2; return halfToFloat(v); }
+        case 26: { const v = this.view.getFloat32(this.offset); this.offset += 4; return v; }
+        case 27: { const v = this.view.getFloat64(this.offset); this.offset += 8; return v; }
+        case 31: return BREAK;
+        default: return info;
+      }
+    }
+
+    const length = this.readArgument(info);
+    switch (major) {
+      case 0: return length;
+      case 1: return -1 - length;
+      case 2: {
+        const value = this.bytes.slice(this.offset, this.offset + length);
+        this.offset += length;
+        return value;
+      }
+      case 3: {
+        let text = '';
+        for (let i = 0; i < length; i++) text += String.fromCharCode(this.bytes[this.offset + i]);
+        this.offset += length;
+        try { return decodeURIComponent(escape(text)); } catch (e) { return text; }
+      }
+      case 4: {
+        const items = [];
+        for (let i = 0; length < 0 || i < length; i++) {
+          const item = this.readItem();
+          if (item === BREAK) break;
+          items.push(item);
+        }
+        return items;
+      }
+      case 5: {
+        const map = {};
+        for (let i = 0; length < 0 || i < length; i++) {
+          const key = this.readItem();
+          if (key === BREAK) break;
+          map[key] = this.readItem();
+        }
+        return map;
+      }
+      case 6: {
+        const item = this.readItem();
+        // Decimal fraction [exponent, mantissa]: the firmware's Fixed fields.
+        // Dividing by the power of ten gives the nearest double to the
+        // decimal (735 / 100 is 7.35, 735 * 0.01 is not)
+        if (length === 4 && Array.isArray(item) && item.length === 2) {
+          const [exponent, mantissa] = item;
+          return exponent < 0 ? mantissa / Math.pow(10, -exponent) : mantissa * Math.pow(10, exponent);
+        }
+        return item; // Other tags are ignored
+      }
+      default: throw new Error(`Unsupported CBOR major type ${major}`);
+    }
+  }
+}
+
+// Decode one CBOR item from a Uint8Array
+export function decodeCbor(bytes) {
+  return new CborReader(bytes).readItem();
+}
+
+// CBOR payloads from the firmware are maps; JSON payloads start with '{'
+export function isCborPayload(bytes) {
+  return bytes.length > 0 && (bytes[0] === 0xbf || (bytes[0] >= 0xa0 && bytes[0] <= 0xbb));
+}
+
+export default { decodeCbor, isCborPayload };
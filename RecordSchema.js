@@ -0,0 +1,202 @@
+// Generated by tools/gen_record_schema.js from src/record_schema.h; do not edit.
+// Decodes the firmware's binary payload format (see record_schema.h).
+
+export const STATUS_NAMES = ['unknown', 'clean', 'unsafe', 'extremely_unsafe', 'vibration_detected'];
+
+// Record id -> name and fields in wire order: [key, kind, decimals]
+export const RECORD_SCHEMAS = {
+  1: {
+    name: 'legacy',
+    fields: [
+      ['pH', 'Fixed', 2],
+      ['temperature', 'Fixed', 1],
+      ['tds', 'Fixed', 1],
+      ['turbidity', 'Fixed', 2],
+      ['vibration', 'Fixed', 2],
+      ['vibrationDetected', 'Bool'],
+      ['waterStatus', 'Status'],
+      ['timestamp', 'QuotedUInt'],
+      ['deviceId', 'Text'],
+      ['status', 'Text'],
+      ['configHash', 'Hex'],
+      ['seq', 'UInt'],
+      ['batteryLevel', 'UInt'],
+      ['batteryVoltage', 'Fixed', 2],
+    ],
+  },
+  2: {
+    name: 'live',
+    fields: [
+      ['pH', 'Fixed', 2],
+      ['temperature', 'Fixed', 1],
+      ['tds', 'Fixed', 1],
+      ['turbidity', 'Fixed', 2],
+      ['waterStatus', 'Status'],
+      ['timestamp', 'UInt'],
+      ['seq', 'UInt'],
+      ['batteryLevel', 'UInt'],
+      ['tdsAt', 'UInt'],
+      ['tds0', 'Fixed', 1],
+      ['tds1', 'Fixed', 1],
+      ['tds2', 'Fixed', 1],
+      ['tds3', 'Fixed', 1],
+      ['tds4', 'Fixed', 1],
+      ['tds5', 'Fixed', 1],
+      ['tds6', 'Fixed', 1],
+      ['tds7', 'Fixed', 1],
+    ],
+  },
+  3: {
+    name: 'vibration',
+    fields: [
+      ['vibration', 'Fixed', 3],
+      ['xAxis', 'Fixed', 3],
+      ['yAxis', 'Fixed', 3],
+      ['zAxis', 'Fixed', 3],
+      ['vibrationDetected', 'Bool'],
+      ['vibRms0', 'Fixed', 3],
+      ['vibPeak0', 'Fixed', 3],
+      ['vibPeakAt0', 'UInt'],
+      ['vibRms1', 'Fixed', 3],
+      ['vibPeak1', 'Fixed', 3],
+      ['vibPeakAt1', 'UInt'],
+      ['timestamp', 'UInt'],
+    ],
+  },
+  4: {
+    name: 'alert',
+    fields: [
+      ['waterStatus', 'Status'],
+      ['previousStatus', 'Status'],
+      ['tds', 'Fixed', 1],
+      ['vibration', 'Fixed', 2],
+      ['timestamp', 'UInt'],
+    ],
+  },
+  5: {
+    name: 'stats',
+    fields: [
+      ['samples', 'UInt'],
+      ['tdsMin', 'Fixed', 1],
+      ['tdsMax', 'Fixed', 1],
+      ['tdsMean', 'Fixed', 1],
+      ['vibrationMax', 'Fixed', 2],
+      ['vibrationEvents', 'UInt'],
+      ['mAhDayCpu', 'Fixed', 2],
+      ['mAhDayRadio', 'Fixed', 2],
+      ['mAhDayAdc', 'Fixed', 2],
+      ['mAhDaySensors', 'Fixed', 2],
+      ['mAhDayLed', 'Fixed', 2],
+      ['mAhDayTotal', 'Fixed', 1],
+      ['rssi', 'Int'],
+      ['txPower', 'Int'],
+      ['radioOnSavedMs', 'UInt'],
+      ['timestamp', 'UInt'],
+    ],
+  },
+  6: {
+    name: 'diagnostics',
+    fields: [
+      ['uptime', 'UInt'],
+      ['freeHeap', 'UInt'],
+      ['bootMs', 'UInt'],
+      ['mpu', 'Text'],
+      ['configHash', 'Hex'],
+      ['payloadFormat', 'Text'],
+      ['cacheRecords', 'UInt'],
+      ['cacheRecordHits', 'UInt'],
+      ['cacheFieldHits', 'UInt'],
+      ['cacheFieldEncodes', 'UInt'],
+      ['alertQueue', 'UInt'],
+      ['alertLatencyMs', 'Fixed', 1],
+      ['statusQueue', 'UInt'],
+      ['statusLatencyMs', 'Fixed', 1],
+      ['liveQueue', 'UInt'],
+      ['liveLatencyMs', 'Fixed', 1],
+      ['bulkQueue', 'UInt'],
+      ['bulkLatencyMs', 'Fixed', 1],
+      ['notifySent', 'UInt'],
+      ['notifyCoalesced', 'UInt'],
+      ['notifyDropped', 'UInt'],
+      ['notifyCongestion', 'UInt'],
+      ['cpuLoad', 'Fixed', 1],
+      ['cpuTasks', 'Text'],
+    ],
+  },
+  7: {
+    name: 'history',
+    fields: [
+      ['seq', 'UInt'],
+      ['pH', 'Fixed', 2],
+      ['temperature', 'Fixed', 1],
+      ['tds', 'Fixed', 1],
+      ['turbidity', 'Fixed', 2],
+      ['vibration', 'Fixed', 2],
+      ['vibrationDetected', 'Bool'],
+      ['waterStatus', 'Status'],
+      ['timestamp', 'UInt'],
+    ],
+  },
+};
+
+export const BINARY_MAGIC = 0xb1;
+
+export function isBinaryPayload(bytes) {
+  return bytes.length >= 6 && bytes[0] === BINARY_MAGIC && RECORD_SCHEMAS[bytes[1]] !== undefined;
+}
+
+// Record name ('live', 'vibration', ...) of a binary payload
+export function binaryRecordName(bytes) {
+  return RECORD_SCHEMAS[bytes[1]].name;
+}
+
+// Decode a binary record into the object the JSON record parses to
+export function decodeBinaryRecord(bytes) {
+  const schema = RECORD_SCHEMAS[bytes[1]];
+  if (!schema) throw new Error(`Unknown binary record ${bytes[1]}`);
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const mask = view.getUint32(2, true);
+  let offset = 6;
+  const record = {};
+
+  schema.fields.forEach(([key, kind, decimals], bit) => {
+    if (!(mask & (1 << bit))) return;
+    switch (kind) {
+      case 'Fixed':
+        record[key] = view.getInt32(offset, true) / Math.pow(10, decimals);
+        offset += 4;
+        break;
+      case 'UInt':
+        record[key] = view.getUint32(offset, true);
+        offset += 4;
+        break;
+      case 'QuotedUInt':
+        record[key] = String(view.getUint32(offset, true));
+        offset += 4;
+        break;
+      case 'Int':
+        record[key] = view.getInt32(offset, true);
+        offset += 4;
+        break;
+      case 'Hex':
+        record[key] = view.getUint32(offset, true).toString(16);
+        offset += 4;
+        break;
+      case 'Bool':
+        record[key] = bytes[offset++] !== 0;
+        break;
+      case 'Status':
+        record[key] = STATUS_NAMES[bytes[offset++]] || 'unknown';
+        break;
+      case 'Text': {
+        const length = bytes[offset++];
+        record[key] = String.fromCharCode(...bytes.subarray(offset, offset + length));
+        offset += length;
+        break;
+      }
+    }
+  });
+  return record;
+}
+
+export default { RECORD_SCHEMAS, STATUS_NAMES, isBinaryPayload, binaryRecordName, decodeBinaryRecord };
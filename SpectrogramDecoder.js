@@ -0,0 +1,90 @@
+// Decoder for live spectrogram notifications from the ESP32 firmware (see
+// src/spectrogram.h). Feed every notification of the spectrogram
+// characteristic to a SpectrogramCollector; it keeps the newest spectra
+// and counts the ones the device dropped.
+
+import { spectrumByteToMagnitude } from './CaptureDecoder';
+
+const HEADER_LEN = 10;
+
+// The rate in each message is the device's running estimate and wanders a
+// little; only a larger change (a switch to or from the 1 kHz capture mode)
+// means the spectra held are of a different rate
+const RATE_TOLERANCE = 0.02;
+
+// One notification from a Uint8Array. Spectra are one byte per bin on the
+// 1/8 octave scale of the capture spectra (see spectrumByteToMagnitude).
+export function decodeSpectrogram(bytes) {
+  if (bytes.length < HEADER_LEN) {
+    throw new Error(`Spectrogram message too short (${bytes.length} bytes)`);
+  }
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const count = bytes[2];
+  const bins = bytes[3];
+  if (HEADER_LEN + count * bins > bytes.length) {
+    throw new Error(`Spectrogram message truncated (${count} x ${bins} bins in ${bytes.length} bytes)`);
+  }
+  const spectra = [];
+  for (let i = 0; i < count; i++) {
+    const start = HEADER_LEN + i * bins;
+    spectra.push(bytes.slice(start, start + bins));
+  }
+  return {
+    sequence: view.getUint16(0, true),
+    bins,
+    sampleRateHz: view.getUint16(4, true) / 10,
+    fftSize: view.getUint16(6, true),
+    hop: view.getUint16(8, true),
+    spectra,
+  };
+}
+
+export class SpectrogramCollector {
+  constructor(maxSpectra = 256) {
+    this.maxSpectra = maxSpectra;
+    this.spectra = [];           // Oldest first
+    this.settings = null;        // { sampleRateHz, fftSize, hop, bins } of the spectra held
+    this.nextSequence = null;
+    this.dropped = 0;            // Spectra the device dropped (gaps in the sequence)
+  }
+
+  // Decode one notification and append its spectra; spectra of other
+  // settings or a clearly different rate are cleared first. Returns the
+  // decoded message.
+  add(bytes) {
+    const message = decodeSpectrogram(bytes);
+    if (this.nextSequence !== null) {
+      this.dropped += (message.sequence - this.nextSequence) & 0xffff;
+    }
+    this.nextSequence = (message.sequence + message.spectra.length) & 0xffff;
+
+    const s = this.settings;
+    if (!s || Math.abs(message.sampleRateHz - s.sampleRateHz) > s.sampleRateHz * RATE_TOLERANCE ||
+        s.fftSize !== message.fftSize || s.hop !== message.hop || s.bins !== message.bins) {
+      this.spectra = [];
+    }
+    this.settings = {
+      sampleRateHz: message.sampleRateHz,
+      fftSize: message.fftSize,
+      hop: message.hop,
+      bins: message.bins,
+    };
+    this.spectra.push(...message.spectra);
+    if (this.spectra.length > this.maxSpectra) {
+      this.spectra.splice(0, this.spectra.length - this.maxSpectra);
+    }
+    return message;
+  }
+
+  // Frequency of a bin in Hz
+  binHz(bin) {
+    return this.settings ? (bin * this.settings.sampleRateHz) / this.settings.fftSize : 0;
+  }
+
+  // Time between spectra in seconds
+  spectrumPeriod() {
+    return this.settings ? this.settings.hop / this.settings.sampleRateHz : 0;
+  }
+}
+
+export default { SpectrogramCollector, decodeSpectrogram, spectrumByteToMagnitude };
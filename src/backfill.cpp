@@ -0,0 +1,167 @@
+#include "backfill.h"
+
+#include <Preferences.h>
+
+#include "ble_service.h"
+#include "crc32.h"
+#include "history_log.h"
+#include "outbound_queue.h"
+#include "trace.h"
+
+static const char* BACKFILL_NAMESPACE = "wqack";
+static const char* BACKFILL_KEY = "acks";
+
+struct ClientAck {
+  uint8_t address[6];
+  uint16_t used;             // 0 for a free entry
+  uint32_t lastAck;          // Newest sequence number the client holds
+  uint32_t lastConnection;   // AckTable::connections when last seen
+};
+
+struct AckTable {
+  ClientAck clients[BACKFILL_MAX_CLIENTS];
+  uint32_t connections;      // Running count, orders lastConnection
+  uint32_t crc;              // CRC-32 of every byte above; must stay last
+};
+
+static AckTable table;
+static bool tableDirty = false;
+
+static ClientAck* client = NULL;   // Entry of the connected client
+static uint32_t connection = 0;    // bleConnectionId() of that connection
+static uint32_t cursor = 0;        // Next sequence number to replay
+static bool catchingUp = false;
+
+static void saveTable() {
+  table.crc = crc32Update(0, &table, offsetof(AckTable, crc));
+
+  Preferences prefs;
+  if (prefs.begin(BACKFILL_NAMESPACE, false)) {
+    prefs.putBytes(BACKFILL_KEY, &table, sizeof(table));
+    prefs.end();
+  }
+  tableDirty = false;
+}
+
+void backfillBegin() {
+  memset(&table, 0, sizeof(table));
+
+  Preferences prefs;
+  if (prefs.begin(BACKFILL_NAMESPACE, true)) {
+    AckTable stored;
+    size_t len = prefs.getBytes(BACKFILL_KEY, &stored, sizeof(stored));
+    prefs.end();
+
+    if (len == sizeof(stored) && crc32Update(0, &stored, offsetof(AckTable, crc)) == stored.crc) {
+      table = stored;
+    }
+  }
+}
+
+// Entry for an address, replacing the least recently seen client if it is new
+static ClientAck* findClient(const uint8_t address[6]) {
+  ClientAck* oldest = &table.clients[0];
+  for (int i = 0; i < BACKFILL_MAX_CLIENTS; i++) {
+    ClientAck* entry = &table.clients[i];
+    if (entry->used && memcmp(entry->address, address, sizeof(entry->address)) == 0) {
+      return entry;
+    }
+    if (!entry->used || (oldest->used && entry->lastConnection < oldest->lastConnection)) {
+      oldest = entry;
+    }
+  }
+
+  // New client: nothing to replay, it starts from live data
+  memcpy(oldest->address, address, sizeof(oldest->address));
+  oldest->used = 1;
+  oldest->lastAck = historyNewestSeq();
+  return oldest;
+}
+
+static void startSession() {
+  uint8_t address[6];
+  blePeerAddress(address);
+
+  client = findClient(address);
+  client->lastConnection = ++table.connections;
+  tableDirty = true;
+
+  cursor = max(client->lastAck + 1, historyOldestSeq());
+  catchingUp = cursor <= historyNewestSeq();
+
+  if (catchingUp) {
+    Serial.print("Backfill: ");
+    Serial.print(historyNewestSeq() - cursor + 1);
+    Serial.print(" records from #");
+    Serial.println(cursor);
+  }
+}
+
+static void endSession() {
+  if (tableDirty) {
+    saveTable();
+  }
+  client = NULL;
+  catchingUp = false;
+}
+
+static void handleAcknowledgement() {
+  uint8_t data[BLE_WRITE_MAX];
+  size_t len;
+  if (!bleStreamTakeWrite(STREAM_HISTORY, data, &len) || len != sizeof(uint32_t)) {
+    return;
+  }
+
+  uint32_t seq = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  if (seq > client->lastAck && seq <= historyNewestSeq()) {
+    client->lastAck = seq;
+    tableDirty = true;
+  }
+}
+
+void backfillUpdate(PayloadFormat format) {
+  bool connected = bleConnected();
+  uint32_t id = bleConnectionId();
+
+  if (client && (!connected || id != connection)) {
+    endSession();
+  }
+  if (connected && id != connection) {
+    connection = id;
+    startSession();
+  }
+  if (!client) {
+    return;
+  }
+
+  handleAcknowledgement();
+
+  // Replay only once the client listens on the history stream
+  if (!catchingUp || !bleStreamSubscribed(STREAM_HISTORY)) {
+    return;
+  }
+
+  // Keep the bulk class topped up; it is sent whenever nothing more
+  // urgent is waiting, so this runs at whatever rate the link allows.
+  // Records are encoded in place from the mapped partition.
+  TRACE_BEGIN(TRACE_BACKFILL);
+  for (; outboundHasRoom(OUTBOUND_BULK) && cursor <= historyNewestSeq(); cursor++) {
+    const HistoryRecord* record = historyPeek(cursor);
+    if (!record) {
+      continue;  // Lost to a failed write; nothing to replay
+    }
+    size_t len;
+    const uint8_t* data = encodeHistory(*record, format, &len);
+    outboundEnqueue(STREAM_HISTORY, OUTBOUND_BULK, data, len);
+  }
+  TRACE_END(TRACE_BACKFILL);
+
+  if (cursor > historyNewestSeq()) {
+    catchingUp = false;
+    Serial.println("Backfill: caught up");
+  }
+}
+
+bool backfillActive() {
+  return catchingUp && bleStreamSubscribed(STREAM_HISTORY);
+}
@@ -0,0 +1,33 @@
+/*
+ * Store-and-forward backfill keyed by acknowledged sequence numbers
+ *
+ * A client acknowledges the readings it has stored by writing the highest
+ * sequence number it holds without gaps to the history characteristic
+ * (uint32, little endian). When a known client reconnects, every logged
+ * reading after its last acknowledgement is replayed on the history stream
+ * as fast as the link takes it, and the live streams resume once it has
+ * caught up. A client seen for the first time starts with live data only.
+ *
+ * Acknowledgements are kept in RAM during a connection and written to NVS
+ * as one blob on disconnect, so acknowledging every record costs no flash
+ * writes; after a power loss mid-connection a few records are sent twice.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "telemetry.h"
+
+// Bonded clients remembered; the least recently connected one is replaced
+#define BACKFILL_MAX_CLIENTS 4
+
+// Load the acknowledgement table (one NVS read)
+void backfillBegin();
+
+// Follow connections and acknowledgements and send missed records; call
+// every loop()
+void backfillUpdate(PayloadFormat format);
+
+// True while a reconnected client is still being sent missed records
+bool backfillActive();
@@ -0,0 +1,137 @@
+#include "battery.h"
+
+#include "config.h"
+
+// Smoothing of the raw voltage: each sample moves it 1/8 of the way
+#define BATTERY_EMA_SHIFT 3
+
+struct SocPoint {
+  float volts;
+  float percent;
+};
+
+// Typical 1S Li-ion / LiPo resting voltage against state of charge at a
+// low discharge rate, highest first
+static const SocPoint DISCHARGE_CURVE[] = {
+  { 4.20, 100 }, { 4.10, 90 }, { 4.00, 80 }, { 3.92, 70 }, { 3.86, 60 },
+  { 3.81, 50 }, { 3.77, 40 }, { 3.73, 30 }, { 3.69, 20 }, { 3.61, 10 },
+  { 3.45, 5 }, { 3.30, 0 },
+};
+#define DISCHARGE_POINTS (sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]))
+
+static const BatteryPolicy POLICIES[BATTERY_MODE_COUNT] = {
+  { 1,  1,    3 },   // normal
+  { 2,  2,    0 },   // saver
+  { 4,  4,   -6 },   // low
+  { 10, 10, -12 },   // critical
+};
+
+static uint8_t batteryPin = 0;
+static float voltage = 0;
+static bool haveSample = false;
+static uint8_t percent = 100;
+static BatteryMode mode = BATTERY_NORMAL;
+
+const char* batteryModeName(BatteryMode mode) {
+  switch (mode) {
+    case BATTERY_NORMAL:   return "normal";
+    case BATTERY_SAVER:    return "saver";
+    case BATTERY_LOW:      return "low";
+    case BATTERY_CRITICAL: return "critical";
+    default:               return "unknown";
+  }
+}
+
+float batterySocFromVoltage(float volts) {
+  if (volts >= DISCHARGE_CURVE[0].volts) {
+    return 100;
+  }
+  for (size_t i = 1; i < DISCHARGE_POINTS; i++) {
+    const SocPoint& hi = DISCHARGE_CURVE[i - 1];
+    const SocPoint& lo = DISCHARGE_CURVE[i];
+    if (volts >= lo.volts) {
+      return lo.percent + (volts - lo.volts) * (hi.percent - lo.percent) / (hi.volts - lo.volts);
+    }
+  }
+  return 0;
+}
+
+// Charge below which each mode (after normal) applies
+static uint8_t modeThreshold(BatteryMode m) {
+  switch (m) {
+    case BATTERY_SAVER:    return config.batterySaverPercent;
+    case BATTERY_LOW:      return config.batteryLowPercent;
+    case BATTERY_CRITICAL: return config.batteryCriticalPercent;
+    default:               return 101;
+  }
+}
+
+static BatteryMode modeFor(uint8_t level) {
+  // Deeper modes are entered as soon as the charge drops below them
+  BatteryMode next = BATTERY_NORMAL;
+  for (int m = BATTERY_SAVER; m < BATTERY_MODE_COUNT; m++) {
+    if (level < modeThreshold((BatteryMode)m)) {
+      next = (BatteryMode)m;
+    }
+  }
+  if (next >= mode) {
+    return next;
+  }
+  // ...but only left once the charge is clearly above the threshold, one
+  // mode at a time so every mode passed on the way up keeps its band
+  BatteryMode up = mode;
+  while (up > next && level >= modeThreshold(up) + BATTERY_HYSTERESIS_PERCENT) {
+    up = (BatteryMode)(up - 1);
+  }
+  return up;
+}
+
+void batteryBegin(uint8_t pin) {
+  batteryPin = pin;
+  voltage = 0;
+  haveSample = false;
+  percent = 100;
+  mode = BATTERY_NORMAL;
+  if (batteryMonitored()) {
+    analogSetPinAttenuation(pin, ADC_11db);  // Full 0-3.1 V input range
+  }
+}
+
+bool batteryMonitored() {
+  return config.batteryDividerRatio > 0;
+}
+
+bool batterySample() {
+  if (!batteryMonitored()) {
+    return false;
+  }
+  float sample = analogReadMilliVolts(batteryPin) * config.batteryDividerRatio / 1000.0;
+  voltage = haveSample ? voltage + (sample - voltage) / (1 << BATTERY_EMA_SHIFT) : sample;
+  haveSample = true;
+
+  BatteryMode previous = mode;
+  if (voltage < BATTERY_ABSENT_VOLTS) {
+    percent = 100;
+    mode = BATTERY_NORMAL;
+  } else {
+    percent = (uint8_t)lroundf(batterySocFromVoltage(voltage));
+    mode = modeFor(percent);
+  }
+  return mode != previous;
+}
+
+float batteryVoltage() {
+  return voltage < BATTERY_ABSENT_VOLTS ? 0 : voltage;
+}
+
+uint8_t batteryPercent() {
+  return percent;
+}
+
+BatteryMode batteryMode() {
+  return mode;
+}
+
+const BatteryPolicy& batteryPolicy() {
+  return POLICIES[mode];
+}
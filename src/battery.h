@@ -0,0 +1,64 @@
+/*
+ * Battery monitoring and battery-aware acquisition policy
+ *
+ * The cell voltage is read through a resistor divider on an ADC pin, one
+ * conversion alongside every TDS reading, and smoothed. A Li-ion discharge
+ * curve turns it into state of charge, which picks a power mode:
+ *
+ *   mode      readings  notify intervals  BLE TX power
+ *   normal    x1        x1                +3 dBm
+ *   saver     x2        x2                 0 dBm
+ *   low       x4        x4                -6 dBm
+ *   critical  x10       x10              -12 dBm
+ *
+ * Thresholds live in config.h; a mode is only left upwards once the charge
+ * is BATTERY_HYSTERESIS_PERCENT above its threshold, and a recovering cell
+ * passes through every mode on the way, so a sagging cell does not flip
+ * between modes. Below BATTERY_ABSENT_VOLTS no cell is assumed
+ * (USB powered): the level reads 100% and the mode stays normal.
+ *
+ * Monitoring is off until a divider ratio is configured (`battery divider`
+ * on Serial): the default hardware has no cell, and an unconnected ADC pin
+ * floats anywhere up to full scale, which would read as a charged or
+ * draining battery and change the power mode.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define BATTERY_ABSENT_VOLTS 2.5
+#define BATTERY_HYSTERESIS_PERCENT 5
+
+enum BatteryMode {
+  BATTERY_NORMAL,
+  BATTERY_SAVER,
+  BATTERY_LOW,
+  BATTERY_CRITICAL,
+  BATTERY_MODE_COUNT
+};
+
+struct BatteryPolicy {
+  uint8_t readingScale;      // Reading interval multiplier
+  uint8_t notifyScale;       // Periodic stream interval multiplier
+  int8_t txPowerDbm;         // BLE transmit power
+};
+
+// Configure the ADC pin the divider is wired to and start over from a
+// full charge; call again after changing the divider ratio
+void batteryBegin(uint8_t pin);
+
+// Take one conversion and update voltage, charge and mode (nothing while
+// monitoring is off). Returns true if the mode changed.
+bool batterySample();
+
+bool batteryMonitored();         // A divider ratio is configured
+float batteryVoltage();          // Smoothed cell voltage, 0 if no cell
+uint8_t batteryPercent();
+BatteryMode batteryMode();
+const BatteryPolicy& batteryPolicy();
+const char* batteryModeName(BatteryMode mode);
+
+// State of charge (0-100) for a resting cell voltage, from the discharge
+// curve table
+float batterySocFromVoltage(float volts);
@@ -0,0 +1,458 @@
+#include "ble_service.h"
+
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+#include <BLE2902.h>
+#include <BLESecurity.h>
+
+#include "config.h"
+#include "energy.h"
+#include "trace.h"
+
+// Each notify characteristic takes 3 handles (declaration, value, CCCD)
+#define SERVICE_NUM_HANDLES 40
+
+const unsigned long READVERTISE_DELAY_MS = 500;  // Give bluetooth stack time to reset
+
+// Notifications the stack may hold before we stop handing over more; a few
+// per connection event keeps the link busy without overrunning its buffers
+const uint16_t MAX_IN_FLIGHT = 6;
+
+// No completion for this long while at the limit: assume the events were
+// lost and start counting afresh rather than stalling every stream
+const unsigned long TX_STALL_TIMEOUT_MS = 2000;
+
+struct StreamSlot {
+  const char* uuid;
+  BLECharacteristic* characteristic;
+  BLE2902* cccd;
+  unsigned long lastNotify;
+  bool writable;
+
+  // Latest client write, filled from the BLE task
+  volatile bool writePending;
+  uint8_t written[BLE_WRITE_MAX];
+  size_t writtenLen;
+};
+
+static StreamSlot streams[STREAM_COUNT] = {
+  { CHARACTERISTIC_UUID,   NULL, NULL, 0, true  },
+  { LIVE_CHAR_UUID,        NULL, NULL, 0, false },
+  { VIBRATION_CHAR_UUID,   NULL, NULL, 0, false },
+  { ALERTS_CHAR_UUID,      NULL, NULL, 0, false },
+  { STATS_CHAR_UUID,       NULL, NULL, 0, false },
+  { DIAGNOSTICS_CHAR_UUID, NULL, NULL, 0, false },
+  { HISTORY_CHAR_UUID,     NULL, NULL, 0, true  },
+  { TRACE_CHAR_UUID,       NULL, NULL, 0, true  },
+  { CAPTURE_CHAR_UUID,     NULL, NULL, 0, true  },
+  { SPECTROGRAM_CHAR_UUID, NULL, NULL, 0, true  },
+};
+
+static BLEServer* pServer = NULL;
+static volatile bool deviceConnected = false;
+static bool oldDeviceConnected = false;
+static volatile unsigned long disconnectedAt = 0;
+static volatile uint32_t connectionId = 0;
+static uint8_t peerAddress[6] = {0};
+
+static portMUX_TYPE writeMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Flow control, updated from the BLE task
+static portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool congested = false;
+static volatile bool notifyFailed = false;  // Set by onStatus() during notify()
+static volatile unsigned long lastTxProgress = 0;
+static BleTxStats txStats;
+
+// Power saving, set by the battery policy
+static uint8_t intervalScale = 1;
+static int8_t txPowerDbm = 3;   // Controller default (ESP_PWR_LVL_P3)
+
+// TX power levels every target's controller has, lowest first. The enum
+// values differ per target (ESP_PWR_LVL_N12 is 0 on the ESP32, but the
+// C3/S3/C6 enums start lower), so levels are only ever used by name.
+struct TxPowerLevel {
+  esp_power_level_t level;
+  int8_t dbm;
+};
+
+static const TxPowerLevel TX_POWER_LEVELS[] = {
+  { ESP_PWR_LVL_N12, -12 }, { ESP_PWR_LVL_N9, -9 }, { ESP_PWR_LVL_N6, -6 }, { ESP_PWR_LVL_N3, -3 },
+  { ESP_PWR_LVL_N0, 0 },    { ESP_PWR_LVL_P3, 3 },  { ESP_PWR_LVL_P6, 6 },  { ESP_PWR_LVL_P9, 9 },
+};
+#define TX_POWER_LEVEL_COUNT (sizeof(TX_POWER_LEVELS) / sizeof(TX_POWER_LEVELS[0]))
+
+// Link quality, updated from the BLE task
+static volatile int8_t linkRssi = 0;
+static volatile bool linkRssiValid = false;
+static volatile uint16_t connIntervalUnits = 0;   // 1.25 ms units, 0 if unknown
+static volatile uint16_t linkMtu = 23;            // ATT default until negotiated
+static uint16_t advIntervalMs = 0;                // 0 until set: stack default
+
+// BLE Server Callbacks
+class MyServerCallbacks: public BLEServerCallbacks {
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+      memcpy(peerAddress, param->connect.remote_bda, sizeof(peerAddress));
+      connectionId++;
+      connIntervalUnits = param->connect.conn_params.interval;
+      linkMtu = 23;
+      linkRssiValid = false;
+      deviceConnected = true;
+      TRACE_INSTANT(TRACE_BLE_CONNECT, 0);
+
+      // Bond (or re-encrypt with the stored keys) so the client shows up
+      // with its identity address next time
+      esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
+      Serial.println("Device connected!");
+    };
+
+    void onDisconnect(BLEServer* pServer) {
+      deviceConnected = false;
+      TRACE_INSTANT(TRACE_BLE_DISCONNECT, 0);
+      disconnectedAt = millis();
+      Serial.println("Device disconnected!");
+    }
+};
+
+// Keeps the latest write to a writable stream for bleStreamTakeWrite() and
+// notes notifications the stack refused
+class StreamCallbacks: public BLECharacteristicCallbacks {
+  public:
+    StreamCallbacks(StreamSlot* slot) : slot(slot) {}
+
+    void onWrite(BLECharacteristic* characteristic) {
+      if (!slot->writable) {
+        return;
+      }
+      size_t len = min(characteristic->getLength(), (size_t)BLE_WRITE_MAX);
+      portENTER_CRITICAL(&writeMux);
+      memcpy(slot->written, characteristic->getData(), len);
+      slot->writtenLen = len;
+      slot->writePending = true;
+      portEXIT_CRITICAL(&writeMux);
+    }
+
+    // Called from within notify(), in the caller's task
+    void onStatus(BLECharacteristic* characteristic, Status status, uint32_t code) {
+      if (status != SUCCESS_NOTIFY && status != SUCCESS_INDICATE) {
+        notifyFailed = true;
+      }
+    }
+
+  private:
+    StreamSlot* slot;
+};
+
+// Link measurements requested by the firmware or negotiated by the central
+static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  switch (event) {
+    case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT:
+      if (param->read_rssi.status == ESP_BT_STATUS_SUCCESS) {
+        linkRssi = param->read_rssi.rssi;
+        linkRssiValid = true;
+      }
+      break;
+
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+      if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+        connIntervalUnits = param->update_conn_params.conn_int;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Stack-level events the Arduino wrapper doesn't surface: per-notification
+// completion and link congestion
+static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+  switch (event) {
+    case ESP_GATTS_CONF_EVT:
+      portENTER_CRITICAL(&txMux);
+      if (txStats.inFlight > 0) {
+        txStats.inFlight--;
+      }
+      portEXIT_CRITICAL(&txMux);
+      lastTxProgress = millis();
+      // CONGESTED means queued in L2CAP, still to be sent
+      if (param->conf.status == ESP_GATT_CONGESTED) {
+        congested = true;
+        TRACE_INSTANT(TRACE_BLE_CONGESTED, 1);
+      } else if (param->conf.status != ESP_GATT_OK) {
+        txStats.failed++;
+      }
+      break;
+
+    case ESP_GATTS_CONGEST_EVT:
+      congested = param->congest.congested;
+      if (congested) {
+        txStats.congestion++;
+      }
+      TRACE_INSTANT(TRACE_BLE_CONGESTED, congested);
+      break;
+
+    case ESP_GATTS_MTU_EVT:
+      linkMtu = param->mtu.mtu;
+      break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+      portENTER_CRITICAL(&txMux);
+      txStats.inFlight = 0;
+      portEXIT_CRITICAL(&txMux);
+      congested = false;
+      break;
+
+    default:
+      break;
+  }
+}
+
+static unsigned long configuredInterval(BleStream stream) {
+  switch (stream) {
+    case STREAM_LEGACY:      return config.notifyIntervalMs;
+    case STREAM_LIVE:        return config.liveIntervalMs;
+    case STREAM_VIBRATION:   return config.vibrationIntervalMs;
+    case STREAM_STATS:       return config.statsIntervalMs;
+    case STREAM_DIAGNOSTICS: return config.diagnosticsIntervalMs;
+    default:                 return 0;  // Event driven
+  }
+}
+
+static unsigned long streamInterval(BleStream stream) {
+  return configuredInterval(stream) * intervalScale;
+}
+
+void bleServiceBegin() {
+  // Create the BLE Device
+  BLEDevice::setCustomGattsHandler(gattsEventHandler);
+  BLEDevice::setCustomGapHandler(gapEventHandler);
+  BLEDevice::init(BLE_DEVICE_NAME); // Device name for scanning
+  // Accept the largest MTU a client asks for, so whole records fit one
+  // notification (see bleNotifyMax())
+  BLEDevice::setMTU(517);
+
+  // Create the BLE Server
+  pServer = BLEDevice::createServer();
+  pServer->setCallbacks(new MyServerCallbacks());
+
+  // Just-works bonding with identity key exchange
+  BLESecurity* pSecurity = new BLESecurity();
+  pSecurity->setAuthenticationMode(ESP_LE_AUTH_BOND);
+  pSecurity->setCapability(ESP_IO_CAP_NONE);
+  pSecurity->setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  pSecurity->setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+
+  // Create the BLE Service
+  BLEService *pService = pServer->createService(BLEUUID(SERVICE_UUID), SERVICE_NUM_HANDLES);
+
+  // One characteristic per stream; the legacy and history ones accept writes
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY;
+    if (streams[i].writable) {
+      properties |= BLECharacteristic::PROPERTY_WRITE;
+    }
+
+    streams[i].characteristic = pService->createCharacteristic(streams[i].uuid, properties);
+    streams[i].cccd = new BLE2902();
+    streams[i].characteristic->addDescriptor(streams[i].cccd);
+    streams[i].characteristic->setCallbacks(new StreamCallbacks(&streams[i]));
+  }
+
+  // Start the service
+  pService->start();
+
+  // Start advertising
+  BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->addServiceUUID(SERVICE_UUID);
+  pAdvertising->setScanResponse(false);
+  pAdvertising->setMinPreferred(0x0);
+  BLEDevice::startAdvertising();
+
+  Serial.println("Water Quality Sensor is now advertising...");
+  Serial.println("Device name: " BLE_DEVICE_NAME);
+}
+
+void bleServiceUpdate() {
+  // Disconnecting: restart advertising once the stack has settled
+  if (!deviceConnected && oldDeviceConnected &&
+      millis() - disconnectedAt >= READVERTISE_DELAY_MS) {
+    pServer->startAdvertising();
+    Serial.println("Restarting advertising...");
+    oldDeviceConnected = deviceConnected;
+  }
+
+  // Connecting
+  if (deviceConnected && !oldDeviceConnected) {
+    oldDeviceConnected = deviceConnected;
+  }
+}
+
+bool bleConnected() {
+  return deviceConnected;
+}
+
+uint32_t bleConnectionId() {
+  return connectionId;
+}
+
+void blePeerAddress(uint8_t address[6]) {
+  memcpy(address, peerAddress, sizeof(peerAddress));
+}
+
+bool bleStreamSubscribed(BleStream stream) {
+  return deviceConnected && stream < STREAM_COUNT &&
+         streams[stream].cccd && streams[stream].cccd->getNotifications();
+}
+
+bool bleStreamDue(BleStream stream, unsigned long now) {
+  if (!bleStreamSubscribed(stream)) {
+    return false;
+  }
+  unsigned long interval = streamInterval(stream);
+  return interval == 0 || now - streams[stream].lastNotify >= interval;
+}
+
+void bleStreamSetValue(BleStream stream, const uint8_t* data, size_t len) {
+  if (data && stream < STREAM_COUNT && streams[stream].characteristic) {
+    streams[stream].characteristic->setValue((uint8_t*)data, len);
+  }
+}
+
+bool bleStreamNotify(BleStream stream, const uint8_t* data, size_t len) {
+  if (stream >= STREAM_COUNT || !streams[stream].characteristic) {
+    return false;
+  }
+  streams[stream].characteristic->setValue((uint8_t*)data, len);
+
+  // Counted before the hand-off: the completion event can arrive first
+  portENTER_CRITICAL(&txMux);
+  txStats.inFlight++;
+  portEXIT_CRITICAL(&txMux);
+
+  notifyFailed = false;
+  streams[stream].characteristic->notify();
+
+  if (notifyFailed) {
+    portENTER_CRITICAL(&txMux);
+    if (txStats.inFlight > 0) {
+      txStats.inFlight--;
+    }
+    portEXIT_CRITICAL(&txMux);
+    txStats.refused++;
+    return false;
+  }
+
+  if (txStats.inFlight == 1) {
+    lastTxProgress = millis();  // Stall timer runs from the oldest hand-off
+  }
+  txStats.notified++;
+  energyRadioTx(len);
+  txStats.maxInFlight = max(txStats.maxInFlight, txStats.inFlight);
+  streams[stream].lastNotify = millis();
+  return true;
+}
+
+bool bleTxReady() {
+  if (!deviceConnected || congested) {
+    return false;
+  }
+  if (txStats.inFlight >= MAX_IN_FLIGHT) {
+    if (millis() - lastTxProgress < TX_STALL_TIMEOUT_MS) {
+      return false;
+    }
+    portENTER_CRITICAL(&txMux);
+    txStats.inFlight = 0;
+    portEXIT_CRITICAL(&txMux);
+    lastTxProgress = millis();
+  }
+  return true;
+}
+
+const BleTxStats& bleTxStats() {
+  return txStats;
+}
+
+void bleStreamRestartInterval(BleStream stream) {
+  if (stream < STREAM_COUNT) {
+    streams[stream].lastNotify = millis();
+  }
+}
+
+void bleSetIntervalScale(uint8_t scale) {
+  intervalScale = max(scale, (uint8_t)1);
+}
+
+void bleSetTxPower(int8_t dbm) {
+  // Highest level at or below the request, the lowest if it is below all
+  const TxPowerLevel* chosen = &TX_POWER_LEVELS[0];
+  for (size_t i = 1; i < TX_POWER_LEVEL_COUNT && TX_POWER_LEVELS[i].dbm <= dbm; i++) {
+    chosen = &TX_POWER_LEVELS[i];
+  }
+  txPowerDbm = chosen->dbm;
+
+  // New connections, advertising, and the current connection
+  BLEDevice::setPower(chosen->level, ESP_BLE_PWR_TYPE_DEFAULT);
+  BLEDevice::setPower(chosen->level, ESP_BLE_PWR_TYPE_ADV);
+  BLEDevice::setPower(chosen->level, ESP_BLE_PWR_TYPE_CONN_HDL0);
+}
+
+int8_t bleTxPower() {
+  return txPowerDbm;
+}
+
+void bleRequestRssi() {
+  if (deviceConnected) {
+    esp_ble_gap_read_rssi(peerAddress);
+  }
+}
+
+bool bleLinkRssi(int8_t* rssi) {
+  if (!deviceConnected || !linkRssiValid) {
+    return false;
+  }
+  *rssi = linkRssi;
+  return true;
+}
+
+size_t bleNotifyMax() {
+  return linkMtu - 3;
+}
+
+uint32_t bleConnIntervalUs() {
+  return deviceConnected ? connIntervalUnits * 1250UL : 0;
+}
+
+void bleSetAdvertisingInterval(uint16_t ms) {
+  if (ms == advIntervalMs) {
+    return;
+  }
+  advIntervalMs = ms;
+  uint16_t units = constrain(ms * 8 / 5, 0x20, 0x4000);  // 0.625 ms units
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setMinInterval(units);
+  advertising->setMaxInterval(units);
+
+  // Restart if advertising now; otherwise it applies the next time it starts
+  if (pServer && !deviceConnected && !oldDeviceConnected) {
+    BLEDevice::stopAdvertising();
+    BLEDevice::startAdvertising();
+  }
+}
+
+uint16_t bleAdvertisingIntervalMs() {
+  return advIntervalMs;
+}
+
+bool bleStreamTakeWrite(BleStream stream, uint8_t* data, size_t* len) {
+  if (stream >= STREAM_COUNT || !streams[stream].writePending) {
+    return false;
+  }
+  portENTER_CRITICAL(&writeMux);
+  *len = streams[stream].writtenLen;
+  memcpy(data, streams[stream].written, *len);
+  streams[stream].writePending = false;
+  portEXIT_CRITICAL(&writeMux);
+  return true;
+}
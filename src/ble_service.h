@@ -0,0 +1,134 @@
+/*
+ * BLE water quality service
+ *
+ * One GATT service with a characteristic per data stream, so a client
+ * subscribes only to what it needs. Every stream has its own notify
+ * cadence (from config) and tracks its own subscription through its
+ * CCCD (BLE2902) descriptor.
+ *
+ * The original all-in-one characteristic is kept as STREAM_LEGACY so the
+ * current app keeps working unchanged.
+ *
+ * Notifications are flow controlled: each one handed to the stack counts as
+ * in flight until the stack reports it sent, and no more are accepted
+ * while too many are in flight or the link reports congestion. Callers
+ * (the outbound queue) keep unsent records and retry instead of losing
+ * them inside the stack.
+ *
+ * Clients are asked to bond (just works, no passkey) so they keep the same
+ * identity address across reconnects; the backfill keys its per-client
+ * state on that address.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// BLE UUIDs for water quality service (must match React Native app)
+#define SERVICE_UUID             "12345678-1234-1234-1234-123456789abc"
+#define CHARACTERISTIC_UUID      "87654321-4321-4321-4321-cba987654321"  // Legacy: full record
+#define LIVE_CHAR_UUID           "87654322-4321-4321-4321-cba987654321"
+#define VIBRATION_CHAR_UUID      "87654323-4321-4321-4321-cba987654321"
+#define ALERTS_CHAR_UUID         "87654324-4321-4321-4321-cba987654321"
+#define STATS_CHAR_UUID          "87654325-4321-4321-4321-cba987654321"
+#define DIAGNOSTICS_CHAR_UUID    "87654326-4321-4321-4321-cba987654321"
+#define HISTORY_CHAR_UUID        "87654327-4321-4321-4321-cba987654321"
+#define TRACE_CHAR_UUID          "87654328-4321-4321-4321-cba987654321"
+#define CAPTURE_CHAR_UUID        "87654329-4321-4321-4321-cba987654321"
+#define SPECTROGRAM_CHAR_UUID    "8765432a-4321-4321-4321-cba987654321"
+
+#define BLE_DEVICE_NAME "ESP32-WaterSensor"
+
+enum BleStream {
+  STREAM_LEGACY,        // Full JSON record (original characteristic)
+  STREAM_LIVE,          // Water quality readings
+  STREAM_VIBRATION,     // Vibration magnitude and axes
+  STREAM_ALERTS,        // Water status transitions, sent as they happen
+  STREAM_STATS,         // Aggregates over the stats interval
+  STREAM_DIAGNOSTICS,   // Device health
+  STREAM_HISTORY,       // Backfilled records; clients write acknowledgements
+  STREAM_TRACE,         // Trace dump lines; clients write 'L' (live) or 'F' (fault)
+  STREAM_CAPTURE,       // Diagnostic capture report; clients write the request
+  STREAM_SPECTROGRAM,   // Live spectra while subscribed; clients write the settings
+  STREAM_COUNT
+};
+
+// Create the service and characteristics and start advertising
+void bleServiceBegin();
+
+// Restart advertising after a disconnect; call every loop()
+void bleServiceUpdate();
+
+bool bleConnected();
+
+// Incremented on every connection, so a caller polling from loop() can
+// tell a quick reconnect from the same connection
+uint32_t bleConnectionId();
+
+// Address of the connected (or last connected) client
+void blePeerAddress(uint8_t address[6]);
+
+// Longest client write kept per stream
+#define BLE_WRITE_MAX 20
+
+// True if a client has notifications enabled on the stream
+bool bleStreamSubscribed(BleStream stream);
+
+// True if the stream is subscribed and its notify interval has elapsed.
+// Event streams (interval 0) are always due while subscribed.
+bool bleStreamDue(BleStream stream, unsigned long now);
+
+// Update the characteristic value (readable even without a subscription)
+void bleStreamSetValue(BleStream stream, const uint8_t* data, size_t len);
+
+// Update the value and notify subscribers; restarts the stream's interval.
+// Returns false if the stack did not take the notification.
+bool bleStreamNotify(BleStream stream, const uint8_t* data, size_t len);
+
+// True if another notification can be handed to the stack now
+bool bleTxReady();
+
+struct BleTxStats {
+  uint32_t notified;         // Handed to the stack
+  uint32_t refused;          // Not taken by the stack (queue full, no client)
+  uint32_t failed;           // Taken but reported as not sent
+  uint32_t congestion;       // Times the link reported congestion
+  uint16_t inFlight;         // Handed over, not yet reported sent
+  uint16_t maxInFlight;
+};
+
+const BleTxStats& bleTxStats();
+
+// Restart the stream's interval without sending, e.g. when a record has
+// been queued for it
+void bleStreamRestartInterval(BleStream stream);
+
+// Stretch every periodic stream's notify interval by `scale` (1 = as
+// configured), e.g. to save power on a low battery
+void bleSetIntervalScale(uint8_t scale);
+
+// Transmit power for advertising and connections in dBm, rounded down to
+// a level the radio supports (-12 to +9 in 3 dB steps; below -12 gives -12)
+void bleSetTxPower(int8_t dbm);
+int8_t bleTxPower();
+
+// Ask the controller for the connection's RSSI; the result arrives a little
+// later through bleLinkRssi()
+void bleRequestRssi();
+
+// Latest connection RSSI in dBm; false if none measured this connection
+bool bleLinkRssi(int8_t* rssi);
+
+// Largest notification payload on the current connection (ATT MTU - 3)
+size_t bleNotifyMax();
+
+// Connection interval chosen by the central, 0 while not connected
+uint32_t bleConnIntervalUs();
+
+// Advertising interval, restarting advertising if it is running
+void bleSetAdvertisingInterval(uint16_t ms);
+uint16_t bleAdvertisingIntervalMs();
+
+// Fetch the latest client write to a writable stream. Only the newest
+// write since the last call is kept; returns false if there was none.
+bool bleStreamTakeWrite(BleStream stream, uint8_t* data, size_t* len);
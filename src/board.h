@@ -0,0 +1,77 @@
+/*
+ * Board profile
+ *
+ * Capabilities of the target chip that select between implementations at
+ * compile time, and the pins the sensors are wired to. Each capability
+ * can be overridden with a build flag, e.g. -DBOARD_HAS_FPU=0 to run the
+ * fixed-point paths on an ESP32.
+ */
+
+#pragma once
+
+// Host builds (pio test -e native) have no sdkconfig: they get the FPU and
+// neither PIE nor PSRAM
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+// Single-precision FPU: the Xtensa ESP32/ESP32-S3 have one, the RISC-V
+// ESP32-C3/C6 don't (every float operation is a software library call)
+#ifndef BOARD_HAS_FPU
+#if defined(ARDUINO_ESP32C6_DEV) || defined(CONFIG_IDF_TARGET_ESP32C6) || defined(CONFIG_IDF_TARGET_ESP32C3)
+#define BOARD_HAS_FPU 0
+#else
+#define BOARD_HAS_FPU 1
+#endif
+#endif
+
+// PIE 128-bit SIMD extension (ESP32-S3): the DSP kernels in dsp.cpp use it
+// for multiply-accumulate loops
+#ifndef BOARD_HAS_PIE
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+#define BOARD_HAS_PIE 1
+#else
+#define BOARD_HAS_PIE 0
+#endif
+#endif
+
+// External PSRAM (ESP32-S3 modules such as the WROOM-1 N8R8): large capture
+// and spectrogram buffers go there (see board_memory.h). Arduino board
+// definitions with PSRAM pass -DBOARD_HAS_PSRAM, and CONFIG_SPIRAM is set
+// once the sdkconfig enables it.
+#ifndef BOARD_USE_PSRAM
+#if defined(CONFIG_SPIRAM) || defined(BOARD_HAS_PSRAM)
+#define BOARD_USE_PSRAM 1
+#else
+#define BOARD_USE_PSRAM 0
+#endif
+#endif
+
+// === Pins ===
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+// ESP32-S3 (DevKitC-1 layout): GPIO19/20 are the USB port, GPIO0/3/45/46
+// are strapping pins, GPIO22-25 don't exist, GPIO26-37 belong to the
+// flash and octal PSRAM, and the default I2C pins are GPIO8/9. Analog
+// inputs use ADC1 (GPIO1-10).
+#define TDS_PIN 1          // ADC1_CH0, TDS sensor (CD4051 output with several probes)
+#define TDS_MUX_S0 10      // CD4051 select lines, only driven with more than one probe
+#define TDS_MUX_S1 11
+#define TDS_MUX_S2 12
+#define TDS_EXC_A 13       // Lock-in excitation: A through the reference resistor,
+#define TDS_EXC_B 14       // B to the far electrode; only driven in lock-in mode
+#define BATTERY_PIN 7      // ADC1_CH6, cell voltage through a 2:1 divider
+#else
+// ESP32 and ESP32-C6 boards
+#define TDS_PIN 1          // GPIO1 for TDS sensor (analog input, CD4051 output with several probes)
+#define TDS_MUX_S0 18      // CD4051 select lines, only driven with more than one probe
+#define TDS_MUX_S1 19
+#define TDS_MUX_S2 23
+#define TDS_EXC_A 14       // Lock-in excitation: A through the reference resistor,
+#define TDS_EXC_B 15       // B to the far electrode; only driven in lock-in mode
+#define BATTERY_PIN 0      // GPIO0, cell voltage through a 2:1 divider
+#endif
+
+#define LED_GREEN  2       // GPIO2 - Green LED
+#define LED_YELLOW 4       // GPIO4 - Yellow LED
+#define LED_RED    5       // GPIO5 - Red LED
@@ -0,0 +1,55 @@
+/*
+ * Placement of large buffers
+ *
+ * On boards with PSRAM (BOARD_USE_PSRAM, see board.h) large buffers that
+ * are filled and read sequentially (recorded capture frames, spectrogram
+ * history) live in external RAM. Internal SRAM stays free for the radio,
+ * the task stacks and the buffers that must stay internal: FFT scratch,
+ * which is hot, and staging buffers that are handed to the BLE stack or a
+ * DMA engine, which can't read PSRAM. Without PSRAM a large buffer comes
+ * from the internal heap only up to BOARD_INTERNAL_LARGE_MAX, and callers
+ * size theirs down to boardLargeMax().
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+#include "board.h"
+
+// Largest "large" buffer taken from internal SRAM, so the BLE stack keeps
+// its heap
+#define BOARD_INTERNAL_LARGE_MAX 16384
+
+// Zeroed large buffer, in PSRAM when the board has it (falling back to
+// the internal heap within its budget); NULL if there is no room
+inline void* boardAllocLarge(size_t size) {
+#if BOARD_USE_PSRAM
+  void* buffer = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (buffer) {
+    return buffer;
+  }
+#endif
+  return size <= BOARD_INTERNAL_LARGE_MAX ? heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) : NULL;
+}
+
+// Zeroed internal buffer that DMA can reach (never PSRAM)
+inline void* boardAllocInternal(size_t size) {
+  return heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+}
+
+inline void boardFree(void* buffer) {
+  heap_caps_free(buffer);
+}
+
+// Largest buffer boardAllocLarge() could return right now
+inline size_t boardLargeMax() {
+  size_t internal = min(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+                        (size_t)BOARD_INTERNAL_LARGE_MAX);
+#if BOARD_USE_PSRAM
+  return max(internal, heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+#else
+  return internal;
+#endif
+}
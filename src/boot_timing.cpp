@@ -0,0 +1,72 @@
+#include "boot_timing.h"
+
+#include <esp_sleep.h>
+#include <esp_system.h>
+
+static const char* const PHASE_NAMES[BOOT_PHASE_COUNT] = {
+  "serial", "gpio", "config", "history", "mpu6050", "ble", "first_reading"
+};
+
+// Microseconds since esp_timer start; 0 means "not reached yet"
+static volatile uint32_t phaseBegin[BOOT_PHASE_COUNT] = {0};
+static volatile uint32_t phaseEnd[BOOT_PHASE_COUNT] = {0};
+
+static uint32_t bootNowMicros() {
+  // esp_timer starts before app_main, so this also covers bootloader hand-off.
+  // Never return 0 so it can be used as the "not reached" marker.
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  return now ? now : 1;
+}
+
+void bootPhaseBegin(BootPhase phase) {
+  if (phase < BOOT_PHASE_COUNT) {
+    phaseBegin[phase] = bootNowMicros();
+  }
+}
+
+void bootPhaseEnd(BootPhase phase) {
+  if (phase < BOOT_PHASE_COUNT) {
+    phaseEnd[phase] = bootNowMicros();
+  }
+}
+
+uint32_t bootPhaseMicros(BootPhase phase) {
+  if (phase >= BOOT_PHASE_COUNT || !phaseBegin[phase] || !phaseEnd[phase]) {
+    return 0;
+  }
+  return phaseEnd[phase] - phaseBegin[phase];
+}
+
+uint32_t bootPhaseDoneAt(BootPhase phase) {
+  return phase < BOOT_PHASE_COUNT ? phaseEnd[phase] : 0;
+}
+
+bool bootPhasesDone() {
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    if (!phaseBegin[i] || !phaseEnd[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void printBootReport() {
+  Serial.print("Boot: reset reason ");
+  Serial.print((int)esp_reset_reason());
+  Serial.print(", wake cause ");
+  Serial.println((int)esp_sleep_get_wakeup_cause());
+
+  Serial.print("Boot: setup() entered at ");
+  Serial.print(phaseBegin[BOOT_PHASE_SERIAL] / 1000.0, 1);
+  Serial.println(" ms");
+
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    Serial.print("Boot: ");
+    Serial.print(PHASE_NAMES[i]);
+    Serial.print(" ");
+    Serial.print(bootPhaseMicros((BootPhase)i) / 1000.0, 1);
+    Serial.print(" ms (done at ");
+    Serial.print(phaseEnd[i] / 1000.0, 1);
+    Serial.println(" ms)");
+  }
+}
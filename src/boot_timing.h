@@ -0,0 +1,39 @@
+/*
+ * Boot phase timing
+ *
+ * Records when each part of the boot sequence starts and finishes so the
+ * time from reset to first reading / advertising can be measured. Phases
+ * may overlap (the MPU6050 is probed from its own task while BLE starts),
+ * so every phase keeps its own begin/end timestamp.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+enum BootPhase {
+  BOOT_PHASE_SERIAL,
+  BOOT_PHASE_GPIO,
+  BOOT_PHASE_CONFIG,
+  BOOT_PHASE_HISTORY,
+  BOOT_PHASE_MPU,
+  BOOT_PHASE_BLE,
+  BOOT_PHASE_FIRST_READING,
+  BOOT_PHASE_COUNT
+};
+
+// Mark the start / end of a phase (safe to call from any task)
+void bootPhaseBegin(BootPhase phase);
+void bootPhaseEnd(BootPhase phase);
+
+// Duration of a finished phase in microseconds (0 if it has not finished)
+uint32_t bootPhaseMicros(BootPhase phase);
+
+// Time from esp_timer start to the end of a phase in microseconds
+uint32_t bootPhaseDoneAt(BootPhase phase);
+
+// True once every phase has both begun and ended
+bool bootPhasesDone();
+
+// Print reset reason, wake cause and per-phase timings
+void printBootReport();
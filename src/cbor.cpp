@@ -0,0 +1,70 @@
+#include "cbor.h"
+
+size_t cborHead(uint8_t* out, uint8_t major, uint32_t value) {
+  major <<= 5;
+  if (value < 24) {
+    out[0] = major | value;
+    return 1;
+  }
+  if (value <= 0xFF) {
+    out[0] = major | 24;
+    out[1] = value;
+    return 2;
+  }
+  if (value <= 0xFFFF) {
+    out[0] = major | 25;
+    out[1] = value >> 8;
+    out[2] = value;
+    return 3;
+  }
+  out[0] = major | 26;
+  out[1] = value >> 24;
+  out[2] = value >> 16;
+  out[3] = value >> 8;
+  out[4] = value;
+  return 5;
+}
+
+size_t cborUInt(uint8_t* out, uint32_t value) {
+  return cborHead(out, CBOR_MAJOR_UINT, value);
+}
+
+size_t cborInt(uint8_t* out, int32_t value) {
+  if (value >= 0) {
+    return cborHead(out, CBOR_MAJOR_UINT, value);
+  }
+  // Negative integers encode -1 - value
+  return cborHead(out, CBOR_MAJOR_NINT, (uint32_t)(-1 - (int64_t)value));
+}
+
+size_t cborText(uint8_t* out, const char* text, size_t len) {
+  size_t head = cborHead(out, CBOR_MAJOR_TEXT, len);
+  memcpy(out + head, text, len);
+  return head + len;
+}
+
+size_t cborText(uint8_t* out, const char* text) {
+  return cborText(out, text, strlen(text));
+}
+
+size_t cborBytes(uint8_t* out, const uint8_t* data, size_t len) {
+  size_t head = cborHead(out, CBOR_MAJOR_BYTES, len);
+  memcpy(out + head, data, len);
+  return head + len;
+}
+
+size_t cborBool(uint8_t* out, bool value) {
+  out[0] = value ? CBOR_TRUE : CBOR_FALSE;
+  return 1;
+}
+
+size_t cborDecimal(uint8_t* out, int32_t mantissa, uint8_t decimals) {
+  if (decimals == 0) {
+    return cborInt(out, mantissa);
+  }
+  size_t len = cborHead(out, CBOR_MAJOR_TAG, CBOR_TAG_DECIMAL);
+  len += cborHead(out + len, CBOR_MAJOR_ARRAY, 2);
+  len += cborInt(out + len, -(int32_t)decimals);
+  len += cborInt(out + len, mantissa);
+  return len;
+}
@@ -0,0 +1,42 @@
+/*
+ * Minimal CBOR (RFC 8949) writer
+ *
+ * Writes single data items into a caller-provided buffer; no heap, no
+ * bounds checks beyond what the caller sizes for. Every function returns
+ * the number of bytes written. Only the item types used by the telemetry
+ * records are provided.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define CBOR_MAJOR_UINT   0
+#define CBOR_MAJOR_NINT   1
+#define CBOR_MAJOR_BYTES  2
+#define CBOR_MAJOR_TEXT   3
+#define CBOR_MAJOR_ARRAY  4
+#define CBOR_MAJOR_MAP    5
+#define CBOR_MAJOR_TAG    6
+
+#define CBOR_TAG_DECIMAL  4     // Decimal fraction [exponent, mantissa]
+
+#define CBOR_FALSE        0xF4
+#define CBOR_TRUE         0xF5
+#define CBOR_MAP_INDEF    0xBF  // Indefinite-length map, closed by CBOR_BREAK
+#define CBOR_BREAK        0xFF
+
+// Major type + argument, using the shortest encoding
+size_t cborHead(uint8_t* out, uint8_t major, uint32_t value);
+
+size_t cborUInt(uint8_t* out, uint32_t value);
+size_t cborInt(uint8_t* out, int32_t value);
+size_t cborText(uint8_t* out, const char* text, size_t len);
+size_t cborText(uint8_t* out, const char* text);
+size_t cborBytes(uint8_t* out, const uint8_t* data, size_t len);
+size_t cborBool(uint8_t* out, bool value);
+
+// mantissa * 10^-decimals as a decimal fraction (tag 4), so the value
+// decodes to exactly the decimal the firmware rounded to; a plain
+// integer when decimals is 0
+size_t cborDecimal(uint8_t* out, int32_t mantissa, uint8_t decimals);
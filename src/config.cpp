@@ -0,0 +1,181 @@
+#include "config.h"
+
+#include <Preferences.h>
+
+#include "crc32.h"
+#include "trace.h"
+
+static const char* CONFIG_NAMESPACE = "wqcfg";
+static const char* CONFIG_KEY = "cfg";
+
+// Bytes of the blob covered by the CRC
+#define CONFIG_CRC_OFFSET offsetof(DeviceConfig, crc)
+
+// version + size + crc: the smallest blob any version can write
+#define CONFIG_MIN_SIZE (2 * sizeof(uint16_t) + sizeof(uint32_t))
+
+DeviceConfig config;
+
+void configDefaults(DeviceConfig& cfg) {
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.version = CONFIG_VERSION;
+  cfg.size = sizeof(DeviceConfig);
+
+  cfg.tdsCleanThreshold = 300.0;
+  cfg.tdsDirtyThreshold = 400.0;
+  cfg.tdsExtremeThreshold = 500.0;
+  cfg.vibThreshold = 1.5;
+
+  cfg.tdsVref = 3.3;
+  cfg.tdsFactor = 0.5;
+  cfg.tdsTempCoefficient = 0.02;
+  cfg.tdsReferenceTemp = 25.0;
+
+  cfg.readingIntervalMs = 3000;
+  cfg.notifyIntervalMs = 1000;
+
+  cfg.gravityBaseline = 9.8;
+  cfg.vibrationBaseline = 0.0;
+
+  cfg.liveIntervalMs = 1000;
+  cfg.vibrationIntervalMs = 1000;
+  cfg.statsIntervalMs = 60000;
+  cfg.diagnosticsIntervalMs = 10000;
+
+  cfg.payloadFormat = 0;  // JSON
+
+  // Datasheet typicals for the ESP32-C6 and sensor boards; replace with
+  // measured values for a real battery estimate
+  cfg.cpuActiveMa = 28.0;
+  cfg.cpuIdleMa = 16.0;
+  cfg.radioTxMa = 24.0;
+  cfg.radioRxMa = 26.0;
+  cfg.adcMa = 1.0;
+  cfg.tdsProbeMa = 5.0;
+  cfg.mpuMa = 3.9;
+  cfg.ledMa = 8.0;
+  cfg.radioConnIntervalMs = 30;
+  cfg.radioAdvIntervalMs = 30;
+
+  cfg.batteryDividerRatio = 0;    // Off: no cell on the default hardware (2.0 for 100k / 100k)
+  cfg.batterySaverPercent = 40;
+  cfg.batteryLowPercent = 20;
+  cfg.batteryCriticalPercent = 10;
+
+  cfg.advSlowIntervalMs = 1000;
+  cfg.advFastDurationMs = 30000;
+
+  cfg.tdsProbeCount = 1;
+  cfg.tdsSettleUs = 1000;
+  cfg.tdsSamplesPerProbe = 8;
+
+  cfg.tdsLockInHalves = 0;        // Off: the DFRobot-style board excites the probe itself
+  cfg.tdsExcitationHalfUs = 500;  // 1 kHz
+  cfg.tdsLockInSamplesPerHalf = 2;
+  cfg.tdsRefOhms = 1000;
+  cfg.tdsCellConstant = 1.0;
+
+  cfg.mpuSampleRateHz = 100;
+  cfg.mpuDrainIntervalMs = 250;
+
+  cfg.spectrogramFftSize = 64;
+  cfg.spectrogramBins = 32;
+  cfg.spectrogramOverlapPercent = 50;
+  cfg.spectrogramAxis = 3;
+
+  cfg.crc = crc32Update(0, &cfg, CONFIG_CRC_OFFSET);
+}
+
+// Bring an older blob up to the current layout. `stored` holds `len` bytes
+// as written by firmware that used `fromVersion`; fields it didn't have
+// keep their defaults from `cfg`.
+static void migrateConfig(DeviceConfig& cfg, const uint8_t* stored, size_t len, uint16_t fromVersion) {
+  size_t copyLen = min(len - sizeof(uint32_t), (size_t)CONFIG_CRC_OFFSET);
+  memcpy(&cfg, stored, copyLen);
+
+  // Add "case N:" here (falling through) when version N+1 appends a field
+  // whose default has to be derived from the older settings.
+  switch (fromVersion) {
+    case 1:
+      // Live readings keep the rate the single characteristic was using
+      cfg.liveIntervalMs = cfg.notifyIntervalMs;
+      // fall through
+    case 2: case 3: case 4: case 5: case 6: case 7: case 8: case 9: case 10:
+      // The divider ratio couldn't be set before version 11, so a stored
+      // one is the old 2:1 default, not a wired cell
+      cfg.batteryDividerRatio = 0;
+      // fall through
+    default:
+      break;
+  }
+
+  cfg.version = CONFIG_VERSION;
+  cfg.size = sizeof(DeviceConfig);
+  cfg.crc = crc32Update(0, &cfg, CONFIG_CRC_OFFSET);
+}
+
+void configBegin() {
+  configDefaults(config);
+
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NAMESPACE, true)) {
+    Serial.println("Config: no stored configuration, using defaults");
+    return;
+  }
+
+  // Read up to one struct; getBytes() returns 0 for a longer blob written
+  // by newer firmware, which is treated like a missing one
+  uint8_t stored[sizeof(DeviceConfig)];
+  size_t len = prefs.getBytes(CONFIG_KEY, stored, sizeof(stored));
+  prefs.end();
+
+  if (len < CONFIG_MIN_SIZE) {
+    Serial.println("Config: no usable stored configuration, using defaults");
+    return;
+  }
+
+  uint16_t version, size;
+  memcpy(&version, stored + offsetof(DeviceConfig, version), sizeof(version));
+  memcpy(&size, stored + offsetof(DeviceConfig, size), sizeof(size));
+
+  uint32_t storedCrc;
+  memcpy(&storedCrc, stored + len - sizeof(storedCrc), sizeof(storedCrc));
+
+  if (size != len || version == 0 || version > CONFIG_VERSION ||
+      crc32Update(0, stored, len - sizeof(storedCrc)) != storedCrc) {
+    Serial.println("Config: stored configuration invalid, using defaults");
+    return;
+  }
+
+  if (version == CONFIG_VERSION && len == sizeof(DeviceConfig)) {
+    memcpy(&config, stored, sizeof(DeviceConfig));
+  } else {
+    migrateConfig(config, stored, len, version);
+    Serial.print("Config: migrated from version ");
+    Serial.println(version);
+    configSave();
+  }
+
+  Serial.print("Config: loaded, hash ");
+  Serial.println(configHash(), HEX);
+}
+
+bool configSave() {
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(DeviceConfig);
+  config.crc = crc32Update(0, &config, CONFIG_CRC_OFFSET);
+
+  TRACE_BEGIN(TRACE_CONFIG_SAVE);
+  Preferences prefs;
+  bool ok = false;
+  if (prefs.begin(CONFIG_NAMESPACE, false)) {
+    ok = prefs.putBytes(CONFIG_KEY, &config, sizeof(DeviceConfig)) == sizeof(DeviceConfig);
+    prefs.end();
+  }
+  TRACE_END(TRACE_CONFIG_SAVE);
+  return ok;
+}
+
+uint32_t configHash() {
+  return config.crc;
+}
@@ -0,0 +1,114 @@
+/*
+ * Device configuration stored as one versioned NVS blob
+ *
+ * All runtime-tunable settings (thresholds, calibration, rates, baselines)
+ * live in a single struct that is read with one Preferences::getBytes()
+ * call at boot. The blob carries its version and size, and ends with a
+ * CRC-32 that doubles as the config hash reported to the app.
+ *
+ * Layout rules for new versions: only append fields before `crc`, bump
+ * CONFIG_VERSION, and add a case to migrateConfig() if a new field's
+ * default depends on older values. Older blobs are then migrated forward
+ * on load and written back once.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define CONFIG_VERSION 11
+
+struct DeviceConfig {
+  uint16_t version;
+  uint16_t size;                 // sizeof(DeviceConfig) of the writer
+
+  // === Water quality thresholds ===
+  float tdsCleanThreshold;       // ppm
+  float tdsDirtyThreshold;       // ppm
+  float tdsExtremeThreshold;     // ppm
+  float vibThreshold;            // m/s²
+
+  // === TDS calibration ===
+  float tdsVref;                 // ADC reference voltage
+  float tdsFactor;               // Probe K factor applied to the polynomial
+  float tdsTempCoefficient;      // Per °C compensation
+  float tdsReferenceTemp;        // °C the probe was calibrated at
+
+  // === Rates ===
+  uint32_t readingIntervalMs;
+  uint32_t notifyIntervalMs;     // Legacy all-in-one characteristic
+
+  // === Baselines ===
+  float gravityBaseline;         // m/s² removed from the accel magnitude
+  float vibrationBaseline;       // m/s² resting vibration offset
+
+  // === Per-stream BLE notify intervals (version 2) ===
+  uint32_t liveIntervalMs;
+  uint32_t vibrationIntervalMs;
+  uint32_t statsIntervalMs;
+  uint32_t diagnosticsIntervalMs;
+
+  // === Payload encoding (version 3) ===
+  uint32_t payloadFormat;        // PayloadFormat for the per-stream characteristics
+
+  // === Energy model currents and radio timing (version 4) ===
+  float cpuActiveMa;             // CPU running (radio and sensors not included)
+  float cpuIdleMa;               // CPU waiting in delay()
+  float radioTxMa;
+  float radioRxMa;
+  float adcMa;                   // Extra while an ADC conversion runs
+  float tdsProbeMa;              // TDS probe board, always powered
+  float mpuMa;                   // MPU6050 accel + temperature
+  float ledMa;                   // One lit status LED
+  uint32_t radioConnIntervalMs;  // Assumed until the central's is known
+  uint32_t radioAdvIntervalMs;   // Fast advertising interval (after boot or a disconnect)
+
+  // === Battery (version 5) ===
+  float batteryDividerRatio;     // Cell voltage / ADC pin voltage; 0 = no cell wired (version 11)
+  uint32_t batterySaverPercent;  // Charge below which each power mode applies
+  uint32_t batteryLowPercent;
+  uint32_t batteryCriticalPercent;
+
+  // === Adaptive radio power (version 6) ===
+  uint32_t advSlowIntervalMs;    // Advertising interval once nobody has connected for a while
+  uint32_t advFastDurationMs;    // How long to advertise fast before slowing down
+
+  // === TDS probe scanning (version 7) ===
+  uint32_t tdsProbeCount;        // Probes on the CD4051 mux; 1 = single probe, no mux
+  uint32_t tdsSettleUs;          // Wait after switching the mux before converting
+  uint32_t tdsSamplesPerProbe;   // Conversions per probe, filtered to one value
+
+  // === Lock-in TDS (version 8) ===
+  uint32_t tdsLockInHalves;      // Excitation half-cycles per probe (odd, >= 3); 0 = DC probe board
+  uint32_t tdsExcitationHalfUs;  // Length of one half-cycle
+  uint32_t tdsLockInSamplesPerHalf; // Conversions at the end of each half
+  float tdsRefOhms;              // Reference resistor between excitation pin A and the ADC node
+  float tdsCellConstant;         // Probe cell constant K (1/cm)
+
+  // === MPU6050 FIFO sampling (version 9) ===
+  uint32_t mpuSampleRateHz;      // Accelerometer samples per second into each FIFO
+  uint32_t mpuDrainIntervalMs;   // FIFO drain period; must empty the 170-frame FIFO in time
+
+  // === Live spectrogram (version 10) ===
+  uint32_t spectrogramFftSize;   // Samples per spectrum (power of two, 16-256)
+  uint32_t spectrogramBins;      // Lowest bins sent per spectrum (at most half the FFT size)
+  uint32_t spectrogramOverlapPercent; // Overlap of successive windows (0-87)
+  uint32_t spectrogramAxis;      // 0-2 X/Y/Z, 3 acceleration magnitude
+
+  uint32_t crc;                  // CRC-32 of every byte above; must stay last
+};
+
+// The active configuration, valid after configBegin()
+extern DeviceConfig config;
+
+// Load the blob (one NVS read), migrating or falling back to defaults
+void configBegin();
+
+// Recompute the CRC and write the blob back in one NVS write
+bool configSave();
+
+// Restore factory defaults (not saved until configSave())
+void configDefaults(DeviceConfig& cfg);
+
+// Hash of the active configuration, for the app to detect changes
+uint32_t configHash();
@@ -0,0 +1,245 @@
+#include "cpu_load.h"
+
+#include <esp_freertos_hooks.h>
+#include <esp_timer.h>
+
+// Name length used for a task in the diagnostics summary
+#define TOP_TASK_NAME 10
+
+// Longest gap between two idle loop passes still counted as idle; passes
+// take a few microseconds, a switch to another task and back takes longer
+#define IDLE_GAP_US 25
+
+static CpuLoadReport report;
+
+// === Idle time ===
+
+// Written only by each core's own idle hook; 32-bit microseconds, so a
+// read from another core is never torn and differences survive a wrap
+static volatile uint32_t idleUs[portNUM_PROCESSORS];
+static uint32_t lastPass[portNUM_PROCESSORS];
+
+static bool hooked = false;
+static uint32_t previousIdle = 0;
+static uint32_t previousTime = 0;
+static unsigned long lastSample = 0;
+
+static void idlePass(UBaseType_t core) {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  uint32_t gap = now - lastPass[core];
+  if (gap <= IDLE_GAP_US) {
+    idleUs[core] += gap;
+  }
+  lastPass[core] = now;
+}
+
+// Returning false keeps the idle loop calling back without waiting for an
+// interrupt, so the gaps stay short while the core is idle
+static bool idleHook0() {
+  idlePass(0);
+  return false;
+}
+
+#if portNUM_PROCESSORS > 1
+static bool idleHook1() {
+  idlePass(1);
+  return false;
+}
+#endif
+
+static uint32_t totalIdle() {
+  uint32_t total = 0;
+  for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+    total += idleUs[core];
+  }
+  return total;
+}
+
+// === Per-task shares ===
+
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+
+struct RunTimeSample {
+  TaskHandle_t handle;
+  uint32_t runTime;
+};
+
+static TaskStatus_t taskStatus[CPU_LOAD_MAX_TASKS];
+static RunTimeSample previous[CPU_LOAD_MAX_TASKS];
+static uint8_t previousCount = 0;
+static uint32_t previousTotal = 0;
+
+static bool isIdleTask(TaskHandle_t handle) {
+  for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+    if (xTaskGetIdleTaskHandleForCPU(core) == handle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Run time at the previous sample; a task created since then started at 0
+static uint32_t previousRunTime(TaskHandle_t handle) {
+  for (uint8_t i = 0; i < previousCount; i++) {
+    if (previous[i].handle == handle) {
+      return previous[i].runTime;
+    }
+  }
+  return 0;
+}
+
+// Snapshot every task's counter; false if there are more tasks than slots
+static bool sample(UBaseType_t* count, uint32_t* total) {
+  *count = uxTaskGetSystemState(taskStatus, CPU_LOAD_MAX_TASKS, total);
+  return *count > 0;
+}
+
+static void keepSample(UBaseType_t count, uint32_t total) {
+  for (UBaseType_t i = 0; i < count; i++) {
+    previous[i].handle = taskStatus[i].xHandle;
+    previous[i].runTime = taskStatus[i].ulRunTimeCounter;
+  }
+  previousCount = count;
+  previousTotal = total;
+}
+
+static void beginTasks() {
+  UBaseType_t count;
+  uint32_t total;
+  if (sample(&count, &total)) {
+    keepSample(count, total);
+  }
+}
+
+static void updateTasks() {
+  UBaseType_t count;
+  uint32_t total;
+  if (!sample(&count, &total)) {
+    return;
+  }
+
+  // Counters are 32-bit microseconds, like the idle time above
+  uint32_t elapsed = total - previousTotal;
+  if (elapsed == 0) {
+    return;
+  }
+  double capacity = (double)elapsed * portNUM_PROCESSORS;
+
+  report.taskCount = 0;
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t& status = taskStatus[i];
+    uint32_t ran = status.ulRunTimeCounter - previousRunTime(status.xHandle);
+
+    CpuTaskLoad load;
+    strncpy(load.name, status.pcTaskName, sizeof(load.name) - 1);
+    load.name[sizeof(load.name) - 1] = '\0';
+    load.percent = 100.0 * ran / capacity;
+    load.idle = isIdleTask(status.xHandle);
+
+    // Insertion keeps the list sorted busiest first
+    uint8_t pos = report.taskCount++;
+    while (pos > 0 && report.tasks[pos - 1].percent < load.percent) {
+      report.tasks[pos] = report.tasks[pos - 1];
+      pos--;
+    }
+    report.tasks[pos] = load;
+  }
+  keepSample(count, total);
+}
+
+#else
+
+static void beginTasks() {
+  Serial.println("CPU: run-time stats not in this build, per-task shares not reported");
+}
+
+static void updateTasks() {
+}
+
+#endif
+
+// === Report ===
+
+void cpuLoadBegin() {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+    lastPass[core] = now;
+  }
+  hooked = esp_register_freertos_idle_hook_for_cpu(idleHook0, 0) == ESP_OK;
+#if portNUM_PROCESSORS > 1
+  hooked = hooked && esp_register_freertos_idle_hook_for_cpu(idleHook1, 1) == ESP_OK;
+#endif
+  if (!hooked) {
+    Serial.println("CPU: could not hook the idle task, load not reported");
+  }
+  previousIdle = totalIdle();
+  previousTime = now;
+  beginTasks();
+  lastSample = millis();
+}
+
+void cpuLoadUpdate() {
+  unsigned long now = millis();
+  if (now - lastSample < CPU_LOAD_PERIOD_MS) {
+    return;
+  }
+  lastSample = now;
+  if (!hooked) {
+    return;
+  }
+
+  uint32_t time = (uint32_t)esp_timer_get_time();
+  uint32_t idle = totalIdle();
+  uint32_t elapsed = time - previousTime;
+  if (elapsed == 0) {
+    return;
+  }
+  double capacity = (double)elapsed * portNUM_PROCESSORS;
+
+  report.available = true;
+  report.windowMs = elapsed / 1000;
+  report.loadPercent = constrain(100.0 - 100.0 * (idle - previousIdle) / capacity, 0.0, 100.0);
+  previousIdle = idle;
+  previousTime = time;
+  updateTasks();
+}
+
+const CpuLoadReport& cpuLoadReport() {
+  return report;
+}
+
+size_t cpuLoadTopTasks(char* out, size_t size, uint8_t count) {
+  size_t len = 0;
+  out[0] = '\0';
+  for (uint8_t i = 0; i < report.taskCount && count > 0; i++) {
+    const CpuTaskLoad& task = report.tasks[i];
+    if (task.idle) {
+      continue;
+    }
+    int n = snprintf(out + len, size - len, "%s%.*s:%d", len ? "," : "",
+                     TOP_TASK_NAME, task.name, (int)lroundf(task.percent));
+    if (n < 0 || len + n >= size) {
+      out[len] = '\0';  // Drop the entry that didn't fit
+      break;
+    }
+    len += n;
+    count--;
+  }
+  return len;
+}
+
+void printCpuLoad() {
+  if (!report.available) {
+    Serial.println("CPU: no full window measured yet");
+    return;
+  }
+  Serial.print("CPU: load "); Serial.print(report.loadPercent, 1);
+  Serial.print("% over "); Serial.print(report.windowMs);
+  Serial.println(" ms");
+  for (uint8_t i = 0; i < report.taskCount; i++) {
+    Serial.print("CPU: ");
+    Serial.print(report.tasks[i].name);
+    Serial.print(" "); Serial.print(report.tasks[i].percent, 1);
+    Serial.println(report.tasks[i].idle ? "% (idle)" : "%");
+  }
+}
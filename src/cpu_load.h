@@ -0,0 +1,61 @@
+/*
+ * CPU load from the idle task(s)
+ *
+ * A hook in each core's FreeRTOS idle task stamps esp_timer every time
+ * the idle loop comes round. Consecutive stamps a few microseconds apart
+ * mean the core had nothing else to run, so those gaps add up to its idle
+ * time; a longer gap means another task (or a long interrupt) had the core
+ * and counts as busy. Every few seconds the idle time over the window
+ * becomes the overall load, which shows how much headroom is left before
+ * raising reading or notify rates. This works on the prebuilt Arduino core.
+ *
+ * The hook keeps the idle loop spinning instead of letting the core wait
+ * for the next interrupt, which costs a little power; nothing here uses
+ * light sleep, so the cores never stop anyway.
+ *
+ * Each task's share comes from FreeRTOS run-time stats and needs
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS and
+ * CONFIG_FREERTOS_USE_TRACE_FACILITY, which only a build that compiles the
+ * framework (framework = arduino, espidf) takes from sdkconfig.defaults.
+ * Without them the report has the load but no task list.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// Tasks tracked per sample; the ESP32 Arduino core with BLE runs ~10
+#define CPU_LOAD_MAX_TASKS 20
+
+// Sampling window
+#define CPU_LOAD_PERIOD_MS 5000
+
+struct CpuTaskLoad {
+  char name[16];
+  float percent;             // Share of the total CPU time (all cores)
+  bool idle;                 // One of the per-core idle tasks
+};
+
+struct CpuLoadReport {
+  bool available;            // A full window has been measured
+  uint32_t windowMs;
+  float loadPercent;         // 100 minus the idle time's share
+  uint8_t taskCount;         // 0 without run-time stats
+  CpuTaskLoad tasks[CPU_LOAD_MAX_TASKS];  // Busiest first
+};
+
+// Hook the idle task(s) and take the first sample
+void cpuLoadBegin();
+
+// Take a new sample once the window has passed; call every loop()
+void cpuLoadUpdate();
+
+// Figures for the last complete window
+const CpuLoadReport& cpuLoadReport();
+
+// Write the busiest non-idle tasks as "name:percent,..." (integer percent)
+// into `out`, for the diagnostics record; names are shortened to fit
+size_t cpuLoadTopTasks(char* out, size_t size, uint8_t count);
+
+// Print load and every task's share to Serial
+void printCpuLoad();
@@ -0,0 +1,24 @@
+/*
+ * CRC-32 (IEEE 802.3, reflected, poly 0xEDB88320)
+ *
+ * Bitwise variant: no table in flash/RAM, fast enough for the small
+ * config blobs and records it is used on.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Continue a CRC over more data; start with crc = 0
+inline uint32_t crc32Update(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
@@ -0,0 +1,253 @@
+#include "data_bus.h"
+
+static const char* const TOPIC_NAMES[TOPIC_COUNT] = { "accel", "tds" };
+
+struct Subscription {
+  bool active;
+  bool aggregate;
+  BusTopic topic;
+  BusPolicy policy;
+  BusBlockHandler handler;
+  BusAggregateHandler aggregateHandler;
+  void* context;
+  uint32_t delivered;
+
+  uint16_t phase;            // BUS_DECIMATE: frames to skip before the next kept one
+  int64_t nextUs;            // BUS_LATEST: earliest time of the next block
+  BusAggregate window;       // Aggregate so far
+};
+
+static BusBlock pool[BUS_POOL_BLOCKS];
+static Subscription subscriptions[BUS_MAX_SUBSCRIBERS];
+static BusStats stats;
+
+static bool matches(const Subscription& s, BusTopic topic, uint8_t source) {
+  return s.active && s.topic == topic &&
+         (s.policy.source == BUS_ANY_SOURCE || s.policy.source == source);
+}
+
+static void resetWindow(BusAggregate& a, BusTopic topic, uint8_t source) {
+  a = BusAggregate();
+  a.topic = topic;
+  a.source = source;
+}
+
+static int addSubscription(const Subscription& s) {
+  for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+    if (!subscriptions[i].active) {
+      subscriptions[i] = s;
+      subscriptions[i].active = true;
+      return i;
+    }
+  }
+  return -1;
+}
+
+int busSubscribe(BusTopic topic, const BusPolicy& policy, BusBlockHandler handler, void* context) {
+  if (!handler) {
+    return -1;
+  }
+  Subscription s = Subscription();
+  s.topic = topic;
+  s.policy = policy;
+  s.policy.decimation = max(policy.decimation, (uint16_t)1);
+  s.handler = handler;
+  s.context = context;
+  return addSubscription(s);
+}
+
+int busSubscribeAggregate(BusTopic topic, uint8_t source, uint32_t periodMs, BusAggregateHandler handler, void* context) {
+  if (source == BUS_ANY_SOURCE) {
+    return -1;
+  }
+  Subscription s = Subscription();
+  s.aggregate = true;
+  s.topic = topic;
+  s.policy.periodMs = periodMs;
+  s.policy.source = source;
+  s.aggregateHandler = handler;
+  s.context = context;
+  resetWindow(s.window, topic, source);
+  return addSubscription(s);
+}
+
+void busUnsubscribe(int id) {
+  if (id >= 0 && id < BUS_MAX_SUBSCRIBERS) {
+    subscriptions[id].active = false;
+  }
+}
+
+bool busTakeAggregate(int id, BusAggregate& aggregate) {
+  if (id < 0 || id >= BUS_MAX_SUBSCRIBERS || !subscriptions[id].aggregate) {
+    return false;
+  }
+  Subscription& s = subscriptions[id];
+  aggregate = s.window;
+  resetWindow(s.window, s.topic, s.policy.source);
+  return aggregate.frames > 0;
+}
+
+bool busHasSubscribers(BusTopic topic, uint8_t source) {
+  for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+    if (matches(subscriptions[i], topic, source)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+BusBlock* busAcquire(BusTopic topic, uint8_t source, uint8_t channels, uint16_t frames) {
+  if (channels == 0 || channels > BUS_MAX_CHANNELS || (uint32_t)channels * frames > BUS_BLOCK_SAMPLES ||
+      !busHasSubscribers(topic, source)) {
+    return NULL;
+  }
+  for (int i = 0; i < BUS_POOL_BLOCKS; i++) {
+    BusBlock& block = pool[i];
+    if (block.refs == 0) {
+      block.refs = 1;
+      block.topic = topic;
+      block.source = source;
+      block.channels = channels;
+      block.frames = frames;
+      block.time = TimeBlock();
+      block.scale = 1;
+      stats.inUse++;
+      stats.maxInUse = max(stats.maxInUse, stats.inUse);
+      return &block;
+    }
+  }
+  stats.dropped++;
+  return NULL;
+}
+
+// Fold the block's frames into the window; a window with a period ends
+// (and is handed over) at the first frame past it
+static void aggregateBlock(Subscription& s, const BusBlock& block) {
+  BusAggregate& a = s.window;
+  for (uint16_t f = 0; f < block.frames; f++) {
+    int64_t atUs = timeBlockSampleUs(block.time, f);
+    if (a.frames > 0 && s.policy.periodMs > 0 && s.aggregateHandler &&
+        atUs - a.firstUs >= (int64_t)s.policy.periodMs * 1000) {
+      s.aggregateHandler(a, s.context);
+      s.delivered++;
+      stats.delivered++;
+      resetWindow(a, s.topic, s.policy.source);
+    }
+    if (a.frames == 0) {
+      a.channels = block.channels;
+      a.scale = block.scale;
+      a.firstUs = atUs;
+      for (uint8_t c = 0; c < block.channels; c++) {
+        a.min[c] = INT16_MAX;
+        a.max[c] = INT16_MIN;
+      }
+    }
+    for (uint8_t c = 0; c < a.channels && c < block.channels; c++) {
+      int16_t value = busSample(block, f, c);
+      a.min[c] = min(a.min[c], value);
+      a.max[c] = max(a.max[c], value);
+      a.sum[c] += value;
+      a.sumSquares[c] += (uint64_t)((int32_t)value * value);
+    }
+    a.frames++;
+    a.lastUs = atUs;
+  }
+}
+
+static void deliver(Subscription& s, const BusBlock& block) {
+  if (s.aggregate) {
+    aggregateBlock(s, block);
+    return;
+  }
+
+  uint16_t first = 0;
+  uint16_t stride = 1;
+  switch (s.policy.kind) {
+    case BUS_DECIMATE:
+      stride = s.policy.decimation;
+      if (s.phase >= block.frames) {
+        s.phase -= block.frames;
+        return;
+      }
+      first = s.phase;
+      // The last kept frame of this block, then how far into the next
+      // block the one after it falls
+      s.phase = first + ((block.frames - 1 - first) / stride + 1) * stride - block.frames;
+      break;
+    case BUS_LATEST:
+      if (block.time.firstUs < s.nextUs) {
+        return;
+      }
+      s.nextUs = block.time.firstUs + (int64_t)s.policy.periodMs * 1000;
+      break;
+    default:
+      break;
+  }
+  s.handler(block, first, stride, s.context);
+  s.delivered++;
+  stats.delivered++;
+}
+
+void busPublish(BusBlock* block) {
+  if (!block) {
+    return;
+  }
+  stats.published++;
+  for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+    if (matches(subscriptions[i], block->topic, block->source)) {
+      deliver(subscriptions[i], *block);
+    }
+  }
+  busRelease(*block);
+}
+
+void busRetain(const BusBlock& block) {
+  const_cast<BusBlock&>(block).refs++;
+}
+
+void busRelease(const BusBlock& block) {
+  BusBlock& b = const_cast<BusBlock&>(block);
+  if (b.refs > 0 && --b.refs == 0) {
+    stats.inUse--;
+  }
+}
+
+const BusStats& busStats() {
+  return stats;
+}
+
+void printBusStats() {
+  Serial.print("Bus: blocks in use "); Serial.print(stats.inUse);
+  Serial.print("/"); Serial.print(BUS_POOL_BLOCKS);
+  Serial.print(" (max "); Serial.print(stats.maxInUse);
+  Serial.print("), published "); Serial.print(stats.published);
+  Serial.print(", delivered "); Serial.print(stats.delivered);
+  Serial.print(", dropped "); Serial.println(stats.dropped);
+
+  static const char* const POLICY_NAMES[] = { "every", "decimate", "latest" };
+  for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+    const Subscription& s = subscriptions[i];
+    if (!s.active) {
+      continue;
+    }
+    Serial.print("Bus: #"); Serial.print(i);
+    Serial.print(" "); Serial.print(TOPIC_NAMES[s.topic]);
+    if (s.policy.source != BUS_ANY_SOURCE) {
+      Serial.print("/"); Serial.print(s.policy.source);
+    }
+    if (s.aggregate) {
+      Serial.print(" aggregate");
+      if (s.policy.periodMs > 0 && s.aggregateHandler) {
+        Serial.print(" every "); Serial.print(s.policy.periodMs); Serial.print(" ms");
+      }
+    } else {
+      Serial.print(" "); Serial.print(POLICY_NAMES[s.policy.kind]);
+      if (s.policy.kind == BUS_DECIMATE) {
+        Serial.print(" 1/"); Serial.print(s.policy.decimation);
+      } else if (s.policy.kind == BUS_LATEST) {
+        Serial.print(" "); Serial.print(s.policy.periodMs); Serial.print(" ms");
+      }
+    }
+    Serial.print(", delivered "); Serial.println(s.delivered);
+  }
+}
@@ -0,0 +1,138 @@
+/*
+ * Publish/subscribe bus for sample blocks
+ *
+ * Acquisition publishes what it reads once, as blocks of samples on the
+ * common timebase: every MPU6050 FIFO chunk per unit (TOPIC_ACCEL, X/Y/Z
+ * counts) and every TDS scan (TOPIC_TDS, ppm x 10 per probe). Consumers
+ * subscribe to a topic with their own policy:
+ *
+ *   BUS_EVERY      every block
+ *   BUS_DECIMATE   every Nth frame, with the phase carried across blocks
+ *   BUS_LATEST     at most one block per period (e.g. a 10 Hz live view)
+ *   aggregate      per-channel count/min/max/sum/sum of squares over a
+ *                  window, pushed when the window ends or taken on demand
+ *
+ * Blocks come from a fixed pool and are reference counted. A handler gets
+ * the publisher's block itself (decimation is a first frame and a stride
+ * into it, not a copy); one that needs it after returning calls
+ * busRetain() and busRelease() when done. The block goes back to the pool
+ * when the last reference is dropped. A topic nobody subscribes to costs
+ * the publisher nothing: busAcquire() returns NULL and the block is never
+ * filled, so adding a consumer adds no acquisition work and removing one
+ * takes its cost away.
+ *
+ * The bus is not thread-safe: publish, subscribe and release from loop().
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "timebase.h"
+
+#define BUS_POOL_BLOCKS 8
+#define BUS_BLOCK_SAMPLES 60      // One 20-frame MPU6050 FIFO chunk, 3 axes
+#define BUS_MAX_CHANNELS 8
+#define BUS_MAX_SUBSCRIBERS 8
+
+#define BUS_ANY_SOURCE 0xFF
+
+enum BusTopic {
+  TOPIC_ACCEL,          // MPU6050 accelerometer counts X/Y/Z; source = unit
+  TOPIC_TDS,            // TDS in ppm x 10 per probe, one frame per scan
+  TOPIC_COUNT
+};
+
+struct BusBlock {
+  BusTopic topic;
+  uint8_t source;            // Unit or probe set within the topic
+  uint8_t channels;          // Samples per frame, interleaved
+  uint16_t frames;
+  TimeBlock time;            // Frame 0 on the timebase and the frame period
+  float scale;               // Physical units per count
+  int16_t data[BUS_BLOCK_SAMPLES];
+  uint8_t refs;              // Managed by the bus
+};
+
+inline int16_t busSample(const BusBlock& block, uint16_t frame, uint8_t channel) {
+  return block.data[frame * block.channels + channel];
+}
+
+enum BusPolicyKind {
+  BUS_EVERY,
+  BUS_DECIMATE,
+  BUS_LATEST
+};
+
+struct BusPolicy {
+  BusPolicyKind kind;
+  uint16_t decimation;       // BUS_DECIMATE: keep one frame in this many
+  uint32_t periodMs;         // BUS_LATEST: shortest time between blocks
+  uint8_t source;            // BUS_ANY_SOURCE or one source of the topic
+};
+
+// Per-channel statistics in counts over a window of frames
+struct BusAggregate {
+  BusTopic topic;
+  uint8_t source;
+  uint8_t channels;
+  uint32_t frames;
+  float scale;
+  int64_t firstUs;           // Timebase time of the first and last frame
+  int64_t lastUs;
+  int16_t min[BUS_MAX_CHANNELS];
+  int16_t max[BUS_MAX_CHANNELS];
+  int64_t sum[BUS_MAX_CHANNELS];
+  uint64_t sumSquares[BUS_MAX_CHANNELS];
+};
+
+inline float busAggregateMean(const BusAggregate& a, uint8_t channel) {
+  return a.frames ? (float)a.sum[channel] / a.frames * a.scale : 0;
+}
+
+// Frames first, first + stride, ... of the block are the subscriber's
+typedef void (*BusBlockHandler)(const BusBlock& block, uint16_t first, uint16_t stride, void* context);
+typedef void (*BusAggregateHandler)(const BusAggregate& aggregate, void* context);
+
+struct BusStats {
+  uint32_t published;        // Blocks published
+  uint32_t delivered;        // Handler calls (blocks and aggregates)
+  uint32_t dropped;          // Blocks not published because the pool was empty
+  uint8_t inUse;             // Blocks held now
+  uint8_t maxInUse;
+};
+
+// Subscribe to a topic; returns the subscription id, or -1 if the
+// subscriber table is full
+int busSubscribe(BusTopic topic, const BusPolicy& policy, BusBlockHandler handler, void* context);
+
+// Aggregate a topic's frames from one source (not BUS_ANY_SOURCE) over
+// windows of periodMs, handed to `handler` as each window ends. With
+// periodMs 0 or no handler the window only ends at busTakeAggregate().
+int busSubscribeAggregate(BusTopic topic, uint8_t source, uint32_t periodMs, BusAggregateHandler handler, void* context);
+
+void busUnsubscribe(int id);
+
+// The aggregate since the last take (or window end); starts a new window.
+// False if no frames arrived.
+bool busTakeAggregate(int id, BusAggregate& aggregate);
+
+// True if publishing on the topic (from the source) would reach anyone
+bool busHasSubscribers(BusTopic topic, uint8_t source);
+
+// A block to fill for the topic; NULL if nobody subscribes, the block
+// would exceed BUS_BLOCK_SAMPLES, or the pool is empty
+BusBlock* busAcquire(BusTopic topic, uint8_t source, uint8_t channels, uint16_t frames);
+
+// Deliver a filled block to every subscriber and drop the publisher's
+// reference
+void busPublish(BusBlock* block);
+
+// Keep a delivered block beyond the handler call, and let it go again
+void busRetain(const BusBlock& block);
+void busRelease(const BusBlock& block);
+
+const BusStats& busStats();
+
+// Print pool use, counters and the subscriptions to Serial
+void printBusStats();
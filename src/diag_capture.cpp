@@ -0,0 +1,565 @@
+#include "diag_capture.h"
+
+#include "ble_service.h"
+#include "board_memory.h"
+#include "data_bus.h"
+#include "dsp.h"
+#include "fixed_point.h"
+#include "mpu_array.h"
+#include "outbound_queue.h"
+
+#define AXES 3
+#define BINS (CAPTURE_FFT_SIZE / 2)
+#define HOP (CAPTURE_FFT_SIZE / 2)         // 50% overlap
+
+#define FRAME_BYTES (AXES * sizeof(int16_t))
+
+// Smallest raw frame store worth recording into (frames per unit)
+#define RAW_MIN_FRAMES 256
+
+// Longest message; shorter links get shorter messages
+#define MESSAGE_MAX 244
+
+// A finished report waits this long for a subscriber before it is dropped
+#define REPORT_HOLD_MS 300000
+
+enum CaptureState {
+  CAPTURE_IDLE,
+  CAPTURE_RUNNING,
+  CAPTURE_REPORTING
+};
+
+enum MessageType {
+  MSG_HEADER = 1,
+  MSG_AXIS,
+  MSG_SPECTRUM,
+  MSG_TDS,
+  MSG_RAW,
+  MSG_END
+};
+
+enum ReportPhase {
+  PHASE_HEADER,
+  PHASE_AXIS,
+  PHASE_SPECTRUM,
+  PHASE_TDS,
+  PHASE_END,
+  PHASE_DONE
+};
+
+struct AxisCapture {
+  int16_t segment[CAPTURE_FFT_SIZE];
+  uint16_t filled;
+  uint16_t segments;
+  uint32_t magnitudeSum[BINS];
+  uint32_t samples;
+  int16_t min;
+  int16_t max;
+  int64_t sum;
+  uint64_t sumSquares;
+};
+
+// Only allocated while a capture runs or is being reported: the statistics
+// in large memory (PSRAM when the board has it), FFT scratch and the
+// outgoing message in internal RAM
+struct CaptureBuffers {
+  AxisCapture axes[MPU_MAX_UNITS][AXES];
+};
+
+struct CaptureScratch {
+  int16_t work[2 * CAPTURE_FFT_SIZE];
+  uint16_t magnitude[BINS];
+  uint8_t message[MESSAGE_MAX];
+};
+
+static CaptureState state = CAPTURE_IDLE;
+static CaptureBuffers* buffers = NULL;
+static CaptureScratch* scratch = NULL;
+static bool raw = false;
+static bool stopped = false;
+static unsigned long startedAt = 0;
+static unsigned long finishedAt = 0;
+static uint32_t durationMs = 0;
+static uint8_t units = 0;
+static int accelSubscription = -1;
+static int tdsSubscription = -1;
+static BusAggregate tds;
+static bool haveTds = false;
+
+// Sample rate as measured by the first unit's sample clock
+static int64_t firstSampleUs = 0;
+static int64_t lastSampleUs = 0;
+static uint32_t rateSamples = 0;
+static float countScale = 0;          // m/s² per count
+
+// Recorded raw frames: a ring of X/Y/Z frames per unit, indexed by the
+// frame's number in the capture. Sized for the whole capture when the
+// board has PSRAM; otherwise it holds what fits the internal budget and
+// the oldest unsent frames give way.
+static int16_t* rawFrames = NULL;
+static uint32_t rawCapacity = 0;      // Frames per unit
+static uint32_t rawWritten[MPU_MAX_UNITS];
+static uint32_t rawSent[MPU_MAX_UNITS];
+static uint8_t rawUnit = 0;           // Unit of the next raw message
+static uint32_t rawDropped = 0;
+
+// Report position
+static ReportPhase phase = PHASE_DONE;
+static uint8_t reportUnit = 0;
+static uint8_t reportAxis = 0;
+static uint16_t reportBin = 0;
+static uint8_t reportProbe = 0;
+
+static const char AXIS_NAMES[AXES] = { 'X', 'Y', 'Z' };
+
+static size_t put16(uint8_t* out, uint16_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  return 2;
+}
+
+static size_t put32(uint8_t* out, uint32_t value) {
+  put16(out, value);
+  put16(out + 2, value >> 16);
+  return 4;
+}
+
+// === Analysis ===
+
+// One Welch segment: remove its mean, window, transform and add the
+// magnitudes of the positive frequencies
+static void analyseSegment(AxisCapture& a) {
+  int16_t* work = scratch->work;
+  int32_t mean = (int32_t)(dspSum(a.segment, CAPTURE_FFT_SIZE) / CAPTURE_FFT_SIZE);
+  for (int i = 0; i < CAPTURE_FFT_SIZE; i++) {
+    work[i] = constrain(a.segment[i] - mean, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+  }
+  dspHann(work, CAPTURE_FFT_SIZE);
+
+  // Spread the real samples out to complex values in place, from the end
+  for (int i = CAPTURE_FFT_SIZE - 1; i >= 0; i--) {
+    work[2 * i] = work[i];
+    work[2 * i + 1] = 0;
+  }
+  dspFft(work, CAPTURE_FFT_SIZE);
+  dspMagnitude(work, BINS, scratch->magnitude);
+  for (int b = 0; b < BINS; b++) {
+    a.magnitudeSum[b] += scratch->magnitude[b];
+  }
+  a.segments++;
+}
+
+static void addSample(AxisCapture& a, int16_t value) {
+  if (a.samples == 0) {
+    a.min = value;
+    a.max = value;
+  }
+  a.samples++;
+  a.min = min(a.min, value);
+  a.max = max(a.max, value);
+  a.sum += value;
+  a.sumSquares += (uint64_t)((int32_t)value * value);
+
+  a.segment[a.filled++] = value;
+  if (a.filled == CAPTURE_FFT_SIZE) {
+    analyseSegment(a);
+    memmove(a.segment, a.segment + HOP, (CAPTURE_FFT_SIZE - HOP) * sizeof(int16_t));
+    a.filled = CAPTURE_FFT_SIZE - HOP;
+  }
+}
+
+static int16_t* rawFrame(uint8_t u, uint32_t frame) {
+  return rawFrames + ((size_t)u * rawCapacity + frame % rawCapacity) * AXES;
+}
+
+static void recordFrames(uint8_t u, const BusBlock& block) {
+  if (!rawFrames) {
+    rawDropped += block.frames;
+    return;
+  }
+  for (uint16_t f = 0; f < block.frames; f++) {
+    if (rawWritten[u] - rawSent[u] == rawCapacity) {
+      rawSent[u]++;
+      rawDropped++;
+    }
+    int16_t* frame = rawFrame(u, rawWritten[u]++);
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+      frame[axis] = busSample(block, f, axis);
+    }
+  }
+}
+
+static bool rawPending() {
+  for (uint8_t u = 0; u < units; u++) {
+    if (rawSent[u] != rawWritten[u]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void discardRaw() {
+  for (uint8_t u = 0; u < units; u++) {
+    rawDropped += rawWritten[u] - rawSent[u];
+    rawSent[u] = rawWritten[u];
+  }
+}
+
+// Frames per unit the store should hold: the whole capture where PSRAM
+// allows, else what fits in the internal budget
+static uint32_t rawStoreFrames() {
+  uint32_t wanted = (uint64_t)durationMs * MPU_CAPTURE_RATE_HZ / 1000 + BUS_BLOCK_SAMPLES;
+  return min(wanted, (uint32_t)(boardLargeMax() / (units * FRAME_BYTES)));
+}
+
+static void onAccel(const BusBlock& block, uint16_t first, uint16_t stride, void* context) {
+  uint8_t u = block.source;
+  if (!buffers || u >= units || block.channels < AXES) {
+    return;
+  }
+  for (uint16_t f = 0; f < block.frames; f++) {
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+      addSample(buffers->axes[u][axis], busSample(block, f, axis));
+    }
+  }
+
+  if (u == 0) {
+    if (rateSamples == 0) {
+      firstSampleUs = block.time.firstUs;
+      countScale = block.scale;
+    }
+    rateSamples += block.frames;
+    lastSampleUs = timeBlockSampleUs(block.time, block.frames - 1);
+  }
+  if (raw) {
+    recordFrames(u, block);
+  }
+}
+
+// === Report ===
+
+static float sampleRateHz() {
+  return rateSamples > 1 && lastSampleUs > firstSampleUs ? (rateSamples - 1) * 1e6f / (lastSampleUs - firstSampleUs) : 0;
+}
+
+static uint16_t acRms(const AxisCapture& a) {
+  if (a.samples == 0) {
+    return 0;
+  }
+  int64_t mean = a.sum / (int64_t)a.samples;
+  int64_t variance = (int64_t)(a.sumSquares / a.samples) - mean * mean;
+  return variance > 0 ? isqrt64(variance) : 0;
+}
+
+static uint16_t peakBin(const AxisCapture& a) {
+  uint16_t best = 1;
+  for (uint16_t b = 2; b < BINS; b++) {
+    if (a.magnitudeSum[b] > a.magnitudeSum[best]) {
+      best = b;
+    }
+  }
+  return best;
+}
+
+static uint8_t tdsProbes() {
+  return haveTds ? tds.channels : 0;
+}
+
+static uint16_t tdsStd(uint8_t probe) {
+  int64_t mean = tds.sum[probe] / (int64_t)tds.frames;
+  int64_t variance = (int64_t)(tds.sumSquares[probe] / tds.frames) - mean * mean;
+  return variance > 0 ? isqrt64(variance) : 0;
+}
+
+static void printReport() {
+  float rate = sampleRateHz();
+  Serial.print("Capture: "); Serial.print((finishedAt - startedAt) / 1000.0, 1);
+  Serial.print(stopped ? " s (stopped), " : " s, "); Serial.print(units);
+  Serial.print(" MPU unit(s) at "); Serial.print(rate, 1);
+  Serial.print(" Hz, "); Serial.print(tdsProbes() ? tds.frames : 0);
+  Serial.println(" TDS scans");
+  for (uint8_t u = 0; u < units; u++) {
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+      const AxisCapture& a = buffers->axes[u][axis];
+      if (a.samples == 0) {
+        continue;
+      }
+      Serial.print("Capture: unit "); Serial.print(u); Serial.print(" "); Serial.print(AXIS_NAMES[axis]);
+      Serial.print(" mean "); Serial.print((float)a.sum / a.samples * countScale, 3);
+      Serial.print(", RMS "); Serial.print(acRms(a) * countScale, 3);
+      Serial.print(", range "); Serial.print(a.min * countScale, 2);
+      Serial.print(" to "); Serial.print(a.max * countScale, 2);
+      Serial.print(" m/s², peak at "); Serial.print(peakBin(a) * rate / CAPTURE_FFT_SIZE, 1);
+      Serial.print(" Hz ("); Serial.print(a.segments); Serial.println(" segments)");
+    }
+  }
+  for (uint8_t p = 0; p < tdsProbes(); p++) {
+    Serial.print("Capture: TDS probe "); Serial.print(p);
+    Serial.print(" mean "); Serial.print(busAggregateMean(tds, p), 1);
+    Serial.print(", std "); Serial.print(tdsStd(p) * tds.scale, 1);
+    Serial.print(", range "); Serial.print(tds.min[p] * tds.scale, 1);
+    Serial.print(" to "); Serial.print(tds.max[p] * tds.scale, 1);
+    Serial.println(" ppm");
+  }
+  if (raw) {
+    Serial.print("Capture: raw frames dropped "); Serial.println(rawDropped);
+  }
+}
+
+// Skip axes of absent units and axes without samples
+static bool nextAxis() {
+  while (reportUnit < units) {
+    if (++reportAxis >= AXES) {
+      reportAxis = 0;
+      reportUnit++;
+    }
+    if (reportUnit < units && buffers->axes[reportUnit][reportAxis].samples > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The next report message into out (at most max bytes); 0 when done
+static size_t nextMessage(uint8_t* out, size_t max) {
+  size_t len = 0;
+  switch (phase) {
+    case PHASE_HEADER: {
+      out[len++] = MSG_HEADER;
+      out[len++] = raw ? CAPTURE_FLAG_RAW : 0;
+      len += put32(out + len, finishedAt - startedAt);
+      len += put16(out + len, (uint16_t)(sampleRateHz() * 10 + 0.5f));
+      len += put16(out + len, CAPTURE_FFT_SIZE);
+      len += put16(out + len, units ? buffers->axes[0][0].segments : 0);
+      out[len++] = units;
+      out[len++] = tdsProbes();
+      len += put16(out + len, (uint16_t)(countScale * 1e6f + 0.5f));
+      len += put32(out + len, rawDropped);
+      reportUnit = 0;
+      reportAxis = 0;
+      bool any = units > 0 && (buffers->axes[0][0].samples > 0 || nextAxis());
+      phase = any ? PHASE_AXIS : PHASE_TDS;
+      return len;
+    }
+
+    case PHASE_AXIS: {
+      const AxisCapture& a = buffers->axes[reportUnit][reportAxis];
+      out[len++] = MSG_AXIS;
+      out[len++] = reportUnit << 2 | reportAxis;
+      len += put32(out + len, a.samples);
+      len += put16(out + len, (int16_t)(a.sum / (int64_t)a.samples));
+      len += put16(out + len, acRms(a));
+      len += put16(out + len, a.min);
+      len += put16(out + len, a.max);
+      len += put16(out + len, peakBin(a));
+      reportBin = 0;
+      phase = a.segments > 0 ? PHASE_SPECTRUM : (nextAxis() ? PHASE_AXIS : PHASE_TDS);
+      return len;
+    }
+
+    case PHASE_SPECTRUM: {
+      const AxisCapture& a = buffers->axes[reportUnit][reportAxis];
+      out[len++] = MSG_SPECTRUM;
+      out[len++] = reportUnit << 2 | reportAxis;
+      out[len++] = reportBin;
+      while (len < max && reportBin < BINS) {
+        // Mean magnitude in 1/16 counts
+        out[len++] = dspLog8((uint32_t)((uint64_t)a.magnitudeSum[reportBin] * 16 / a.segments));
+        reportBin++;
+      }
+      if (reportBin >= BINS) {
+        phase = nextAxis() ? PHASE_AXIS : PHASE_TDS;
+      }
+      return len;
+    }
+
+    case PHASE_TDS:
+      if (reportProbe >= tdsProbes()) {
+        phase = PHASE_END;
+        return nextMessage(out, max);
+      }
+      out[len++] = MSG_TDS;
+      out[len++] = reportProbe;
+      len += put16(out + len, min(tds.frames, (uint32_t)UINT16_MAX));
+      len += put16(out + len, (uint16_t)(tds.sum[reportProbe] / (int64_t)tds.frames));
+      len += put16(out + len, tdsStd(reportProbe));
+      len += put16(out + len, tds.min[reportProbe]);
+      len += put16(out + len, tds.max[reportProbe]);
+      reportProbe++;
+      return len;
+
+    case PHASE_END:
+      out[len++] = MSG_END;
+      out[len++] = stopped ? 1 : 0;
+      phase = PHASE_DONE;
+      return len;
+
+    default:
+      return 0;
+  }
+}
+
+// The oldest unsent frames of the next unit that has any, as many as fit
+// one message (copied out of the store into the internal message buffer)
+static size_t nextRawMessage(uint8_t* out, size_t max) {
+  uint8_t u = rawUnit;
+  while (rawSent[u] == rawWritten[u]) {
+    u = (u + 1) % units;
+  }
+  rawUnit = (u + 1) % units;
+
+  size_t len = 0;
+  out[len++] = MSG_RAW;
+  out[len++] = u;
+  len += put32(out + len, rawSent[u]);
+  while (len + FRAME_BYTES <= max && rawSent[u] != rawWritten[u]) {
+    const int16_t* frame = rawFrame(u, rawSent[u]++);
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+      len += put16(out + len, frame[axis]);
+    }
+  }
+  return len;
+}
+
+static void finish() {
+  busUnsubscribe(accelSubscription);
+  haveTds = busTakeAggregate(tdsSubscription, tds);
+  busUnsubscribe(tdsSubscription);
+  accelSubscription = -1;
+  tdsSubscription = -1;
+  mpuArraySetCaptureMode(false);
+  finishedAt = millis();
+
+  printReport();
+  phase = PHASE_HEADER;
+  reportProbe = 0;
+  state = CAPTURE_REPORTING;
+}
+
+static void freeBuffers() {
+  discardRaw();
+  boardFree(rawFrames);
+  boardFree(scratch);
+  boardFree(buffers);
+  rawFrames = NULL;
+  scratch = NULL;
+  buffers = NULL;
+  state = CAPTURE_IDLE;
+}
+
+// The frame store: as large as wanted or as large as memory allows, down
+// to a minimum worth recording
+static void allocateRawStore() {
+  rawCapacity = rawStoreFrames();
+  while (rawCapacity >= RAW_MIN_FRAMES &&
+         !(rawFrames = (int16_t*)boardAllocLarge((size_t)rawCapacity * units * FRAME_BYTES))) {
+    rawCapacity /= 2;
+  }
+  if (!rawFrames) {
+    rawCapacity = 0;
+  }
+}
+
+// === API ===
+
+bool diagCaptureStart(uint8_t seconds, bool withRaw) {
+  // A report still waiting for a subscriber gives way to a new capture
+  if (state == CAPTURE_REPORTING && !bleStreamSubscribed(STREAM_CAPTURE)) {
+    Serial.println("Capture: dropped the unsent report");
+    freeBuffers();
+  }
+  if (state != CAPTURE_IDLE) {
+    Serial.println("Capture: already running");
+    return false;
+  }
+  buffers = (CaptureBuffers*)boardAllocLarge(sizeof(CaptureBuffers));
+  scratch = (CaptureScratch*)boardAllocInternal(sizeof(CaptureScratch));
+  if (!buffers || !scratch) {
+    Serial.println("Capture: not enough memory");
+    freeBuffers();
+    return false;
+  }
+
+  raw = withRaw;
+  stopped = false;
+  durationMs = constrain(seconds ? seconds : CAPTURE_DEFAULT_SECONDS, 1, CAPTURE_MAX_SECONDS) * 1000UL;
+  units = mpuArrayUnits();
+  rateSamples = 0;
+  countScale = 0;
+  rawDropped = 0;
+  rawUnit = 0;
+  memset(rawWritten, 0, sizeof(rawWritten));
+  memset(rawSent, 0, sizeof(rawSent));
+  if (raw && units > 0) {
+    allocateRawStore();
+  }
+
+  // Switch rates first, so every block the capture sees is at full rate
+  mpuArraySetCaptureMode(true);
+  BusPolicy every = { BUS_EVERY, 1, 0, BUS_ANY_SOURCE };
+  accelSubscription = busSubscribe(TOPIC_ACCEL, every, onAccel, NULL);
+  tdsSubscription = busSubscribeAggregate(TOPIC_TDS, 0, 0, NULL, NULL);
+  startedAt = millis();
+  state = CAPTURE_RUNNING;
+
+  Serial.print("Capture: started for "); Serial.print(durationMs / 1000);
+  if (raw) {
+    Serial.print(" s, storing up to ");
+    Serial.print((float)rawCapacity / MPU_CAPTURE_RATE_HZ, 1);
+    Serial.println(" s of raw frames");
+  } else {
+    Serial.println(" s");
+  }
+  return true;
+}
+
+void diagCaptureStop() {
+  if (state == CAPTURE_RUNNING) {
+    stopped = true;
+    finish();
+  }
+}
+
+bool diagCaptureActive() {
+  return state == CAPTURE_RUNNING;
+}
+
+void diagCaptureUpdate() {
+  if (state == CAPTURE_IDLE) {
+    return;
+  }
+  if (state == CAPTURE_RUNNING && millis() - startedAt >= durationMs) {
+    finish();
+  }
+
+  // Nobody to send to: recorded frames and the report wait for a
+  // subscriber (a client reconnecting after the capture), though not for
+  // ever; the report has been printed
+  if (!bleStreamSubscribed(STREAM_CAPTURE)) {
+    if (state == CAPTURE_REPORTING && millis() - finishedAt >= REPORT_HOLD_MS) {
+      Serial.println("Capture: nobody subscribed, dropped the report");
+      freeBuffers();
+    }
+    return;
+  }
+
+  uint8_t* message = scratch->message;
+  size_t max = min(bleNotifyMax(), (size_t)MESSAGE_MAX);
+  while (rawPending() && outboundHasRoom(OUTBOUND_BULK)) {
+    size_t len = nextRawMessage(message, max);
+    outboundEnqueue(STREAM_CAPTURE, OUTBOUND_BULK, message, len);
+  }
+
+  // Raw frames first, then the report
+  if (state != CAPTURE_REPORTING || rawPending()) {
+    return;
+  }
+  while (outboundHasRoom(OUTBOUND_BULK)) {
+    size_t len = nextMessage(message, max);
+    if (len == 0) {
+      freeBuffers();
+      return;
+    }
+    outboundEnqueue(STREAM_CAPTURE, OUTBOUND_BULK, message, len);
+  }
+}
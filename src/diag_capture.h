@@ -0,0 +1,64 @@
+/*
+ * On-demand high-rate diagnostic capture
+ *
+ * For a technician on site: for a bounded time (10 s by default, at most
+ * 30 s) the MPU6050s sample at 1 kHz with a 184 Hz filter and TDS scans
+ * run back to back. The capture is a data bus consumer, so the normal
+ * readings carry on from the same samples. Per unit and axis it keeps
+ * statistics and a Welch-averaged spectrum (256-sample Hann segments, 50%
+ * overlap, mean FFT magnitude); per TDS probe, the spread of every scan.
+ * When the time is up the sensors go back to the configured rates and the
+ * report is sent on the capture characteristic (and printed to Serial);
+ * with nobody subscribed it waits up to five minutes for a client.
+ *
+ * With `raw`, the accelerometer frames themselves are recorded into a
+ * store and streamed from it as the link takes them, then the rest after
+ * the capture. On boards with PSRAM the store holds the whole capture (up
+ * to 30 s of two units); otherwise it is limited to the internal budget
+ * (see board_memory.h), about a second, and when it fills the oldest
+ * unsent frames are dropped and counted. Acquisition never waits.
+ *
+ * Every message is binary, little-endian and at most one notification
+ * long (CaptureDecoder.js decodes them):
+ *
+ *   header    0x01, flags (bit 0 raw), duration ms u32, sample rate in
+ *             0.1 Hz u16, FFT size u16, segments u16, units u8, probes u8,
+ *             µm/s² per count u16, raw frames dropped u32
+ *   axis      0x02, unit << 2 | axis, samples u32, mean i16, AC RMS u16,
+ *             min i16, max i16, peak bin u16 (all in counts)
+ *   spectrum  0x03, unit << 2 | axis, first bin u8, then one byte per bin:
+ *             8 log2(16 x mean magnitude), i.e. 1/8 octave steps (see
+ *             dspLog8). A sine of amplitude A counts shows as A/4.
+ *   tds       0x04, probe, scans u16, mean u16, std u16, min u16, max u16
+ *             (0.1 ppm)
+ *   raw       0x05, unit, first frame u32, then X/Y/Z i16 per frame
+ *   end       0x06, 0 (complete) or 1 (stopped early)
+ *
+ * Request over BLE by writing [seconds, flags] to the capture
+ * characteristic (seconds 0 = default; flags bit 0 raw, bit 7 stop).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define CAPTURE_DEFAULT_SECONDS 10
+#define CAPTURE_MAX_SECONDS 30
+#define CAPTURE_FFT_SIZE 256
+
+#define CAPTURE_FLAG_RAW 0x01
+#define CAPTURE_FLAG_STOP 0x80
+
+// Start a capture; false if one is running or being sent. A finished
+// report nobody has subscribed to yet is dropped instead.
+bool diagCaptureStart(uint8_t seconds, bool raw);
+
+// End the running capture now; its report is still sent
+void diagCaptureStop();
+
+// True while sampling at capture rate (TDS scans should run back to back)
+bool diagCaptureActive();
+
+// Finish the capture when its time is up and send raw frames and the
+// report as the link has room; call every loop()
+void diagCaptureUpdate();
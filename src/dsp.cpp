@@ -0,0 +1,346 @@
+#include "dsp.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "board.h"
+#include "fixed_point.h"
+
+// cos(2 pi k / DSP_FFT_MAX) for k <= DSP_FFT_MAX / 2, Q15; built on first
+// use. sin is read from the same table a quarter turn on.
+static int16_t cosTable[DSP_FFT_MAX / 2 + 1];
+static bool tablesReady = false;
+
+static void buildTables() {
+  if (tablesReady) {
+    return;
+  }
+  for (int k = 0; k <= DSP_FFT_MAX / 2; k++) {
+    cosTable[k] = Q15::fromFloat(cosf(2 * M_PI * k / DSP_FFT_MAX)).raw;
+  }
+  tablesReady = true;
+}
+
+// cos(2 pi k / DSP_FFT_MAX) for any k
+static int16_t cosTurn(uint32_t k) {
+  k &= DSP_FFT_MAX - 1;
+  return cosTable[k <= DSP_FFT_MAX / 2 ? k : DSP_FFT_MAX - k];
+}
+
+static int16_t saturate16(int32_t value) {
+  return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
+
+static bool isPowerOfTwo(size_t n) {
+  return n >= 2 && (n & (n - 1)) == 0;
+}
+
+// Samples x lies past the last 16-byte boundary (0 when it's on one)
+static size_t misalignment(const int16_t* x) {
+  return ((uintptr_t)x & 15) >> 1;
+}
+
+// === Vector unit ===
+
+#if BOARD_HAS_PIE
+// Groups of 8 products per vector MAC block; 32 blocks keep the 40-bit
+// accumulator below overflow even for full-scale -32768 * -32768
+#define PIE_MAX_BLOCKS 32
+
+static const int16_t PIE_ONE = 1;
+static const int16_t PIE_MIN = INT16_MIN;
+static const int16_t PIE_MAX = INT16_MAX;
+
+static int64_t readAccx(uint32_t low, uint32_t high) {
+  // ACCX is 40 bits: sign-extend the top 8
+  return (int64_t)(int8_t)(high & 0xFF) * 4294967296LL + low;
+}
+
+// Sum of products of `blocks` groups of 8 values; a and b 16-byte aligned
+static int64_t pieDot(const int16_t* a, const int16_t* b, uint32_t blocks) {
+  uint32_t low, high;
+  asm volatile(
+      "ee.zero.accx\n"
+      "loopnez %[blocks], 1f\n"
+      "ee.vld.128.ip q0, %[a], 16\n"
+      "ee.vld.128.ip q1, %[b], 16\n"
+      "ee.vmulas.s16.accx q0, q1\n"
+      "1:\n"
+      "rur.accx_0 %[low]\n"
+      "rur.accx_1 %[high]\n"
+      : [a] "+r"(a), [b] "+r"(b), [low] "=r"(low), [high] "=r"(high)
+      : [blocks] "r"(blocks)
+      : "memory");
+  return readAccx(low, high);
+}
+
+// Sum, lane minima and lane maxima of `blocks` groups of 8 values; x and
+// the lane arrays 16-byte aligned. The sum is a MAC against a vector of
+// ones, so it's exact like pieDot.
+static int64_t pieSumRange(const int16_t* x, uint32_t blocks, int16_t* laneMin, int16_t* laneMax) {
+  uint32_t low, high;
+  asm volatile(
+      "ee.zero.accx\n"
+      "ee.vldbc.16 q1, %[one]\n"
+      "ee.vldbc.16 q2, %[top]\n"
+      "ee.vldbc.16 q3, %[bottom]\n"
+      "loopnez %[blocks], 1f\n"
+      "ee.vld.128.ip q0, %[x], 16\n"
+      "ee.vmin.s16 q2, q2, q0\n"
+      "ee.vmax.s16 q3, q3, q0\n"
+      "ee.vmulas.s16.accx q0, q1\n"
+      "1:\n"
+      "ee.vst.128.ip q2, %[laneMin], 16\n"
+      "ee.vst.128.ip q3, %[laneMax], 16\n"
+      "rur.accx_0 %[low]\n"
+      "rur.accx_1 %[high]\n"
+      : [x] "+r"(x), [laneMin] "+r"(laneMin), [laneMax] "+r"(laneMax), [low] "=r"(low), [high] "=r"(high)
+      : [blocks] "r"(blocks), [one] "r"(&PIE_ONE), [top] "r"(&PIE_MAX), [bottom] "r"(&PIE_MIN)
+      : "memory");
+  return readAccx(low, high);
+}
+
+// x[i] = x[i] * w[i] >> 15 for `blocks` groups of 8; x and w 16-byte
+// aligned. The vector multiply shifts by SAR and truncates, the same as
+// the scalar loop.
+static void pieWindow(int16_t* x, const int16_t* w, uint32_t blocks) {
+  int16_t* out = x;
+  asm volatile(
+      "ssai 15\n"
+      "loopnez %[blocks], 1f\n"
+      "ee.vld.128.ip q0, %[x], 16\n"
+      "ee.vld.128.ip q1, %[w], 16\n"
+      "ee.vmul.s16 q2, q0, q1\n"
+      "ee.vst.128.ip q2, %[out], 16\n"
+      "1:\n"
+      : [x] "+r"(x), [w] "+r"(w), [out] "+r"(out)
+      : [blocks] "r"(blocks)
+      : "memory");
+}
+#endif
+
+// === Multiply-accumulate ===
+
+int64_t dspDot(const int16_t* a, const int16_t* b, size_t n) {
+#if BOARD_HAS_PIE
+  // Scalar until a is aligned; the vector loads need b aligned the same way
+  int64_t sum = 0;
+  while (n > 0 && misalignment(a) != 0) {
+    sum += (int32_t)*a++ * *b++;
+    n--;
+  }
+  if (misalignment(b) == 0) {
+    while (n >= 8) {
+      uint32_t blocks = n / 8 < PIE_MAX_BLOCKS ? n / 8 : PIE_MAX_BLOCKS;
+      sum += pieDot(a, b, blocks);
+      a += blocks * 8;
+      b += blocks * 8;
+      n -= blocks * 8;
+    }
+  }
+  return sum + q15Dot(a, b, n);
+#else
+  return q15Dot(a, b, n);
+#endif
+}
+
+uint64_t dspSumSquares(const int16_t* a, size_t n) {
+#if BOARD_HAS_PIE
+  return (uint64_t)dspDot(a, a, n);
+#else
+  return q15SumSquares(a, n);
+#endif
+}
+
+static void foldScalar(const int16_t* x, size_t n, DspBlockStats& stats) {
+  for (size_t i = 0; i < n; i++) {
+    stats.min = x[i] < stats.min ? x[i] : stats.min;
+    stats.max = x[i] > stats.max ? x[i] : stats.max;
+    stats.sum += x[i];
+  }
+}
+
+// Fold the min, max and sum of x[0..n) into stats
+static void foldRange(const int16_t* x, size_t n, DspBlockStats& stats) {
+#if BOARD_HAS_PIE
+  // Scalar to the boundary, then vectors; the ranges come free alongside
+  // the MAC
+  static int16_t laneMin[8] __attribute__((aligned(16)));
+  static int16_t laneMax[8] __attribute__((aligned(16)));
+  size_t head = (8 - misalignment(x)) & 7;
+  head = head < n ? head : n;
+  foldScalar(x, head, stats);
+  x += head;
+  n -= head;
+  while (n >= 8) {
+    uint32_t blocks = n / 8 < PIE_MAX_BLOCKS ? n / 8 : PIE_MAX_BLOCKS;
+    stats.sum += pieSumRange(x, blocks, laneMin, laneMax);
+    for (int lane = 0; lane < 8; lane++) {
+      stats.min = laneMin[lane] < stats.min ? laneMin[lane] : stats.min;
+      stats.max = laneMax[lane] > stats.max ? laneMax[lane] : stats.max;
+    }
+    x += blocks * 8;
+    n -= blocks * 8;
+  }
+#endif
+  foldScalar(x, n, stats);
+}
+
+int64_t dspSum(const int16_t* x, size_t n) {
+  DspBlockStats stats = { INT16_MAX, INT16_MIN, 0, 0 };
+  foldRange(x, n, stats);
+  return stats.sum;
+}
+
+void dspBlockStats(const int16_t* x, size_t n, DspBlockStats& stats) {
+  stats.min = INT16_MAX;
+  stats.max = INT16_MIN;
+  stats.sum = 0;
+  foldRange(x, n, stats);
+  stats.sumSquares = dspSumSquares(x, n);
+}
+
+// === Filters ===
+
+void dspFirInit(DspFir& fir, const int16_t* taps, uint8_t count) {
+  memset(fir.phases, 0, sizeof(fir.phases));
+  fir.taps = count < DSP_FIR_MAX_TAPS ? count : DSP_FIR_MAX_TAPS;
+  for (uint8_t phase = 0; phase < 8; phase++) {
+    memcpy(fir.phases[phase] + phase, taps, fir.taps * sizeof(int16_t));
+  }
+}
+
+size_t dspFir(const DspFir& fir, const int16_t* x, size_t n, uint16_t decimation, int16_t* out) {
+  if (fir.taps == 0 || n < fir.taps) {
+    return 0;
+  }
+  decimation = decimation > 0 ? decimation : 1;
+  size_t outputs = (n - fir.taps) / decimation + 1;
+  for (size_t i = 0; i < outputs; i++) {
+    const int16_t* start = x + i * decimation;
+#if BOARD_HAS_PIE
+    // From the boundary at or before the first sample, against the copy
+    // of the taps shifted to match. The extra samples either side lie in
+    // the same 16-byte blocks and meet zero taps.
+    size_t phase = misalignment(start);
+    int64_t sum = pieDot(start - phase, fir.phases[phase], (phase + fir.taps + 7) / 8);
+#else
+    int64_t sum = q15Dot(fir.phases[0], start, fir.taps);
+#endif
+    out[i] = saturate16((int32_t)((sum + (1 << 14)) >> 15));
+  }
+  return outputs;
+}
+
+// === Spectra ===
+
+// Hann weights for the last size and input alignment asked for, starting
+// hannPhase entries in so they share the input's 16-byte alignment
+static int16_t hannTable[DSP_FFT_MAX + 8] __attribute__((aligned(16)));
+static size_t hannSize = 0;
+static size_t hannPhase = 0;
+
+void dspHann(int16_t* x, size_t n) {
+  if (!isPowerOfTwo(n) || n > DSP_FFT_MAX) {
+    return;
+  }
+  size_t phase = misalignment(x);
+  if (n != hannSize || phase != hannPhase) {
+    buildTables();
+    uint32_t stride = DSP_FFT_MAX / n;
+    for (size_t i = 0; i < n; i++) {
+      // (1 - cos) / 2, in Q15; the peak of exactly 1 is held just below
+      int32_t w = (32768 - cosTurn(i * stride)) >> 1;
+      hannTable[phase + i] = w > INT16_MAX ? INT16_MAX : (int16_t)w;
+    }
+    hannSize = n;
+    hannPhase = phase;
+  }
+
+  const int16_t* w = hannTable + phase;
+  size_t i = 0;
+#if BOARD_HAS_PIE
+  size_t head = (8 - phase) & 7;
+  for (; i < head && i < n; i++) {
+    x[i] = (int16_t)(((int32_t)x[i] * w[i]) >> 15);
+  }
+  if (n - i >= 8) {
+    uint32_t blocks = (n - i) / 8;
+    pieWindow(x + i, w + i, blocks);
+    i += blocks * 8;
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] = (int16_t)(((int32_t)x[i] * w[i]) >> 15);
+  }
+}
+
+bool dspFft(int16_t* data, size_t n) {
+  if (!isPowerOfTwo(n) || n > DSP_FFT_MAX) {
+    return false;
+  }
+  buildTables();
+
+  // Bit-reversed order
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      int16_t re = data[2 * i], im = data[2 * i + 1];
+      data[2 * i] = data[2 * j];
+      data[2 * i + 1] = data[2 * j + 1];
+      data[2 * j] = re;
+      data[2 * j + 1] = im;
+    }
+  }
+
+  for (size_t len = 2; len <= n; len <<= 1) {
+    size_t half = len / 2;
+    uint32_t stride = DSP_FFT_MAX / len;
+    for (size_t start = 0; start < n; start += len) {
+      for (size_t k = 0; k < half; k++) {
+        // w = e^(-j 2 pi k / len)
+        int32_t wr = cosTurn(k * stride);
+        int32_t wi = -cosTurn(k * stride + DSP_FFT_MAX * 3 / 4);
+        int16_t* u = data + 2 * (start + k);
+        int16_t* v = data + 2 * (start + k + half);
+
+        // Each product is at most 2^30, so the sums fit 32 bits
+        int32_t tr = ((int32_t)v[0] * wr - (int32_t)v[1] * wi + (1 << 14)) >> 15;
+        int32_t ti = ((int32_t)v[0] * wi + (int32_t)v[1] * wr + (1 << 14)) >> 15;
+        int32_t ur = u[0], ui = u[1];
+        u[0] = saturate16((ur + tr) >> 1);
+        u[1] = saturate16((ui + ti) >> 1);
+        v[0] = saturate16((ur - tr) >> 1);
+        v[1] = saturate16((ui - ti) >> 1);
+      }
+    }
+  }
+  return true;
+}
+
+void dspMagnitude(const int16_t* data, size_t n, uint16_t* out) {
+  for (size_t i = 0; i < n; i++) {
+    int32_t re = data[2 * i], im = data[2 * i + 1];
+    out[i] = isqrt32((uint32_t)(re * re) + (uint32_t)(im * im));
+  }
+}
+
+// 2^((2k + 1) / 16) in Q16: the rounding points between eighths of an octave
+static const uint32_t LOG8_STEPS[8] = { 68438, 74632, 81386, 88752, 96785, 105545, 115098, 125515 };
+
+uint8_t dspLog8(uint32_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  int octave = 31 - __builtin_clz(value);
+  uint32_t mantissa = octave >= 16 ? value >> (octave - 16) : value << (16 - octave);
+  uint32_t q = octave * 8;
+  for (int k = 0; k < 8 && mantissa >= LOG8_STEPS[k]; k++) {
+    q++;
+  }
+  return q < 255 ? q : 255;
+}
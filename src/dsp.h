@@ -0,0 +1,90 @@
+/*
+ * Block DSP kernels on Q15 samples
+ *
+ * Statistics, FIR filtering, windowing, FFT and magnitude over blocks of
+ * int16_t samples (raw sensor counts are valid Q15). On the ESP32-S3
+ * (BOARD_HAS_PIE) the dot product, sums, block statistics, FIR filter and
+ * Hann window use the PIE vector unit: 8 x 16-bit MACs per instruction
+ * into the 40-bit accumulator, lane-wise min/max, and lane-wise multiplies.
+ * Every other board, and the host, uses the portable scalar versions.
+ *
+ * The two are bit-exact. The vector MAC accumulates exactly (blocks are
+ * bounded so the accumulator can't overflow) as the scalar code does in
+ * 64 bits, and the window truncates its products the way the vector
+ * multiply does. `bench dsp` checks this on the device while it times
+ * them; test/test_dsp checks the scalar versions against a reference.
+ *
+ * The FFT is scalar on every board: each butterfly is a rotation with its
+ * own rounding, which doesn't map onto the MAC accumulator.
+ *
+ * The vector loads need 16-byte alignment. Inputs at any alignment work:
+ * the kernels run scalar up to the boundary, and dspDot stays scalar when
+ * its two inputs sit differently against it. The FIR filter keeps its
+ * taps at every alignment, so its outputs are always whole vector blocks.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest FFT; the twiddle table is sized for it
+#define DSP_FFT_MAX 512
+
+// Longest FIR filter
+#define DSP_FIR_MAX_TAPS 32
+
+struct DspBlockStats {
+  int16_t min;
+  int16_t max;
+  int64_t sum;
+  uint64_t sumSquares;
+};
+
+// Sum of a[i] * b[i], exact
+int64_t dspDot(const int16_t* a, const int16_t* b, size_t n);
+
+// Sum of a[i]^2, exact
+uint64_t dspSumSquares(const int16_t* a, size_t n);
+
+// Sum of x[i], exact
+int64_t dspSum(const int16_t* x, size_t n);
+
+void dspBlockStats(const int16_t* x, size_t n, DspBlockStats& stats);
+
+// FIR filter taps in Q15, stored once per possible input alignment (the
+// taps shifted by 0..7 samples) so every output is whole vector blocks on
+// the S3. 16-byte aligned: keep it static or on the stack.
+struct DspFir {
+  int16_t phases[8][DSP_FIR_MAX_TAPS + 8] __attribute__((aligned(16)));
+  uint8_t taps;
+};
+
+// Up to DSP_FIR_MAX_TAPS taps; more are dropped
+void dspFirInit(DspFir& fir, const int16_t* taps, uint8_t count);
+
+// out[i] = sum of taps[k] * x[i * decimation + k], rounded to Q15 and
+// saturated, for every output whose taps lie inside x[0..n). Returns the
+// number of outputs, (n - taps) / decimation + 1, or 0 if n < taps. out
+// may be x.
+size_t dspFir(const DspFir& fir, const int16_t* x, size_t n, uint16_t decimation, int16_t* out);
+
+// Multiply by a Hann window in Q15 (the products truncated), in place
+void dspHann(int16_t* x, size_t n);
+
+// In-place radix-2 FFT of n interleaved complex Q15 values (re, im),
+// n a power of two up to DSP_FFT_MAX. Every stage halves the values, so
+// the result is the DFT divided by n and can't overflow. False for an
+// unsupported n.
+bool dspFft(int16_t* data, size_t n);
+
+// |re + j im| of n complex values
+void dspMagnitude(const int16_t* data, size_t n, uint16_t* out);
+
+// round(8 * log2(value)), 0 for 0, at most 255: a magnitude in eighths of
+// an octave (0.75 dB) for 8-bit log spectra; value = 2^(q / 8)
+uint8_t dspLog8(uint32_t value);
+
+// Time the scalar and selected kernels, check they agree, and print the
+// results to Serial (dsp_bench.cpp)
+void runDspBenchmark(uint32_t iterations);
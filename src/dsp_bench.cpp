@@ -0,0 +1,167 @@
+#include "dsp.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "board.h"
+#include "fixed_point.h"
+
+// Scalar references for the kernels without a fixed_point.h counterpart,
+// written the way the portable versions in dsp.cpp work
+
+static void referenceStats(const int16_t* x, size_t n, DspBlockStats& stats) {
+  stats.min = INT16_MAX;
+  stats.max = INT16_MIN;
+  stats.sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    stats.min = min(stats.min, x[i]);
+    stats.max = max(stats.max, x[i]);
+    stats.sum += x[i];
+  }
+  stats.sumSquares = q15SumSquares(x, n);
+}
+
+static bool sameStats(const DspBlockStats& a, const DspBlockStats& b) {
+  return a.min == b.min && a.max == b.max && a.sum == b.sum && a.sumSquares == b.sumSquares;
+}
+
+static size_t referenceFir(const int16_t* taps, uint8_t count, const int16_t* x, size_t n, uint16_t decimation, int16_t* out) {
+  size_t outputs = (n - count) / decimation + 1;
+  for (size_t i = 0; i < outputs; i++) {
+    int64_t sum = q15Dot(taps, x + i * decimation, count);
+    out[i] = (int16_t)constrain((sum + (1 << 14)) >> 15, (int64_t)INT16_MIN, (int64_t)INT16_MAX);
+  }
+  return outputs;
+}
+
+static void referenceHann(int16_t* x, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint32_t k = i * (DSP_FFT_MAX / n);
+    int32_t w = (32768 - Q15::fromFloat(cosf(2 * M_PI * k / DSP_FFT_MAX)).raw) >> 1;
+    x[i] = (int16_t)(((int32_t)x[i] * min(w, (int32_t)INT16_MAX)) >> 15);
+  }
+}
+
+static void printBenchmarkLine(const char* name, int64_t scalarUs, int64_t selectedUs, uint32_t iterations, bool exact) {
+  Serial.print("Dsp: "); Serial.print(name);
+  Serial.print(" scalar "); Serial.print((float)scalarUs * 1000 / iterations, 0);
+  Serial.print(" ns, selected "); Serial.print((float)selectedUs * 1000 / iterations, 0);
+  Serial.print(" ns, x"); Serial.print(selectedUs > 0 ? (float)scalarUs / selectedUs : 0, 1);
+  Serial.println(exact ? ", exact" : ", MISMATCH");
+}
+
+void runDspBenchmark(uint32_t iterations) {
+  if (iterations == 0) {
+    return;
+  }
+  Serial.println(BOARD_HAS_PIE ? "Dsp: selected kernels use the S3 PIE vector unit" : "Dsp: selected kernels are the scalar ones on this board");
+
+  // Aligned like the capture buffers; full-scale values stress the
+  // accumulator
+  static int16_t a[256] __attribute__((aligned(16)));
+  static int16_t b[256] __attribute__((aligned(16)));
+  for (int i = 0; i < 256; i++) {
+    a[i] = (int16_t)(i * 2654435761u >> 16);
+    b[i] = i % 7 == 0 ? INT16_MIN : (int16_t)(i * 40503u);
+  }
+
+  volatile int64_t sink;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = q15Dot(a, b, 256);
+  }
+  int64_t scalarUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = dspDot(a, b, 256);
+  }
+  printBenchmarkLine("dot256", scalarUs, esp_timer_get_time() - start, iterations, q15Dot(a, b, 256) == dspDot(a, b, 256));
+
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = q15SumSquares(b, 256);
+  }
+  scalarUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = dspSumSquares(b, 256);
+  }
+  printBenchmarkLine("sumsq256", scalarUs, esp_timer_get_time() - start, iterations, q15SumSquares(b, 256) == dspSumSquares(b, 256));
+
+  // Unaligned start: scalar head, then vectors
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = q15Dot(a + 3, b + 3, 250);
+  }
+  scalarUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = dspDot(a + 3, b + 3, 250);
+  }
+  printBenchmarkLine("dot250+3", scalarUs, esp_timer_get_time() - start, iterations, q15Dot(a + 3, b + 3, 250) == dspDot(a + 3, b + 3, 250));
+  (void)sink;
+
+  // Block statistics, unaligned so both the head and the vectors run
+  DspBlockStats expected, actual;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    referenceStats(b + 5, 250, expected);
+  }
+  scalarUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    dspBlockStats(b + 5, 250, actual);
+  }
+  printBenchmarkLine("stats250+5", scalarUs, esp_timer_get_time() - start, iterations, sameStats(expected, actual));
+
+  // 16-tap low-pass, decimating by 2: every output starts at a different
+  // alignment from the one before
+  static const int16_t TAPS[16] = { -120, -310, -260, 420, 1750, 3520, 5060, 5730,
+                                    5060, 3520, 1750, 420, -260, -310, -120, 0 };
+  static DspFir fir;
+  static int16_t filtered[128], reference[128];
+  dspFirInit(fir, TAPS, 16);
+  uint32_t filters = max(iterations / 16, (uint32_t)1);
+  size_t outputs = 0;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < filters; i++) {
+    outputs = referenceFir(TAPS, 16, a, 256, 2, reference);
+  }
+  scalarUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < filters; i++) {
+    dspFir(fir, a, 256, 2, filtered);
+  }
+  printBenchmarkLine("fir16/2", scalarUs, esp_timer_get_time() - start, filters,
+                     memcmp(filtered, reference, outputs * sizeof(int16_t)) == 0);
+
+  // Hann window; the reference rebuilds its weights, so only the check
+  // is meaningful on boards without the vector unit
+  static int16_t windowed[256] __attribute__((aligned(16)));
+  static int16_t expectedWindow[256];
+  memcpy(expectedWindow, b, sizeof(expectedWindow));
+  referenceHann(expectedWindow, 256);
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < filters; i++) {
+    memcpy(windowed, b, sizeof(windowed));
+    dspHann(windowed, 256);
+  }
+  int64_t hannUs = esp_timer_get_time() - start;
+  bool hannExact = memcmp(windowed, expectedWindow, sizeof(windowed)) == 0;
+  Serial.print("Dsp: hann256 "); Serial.print((float)hannUs / filters, 1);
+  Serial.println(hannExact ? " us, exact" : " us, MISMATCH");
+
+  // Shared scalar code on every board, for scale
+  static int16_t spectrum[2 * 256];
+  uint32_t ffts = max(iterations / 16, (uint32_t)1);
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < ffts; i++) {
+    for (int k = 0; k < 256; k++) {
+      spectrum[2 * k] = a[k];
+      spectrum[2 * k + 1] = 0;
+    }
+    dspFft(spectrum, 256);
+  }
+  int64_t fftUs = esp_timer_get_time() - start;
+  Serial.print("Dsp: fft256 "); Serial.print((float)fftUs / ffts, 1); Serial.println(" us (scalar on every board)");
+}
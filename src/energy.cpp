@@ -0,0 +1,172 @@
+#include "energy.h"
+
+#include "ble_service.h"
+#include "config.h"
+#include "status_led.h"
+
+// === Radio airtime model (1M PHY, no data length extension) ===
+// A notification is L2CAP (4) + ATT (3) header plus the payload, split
+// into 27-byte link-layer packets with 10 bytes of framing each; every
+// bit takes 1 µs. Each packet also costs a TX ramp-up.
+#define RADIO_US_PER_BYTE 8
+#define RADIO_LL_PAYLOAD 27
+#define RADIO_LL_OVERHEAD 10
+#define RADIO_ATT_OVERHEAD 7
+#define RADIO_RAMP_US 140
+
+// An idle connection event: one empty packet each way, with ramp-up and
+// the receive window the peripheral opens early for clock drift
+#define CONN_EVENT_TX_US 220
+#define CONN_EVENT_RX_US 300
+
+// An advertising event: a PDU on each of three channels, each followed by
+// a short listen for scan or connect requests
+#define ADV_EVENT_TX_US (3 * (RADIO_RAMP_US + 39 * RADIO_US_PER_BYTE))
+#define ADV_EVENT_RX_US (3 * 200)
+
+#define US_PER_HOUR 3600000000.0
+
+struct EnergyWindow {
+  int64_t startUs;
+  uint64_t cpuIdleUs;
+  uint64_t adcUs;
+  uint64_t radioTxUs;          // Notification airtime only
+  double connEvents;           // At the interval in use at the time
+  double advEvents;
+  uint64_t mpuActiveUs;
+  uint64_t ledOnUs;            // statusLedOnTime() at the window start
+};
+
+static EnergyWindow window;
+static int64_t lastUpdateUs = 0;
+static bool mpuActive = false;
+
+const char* energySubsystemName(EnergySubsystem subsystem) {
+  switch (subsystem) {
+    case ENERGY_CPU:     return "cpu";
+    case ENERGY_RADIO:   return "radio";
+    case ENERGY_ADC:     return "adc";
+    case ENERGY_SENSORS: return "sensors";
+    case ENERGY_LED:     return "led";
+    default:             return "unknown";
+  }
+}
+
+static void startWindow(int64_t now) {
+  memset(&window, 0, sizeof(window));
+  window.startUs = now;
+  window.ledOnUs = statusLedOnTime();
+}
+
+void energyBegin() {
+  lastUpdateUs = esp_timer_get_time();
+  startWindow(lastUpdateUs);
+}
+
+void energyCpuIdle(uint32_t us) {
+  window.cpuIdleUs += us;
+}
+
+void energyAdcSample(uint32_t us) {
+  window.adcUs += us;
+}
+
+void energyRadioTx(size_t len) {
+  size_t bytes = len + RADIO_ATT_OVERHEAD;
+  size_t packets = (bytes + RADIO_LL_PAYLOAD - 1) / RADIO_LL_PAYLOAD;
+  window.radioTxUs += (bytes + packets * RADIO_LL_OVERHEAD) * RADIO_US_PER_BYTE + packets * RADIO_RAMP_US;
+}
+
+uint32_t energyAdvEventRadioUs() {
+  return ADV_EVENT_TX_US + ADV_EVENT_RX_US;
+}
+
+void energySetMpuActive(bool active) {
+  mpuActive = active;
+}
+
+void energyUpdate() {
+  int64_t now = esp_timer_get_time();
+  uint64_t elapsed = now - lastUpdateUs;
+  lastUpdateUs = now;
+
+  // The central picks the connection interval; until it is known (and
+  // for the advertising interval before it is first set) the configured
+  // values stand in
+  if (bleConnected()) {
+    uint32_t intervalUs = bleConnIntervalUs();
+    if (intervalUs == 0) {
+      intervalUs = config.radioConnIntervalMs * 1000;
+    }
+    if (intervalUs > 0) {
+      window.connEvents += (double)elapsed / intervalUs;
+    }
+  } else {
+    uint32_t intervalMs = bleAdvertisingIntervalMs();
+    if (intervalMs == 0) {
+      intervalMs = config.radioAdvIntervalMs;
+    }
+    if (intervalMs > 0) {
+      window.advEvents += (double)elapsed / (intervalMs * 1000);
+    }
+  }
+  if (mpuActive) {
+    window.mpuActiveUs += elapsed;
+  }
+}
+
+void energyReport(EnergyReport& report, bool reset) {
+  int64_t now = esp_timer_get_time();
+  uint64_t elapsedUs = max((int64_t)1, now - window.startUs);
+  double hours = elapsedUs / US_PER_HOUR;
+
+  uint64_t idleUs = min(window.cpuIdleUs, elapsedUs);
+  uint64_t activeUs = elapsedUs - idleUs;
+
+  uint64_t txUs = window.radioTxUs + window.connEvents * CONN_EVENT_TX_US + window.advEvents * ADV_EVENT_TX_US;
+  uint64_t rxUs = window.connEvents * CONN_EVENT_RX_US + window.advEvents * ADV_EVENT_RX_US;
+
+  uint64_t ledUs = statusLedOnTime() - window.ledOnUs;
+
+  // Charge per subsystem in mA·µs
+  double charge[ENERGY_SUBSYSTEM_COUNT];
+  charge[ENERGY_CPU] = activeUs * (double)config.cpuActiveMa + idleUs * (double)config.cpuIdleMa;
+  charge[ENERGY_RADIO] = txUs * (double)config.radioTxMa + rxUs * (double)config.radioRxMa;
+  charge[ENERGY_ADC] = window.adcUs * (double)config.adcMa;
+  charge[ENERGY_SENSORS] = elapsedUs * (double)config.tdsProbeMa + window.mpuActiveUs * (double)config.mpuMa;
+  charge[ENERGY_LED] = ledUs * (double)config.ledMa;
+
+  // mAh per day at the window's average current
+  report.windowMs = elapsedUs / 1000;
+  report.totalMahPerDay = 0;
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    report.mAhPerDay[i] = charge[i] / US_PER_HOUR / hours * 24.0;
+    report.totalMahPerDay += report.mAhPerDay[i];
+  }
+  report.cpuActivePercent = 100.0 * activeUs / elapsedUs;
+  report.radioTxMs = txUs / 1000.0;
+  report.radioRxMs = rxUs / 1000.0;
+
+  if (reset) {
+    startWindow(now);
+  }
+}
+
+void printEnergyReport() {
+  EnergyReport report;
+  energyReport(report, false);
+
+  Serial.print("Energy: window "); Serial.print(report.windowMs / 1000.0, 1);
+  Serial.print(" s, cpu active "); Serial.print(report.cpuActivePercent, 1);
+  Serial.print("%, radio tx "); Serial.print(report.radioTxMs, 1);
+  Serial.print(" ms, rx "); Serial.print(report.radioRxMs, 1);
+  Serial.println(" ms");
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    Serial.print("Energy: ");
+    Serial.print(energySubsystemName((EnergySubsystem)i));
+    Serial.print(" "); Serial.print(report.mAhPerDay[i], 2);
+    Serial.println(" mAh/day");
+  }
+  Serial.print("Energy: total "); Serial.print(report.totalMahPerDay, 1);
+  Serial.println(" mAh/day");
+}
@@ -0,0 +1,70 @@
+/*
+ * Per-subsystem energy accounting
+ *
+ * There is no current sensor on the board, so charge is estimated: the
+ * firmware accumulates how long each subsystem spends in each power state
+ * and multiplies by the typical currents in config.h. Measure the board
+ * once and put the real currents there to make the estimate trustworthy.
+ *
+ *   cpu      active vs. waiting in loop()'s delay
+ *   radio    TX and RX airtime: notifications by payload size, plus the
+ *            empty packets of each connection event or advertising event
+ *   adc      time spent in analogRead()
+ *   sensors  TDS probe (always powered) and MPU6050 (once detected)
+ *   led      time any status LED is lit (see status_led.h)
+ *
+ * The totals are reported as mAh per day at the rate seen since the last
+ * reset, which is the unit tools/battery_model.js works in.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+enum EnergySubsystem {
+  ENERGY_CPU,
+  ENERGY_RADIO,
+  ENERGY_ADC,
+  ENERGY_SENSORS,
+  ENERGY_LED,
+  ENERGY_SUBSYSTEM_COUNT
+};
+
+struct EnergyReport {
+  uint32_t windowMs;                          // Time the figures cover
+  float mAhPerDay[ENERGY_SUBSYSTEM_COUNT];
+  float totalMahPerDay;
+  float cpuActivePercent;
+  float radioTxMs;                            // Estimated airtime in the window
+  float radioRxMs;
+};
+
+const char* energySubsystemName(EnergySubsystem subsystem);
+
+// Start the first accounting window
+void energyBegin();
+
+// Time the main loop spent waiting rather than working
+void energyCpuIdle(uint32_t us);
+
+// Time one ADC conversion took
+void energyAdcSample(uint32_t us);
+
+// One notification of `len` payload bytes handed to the radio
+void energyRadioTx(size_t len);
+
+// Radio time of one advertising event (transmit and listen) in the
+// airtime model
+uint32_t energyAdvEventRadioUs();
+
+// The MPU6050 is powered and sampling
+void energySetMpuActive(bool active);
+
+// Accumulate radio and sensor state time; call every loop()
+void energyUpdate();
+
+// Estimate for the window so far; `reset` starts a new window
+void energyReport(EnergyReport& report, bool reset);
+
+// Print the current window's estimate to Serial
+void printEnergyReport();
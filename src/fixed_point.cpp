@@ -0,0 +1,83 @@
+#include "fixed_point.h"
+
+uint16_t isqrt32(uint32_t x) {
+  uint32_t root = 0;
+  uint32_t bit = 1u << 30;
+  while (bit > x) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+uint32_t isqrt64(uint64_t x) {
+  // Most calls fit in 32 bits; the 32-bit loop is several times cheaper
+  // on a 32-bit core
+  if (x <= UINT32_MAX) {
+    return isqrt32((uint32_t)x);
+  }
+  uint64_t root = 0;
+  uint64_t bit = 1ull << 62;
+  while (bit > x) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+uint32_t reciprocalQ31(uint32_t m) {
+  // Linear estimate 48/17 - 32/17 m (error <= 1/17), then Newton steps
+  // y = y (2 - m y), each of which squares the error
+  const int64_t K1 = 3031741621ll;   // 48/17 in Q30
+  const int64_t K2 = 2021161081ll;   // 32/17 in Q30
+  int64_t y = K1 - ((K2 * (int64_t)m) >> 31);
+  for (int i = 0; i < 3; i++) {
+    int64_t e = (1ll << 30) - (((int64_t)m * y) >> 31);   // 1 - m y, Q30
+    y += (y * e) >> 30;
+  }
+  return y > (1ll << 31) ? (1u << 31) : (uint32_t)y;
+}
+
+int64_t q15Dot(const int16_t* a, const int16_t* b, size_t n) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += (int32_t)a[i] * b[i];
+  }
+  return sum;
+}
+
+uint64_t q15SumSquares(const int16_t* a, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += (uint32_t)((int32_t)a[i] * a[i]);
+  }
+  return sum;
+}
+
+void q15Scale(const int16_t* a, Q15 gain, int16_t* out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = (Q15::fromRaw(a[i]) * gain).raw;
+  }
+}
+
+void q15Add(const int16_t* a, const int16_t* b, int16_t* out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = Q15::fromRaw((int32_t)a[i] + b[i]).raw;
+  }
+}
@@ -0,0 +1,174 @@
+/*
+ * Fixed-point arithmetic for targets without an FPU
+ *
+ * On the ESP32-C6 every float add, multiply, divide and sqrt is a software
+ * library call. Fixed<T, FRAC> keeps a value as a signed integer with FRAC
+ * fractional bits, so the same operations become a few integer
+ * instructions:
+ *
+ *   Q15    = Fixed<int16_t, 15>   [-1, 1)          resolution 3.1e-5
+ *   Q31    = Fixed<int32_t, 31>   [-1, 1)          resolution 4.7e-10
+ *   Q16_16 = Fixed<int32_t, 16>   [-32768, 32768)  resolution 1.5e-5
+ *
+ * All arithmetic saturates at the ends of the range instead of wrapping.
+ * Multiplication rounds to nearest (error <= 1/2 LSB). sqrt() is exact to
+ * the LSB (floor of the true root). reciprocal() is three Newton-Raphson
+ * steps from a linear estimate, within 1 LSB of the rounded true value
+ * wherever that is representable.
+ *
+ * The vector helpers work on plain Q15 sample arrays (e.g. int16_t sensor
+ * frames) with 64-bit accumulators, so they can't overflow for any length
+ * the firmware uses.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Integer square roots, floor(sqrt(x))
+uint16_t isqrt32(uint32_t x);
+uint32_t isqrt64(uint64_t x);
+
+// 1/m for a mantissa m in [0.5, 1) given in Q31 (2^30 <= m < 2^31);
+// the result is in Q30, in (1, 2]
+uint32_t reciprocalQ31(uint32_t m);
+
+template <typename T> struct FixedTraits;
+
+template <> struct FixedTraits<int16_t> {
+  typedef int32_t Wide;
+  static const int16_t MIN = INT16_MIN;
+  static const int16_t MAX = INT16_MAX;
+};
+
+template <> struct FixedTraits<int32_t> {
+  typedef int64_t Wide;
+  static const int32_t MIN = INT32_MIN;
+  static const int32_t MAX = INT32_MAX;
+};
+
+template <typename T, int FRAC>
+struct Fixed {
+  typedef typename FixedTraits<T>::Wide Wide;
+  static const Wide ONE = (Wide)1 << FRAC;
+
+  T raw;
+
+  // Clamp a wide intermediate into range
+  static Fixed fromRaw(Wide value) {
+    Fixed f;
+    if (value > (Wide)FixedTraits<T>::MAX) {
+      f.raw = FixedTraits<T>::MAX;
+    } else if (value < (Wide)FixedTraits<T>::MIN) {
+      f.raw = FixedTraits<T>::MIN;
+    } else {
+      f.raw = (T)value;
+    }
+    return f;
+  }
+
+  static Fixed fromFloat(float value) {
+    float scaled = value * (float)ONE;
+    if (scaled >= (float)FixedTraits<T>::MAX) {
+      return fromRaw(FixedTraits<T>::MAX);
+    }
+    if (scaled <= (float)FixedTraits<T>::MIN) {
+      return fromRaw(FixedTraits<T>::MIN);
+    }
+    return fromRaw((Wide)(scaled + (scaled >= 0 ? 0.5f : -0.5f)));
+  }
+
+  static Fixed fromInt(int32_t value) {
+    return fromRaw((Wide)value << FRAC);
+  }
+
+  float toFloat() const {
+    return raw / (float)ONE;
+  }
+
+  // Rounded to the nearest integer
+  int32_t toInt() const {
+    return (int32_t)(((Wide)raw + (ONE >> 1)) >> FRAC);
+  }
+
+  Fixed operator+(Fixed other) const { return fromRaw((Wide)raw + other.raw); }
+  Fixed operator-(Fixed other) const { return fromRaw((Wide)raw - other.raw); }
+  Fixed operator-() const { return fromRaw(-(Wide)raw); }
+
+  Fixed operator*(Fixed other) const {
+    return fromRaw(((Wide)raw * other.raw + (ONE >> 1)) >> FRAC);
+  }
+
+  // Multiply by an integer
+  Fixed scale(int32_t k) const { return fromRaw((Wide)raw * k); }
+
+  // Integer division; saturates on division by zero
+  Fixed operator/(Fixed other) const {
+    if (other.raw == 0) {
+      return fromRaw(raw >= 0 ? FixedTraits<T>::MAX : FixedTraits<T>::MIN);
+    }
+    return fromRaw(((Wide)raw << FRAC) / other.raw);
+  }
+
+  bool operator<(Fixed other) const { return raw < other.raw; }
+  bool operator>(Fixed other) const { return raw > other.raw; }
+  bool operator<=(Fixed other) const { return raw <= other.raw; }
+  bool operator>=(Fixed other) const { return raw >= other.raw; }
+  bool operator==(Fixed other) const { return raw == other.raw; }
+
+  // 0 for negative values
+  Fixed sqrt() const {
+    if (raw <= 0) {
+      return fromRaw(0);
+    }
+    return fromRaw(isqrt64((uint64_t)raw << FRAC));
+  }
+
+  // 1/x without a divide; saturates for 0 and results out of range
+  Fixed reciprocal() const {
+    if (raw == 0) {
+      return fromRaw(FixedTraits<T>::MAX);
+    }
+    bool negative = raw < 0;
+    uint32_t magnitude = negative ? (uint32_t)(-(int64_t)raw) : (uint32_t)raw;
+
+    // Normalise to a Q31 mantissa in [0.5, 1): magnitude * 2^shift
+    int shift = __builtin_clz(magnitude) - 1;
+    uint32_t m = shift >= 0 ? magnitude << shift : magnitude >> 1;
+    uint64_t y = reciprocalQ31(m);
+
+    // x = m * 2^(31 - shift - FRAC), so 1/x = y * 2^(shift + FRAC - 31 - 30);
+    // in raw units (* 2^FRAC) that's y shifted by shift + 2 FRAC - 61
+    int exponent = shift + 2 * FRAC - 61;
+    int64_t value;
+    if (exponent >= 0) {
+      value = exponent > 31 ? INT64_MAX >> 1 : (int64_t)(y << exponent);
+    } else {
+      value = -exponent > 40 ? 0 : (int64_t)((y + (1ull << (-exponent - 1))) >> -exponent);
+    }
+    return fromRaw(negative ? -value : value);
+  }
+};
+
+typedef Fixed<int16_t, 15> Q15;
+typedef Fixed<int32_t, 31> Q31;
+typedef Fixed<int32_t, 16> Q16_16;
+
+// === Q15 vectors ===
+
+// Sum of a[i] * b[i], in Q30
+int64_t q15Dot(const int16_t* a, const int16_t* b, size_t n);
+
+// Sum of a[i]^2, in Q30
+uint64_t q15SumSquares(const int16_t* a, size_t n);
+
+// out[i] = a[i] * gain, saturated; out may be a
+void q15Scale(const int16_t* a, Q15 gain, int16_t* out, size_t n);
+
+// out[i] = a[i] + b[i], saturated; out may be a or b
+void q15Add(const int16_t* a, const int16_t* b, int16_t* out, size_t n);
+
+// Time float and fixed-point versions of the firmware's kernels and print
+// the results to Serial (fixed_point_bench.cpp)
+void runFixedPointBenchmark(uint32_t iterations);
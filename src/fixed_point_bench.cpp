@@ -0,0 +1,78 @@
+#include "fixed_point.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Keeps the compiler from optimising the loops away
+static volatile int32_t benchSink;
+
+static void printBenchmarkLine(const char* name, int64_t floatUs, int64_t fixedUs, uint32_t iterations) {
+  Serial.print("Fixed: "); Serial.print(name);
+  Serial.print(" float "); Serial.print((float)floatUs * 1000 / iterations, 0);
+  Serial.print(" ns, fixed "); Serial.print((float)fixedUs * 1000 / iterations, 0);
+  Serial.print(" ns, x"); Serial.println(fixedUs > 0 ? (float)floatUs / fixedUs : 0, 1);
+}
+
+void runFixedPointBenchmark(uint32_t iterations) {
+  if (iterations == 0) {
+    return;
+  }
+
+  // Accelerometer magnitude, as in every MPU6050 FIFO frame
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    float ax = (int16_t)(i * 7), ay = (int16_t)(i * 13), az = (int16_t)(4096 + i);
+    benchSink = (int32_t)sqrtf(ax * ax + ay * ay + az * az);
+  }
+  int64_t floatUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    int32_t ax = (int16_t)(i * 7), ay = (int16_t)(i * 13), az = (int16_t)(4096 + i);
+    benchSink = isqrt32((uint32_t)(ax * ax + ay * ay) + (uint32_t)(az * az));
+  }
+  printBenchmarkLine("magnitude", floatUs, esp_timer_get_time() - start, iterations);
+
+  // TDS polynomial with temperature compensation
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    float v = (i & 4095) * 3.3f / 4096 / (1.0f + 0.02f * ((i & 31) - 3.0f));
+    benchSink = (int32_t)((133.42f * v * v * v - 255.86f * v * v + 857.39f * v) * 0.5f);
+  }
+  floatUs = esp_timer_get_time() - start;
+  const Q16_16 A = Q16_16::fromFloat(133.42f), B = Q16_16::fromFloat(-255.86f), C = Q16_16::fromFloat(857.39f);
+  const Q16_16 VREF = Q16_16::fromFloat(3.3f / 4096), COEF = Q16_16::fromFloat(0.02f), HALF = Q16_16::fromFloat(0.5f);
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    Q16_16 compensation = Q16_16::fromInt(1) + COEF.scale((int32_t)(i & 31) - 3);
+    Q16_16 v = VREF.scale(i & 4095) * compensation.reciprocal();
+    benchSink = (((A * v + B) * v + C) * v * HALF).raw;
+  }
+  printBenchmarkLine("tds-poly", floatUs, esp_timer_get_time() - start, iterations);
+
+  // Dot product of 64 samples, as in demodulation and RMS
+  int16_t a[64], b[64];
+  float fa[64], fb[64];
+  for (int i = 0; i < 64; i++) {
+    a[i] = (int16_t)(i * 517);
+    b[i] = (int16_t)(16384 - i * 311);
+    fa[i] = a[i] / 32768.0f;
+    fb[i] = b[i] / 32768.0f;
+  }
+  uint32_t blocks = max(iterations / 64, (uint32_t)1);
+  start = esp_timer_get_time();
+  for (uint32_t k = 0; k < blocks; k++) {
+    fb[k & 63] += 1 / 32768.0f;
+    float sum = 0;
+    for (int i = 0; i < 64; i++) {
+      sum += fa[i] * fb[i];
+    }
+    benchSink = (int32_t)(sum * 1000);
+  }
+  floatUs = esp_timer_get_time() - start;
+  start = esp_timer_get_time();
+  for (uint32_t k = 0; k < blocks; k++) {
+    b[k & 63]++;
+    benchSink = (int32_t)(q15Dot(a, b, 64) >> 30);
+  }
+  printBenchmarkLine("dot64", floatUs, esp_timer_get_time() - start, blocks);
+}
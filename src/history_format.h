@@ -0,0 +1,50 @@
+/*
+ * On-flash layout of the reading history
+ *
+ * Fixed-size records in a ring of 4 KB sectors; record `seq` lives in slot
+ * `seq % slot count`. See history_log.h for how the ring is written.
+ *
+ * Plain C++ with no Arduino dependency, so host tools can decode a
+ * partition image with the same definitions.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32.h"
+
+#define HISTORY_MAGIC 0x5748  // "HW"
+#define HISTORY_SECTOR_SIZE 4096
+
+// One flash slot; 32 bytes, so a 4 KB sector holds 128 records
+struct HistoryRecord {
+  uint32_t seq;
+  uint32_t timestamp;        // millis() when the reading was taken
+  float tds;                 // ppm
+  float vibration;           // m/s²
+  int16_t temperature;       // °C x 10
+  int16_t pH;                // x 100
+  int16_t turbidity;         // NTU x 100
+  uint8_t waterStatus;       // WaterStatus
+  uint8_t flags;             // HISTORY_FLAG_*
+  uint16_t magic;
+  uint16_t reserved;
+  uint32_t crc;              // CRC-32 of every byte above; must stay last
+};
+
+#define HISTORY_FLAG_VIBRATION 0x01
+
+#define HISTORY_SLOTS_PER_SECTOR (HISTORY_SECTOR_SIZE / sizeof(HistoryRecord))
+
+// Bytes of a record covered by its CRC
+#define HISTORY_CRC_OFFSET offsetof(HistoryRecord, crc)
+
+static_assert(HISTORY_SECTOR_SIZE % sizeof(HistoryRecord) == 0, "records must not straddle sectors");
+
+// True if the slot holds an intact record with this sequence number
+inline bool historyRecordValid(const HistoryRecord& record, uint32_t seq) {
+  return record.magic == HISTORY_MAGIC && record.seq == seq &&
+         crc32Update(0, &record, HISTORY_CRC_OFFSET) == record.crc;
+}
@@ -0,0 +1,185 @@
+#include "history_log.h"
+
+#include <esp_partition.h>
+
+#include "partition_map.h"
+#include "trace.h"
+
+static const esp_partition_t* partition = NULL;
+static PartitionMap map;
+static uint32_t slotCount = 0;     // Whole sectors only
+static uint32_t firstSeq = 0;      // Oldest record ever found or written
+static uint32_t newestSeq = 0;     // 0 while the log is empty
+static uint32_t nextSeq = 0;
+
+static size_t slotOffset(uint32_t seq) {
+  return (seq % slotCount) * sizeof(HistoryRecord);
+}
+
+// Smallest sequence number >= seq whose slot starts a sector
+static uint32_t sectorAlignUp(uint32_t seq) {
+  uint32_t rest = seq % HISTORY_SLOTS_PER_SECTOR;
+  return rest ? seq + HISTORY_SLOTS_PER_SECTOR - rest : seq;
+}
+
+// The slot of `seq` in place, whatever it holds
+static const HistoryRecord* mapSlot(uint32_t seq) {
+  return (const HistoryRecord*)partitionMapAt(map, slotOffset(seq), sizeof(HistoryRecord));
+}
+
+static const HistoryRecord* peekSlot(uint32_t seq) {
+  const HistoryRecord* record = mapSlot(seq);
+  return record && historyRecordValid(*record, seq) ? record : NULL;
+}
+
+static bool slotErased(uint32_t seq) {
+  const uint8_t* raw = (const uint8_t*)mapSlot(seq);
+  if (!raw) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(HistoryRecord); i++) {
+    if (raw[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool historyBegin() {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)ESP_PARTITION_SUBTYPE_ANY,
+                                       HISTORY_PARTITION_LABEL);
+  if (!partition) {
+    Serial.println("History: no " HISTORY_PARTITION_LABEL " partition, history disabled");
+    return false;
+  }
+
+  partitionMapOpen(map, partition);
+  uint32_t sectors = partition->size / HISTORY_SECTOR_SIZE;
+  slotCount = sectors * HISTORY_SLOTS_PER_SECTOR;
+
+  // The head sector is the one whose first record is the newest
+  uint32_t headSeq = 0;
+  firstSeq = 0;
+  for (uint32_t s = 0; s < sectors; s++) {
+    const HistoryRecord* record = (const HistoryRecord*)partitionMapAt(map, s * HISTORY_SECTOR_SIZE, sizeof(HistoryRecord));
+    if (!record || record->seq % slotCount != s * HISTORY_SLOTS_PER_SECTOR || !historyRecordValid(*record, record->seq)) {
+      continue;
+    }
+    headSeq = max(headSeq, record->seq);
+    firstSeq = firstSeq ? min(firstSeq, record->seq) : record->seq;
+  }
+
+  if (headSeq == 0) {
+    // Start on a sector boundary so the first append erases whatever the
+    // partition held before
+    newestSeq = 0;
+    nextSeq = HISTORY_SLOTS_PER_SECTOR;
+    firstSeq = 0;
+    Serial.println("History: empty log");
+    return true;
+  }
+
+  // Walk the head sector up to its last valid record
+  newestSeq = headSeq;
+  while ((newestSeq + 1) % HISTORY_SLOTS_PER_SECTOR != 0 && peekSlot(newestSeq + 1)) {
+    newestSeq++;
+  }
+  nextSeq = newestSeq + 1;
+
+  // A write cut short by a reset leaves a slot that is neither valid nor
+  // erased; continue in the next sector, which is erased before use
+  if (nextSeq % HISTORY_SLOTS_PER_SECTOR != 0 && !slotErased(nextSeq)) {
+    nextSeq = sectorAlignUp(nextSeq);
+  }
+
+  Serial.print("History: ");
+  Serial.print(newestSeq - historyOldestSeq() + 1);
+  Serial.print(" records, newest #");
+  Serial.println(newestSeq);
+  return true;
+}
+
+bool historyAvailable() {
+  return partition != NULL;
+}
+
+static uint32_t appendRecord(const WaterReading& reading) {
+  // Entering a sector: erase it, dropping the oldest records
+  if (nextSeq % HISTORY_SLOTS_PER_SECTOR == 0 &&
+      esp_partition_erase_range(partition, slotOffset(nextSeq), HISTORY_SECTOR_SIZE) != ESP_OK) {
+    Serial.println("History: sector erase failed");
+    nextSeq += HISTORY_SLOTS_PER_SECTOR;
+    return 0;
+  }
+
+  HistoryRecord record;
+  memset(&record, 0, sizeof(record));
+  record.seq = nextSeq;
+  record.timestamp = reading.timestamp;
+  record.tds = reading.tds;
+  record.vibration = reading.vibration;
+  record.temperature = (int16_t)lroundf(reading.temperature * 10);
+  record.pH = (int16_t)lroundf(reading.pH * 100);
+  record.turbidity = (int16_t)lroundf(reading.turbidity * 100);
+  record.waterStatus = reading.waterStatus;
+  record.flags = reading.vibrationDetected ? HISTORY_FLAG_VIBRATION : 0;
+  record.magic = HISTORY_MAGIC;
+  record.crc = crc32Update(0, &record, HISTORY_CRC_OFFSET);
+
+  if (esp_partition_write(partition, slotOffset(nextSeq), &record, sizeof(record)) != ESP_OK) {
+    Serial.println("History: write failed");
+    nextSeq = sectorAlignUp(nextSeq + 1);
+    return 0;
+  }
+
+  newestSeq = nextSeq++;
+  if (firstSeq == 0) {
+    firstSeq = newestSeq;
+  }
+  return newestSeq;
+}
+
+uint32_t historyAppend(const WaterReading& reading) {
+  if (!partition) {
+    return 0;
+  }
+  TRACE_BEGIN(TRACE_HISTORY_APPEND);
+  uint32_t seq = appendRecord(reading);
+  TRACE_END(TRACE_HISTORY_APPEND);
+  return seq;
+}
+
+uint32_t historyOldestSeq() {
+  if (newestSeq == 0) {
+    return 0;
+  }
+  // The sector after the head sector holds the oldest records; until the
+  // ring has wrapped that is simply the first record written
+  uint32_t headStart = newestSeq - newestSeq % HISTORY_SLOTS_PER_SECTOR;
+  uint32_t oldest = headStart + HISTORY_SLOTS_PER_SECTOR > slotCount ? headStart + HISTORY_SLOTS_PER_SECTOR - slotCount : 0;
+  return max(oldest, firstSeq);
+}
+
+uint32_t historyNewestSeq() {
+  return newestSeq;
+}
+
+const HistoryRecord* historyPeek(uint32_t seq) {
+  if (!partition || seq == 0 || seq > newestSeq || seq < historyOldestSeq()) {
+    return NULL;
+  }
+  return peekSlot(seq);
+}
+
+bool historyRead(uint32_t seq, HistoryRecord& record) {
+  const HistoryRecord* mapped = historyPeek(seq);
+  if (!mapped) {
+    return false;
+  }
+  record = *mapped;
+  return true;
+}
+
+uint32_t historyMapRemaps() {
+  return map.remaps;
+}
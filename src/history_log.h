@@ -0,0 +1,53 @@
+/*
+ * Sequence-numbered reading history in flash
+ *
+ * Every reading is appended to a ring of fixed-size records in the "wlog"
+ * data partition (see partitions.csv) and gets a sequence number that keeps
+ * counting across reboots. A client that was out of range can then be sent
+ * exactly the records it missed, looked up by sequence number.
+ *
+ * Record `seq` always lives in slot `seq % slot count`, so a lookup is one
+ * partition read and the head is found at boot by checking the first slot
+ * of every sector. A sector is erased just before its first slot is
+ * written; the records it held are the oldest ones and drop out of the
+ * ring.
+ *
+ * Reads go through a memory-mapped window of the partition (see
+ * partition_map.h): historyPeek() hands out a pointer to the record in
+ * flash, so a backfill or query encodes straight from flash without
+ * staging records in RAM.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "history_format.h"
+#include "telemetry.h"
+
+#define HISTORY_PARTITION_LABEL "wlog"
+
+// Find the partition and the newest record. Returns false (and the log
+// stays disabled) if the partition table has no history partition.
+bool historyBegin();
+
+bool historyAvailable();
+
+// Store the reading and return its sequence number (0 if the log is
+// unavailable; valid sequence numbers start above 0)
+uint32_t historyAppend(const WaterReading& reading);
+
+// Range of sequence numbers that can still be read; newest is 0 while the
+// log is empty
+uint32_t historyOldestSeq();
+uint32_t historyNewestSeq();
+
+// The record in flash, read in place; NULL if it was overwritten, never
+// written or corrupt. Valid until the next history call.
+const HistoryRecord* historyPeek(uint32_t seq);
+
+// Copy of one record; false if historyPeek() would give NULL
+bool historyRead(uint32_t seq, HistoryRecord& record);
+
+// Windows of the partition mapped since boot
+uint32_t historyMapRemaps();
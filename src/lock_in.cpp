@@ -0,0 +1,34 @@
+#include "lock_in.h"
+
+LockInResult lockInDemodulate(const uint16_t* samples, uint8_t halves, uint8_t perHalf, bool positiveFirst) {
+  LockInResult result = { 0, 0 };
+  if (halves % 2 == 0) {
+    halves--;
+  }
+  if (halves < 3 || perHalf == 0) {
+    return result;
+  }
+
+  // Integer sums with doubled weights (ends 1, the rest 2), so the whole
+  // window is exact and needs one division per result
+  int32_t demodulated = 0;
+  int32_t level = 0;
+  for (uint8_t half = 0; half < halves; half++) {
+    int32_t sum = 0;
+    const uint16_t* burst = samples + (uint16_t)half * perHalf;
+    for (uint8_t i = 0; i < perHalf; i++) {
+      sum += burst[i];
+    }
+    int32_t weighted = (half == 0 || half == halves - 1) ? sum : 2 * sum;
+    bool positive = (half % 2 == 0) == positiveFirst;
+
+    demodulated += positive ? weighted : -weighted;
+    level += weighted;
+  }
+
+  // Sum of the doubled weights: 2 (halves - 1), each half perHalf samples
+  float divisor = 2.0f * (halves - 1) * perHalf;
+  result.amplitude = demodulated / divisor;
+  result.offset = level / divisor;
+  return result;
+}
@@ -0,0 +1,35 @@
+/*
+ * Synchronous (lock-in) demodulation of an alternately excited probe
+ *
+ * The probe is driven with a square wave: each half-cycle the excitation
+ * polarity flips and a few conversions are taken at the end of the half,
+ * once the probe has settled. The response amplitude is the difference
+ * between the halves, so anything that doesn't follow the excitation (the
+ * ADC offset, electrode polarisation potential, slow drift, mains pickup
+ * averaged over the window) drops out instead of having to be averaged
+ * away.
+ *
+ * The window is an odd number of halves that starts and ends on the same
+ * polarity, with the two end halves weighted 1/2 (the halves in between
+ * weighted 1). With that weighting a constant offset and a linear drift
+ * both cancel exactly, not just on average.
+ *
+ * Plain C++ with no Arduino dependency, so it can be exercised on a host
+ * with synthetic waveforms.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct LockInResult {
+  float amplitude;   // Half the peak-to-peak response, in ADC counts
+  float offset;      // Level the response swings around, in ADC counts
+};
+
+// Demodulate `halves` half-cycles of `perHalf` conversions each, stored
+// half after half. Half 0 was excited with positive polarity when
+// positiveFirst, negative otherwise; a response in phase with the
+// excitation gives a positive amplitude. An even `halves` drops the last
+// half; fewer than 3 halves gives zero.
+LockInResult lockInDemodulate(const uint16_t* samples, uint8_t halves, uint8_t perHalf, bool positiveFirst);
@@ -1,186 +1,838 @@
 /*
- * ESP32 Water Quality Sensor - Test Version (No BLE)
- * 
- * This simplified version tests the TDS sensor and MPU6050 
- * without BLE complications for initial testing.
+ * ESP32 Water Quality Sensor - PlatformIO Version
+ *
+ * Reads the TDS sensor and MPU6050(s) and serves the readings over BLE to the
+ * React Native Water Testing app.
+ *
+ * Boot is ordered for the shortest time to first reading and advertising:
+ * the MPU6050 is probed from its own task while BLE starts, the first TDS
+ * reading is taken as soon as advertising is up, and LED indication runs
+ * from loop() instead of delay(). Per-phase boot timings are printed once
+ * every phase has finished.
+ *
+ * Every reading is also logged to flash with a sequence number; a client
+ * that reconnects is first sent the readings it missed (see backfill.h).
+ *
+ * A flight-recorder trace (trace.h) records the timing of readings, I2C,
+ * flash and BLE activity and can be dumped over Serial or BLE.
+ *
+ * Time spent in each power state is accounted per subsystem (energy.h) and
+ * reported as estimated mAh per day on the stats stream. As the battery
+ * drains, readings, notifications and radio power are stepped down
+ * (battery.h).
+ *
+ * A technician can ask for a short high-rate diagnostic capture over BLE or
+ * Serial (diag_capture.h); readings carry on while it runs.
  */
 
 #include <Arduino.h>
 #include <Wire.h>
-#include <Adafruit_MPU6050.h>
-#include <Adafruit_Sensor.h>
 
-// Hardware pin definitions (compatible with most ESP32 boards)
-#define TDS_PIN 1          // GPIO1 for TDS sensor (analog input)
-#define LED_GREEN  2       // GPIO2 - Green LED  
-#define LED_YELLOW 4       // GPIO4 - Yellow LED
-#define LED_RED    5       // GPIO5 - Red LED
+#include "backfill.h"
+#include "battery.h"
+#include "ble_service.h"
+#include "board.h"
+#include "boot_timing.h"
+#include "config.h"
+#include "cpu_load.h"
+#include "data_bus.h"
+#include "diag_capture.h"
+#include "dsp.h"
+#include "energy.h"
+#include "fixed_point.h"
+#include "history_log.h"
+#include "mpu_array.h"
+#include "outbound_queue.h"
+#include "radio_power.h"
+#include "spectrogram.h"
+#include "status_led.h"
+#include "tds_polynomial.h"
+#include "tds_scanner.h"
+#include "telemetry.h"
+#include "trace.h"
 
-// TDS sensor parameters
-const float VREF = 3.3;
+// Hardware pins are per board, in board.h
+
+// TDS sensor parameters (calibration and thresholds live in config.h)
 const int ADC_RES = 4095;
 const float sensorTemperature = 25.0;  // Default temperature for TDS compensation
+TdsPolynomial tdsPolynomial;           // Calibration folded into constants once the config is loaded
 
-// Water quality thresholds  
-const float TDSCLEAN_THRESHOLD = 300.0;    // ppm
-const float TDSDIRTY_THRESHOLD = 400.0;    // ppm  
-const float TDSXTREME_THRESHOLD = 500.0;   // ppm
-const float VIB_THRESHOLD = 1.5;           // m/s²
+// Timing (reading/notify rates live in config.h)
+const uint16_t I2C_TIMEOUT_MS = 50;              // Bound the MPU6050 probe on an empty bus
 
 // Sensor objects
-Adafruit_MPU6050 mpu;
 
-// Water quality sensor variables
-float pH = 7.0;              // Will be simulated for now
-float temperature = 22.0;    // From MPU6050
-float tds = 150.0;           // From TDS sensor  
-float turbidity = 2.0;       // Will be simulated for now
-float vibration = 0.0;       // From MPU6050 accelerometer
-bool vibrationDetected = false;
-String waterStatus = "unknown";
+// MPU6050 is probed in the background during boot
+enum MpuState {
+  MPU_PENDING,
+  MPU_READY,
+  MPU_MISSING
+};
+volatile MpuState mpuState = MPU_PENDING;
+bool mpuResultReported = false;
+
+// Latest reading; the encoders in telemetry.cpp build every payload from it
+WaterReading reading = {
+  7.0,                 // pH (simulated for now)
+  22.0,                // temperature, from MPU6050
+  150.0,               // tds, from TDS sensor
+  2.0,                 // turbidity (simulated for now)
+  0.0, 0.0, 0.0, 0.0,  // vibration and axes, from MPU6050 accelerometer
+  false,
+  STATUS_UNKNOWN,
+  0,                   // timestamp
+  0,                   // seq, from the history log
+  0.0,                 // batteryVoltage, from the battery ADC
+  100                  // batteryLevel
+};
+WaterStatus previousWaterStatus = STATUS_UNKNOWN;
+
+// Aggregates for the stats stream, reset after each stats notification;
+// the TDS range comes from a bus aggregate over every scan
+ReadingStats readingStats = {};
+int statsTdsSubscription = -1;
+
+// The live fields of the reading follow the bus at most every
+// LIVE_PERIOD_MS, so the live streams and the log see fresh TDS between
+// readings too (e.g. while a capture runs scans back to back). The
+// accelerometer view is only subscribed while a live stream is.
+#define LIVE_PERIOD_MS 100
+int liveTdsSubscription = -1;
+int liveAccelSubscription = -1;
 
 unsigned long lastReading = 0;
+bool scanIsReading = false;      // The running TDS scan completes a reading
+bool bootReportPrinted = false;
+
+// Trace dump requested over BLE, sent as bulk notifications
+TraceDumpCursor bleTraceDump = { TRACE_SOURCE_LIVE, 0, 0, true };
 
 // Function declarations
-void updateWaterQualityReadings();
+void mpuInitTask(void* param);
+void handleMpuInitResult();
+void updateWaterQualityReadings(const TdsScan& scan);
+void convertTdsScan(const TdsScan& scan, float ppm[TDS_MAX_PROBES]);
+bool publishTdsScan(const TdsScan& scan, const float ppm[TDS_MAX_PROBES]);
+void onLiveTds(const BusBlock& block, uint16_t first, uint16_t stride, void* context);
+void onLiveAccel(const BusBlock& block, uint16_t first, uint16_t stride, void* context);
+void updateLiveSubscriptions();
+float tdsFromRaw(float raw);
+float tdsFromResponse(float response);
+void updateReadingStats();
+void applyBatteryPolicy();
+void printBatteryStatus();
+void sendStreams(unsigned long now);
+void fillDiagnostics(DeviceDiagnostics& diag);
+PayloadFormat payloadFormat();
+void handleSerialCommands();
+void sendTraceDump();
+void handleCaptureRequest();
+void handleSpectrogramRequest();
+void printHistory(uint32_t count);
 
 void setup() {
+  traceBegin();
+
+  bootPhaseBegin(BOOT_PHASE_SERIAL);
   Serial.begin(115200);
-  delay(1000);
-  Serial.println("Starting ESP32 Water Quality Sensor (Test Version)...");
+  Serial.println("Starting ESP32 Water Quality Sensor...");
+  bootPhaseEnd(BOOT_PHASE_SERIAL);
 
-  // Initialize LED pins
+  // Initialize LED pins, all off
+  bootPhaseBegin(BOOT_PHASE_GPIO);
   pinMode(LED_GREEN, OUTPUT);
   pinMode(LED_YELLOW, OUTPUT);
   pinMode(LED_RED, OUTPUT);
-  
-  // Turn off all LEDs initially
-  digitalWrite(LED_GREEN, LOW);
-  digitalWrite(LED_YELLOW, LOW);
-  digitalWrite(LED_RED, LOW);
+  statusLedWrite(LED_GREEN, false);
+  statusLedWrite(LED_YELLOW, false);
+  statusLedWrite(LED_RED, false);
+  batteryBegin(BATTERY_PIN);
+  tdsScannerBegin(TDS_PIN, TDS_MUX_S0, TDS_MUX_S1, TDS_MUX_S2);
+  tdsScannerSetExcitation(TDS_EXC_A, TDS_EXC_B);
+  bootPhaseEnd(BOOT_PHASE_GPIO);
 
-  // Initialize MPU6050
-  Wire.begin();
-  if (!mpu.begin()) {
-    Serial.println("Failed to find MPU6050 chip!");
-    // Flash red LED to indicate error
-    for(int i = 0; i < 5; i++) {
-      digitalWrite(LED_RED, HIGH);
-      delay(200);
-      digitalWrite(LED_RED, LOW);
-      delay(200);
-    }
-    Serial.println("Continuing without MPU6050...");
-  } else {
-    mpu.setAccelerometerRange(MPU6050_RANGE_8_G);
-    mpu.setFilterBandwidth(MPU6050_BAND_21_HZ);
-    Serial.println("MPU6050 initialized successfully.");
+  // One NVS read for every setting
+  bootPhaseBegin(BOOT_PHASE_CONFIG);
+  configBegin();
+  tdsPolynomialInit(tdsPolynomial, config.tdsVref, ADC_RES, config.tdsFactor,
+                    config.tdsTempCoefficient, config.tdsReferenceTemp, sensorTemperature);
+  energyBegin();
+  bootPhaseEnd(BOOT_PHASE_CONFIG);
+
+  // Locate the newest logged reading so sequence numbers carry on
+  bootPhaseBegin(BOOT_PHASE_HISTORY);
+  historyBegin();
+  backfillBegin();
+  bootPhaseEnd(BOOT_PHASE_HISTORY);
+
+  // Probe the MPU6050 in parallel with BLE bring-up; the I2C driver blocks
+  // on its own semaphore, so the BLE stack gets the CPU meanwhile
+  xTaskCreate(mpuInitTask, "mpuInit", 4096, NULL, 1, NULL);
+
+  bootPhaseBegin(BOOT_PHASE_BLE);
+  bleServiceBegin();
+  radioPowerBegin();
+  bootPhaseEnd(BOOT_PHASE_BLE);
+
+  statsTdsSubscription = busSubscribeAggregate(TOPIC_TDS, 0, 0, NULL, NULL);
+  BusPolicy livePolicy = { BUS_LATEST, 0, LIVE_PERIOD_MS, 0 };
+  liveTdsSubscription = busSubscribe(TOPIC_TDS, livePolicy, onLiveTds, NULL);
+
+  // First reading straight away instead of after the first interval;
+  // vibration joins in once the MPU6050 probe has finished
+  bootPhaseBegin(BOOT_PHASE_FIRST_READING);
+  TdsScan scan;
+  tdsScanStart();
+  while (!tdsScanTake(scan)) {
+    delay(1);
   }
+  updateWaterQualityReadings(scan);
+  size_t len;
+  const uint8_t* data = encodeWaterQualityJSON(reading, &len);
+  bleStreamSetValue(STREAM_LEGACY, data, len);
+  data = encodeLive(reading, payloadFormat(), &len);
+  bleStreamSetValue(STREAM_LIVE, data, len);
+  lastReading = millis();
+  bootPhaseEnd(BOOT_PHASE_FIRST_READING);
+
+  cpuLoadBegin();
 
-  Serial.println("System ready. Monitoring water quality...");
-  
   // Green LED indicates successful initialization
-  digitalWrite(LED_GREEN, HIGH);
-  delay(1000);
-  digitalWrite(LED_GREEN, LOW);
+  statusLedFlash(LED_GREEN, 1, 1000, 0);
+
+  if (traceHasFault()) {
+    Serial.println("Trace: kept the trace of the crashed boot, send 'trace fault' to dump it");
+  }
+
+  Serial.println("System ready. Monitoring water quality...");
 }
 
 void loop() {
-  // Update water quality readings every 3 seconds
-  if (millis() - lastReading > 3000) {
-    updateWaterQualityReadings();
-    lastReading = millis();
+  unsigned long now = millis();
+
+  handleMpuInitResult();
+  updateLiveSubscriptions();
+  if (mpuState == MPU_READY) {
+    mpuArrayUpdate();
+  }
+
+  if (!bootReportPrinted && bootPhasesDone()) {
+    printBootReport();
+    bootReportPrinted = true;
+  }
+
+  // Update water quality readings (every 3 seconds by default, less
+  // often on a low battery): start a probe scan, and complete the reading
+  // once the scan has finished in the background. During a capture scans
+  // run back to back; those in between readings only go on the bus (and
+  // from there into the live fields).
+  bool readingDue = now - lastReading >= config.readingIntervalMs * batteryPolicy().readingScale;
+  if ((readingDue || diagCaptureActive()) && tdsScanStart()) {
+    scanIsReading = readingDue;
+    if (readingDue) {
+      lastReading = now;
+    }
+  }
+  TdsScan scan;
+  if (tdsScanTake(scan)) {
+    if (scanIsReading) {
+      updateWaterQualityReadings(scan);
+    } else {
+      float ppm[TDS_MAX_PROBES];
+      convertTdsScan(scan, ppm);
+      publishTdsScan(scan, ppm);
+    }
+  }
+
+  handleCaptureRequest();
+  diagCaptureUpdate();
+  handleSpectrogramRequest();
+  spectrogramUpdate();
+
+  // Missed readings go out before live data
+  backfillUpdate(payloadFormat());
+
+  // Each stream goes out at its own rate, only while subscribed
+  sendStreams(now);
+  sendTraceDump();
+  outboundUpdate();
+
+  handleSerialCommands();
+
+  bleServiceUpdate();
+  radioPowerUpdate();
+  statusLedUpdate();
+  energyUpdate();
+  cpuLoadUpdate();
+
+  int64_t idleStart = esp_timer_get_time();
+  delay(10);
+  energyCpuIdle(esp_timer_get_time() - idleStart);
+}
+
+// Runs once at boot, then deletes itself
+void mpuInitTask(void* param) {
+  TRACE_BEGIN(TRACE_MPU_INIT);
+  bootPhaseBegin(BOOT_PHASE_MPU);
+  Wire.begin();
+  Wire.setTimeOut(I2C_TIMEOUT_MS);
+
+  if (mpuArrayBegin() > 0) {
+    mpuState = MPU_READY;
+  } else {
+    mpuState = MPU_MISSING;
   }
+  bootPhaseEnd(BOOT_PHASE_MPU);
+  TRACE_END(TRACE_MPU_INIT);
 
-  delay(1000); // Update every second
+  vTaskDelete(NULL);
 }
 
-// Read real sensor data
-void updateWaterQualityReadings() {
-  // === MPU6050 Accelerometer (Vibration Detection) ===
-  sensors_event_t accel, gyro, temp;
-  if (mpu.begin()) { // Check if MPU6050 is available
-    mpu.getEvent(&accel, &gyro, &temp);
+// Report the background MPU6050 probe once it has finished
+void handleMpuInitResult() {
+  if (mpuResultReported || mpuState == MPU_PENDING) {
+    return;
+  }
+  mpuResultReported = true;
+
+  if (mpuState == MPU_READY) {
+    Serial.print("MPU6050 initialized successfully (");
+    Serial.print(mpuArrayUnits());
+    Serial.println(mpuArrayUnits() == 1 ? " unit)." : " units in lock-step).");
+    energySetMpuActive(true);
+  } else {
+    Serial.println("Failed to find MPU6050 chip!");
+    Serial.println("Continuing without MPU6050...");
+    // Flash red LED to indicate error
+    statusLedFlash(LED_RED, 5, 200, 200);
+  }
+}
 
-    float ax = accel.acceleration.x;
-    float ay = accel.acceleration.y;
-    float az = accel.acceleration.z;
+// Read real sensor data; the TDS probes arrive through the live
+// subscription when the scan is published
+void updateWaterQualityReadings(const TdsScan& scan) {
+  TRACE_BEGIN(TRACE_READING);
+  reading.timestamp = millis();
 
-    // Calculate vibration magnitude (remove gravity)
-    vibration = sqrt(ax * ax + ay * ay + az * az) - 9.8;
-    vibrationDetected = abs(vibration) > VIB_THRESHOLD;
+  // === MPU6050 Accelerometers (Vibration Detection) ===
+  // Every FIFO sample since the last reading counts: vibration is detected
+  // if any unit peaked above the threshold
+  MpuFeatures features[MPU_MAX_UNITS];
+  if (mpuState == MPU_READY && mpuArrayTake(features)) {
+    reading.mpuUnits = mpuArrayUnits();
+    reading.xAxis = features[0].xAxis;
+    reading.yAxis = features[0].yAxis;
+    reading.zAxis = features[0].zAxis;
+    reading.vibration = features[0].latest;
+    bool detected = false;
+    for (uint8_t u = 0; u < reading.mpuUnits; u++) {
+      reading.vibrationRms[u] = features[u].rms;
+      reading.vibrationPeak[u] = features[u].peak;
+      reading.vibrationPeakAt[u] = features[u].peakUs / 1000;
+      detected |= features[u].peak > config.vibThreshold;
+    }
+    reading.vibrationDetected = detected;
 
     // Get temperature from MPU6050
-    temperature = temp.temperature;
-  } else {
+    reading.temperature = mpuArrayTemperature();
+  } else if (mpuState == MPU_MISSING) {
     // Use simulated values if MPU6050 not available
-    vibration = random(-50, 50) / 100.0;
-    vibrationDetected = false;
-    temperature = 22.0 + random(-30, 30) / 10.0;
+    reading.vibration = random(-50, 50) / 100.0;
+    reading.xAxis = random(1, 25) / 100.0;
+    reading.yAxis = random(1, 25) / 100.0;
+    reading.zAxis = random(1, 25) / 100.0;
+    reading.vibrationDetected = false;
+    reading.temperature = 22.0 + random(-30, 30) / 10.0;
+  }
+  // While the probe is still pending keep the defaults
+
+  // === TDS Sensors (Water Quality) ===
+  // Probe 0 is the primary reading; the worst probe decides the status.
+  // If a scan between readings went out less than LIVE_PERIOD_MS ago,
+  // the reading keeps that one.
+  float ppm[TDS_MAX_PROBES];
+  convertTdsScan(scan, ppm);
+  if (!publishTdsScan(scan, ppm)) {
+    // Every block is held elsewhere; the reading can't wait for one
+    reading.tdsProbes = scan.probes;
+    memcpy(reading.tdsProbe, ppm, scan.probes * sizeof(float));
+    reading.tds = ppm[0];
+    reading.tdsAt = scan.atUs[0] / 1000;
+  }
+  float worstTds = 0;
+  for (uint8_t i = 0; i < reading.tdsProbes; i++) {
+    worstTds = max(worstTds, reading.tdsProbe[i]);
   }
 
-  // === TDS Sensor (Water Quality) ===
-  int adcValue = analogRead(TDS_PIN);
-  float voltage = (float)adcValue * VREF / ADC_RES;
-  float compensation = 1.0 + 0.02 * (sensorTemperature - 25.0);
-  float vComp = voltage / compensation;
+  // === Battery ===
+  int64_t adcStart = esp_timer_get_time();
+  bool batteryModeChanged = batterySample();
+  energyAdcSample(scan.busyUs + (esp_timer_get_time() - adcStart));
+  reading.batteryVoltage = batteryVoltage();
+  reading.batteryLevel = batteryPercent();
+  if (batteryModeChanged) {
+    applyBatteryPolicy();
+  }
 
-  tds = (133.42 * pow(vComp, 3) - 255.86 * pow(vComp, 2) + 857.39 * vComp) * 0.5;
-  
-  // Constrain TDS to reasonable range
-  tds = constrain(tds, 0, 2000);
-  
   // === Water Quality Assessment ===
-  if (tds <= TDSCLEAN_THRESHOLD && !vibrationDetected) {
-    waterStatus = "clean";
-  } else if (tds <= TDSDIRTY_THRESHOLD && tds > TDSCLEAN_THRESHOLD && !vibrationDetected) {
-    waterStatus = "unsafe";
-  } else if (tds >= TDSXTREME_THRESHOLD) {
-    waterStatus = "extremely_unsafe";
+  bool vibrationDetected = reading.vibrationDetected;
+  if (worstTds <= config.tdsCleanThreshold && !vibrationDetected) {
+    reading.waterStatus = STATUS_CLEAN;
+  } else if (worstTds <= config.tdsDirtyThreshold && worstTds > config.tdsCleanThreshold && !vibrationDetected) {
+    reading.waterStatus = STATUS_UNSAFE;
+  } else if (worstTds >= config.tdsExtremeThreshold) {
+    reading.waterStatus = STATUS_EXTREMELY_UNSAFE;
   } else if (vibrationDetected) {
-    waterStatus = "vibration_detected";
+    reading.waterStatus = STATUS_VIBRATION_DETECTED;
   }
 
   // === LED Status Indicators ===
-  // Turn off all LEDs first
-  digitalWrite(LED_GREEN, LOW);
-  digitalWrite(LED_YELLOW, LOW);
-  digitalWrite(LED_RED, LOW);
-
-  // Set LED based on water status
-  if (waterStatus == "clean") {
-    digitalWrite(LED_GREEN, HIGH);
-  } else if (waterStatus == "unsafe") {
-    digitalWrite(LED_YELLOW, HIGH);
-  } else if (waterStatus == "extremely_unsafe") {
-    digitalWrite(LED_RED, HIGH);
-  } else if (waterStatus == "vibration_detected") {
-    // Flash yellow for vibration
-    digitalWrite(LED_YELLOW, (millis() / 500) % 2);
+  // Don't override a startup/error flash that is still running
+  if (!statusLedBusy()) {
+    // Turn off all LEDs first
+    statusLedWrite(LED_GREEN, false);
+    statusLedWrite(LED_YELLOW, false);
+    statusLedWrite(LED_RED, false);
+
+    // Set LED based on water status
+    switch (reading.waterStatus) {
+      case STATUS_CLEAN:
+        statusLedWrite(LED_GREEN, true);
+        break;
+      case STATUS_UNSAFE:
+        statusLedWrite(LED_YELLOW, true);
+        break;
+      case STATUS_EXTREMELY_UNSAFE:
+        statusLedWrite(LED_RED, true);
+        break;
+      case STATUS_VIBRATION_DETECTED:
+        // Flash yellow for vibration
+        statusLedWrite(LED_YELLOW, (millis() / 500) % 2);
+        break;
+      default:
+        break;
+    }
   }
 
   // === pH and Turbidity (simulated for now) ===
-  pH = 7.0 + (sin(millis() / 15000.0) * 0.8) + (random(-10, 10) / 100.0);
-  turbidity = 2.0 + (sin(millis() / 18000.0) * 1.5) + (random(-30, 30) / 100.0);
-  
-  pH = constrain(pH, 6.0, 9.0);
-  turbidity = constrain(turbidity, 0.1, 10.0);
+  float pH = 7.0 + (sin(millis() / 15000.0) * 0.8) + (random(-10, 10) / 100.0);
+  float turbidity = 2.0 + (sin(millis() / 18000.0) * 1.5) + (random(-30, 30) / 100.0);
+
+  reading.pH = constrain(pH, 6.0, 9.0);
+  reading.turbidity = constrain(turbidity, 0.1, 10.0);
+
+  updateReadingStats();
+
+  reading.seq = historyAppend(reading);
 
   // === Serial Output for Debugging ===
-  Serial.print("TDS: "); Serial.print(tds); Serial.print(" ppm");
-  Serial.print(" | Vibration: "); Serial.print(vibration, 2); Serial.print(" m/s²");
-  Serial.print(" | Vibration Detected: "); Serial.print(vibrationDetected ? "YES" : "NO");
-  Serial.print(" | Temperature: "); Serial.print(temperature, 1); Serial.print("°C");
-  Serial.print(" | Water Status: "); Serial.println(waterStatus);
-  
-  // Show JSON that would be sent to app
-  Serial.print("JSON: {");
-  Serial.print("\"pH\":"); Serial.print(pH, 2); Serial.print(",");
-  Serial.print("\"temperature\":"); Serial.print(temperature, 1); Serial.print(",");
-  Serial.print("\"tds\":"); Serial.print(tds, 1); Serial.print(",");
-  Serial.print("\"turbidity\":"); Serial.print(turbidity, 2); Serial.print(",");
-  Serial.print("\"vibration\":"); Serial.print(vibration, 2); Serial.print(",");
-  Serial.print("\"vibrationDetected\":"); Serial.print(vibrationDetected ? "true" : "false"); Serial.print(",");
-  Serial.print("\"waterStatus\":\""); Serial.print(waterStatus); Serial.print("\"");
-  Serial.println("}");
-}
\ No newline at end of file
+  TRACE_BEGIN(TRACE_SERIAL);
+  Serial.print("TDS: "); Serial.print(reading.tds); Serial.print(" ppm");
+  for (uint8_t i = 1; i < reading.tdsProbes; i++) {
+    Serial.print(i == 1 ? " (probes " : ", "); Serial.print(reading.tdsProbe[i]);
+    if (i == reading.tdsProbes - 1) Serial.print(")");
+  }
+  Serial.print(" | Vibration: "); Serial.print(reading.vibration, 2); Serial.print(" m/s²");
+  Serial.print(" | Vibration Detected: "); Serial.print(reading.vibrationDetected ? "YES" : "NO");
+  Serial.print(" | Temperature: "); Serial.print(reading.temperature, 1); Serial.print("°C");
+  Serial.print(" | Water Status: "); Serial.println(waterStatusName(reading.waterStatus));
+  TRACE_END(TRACE_SERIAL);
+  TRACE_END(TRACE_READING);
+}
+
+// Every probe of a scan to ppm
+void convertTdsScan(const TdsScan& scan, float ppm[TDS_MAX_PROBES]) {
+  for (uint8_t i = 0; i < scan.probes; i++) {
+    ppm[i] = scan.lockIn ? tdsFromResponse(scan.raw[i]) : tdsFromRaw(scan.raw[i]);
+  }
+}
+
+// Every scan goes on the bus, in 0.1 ppm; false if the pool was empty
+bool publishTdsScan(const TdsScan& scan, const float ppm[TDS_MAX_PROBES]) {
+  BusBlock* tdsBlock = busAcquire(TOPIC_TDS, 0, scan.probes, 1);
+  if (!tdsBlock) {
+    return false;
+  }
+  for (uint8_t i = 0; i < scan.probes; i++) {
+    tdsBlock->data[i] = (int16_t)lroundf(ppm[i] * 10);
+  }
+  tdsBlock->time.firstUs = scan.atUs[0];
+  tdsBlock->time.periodUs = 0;
+  tdsBlock->time.count = 1;
+  tdsBlock->scale = 0.1;
+  busPublish(tdsBlock);
+  return true;
+}
+
+// The newest scan into the reading
+void onLiveTds(const BusBlock& block, uint16_t, uint16_t, void*) {
+  uint16_t frame = block.frames - 1;
+  reading.tdsProbes = block.channels;
+  for (uint8_t i = 0; i < block.channels; i++) {
+    reading.tdsProbe[i] = busSample(block, frame, i) * block.scale;
+  }
+  reading.tds = reading.tdsProbe[0];
+  reading.tdsAt = timeBlockSampleUs(block.time, frame) / 1000;
+}
+
+// The newest sample of the first MPU6050 as the live vibration, the same
+// deviation the reading's features report as `latest`
+void onLiveAccel(const BusBlock& block, uint16_t, uint16_t, void*) {
+  uint16_t frame = block.frames - 1;
+  int32_t x = busSample(block, frame, 0);
+  int32_t y = busSample(block, frame, 1);
+  int32_t z = busSample(block, frame, 2);
+  uint32_t squared = (uint32_t)(x * x) + (uint32_t)(y * y) + (uint32_t)(z * z);
+#if BOARD_HAS_FPU
+  float magnitude = sqrtf((float)squared);
+#else
+  float magnitude = isqrt32(squared);
+#endif
+  reading.vibration = magnitude * block.scale - config.gravityBaseline - config.vibrationBaseline;
+}
+
+// Publishing accelerometer blocks costs a copy per FIFO chunk, so the
+// live view only subscribes while a client watches
+void updateLiveSubscriptions() {
+  bool watched = mpuState == MPU_READY && bleConnected() &&
+                 (bleStreamSubscribed(STREAM_LIVE) || bleStreamSubscribed(STREAM_VIBRATION));
+  if (watched && liveAccelSubscription < 0) {
+    BusPolicy policy = { BUS_LATEST, 0, LIVE_PERIOD_MS, 0 };
+    liveAccelSubscription = busSubscribe(TOPIC_ACCEL, policy, onLiveAccel, NULL);
+  } else if (!watched && liveAccelSubscription >= 0) {
+    busUnsubscribe(liveAccelSubscription);
+    liveAccelSubscription = -1;
+  }
+}
+
+// Filtered ADC reading of one probe to temperature-compensated ppm
+float tdsFromRaw(float raw) {
+#if !BOARD_HAS_FPU
+  float tds = tdsPolynomialFixed(tdsPolynomial, raw);
+#else
+  float tds = tdsPolynomialFloat(tdsPolynomial, raw);
+#endif
+  // Constrain TDS to reasonable range
+  return constrain(tds, 0, 2000);
+}
+
+// Lock-in response of a bare probe to temperature-compensated ppm. The
+// probe and the reference resistor form a divider the excitation drives
+// both ways, so response = (Rprobe - Rref) / (Rprobe + Rref) regardless
+// of the supply voltage.
+float tdsFromResponse(float response) {
+  if (response >= 0.999) {
+    return 0;  // Open probe (dry)
+  }
+  response = max(response, -0.999f);
+  float probeOhms = config.tdsRefOhms * (1 + response) / (1 - response);
+  float conductivity = config.tdsCellConstant / probeOhms * 1e6;  // µS/cm
+  float tds = conductivity / tdsPolynomial.compensation * config.tdsFactor;
+  return constrain(tds, 0, 2000);
+}
+
+void updateReadingStats() {
+  readingStats.samples++;
+  readingStats.vibrationMax = max(readingStats.vibrationMax, (float)abs(reading.vibration));
+  if (reading.vibrationDetected) {
+    readingStats.vibrationEvents++;
+  }
+}
+
+// Step acquisition and radio down (or back up) for the battery's mode
+void applyBatteryPolicy() {
+  const BatteryPolicy& policy = batteryPolicy();
+  bleSetIntervalScale(policy.notifyScale);
+  radioPowerSetMaxTxPower(policy.txPowerDbm);
+  printBatteryStatus();
+}
+
+void printBatteryStatus() {
+  if (!batteryMonitored()) {
+    Serial.println("Battery: not monitored (no divider ratio set, see 'battery divider')");
+    return;
+  }
+  const BatteryPolicy& policy = batteryPolicy();
+  Serial.print("Battery: "); Serial.print(batteryPercent());
+  Serial.print("% ("); Serial.print(batteryVoltage(), 2);
+  Serial.print(" V), mode "); Serial.print(batteryModeName(batteryMode()));
+  Serial.print(": readings x"); Serial.print(policy.readingScale);
+  Serial.print(", notify x"); Serial.print(policy.notifyScale);
+  Serial.print(", TX max "); Serial.print(policy.txPowerDbm);
+  Serial.println(" dBm");
+}
+
+void sendStreams(unsigned long now) {
+  if (!bleConnected()) {
+    return;
+  }
+
+  size_t len;
+  const uint8_t* data;
+
+  // Status transitions, on change only; moving into an unsafe state
+  // preempts everything else queued
+  if (reading.waterStatus != previousWaterStatus) {
+    if (bleStreamDue(STREAM_ALERTS, now)) {
+      bool unsafe = reading.waterStatus == STATUS_UNSAFE ||
+                    reading.waterStatus == STATUS_EXTREMELY_UNSAFE ||
+                    reading.waterStatus == STATUS_VIBRATION_DETECTED;
+      data = encodeAlert(reading, previousWaterStatus, payloadFormat(), &len);
+      outboundEnqueue(STREAM_ALERTS, unsafe ? OUTBOUND_ALERT : OUTBOUND_STATUS, data, len);
+    }
+    previousWaterStatus = reading.waterStatus;
+  }
+
+  // Live readings wait until a reconnected client has its backlog; they
+  // are in the log, so they arrive through the backfill instead
+  bool live = !backfillActive();
+
+  // Unchanged readings come straight from the encoder caches
+  if (live && bleStreamDue(STREAM_LEGACY, now)) {
+    data = encodeWaterQualityJSON(reading, &len);
+    outboundEnqueue(STREAM_LEGACY, OUTBOUND_LIVE, data, len);
+    TRACE_BEGIN(TRACE_SERIAL);
+    Serial.print("Sent: ");
+    Serial.write(data, len);
+    Serial.println();
+    TRACE_END(TRACE_SERIAL);
+  }
+  if (live && bleStreamDue(STREAM_LIVE, now)) {
+    data = encodeLive(reading, payloadFormat(), &len);
+    outboundEnqueue(STREAM_LIVE, OUTBOUND_LIVE, data, len);
+  }
+  if (live && bleStreamDue(STREAM_VIBRATION, now)) {
+    data = encodeVibration(reading, payloadFormat(), &len);
+    outboundEnqueue(STREAM_VIBRATION, OUTBOUND_LIVE, data, len);
+  }
+  if (bleStreamDue(STREAM_STATS, now) && readingStats.samples > 0) {
+    BusAggregate tds;
+    if (busTakeAggregate(statsTdsSubscription, tds)) {
+      // Over every probe: the lowest and highest of any, and the mean of
+      // all their values
+      int16_t lowest = tds.min[0];
+      int16_t highest = tds.max[0];
+      int64_t sum = 0;
+      for (uint8_t i = 0; i < tds.channels; i++) {
+        lowest = min(lowest, tds.min[i]);
+        highest = max(highest, tds.max[i]);
+        sum += tds.sum[i];
+      }
+      readingStats.tdsMin = lowest * tds.scale;
+      readingStats.tdsMax = highest * tds.scale;
+      readingStats.tdsMean = (float)sum / ((int64_t)tds.frames * tds.channels) * tds.scale;
+    }
+    EnergyReport energy;
+    energyReport(energy, true);
+    for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+      readingStats.energyMahPerDay[i] = energy.mAhPerDay[i];
+    }
+    readingStats.energyTotalMahPerDay = energy.totalMahPerDay;
+    const RadioPowerStats& radio = radioPowerStats();
+    readingStats.rssi = radio.rssi;
+    readingStats.txPowerDbm = radio.txPowerDbm;
+    readingStats.radioOnSavedMs = radio.radioOnSavedMs;
+    data = encodeStats(readingStats, now, payloadFormat(), &len);
+    outboundEnqueue(STREAM_STATS, OUTBOUND_LIVE, data, len);
+    readingStats = {};
+  }
+  if (bleStreamDue(STREAM_DIAGNOSTICS, now)) {
+    DeviceDiagnostics diag;
+    fillDiagnostics(diag);
+    data = encodeDiagnostics(diag, payloadFormat(), &len);
+    outboundEnqueue(STREAM_DIAGNOSTICS, OUTBOUND_LIVE, data, len);
+  }
+}
+
+// Start a trace dump when the client writes to the trace characteristic,
+// then keep the bulk class topped up with its lines
+void sendTraceDump() {
+  uint8_t request[BLE_WRITE_MAX];
+  size_t requestLen;
+  if (bleStreamTakeWrite(STREAM_TRACE, request, &requestLen) && requestLen > 0) {
+    traceDumpCancel(bleTraceDump);
+    traceDumpStart(bleTraceDump, request[0] == 'F' ? TRACE_SOURCE_FAULT : TRACE_SOURCE_LIVE);
+  }
+
+  if (bleTraceDump.done) {
+    return;
+  }
+  if (!bleStreamSubscribed(STREAM_TRACE)) {
+    traceDumpCancel(bleTraceDump);
+    return;
+  }
+
+  // Short lines so each fits a notification at a typical negotiated MTU
+  char line[128];
+  size_t len;
+  while (outboundHasRoom(OUTBOUND_BULK) && (len = traceDumpLine(bleTraceDump, line, sizeof(line))) > 0) {
+    outboundEnqueue(STREAM_TRACE, OUTBOUND_BULK, (const uint8_t*)line, len);
+  }
+}
+
+// Start or stop a diagnostic capture when the client writes
+// [seconds, flags] to the capture characteristic
+void handleCaptureRequest() {
+  uint8_t request[BLE_WRITE_MAX];
+  size_t requestLen;
+  if (!bleStreamTakeWrite(STREAM_CAPTURE, request, &requestLen)) {
+    return;
+  }
+  uint8_t flags = requestLen > 1 ? request[1] : 0;
+  if (flags & CAPTURE_FLAG_STOP) {
+    diagCaptureStop();
+  } else {
+    diagCaptureStart(requestLen > 0 ? request[0] : 0, flags & CAPTURE_FLAG_RAW);
+  }
+}
+
+// Apply [FFT size log2, bins, overlap %, axis, flags] written to the
+// spectrogram characteristic; the settings are saved if they changed
+void handleSpectrogramRequest() {
+  uint8_t request[BLE_WRITE_MAX];
+  size_t requestLen;
+  if (!bleStreamTakeWrite(STREAM_SPECTROGRAM, request, &requestLen) || requestLen < 4) {
+    return;
+  }
+  uint32_t fftSize = 1UL << min(request[0], (uint8_t)16);
+  if (fftSize != config.spectrogramFftSize || request[1] != config.spectrogramBins ||
+      request[2] != config.spectrogramOverlapPercent || request[3] != config.spectrogramAxis) {
+    config.spectrogramFftSize = fftSize;
+    config.spectrogramBins = request[1];
+    config.spectrogramOverlapPercent = request[2];
+    config.spectrogramAxis = request[3];
+    configSave();
+    spectrogramRestart();
+  }
+  spectrogramSetHighRate(requestLen > 4 && (request[4] & SPECTROGRAM_FLAG_HIGH_RATE));
+}
+
+void fillDiagnostics(DeviceDiagnostics& diag) {
+  diag.uptime = millis();
+  diag.freeHeap = ESP.getFreeHeap();
+  diag.bootMs = bootPhaseDoneAt(BOOT_PHASE_FIRST_READING) / 1000;
+  diag.mpuStatus = mpuState == MPU_READY ? "ready" : (mpuState == MPU_MISSING ? "missing" : "pending");
+  diag.configHash = configHash();
+  for (int c = 0; c < OUTBOUND_CLASS_COUNT; c++) {
+    diag.queueDepth[c] = outboundStats((OutboundClass)c).depth;
+    diag.queueLatencyUs[c] = outboundStats((OutboundClass)c).latencyUs;
+  }
+  OutboundClassStats totals = outboundTotals();
+  diag.notifySent = totals.sent;
+  diag.notifyCoalesced = totals.coalesced;
+  diag.notifyDropped = totals.dropped;
+  diag.notifyCongestion = bleTxStats().congestion;
+
+  const CpuLoadReport& cpu = cpuLoadReport();
+  diag.cpuLoadAvailable = cpu.available;
+  diag.cpuLoad = cpu.loadPercent;
+  cpuLoadTopTasks(diag.cpuTasks, sizeof(diag.cpuTasks), 3);
+}
+
+// Newest logged readings, oldest first, straight from the mapped partition
+void printHistory(uint32_t count) {
+  uint32_t newest = historyNewestSeq();
+  if (newest == 0) {
+    Serial.println("History: empty");
+    return;
+  }
+  uint32_t oldest = historyOldestSeq();
+  uint32_t first = newest - oldest + 1 > count ? newest - count + 1 : oldest;
+  for (uint32_t seq = first; seq <= newest; seq++) {
+    const HistoryRecord* record = historyPeek(seq);
+    if (!record) {
+      continue;
+    }
+    Serial.print("History: #"); Serial.print(record->seq);
+    Serial.print(" at "); Serial.print(record->timestamp);
+    Serial.print(" ms, TDS "); Serial.print(record->tds, 1);
+    Serial.print(" ppm, vibration "); Serial.print(record->vibration, 2);
+    Serial.print(" m/s², "); Serial.println(waterStatusName((WaterStatus)record->waterStatus));
+  }
+  Serial.print("History: #"); Serial.print(oldest);
+  Serial.print(" to #"); Serial.print(newest);
+  Serial.print(", windows mapped "); Serial.println(historyMapRemaps());
+}
+
+// Encoding used by the per-stream characteristics
+PayloadFormat payloadFormat() {
+  return config.payloadFormat < PAYLOAD_FORMAT_COUNT ? (PayloadFormat)config.payloadFormat : PAYLOAD_JSON;
+}
+
+// Line-based debug commands on the serial monitor:
+//   bench         - compare payload formats (size and encode time)
+//   bench fixed   - time float against fixed-point versions of the sensor kernels
+//   bench dsp     - time the scalar against the selected DSP kernels and check they agree
+//   queue         - outbound queue counters, depth and latency per class
+//   cpu           - CPU load and per-task share over the last few seconds
+//   battery       - cell voltage, charge and power mode
+//   battery divider <ratio> - cell / ADC pin voltage of the divider, 0 = no cell (saved)
+//   radio         - TX power, RSSI, advertising interval and time saved
+//   mpu           - MPU6050 units, FIFO drains, skew and resyncs
+//   bus           - data bus pool use, counters and subscriptions
+//   spectrogram   - live spectrogram settings and sent/dropped spectra
+//   history [n]   - the newest n logged readings (default 10), read in place from flash
+//   capture [s] [raw] - high-rate diagnostic capture (default 10 s), optionally streaming raw frames
+//   capture stop  - end the running capture and report it
+//   energy        - estimated consumption per subsystem since the last stats record
+//   trace         - dump the flight-recorder trace
+//   trace fault   - dump the trace kept from a boot that crashed
+//   format json   - select the per-stream payload format (saved)
+//   format cbor
+//   format binary
+void handleSerialCommands() {
+  if (!Serial.available()) {
+    return;
+  }
+
+  String command = Serial.readStringUntil('\n');
+  command.trim();
+
+  if (command == "bench") {
+    runPayloadBenchmark(reading, 1000);
+  } else if (command == "bench fixed") {
+    runFixedPointBenchmark(10000);
+  } else if (command == "bench dsp") {
+    runDspBenchmark(10000);
+  } else if (command == "queue") {
+    printOutboundStats();
+  } else if (command == "cpu") {
+    printCpuLoad();
+  } else if (command == "battery") {
+    printBatteryStatus();
+  } else if (command.startsWith("battery divider ")) {
+    config.batteryDividerRatio = max(command.substring(16).toFloat(), 0.0f);
+    configSave();
+    batteryBegin(BATTERY_PIN);
+    applyBatteryPolicy();
+  } else if (command == "radio") {
+    printRadioPowerStats();
+  } else if (command == "mpu") {
+    printMpuArrayStats();
+  } else if (command == "bus") {
+    printBusStats();
+  } else if (command == "spectrogram") {
+    printSpectrogramStats();
+  } else if (command == "history" || command.startsWith("history ")) {
+    uint32_t count = command.substring(7).toInt();
+    printHistory(count > 0 ? count : 10);
+  } else if (command == "capture stop") {
+    diagCaptureStop();
+  } else if (command == "capture" || command.startsWith("capture ")) {
+    String options = command.substring(7);
+    options.trim();
+    diagCaptureStart(options.toInt(), options.endsWith("raw"));
+  } else if (command == "energy") {
+    printEnergyReport();
+  } else if (command == "trace" || command == "trace fault") {
+    traceDumpSerial(command == "trace fault" ? TRACE_SOURCE_FAULT : TRACE_SOURCE_LIVE);
+  } else if (command == "format json" || command == "format cbor" || command == "format binary") {
+    config.payloadFormat = command == "format cbor" ? PAYLOAD_CBOR : command == "format binary" ? PAYLOAD_BINARY : PAYLOAD_JSON;
+    configSave();
+    Serial.print("Payload format: ");
+    Serial.println(payloadFormatName(payloadFormat()));
+  } else if (command.length() > 0) {
+    Serial.println("Unknown command: " + command);
+  }
+}
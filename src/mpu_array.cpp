@@ -0,0 +1,357 @@
+#include "mpu_array.h"
+
+#include <Wire.h>
+
+#include "board.h"
+#include "config.h"
+#include "data_bus.h"
+#include "fixed_point.h"
+#include "timebase.h"
+#include "trace.h"
+
+// MPU6050 registers
+#define REG_SMPLRT_DIV 0x19
+#define REG_CONFIG 0x1A
+#define REG_ACCEL_CONFIG 0x1C
+#define REG_FIFO_EN 0x23
+#define REG_INT_STATUS 0x3A
+#define REG_TEMP_OUT_H 0x41
+#define REG_USER_CTRL 0x6A
+#define REG_PWR_MGMT_1 0x6B
+#define REG_FIFO_COUNT_H 0x72
+#define REG_FIFO_R_W 0x74
+#define REG_WHO_AM_I 0x75
+
+#define FIFO_EN_ACCEL 0x08
+#define USER_CTRL_FIFO_EN 0x40
+#define USER_CTRL_FIFO_RESET 0x04
+#define INT_STATUS_FIFO_OFLOW 0x10
+#define DLPF_21_HZ 0x04              // Accel 21 Hz, 1 kHz internal rate
+#define DLPF_184_HZ 0x01             // Accel 184 Hz, for capture mode
+#define ACCEL_RANGE_8G 0x10
+#define CLOCK_PLL_X 0x01
+
+#define ACCEL_LSB_PER_G 4096.0f      // ±8 g
+#define FRAME_BYTES 6                // Accel X/Y/Z, big-endian int16
+
+// Frames per I2C read: the Wire buffer holds 128 bytes
+#define CHUNK_FRAMES 20
+
+// Restart both FIFOs once one unit is this many frames ahead
+#define RESYNC_SKEW_FRAMES 8
+
+// Capture mode: full rate, drained often enough that the 1 KB FIFOs (170
+// frames) never fill, on a fast bus
+#define CAPTURE_DRAIN_MS 20
+#define CAPTURE_I2C_HZ 400000
+
+static const uint8_t ADDRESSES[MPU_MAX_UNITS] = { 0x68, 0x69 };
+
+// Accumulated in raw counts, integers only; converted to m/s² once per
+// take
+struct Accumulator {
+  uint32_t samples;
+  uint64_t sumSquares;
+  int32_t peak;
+  int64_t peakUs;
+  int32_t latest;
+  int64_t sumX, sumY, sumZ;
+};
+
+static uint8_t unitCount = 0;
+static uint8_t units[MPU_MAX_UNITS];   // Addresses of the units found
+static Accumulator acc[MPU_MAX_UNITS];
+static MpuArrayStats stats;
+static float temperature = 22.0;
+static SampleClock sampleClock;
+static int32_t gravityCounts = 0;      // config.gravityBaseline in counts
+static int32_t offsetCounts = 0;       // Gravity plus the resting vibration baseline
+static unsigned long lastDrain = 0;
+static bool captureMode = false;
+static uint8_t captureUsers = 0;       // Capture mode stays on while any user wants it
+static uint32_t normalI2cHz = 100000;
+
+static bool writeRegister(uint8_t address, uint8_t reg, uint8_t value) {
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.write(value);
+  return Wire.endTransmission() == 0;
+}
+
+static bool readRegisters(uint8_t address, uint8_t reg, uint8_t* out, size_t len) {
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0) {
+    return false;
+  }
+  if (Wire.requestFrom(address, (uint8_t)len) != len) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    out[i] = Wire.read();
+  }
+  return true;
+}
+
+// Sample rate = 1 kHz / (divider + 1)
+static uint8_t sampleRateDivider() {
+  uint32_t rate = captureMode ? MPU_CAPTURE_RATE_HZ : constrain(config.mpuSampleRateHz, (uint32_t)4, (uint32_t)1000);
+  return 1000 / rate - 1;
+}
+
+static bool configureUnit(uint8_t address) {
+  uint8_t whoAmI = 0;
+  // WHO_AM_I reads 0x68 whatever AD0 is
+  if (!readRegisters(address, REG_WHO_AM_I, &whoAmI, 1) || (whoAmI & 0x7E) != 0x68) {
+    return false;
+  }
+  return writeRegister(address, REG_PWR_MGMT_1, CLOCK_PLL_X) &&
+         writeRegister(address, REG_CONFIG, captureMode ? DLPF_184_HZ : DLPF_21_HZ) &&
+         writeRegister(address, REG_SMPLRT_DIV, sampleRateDivider()) &&
+         writeRegister(address, REG_ACCEL_CONFIG, ACCEL_RANGE_8G) &&
+         writeRegister(address, REG_FIFO_EN, FIFO_EN_ACCEL);
+}
+
+// Reset every FIFO first, then enable them back to back, so the units
+// start filling within a few hundred microseconds of each other
+static void restartFifos() {
+  for (uint8_t u = 0; u < unitCount; u++) {
+    writeRegister(units[u], REG_USER_CTRL, USER_CTRL_FIFO_RESET);
+  }
+  for (uint8_t u = 0; u < unitCount; u++) {
+    writeRegister(units[u], REG_USER_CTRL, USER_CTRL_FIFO_EN);
+  }
+  uint8_t status;
+  for (uint8_t u = 0; u < unitCount; u++) {
+    readRegisters(units[u], REG_INT_STATUS, &status, 1);  // Clears the overflow flag
+  }
+  sampleClockRestart(sampleClock);
+}
+
+static const float MS2_PER_COUNT = 9.80665f / ACCEL_LSB_PER_G;
+
+static void addFrame(Accumulator& a, int32_t ax, int32_t ay, int32_t az, int64_t atUs) {
+  // At most 3 * 32768^2, which fits unsigned 32 bits
+  uint32_t squared = (uint32_t)(ax * ax) + (uint32_t)(ay * ay) + (uint32_t)(az * az);
+#if BOARD_HAS_FPU
+  int32_t magnitude = (int32_t)(sqrtf((float)squared) + 0.5f);
+#else
+  int32_t magnitude = isqrt32(squared);
+#endif
+  int32_t deviation = magnitude - offsetCounts;
+  a.samples++;
+  a.sumSquares += (uint64_t)((int64_t)deviation * deviation);
+  if (abs(deviation) >= a.peak) {
+    a.peak = abs(deviation);
+    a.peakUs = atUs;
+  }
+  a.latest = deviation;
+  a.sumX += abs(ax);
+  a.sumY += abs(ay);
+  a.sumZ += abs(az - gravityCounts);
+}
+
+static void drain() {
+  TRACE_BEGIN(TRACE_MPU_READ);
+  uint16_t minFrames = UINT16_MAX;
+  uint16_t maxFrames = 0;
+  uint16_t firstUnitFrames = 0;
+  int64_t readUs = 0;
+  bool overflow = false;
+  for (uint8_t u = 0; u < unitCount; u++) {
+    uint8_t count[2];
+    uint8_t status = 0;
+    if (!readRegisters(units[u], REG_INT_STATUS, &status, 1) ||
+        !readRegisters(units[u], REG_FIFO_COUNT_H, count, 2)) {
+      TRACE_END(TRACE_MPU_READ);
+      return;
+    }
+    overflow |= (status & INT_STATUS_FIFO_OFLOW) != 0;
+    uint16_t frames = ((count[0] << 8) | count[1]) / FRAME_BYTES;
+    if (u == 0) {
+      readUs = timebaseNowUs();
+      firstUnitFrames = frames;
+    }
+    minFrames = min(minFrames, frames);
+    maxFrames = max(maxFrames, frames);
+  }
+
+  // A full FIFO has lost samples and its frame boundaries; start over
+  if (overflow || maxFrames - minFrames > RESYNC_SKEW_FRAMES) {
+    restartFifos();
+    stats.resyncs++;
+    if (overflow) {
+      stats.overflows++;
+    }
+    TRACE_END(TRACE_MPU_READ);
+    return;
+  }
+  stats.maxSkewFrames = max(stats.maxSkewFrames, (uint8_t)(maxFrames - minFrames));
+
+  // The frames taken now on the timebase; any newer ones the first unit
+  // has queued are read next time
+  TimeBlock block = sampleClockStamp(sampleClock, readUs, minFrames, firstUnitFrames - minFrames);
+
+  // The same frames from every unit, a chunk at a time
+  uint8_t buffer[CHUNK_FRAMES * FRAME_BYTES];
+  gravityCounts = (int32_t)(config.gravityBaseline / MS2_PER_COUNT);
+  offsetCounts = (int32_t)((config.gravityBaseline + config.vibrationBaseline) / MS2_PER_COUNT);
+  for (uint16_t done = 0; done < minFrames;) {
+    uint16_t chunk = min((uint16_t)(minFrames - done), (uint16_t)CHUNK_FRAMES);
+    for (uint8_t u = 0; u < unitCount; u++) {
+      if (!readRegisters(units[u], REG_FIFO_R_W, buffer, chunk * FRAME_BYTES)) {
+        // Frame boundaries are unknown after a failed read
+        restartFifos();
+        stats.resyncs++;
+        TRACE_END(TRACE_MPU_READ);
+        return;
+      }
+      // The same frames go on the bus as they are, if anyone listens
+      BusBlock* published = busAcquire(TOPIC_ACCEL, u, 3, chunk);
+      for (uint16_t f = 0; f < chunk; f++) {
+        const uint8_t* frame = buffer + f * FRAME_BYTES;
+        int16_t ax = (frame[0] << 8) | frame[1];
+        int16_t ay = (frame[2] << 8) | frame[3];
+        int16_t az = (frame[4] << 8) | frame[5];
+        addFrame(acc[u], ax, ay, az, timeBlockSampleUs(block, done + f));
+        if (published) {
+          int16_t* out = published->data + f * 3;
+          out[0] = ax;
+          out[1] = ay;
+          out[2] = az;
+        }
+      }
+      if (published) {
+        published->time.firstUs = timeBlockSampleUs(block, done);
+        published->time.periodUs = block.periodUs;
+        published->time.count = chunk;
+        published->scale = MS2_PER_COUNT;
+        busPublish(published);
+      }
+    }
+    done += chunk;
+  }
+
+  uint8_t raw[2];
+  if (readRegisters(units[0], REG_TEMP_OUT_H, raw, 2)) {
+    temperature = (int16_t)((raw[0] << 8) | raw[1]) / 340.0 + 36.53;
+  }
+  if (minFrames > 0) {
+    stats.drains++;
+    stats.frames += minFrames;
+  }
+  TRACE_END(TRACE_MPU_READ);
+}
+
+uint8_t mpuArrayBegin() {
+  unitCount = 0;
+  sampleClockBegin(sampleClock, 1e6f * (sampleRateDivider() + 1) / 1000);
+  for (uint8_t i = 0; i < MPU_MAX_UNITS; i++) {
+    if (configureUnit(ADDRESSES[i])) {
+      units[unitCount++] = ADDRESSES[i];
+    }
+  }
+  if (unitCount > 0) {
+    restartFifos();
+    lastDrain = millis();
+  }
+  return unitCount;
+}
+
+uint8_t mpuArrayUnits() {
+  return unitCount;
+}
+
+void mpuArrayUpdate() {
+  uint32_t interval = captureMode ? CAPTURE_DRAIN_MS : config.mpuDrainIntervalMs;
+  if (unitCount == 0 || millis() - lastDrain < interval) {
+    return;
+  }
+  lastDrain = millis();
+  drain();
+}
+
+bool mpuArrayTake(MpuFeatures features[MPU_MAX_UNITS]) {
+  if (unitCount == 0) {
+    return false;
+  }
+  drain();
+  lastDrain = millis();
+
+  bool any = false;
+  for (uint8_t u = 0; u < MPU_MAX_UNITS; u++) {
+    MpuFeatures& f = features[u];
+    f = MpuFeatures();
+    if (u >= unitCount) {
+      continue;
+    }
+    Accumulator& a = acc[u];
+    f.address = units[u];
+    f.samples = a.samples;
+    if (a.samples > 0) {
+      f.rms = isqrt64(a.sumSquares / a.samples) * MS2_PER_COUNT;
+      f.peak = a.peak * MS2_PER_COUNT;
+      f.peakUs = a.peakUs;
+      f.latest = a.latest * MS2_PER_COUNT;
+      f.xAxis = (float)(a.sumX / a.samples) * MS2_PER_COUNT;
+      f.yAxis = (float)(a.sumY / a.samples) * MS2_PER_COUNT;
+      f.zAxis = (float)(a.sumZ / a.samples) * MS2_PER_COUNT;
+      any = true;
+    }
+    a = Accumulator();
+  }
+  return any;
+}
+
+void mpuArraySetCaptureMode(bool on) {
+  if (on) {
+    captureUsers++;
+  } else if (captureUsers > 0) {
+    captureUsers--;
+  }
+  on = captureUsers > 0;
+  if (on == captureMode || unitCount == 0) {
+    return;
+  }
+  // Fold in what was sampled at the old rate before switching
+  drain();
+  captureMode = on;
+  if (on) {
+    normalI2cHz = Wire.getClock();
+  }
+  Wire.setClock(on ? CAPTURE_I2C_HZ : normalI2cHz);
+  for (uint8_t u = 0; u < unitCount; u++) {
+    writeRegister(units[u], REG_CONFIG, on ? DLPF_184_HZ : DLPF_21_HZ);
+    writeRegister(units[u], REG_SMPLRT_DIV, sampleRateDivider());
+  }
+  sampleClockBegin(sampleClock, 1e6f * (sampleRateDivider() + 1) / 1000);
+  restartFifos();
+  lastDrain = millis();
+}
+
+bool mpuArrayCaptureMode() {
+  return captureMode;
+}
+
+float mpuArrayTemperature() {
+  return temperature;
+}
+
+const MpuArrayStats& mpuArrayStats() {
+  return stats;
+}
+
+void printMpuArrayStats() {
+  Serial.print("MPU: "); Serial.print(unitCount); Serial.print(" unit(s)");
+  for (uint8_t u = 0; u < unitCount; u++) {
+    Serial.print(u == 0 ? " at 0x" : ", 0x"); Serial.print(units[u], HEX);
+  }
+  Serial.print(", "); Serial.print(captureMode ? MPU_CAPTURE_RATE_HZ : config.mpuSampleRateHz);
+  Serial.println(captureMode ? " Hz (capture)" : " Hz");
+  Serial.print("MPU: drains "); Serial.print(stats.drains);
+  Serial.print(", frames per unit "); Serial.print(stats.frames);
+  Serial.print(", max skew "); Serial.print(stats.maxSkewFrames);
+  Serial.print(" frames, resyncs "); Serial.print(stats.resyncs);
+  Serial.print(" ("); Serial.print(stats.overflows);
+  Serial.println(" overflows)");
+}
@@ -0,0 +1,81 @@
+/*
+ * MPU6050 array with lock-step FIFO sampling
+ *
+ * Up to two MPU6050s share the I2C bus at 0x68 and 0x69 (AD0 low/high),
+ * e.g. one on the pump motor and one on the pipe. Both sample the
+ * accelerometer at config.mpuSampleRateHz into their own FIFO instead of
+ * being polled once per reading:
+ *
+ *   - the FIFOs are reset and enabled back to back, so sample k of each
+ *     unit was taken at (nearly) the same instant;
+ *   - every drain reads the same number of frames from each unit, in
+ *     interleaved chunks, so one bus schedule serves both units and they
+ *     stay aligned;
+ *   - the units' oscillators drift apart slowly; frames one unit has that
+ *     the other doesn't yet stay queued, and once the skew grows past a
+ *     few frames (or a FIFO overflows) both FIFOs are restarted together.
+ *
+ * Every sample is folded into per-unit features (RMS and peak deviation
+ * from gravity, mean per-axis level), taken once per reading. The features
+ * are accumulated in raw counts with integer arithmetic (the magnitude's
+ * square root too, on boards without an FPU) and converted once per take. Samples are
+ * placed on the common timebase by a SampleClock shared by the units
+ * (their frames line up), so the peak's time is known to well under a
+ * millisecond. Each chunk read is also published on the data bus
+ * (TOPIC_ACCEL, raw counts per unit) when something subscribes to it.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define MPU_MAX_UNITS 2
+#define MPU_CAPTURE_RATE_HZ 1000   // Sample rate in capture mode
+
+struct MpuFeatures {
+  uint8_t address;           // I2C address, 0 if the unit is absent
+  uint32_t samples;          // FIFO samples folded in since the last take
+  float rms;                 // m/s², RMS of the magnitude minus gravity and baseline
+  float peak;                // m/s², largest absolute deviation
+  int64_t peakUs;            // Timebase time of the peak sample
+  float latest;              // m/s², deviation of the newest sample
+  float xAxis;               // m/s², mean |x|
+  float yAxis;               // m/s², mean |y|
+  float zAxis;               // m/s², mean |z - gravity|
+};
+
+struct MpuArrayStats {
+  uint32_t drains;           // Drains that read frames
+  uint32_t frames;           // Frames read per unit
+  uint32_t resyncs;          // FIFO restarts (skew or overflow)
+  uint32_t overflows;        // Of those, caused by a full FIFO
+  uint8_t maxSkewFrames;     // Largest frame count difference seen at a drain
+};
+
+// Probe both addresses, configure the units found and start their FIFOs
+// together; returns the number of units. Wire must already be started.
+uint8_t mpuArrayBegin();
+
+uint8_t mpuArrayUnits();
+
+// Drain the FIFOs every config.mpuDrainIntervalMs; call every loop()
+void mpuArrayUpdate();
+
+// Features per unit since the previous take (drains first, so the newest
+// samples are included); false if no samples arrived
+bool mpuArrayTake(MpuFeatures features[MPU_MAX_UNITS]);
+
+// Capture mode: sample at 1 kHz with a 184 Hz filter and drain every
+// 20 ms on a 400 kHz bus, for a short high-rate capture; off restores the
+// configured rate. Requests nest: the rate only drops back once every
+// caller that turned it on has turned it off.
+void mpuArraySetCaptureMode(bool on);
+bool mpuArrayCaptureMode();
+
+// Die temperature of the first unit, read at the last drain (°C)
+float mpuArrayTemperature();
+
+const MpuArrayStats& mpuArrayStats();
+
+// Print the units and drain counters to Serial
+void printMpuArrayStats();
@@ -0,0 +1,248 @@
+#include "outbound_queue.h"
+
+#include "trace.h"
+
+// Upper bound per loop() pass; BLE flow control normally stops sooner
+#define OUTBOUND_BURST 16
+
+struct OutboundEntry {
+  BleStream stream;
+  uint16_t len;
+  uint32_t enqueuedAt;       // micros()
+  uint8_t data[OUTBOUND_PAYLOAD_MAX];
+};
+
+// What a full class does with one more record
+enum OutboundFullPolicy {
+  FULL_EVICT_OLDEST,
+  FULL_REFUSE
+};
+
+struct OutboundQueue {
+  OutboundEntry* entries;
+  uint8_t capacity;
+  bool coalesce;             // Same-stream records replace each other
+  OutboundFullPolicy whenFull;
+  uint8_t head;
+  uint8_t count;
+};
+
+static OutboundEntry alertEntries[4];
+static OutboundEntry statusEntries[4];
+static OutboundEntry liveEntries[STREAM_COUNT];
+static OutboundEntry bulkEntries[8];
+
+static OutboundQueue queues[OUTBOUND_CLASS_COUNT] = {
+  { alertEntries,  4,            false, FULL_EVICT_OLDEST, 0, 0 },
+  { statusEntries, 4,            false, FULL_EVICT_OLDEST, 0, 0 },
+  { liveEntries,   STREAM_COUNT, true,  FULL_EVICT_OLDEST, 0, 0 },
+  { bulkEntries,   8,            false, FULL_REFUSE,       0, 0 },
+};
+
+static OutboundClassStats stats[OUTBOUND_CLASS_COUNT];
+
+// loop() passes that ended with records waiting for the link
+static uint32_t backpressurePasses = 0;
+
+const char* outboundClassName(OutboundClass cls) {
+  switch (cls) {
+    case OUTBOUND_ALERT:  return "alert";
+    case OUTBOUND_STATUS: return "status";
+    case OUTBOUND_LIVE:   return "live";
+    case OUTBOUND_BULK:   return "bulk";
+    default:              return "unknown";
+  }
+}
+
+static OutboundEntry& entryAt(OutboundQueue& q, uint8_t index) {
+  return q.entries[(q.head + index) % q.capacity];
+}
+
+static void popFront(OutboundQueue& q) {
+  q.head = (q.head + 1) % q.capacity;
+  q.count--;
+}
+
+static void fillEntry(OutboundEntry& entry, BleStream stream, const uint8_t* data, size_t len) {
+  entry.stream = stream;
+  entry.len = len;
+  entry.enqueuedAt = micros();
+  memcpy(entry.data, data, len);
+}
+
+bool outboundEnqueue(BleStream stream, OutboundClass cls, const uint8_t* data, size_t len) {
+  if (cls >= OUTBOUND_CLASS_COUNT) {
+    return false;
+  }
+  OutboundQueue& q = queues[cls];
+  OutboundClassStats& s = stats[cls];
+
+  if (!data) {
+    s.dropped++;
+    return false;
+  }
+  // BLE would truncate it to the MTU, which no decoder can parse
+  size_t max = min(bleNotifyMax(), (size_t)OUTBOUND_PAYLOAD_MAX);
+  if (len > max) {
+    s.dropped++;
+    s.oversize++;
+    if (s.oversize == 1) {
+      Serial.print("Queue: "); Serial.print(outboundClassName(cls));
+      Serial.print(" record of "); Serial.print((unsigned)len);
+      Serial.print(" bytes is over the link's "); Serial.print((unsigned)max);
+      Serial.println(", not sent (larger MTU, or a shorter payload format)");
+    }
+    return false;
+  }
+  s.enqueued++;
+  bleStreamRestartInterval(stream);
+
+  // The newest record of a stream supersedes one still waiting; it keeps
+  // the older one's place in the queue
+  if (q.coalesce) {
+    for (uint8_t i = 0; i < q.count; i++) {
+      OutboundEntry& entry = entryAt(q, i);
+      if (entry.stream == stream) {
+        fillEntry(entry, stream, data, len);
+        s.coalesced++;
+        return true;
+      }
+    }
+  }
+
+  if (q.count == q.capacity) {
+    s.dropped++;
+    if (q.whenFull == FULL_REFUSE) {
+      return false;
+    }
+    popFront(q);
+  }
+
+  fillEntry(entryAt(q, q.count), stream, data, len);
+  q.count++;
+  s.depth = q.count;
+  s.maxDepth = max(s.maxDepth, s.depth);
+  return true;
+}
+
+bool outboundHasRoom(OutboundClass cls) {
+  return cls < OUTBOUND_CLASS_COUNT && queues[cls].count < queues[cls].capacity;
+}
+
+bool outboundQueued(BleStream stream, OutboundClass cls) {
+  if (cls >= OUTBOUND_CLASS_COUNT) {
+    return false;
+  }
+  OutboundQueue& q = queues[cls];
+  for (uint8_t i = 0; i < q.count; i++) {
+    if (entryAt(q, i).stream == stream) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void discardAll() {
+  for (int c = 0; c < OUTBOUND_CLASS_COUNT; c++) {
+    stats[c].dropped += queues[c].count;
+    stats[c].depth = 0;
+    queues[c].count = 0;
+  }
+}
+
+void outboundUpdate() {
+  if (!bleConnected()) {
+    discardAll();
+    return;
+  }
+
+  for (int n = 0; n < OUTBOUND_BURST; n++) {
+    int c = 0;
+    while (c < OUTBOUND_CLASS_COUNT && queues[c].count == 0) {
+      c++;
+    }
+    if (c == OUTBOUND_CLASS_COUNT) {
+      break;
+    }
+
+    OutboundQueue& q = queues[c];
+    OutboundClassStats& s = stats[c];
+    OutboundEntry& entry = entryAt(q, 0);
+
+    // Nobody to deliver to (the client unsubscribed after it was queued)
+    if (!bleStreamSubscribed(entry.stream)) {
+      s.dropped++;
+      popFront(q);
+      s.depth = q.count;
+      continue;
+    }
+
+    // Link full: keep the record; newer live records coalesce into it
+    if (!bleTxReady()) {
+      backpressurePasses++;
+      break;
+    }
+    TRACE_BEGIN(TRACE_NOTIFY);
+    bool taken = bleStreamNotify(entry.stream, entry.data, entry.len);
+    TRACE_END(TRACE_NOTIFY);
+    if (!taken) {
+      backpressurePasses++;
+      break;
+    }
+
+    uint32_t latency = micros() - entry.enqueuedAt;
+    s.latencyUs = s.sent ? s.latencyUs + ((int32_t)(latency - s.latencyUs) >> 3) : latency;
+    s.maxLatencyUs = max(s.maxLatencyUs, latency);
+    s.sent++;
+
+    popFront(q);
+    s.depth = q.count;
+  }
+}
+
+const OutboundClassStats& outboundStats(OutboundClass cls) {
+  return stats[cls < OUTBOUND_CLASS_COUNT ? cls : OUTBOUND_LIVE];
+}
+
+OutboundClassStats outboundTotals() {
+  OutboundClassStats total;
+  memset(&total, 0, sizeof(total));
+  for (int c = 0; c < OUTBOUND_CLASS_COUNT; c++) {
+    total.enqueued += stats[c].enqueued;
+    total.sent += stats[c].sent;
+    total.coalesced += stats[c].coalesced;
+    total.dropped += stats[c].dropped;
+    total.oversize += stats[c].oversize;
+    total.depth = max(total.depth, stats[c].depth);
+    total.maxDepth = max(total.maxDepth, stats[c].maxDepth);
+    total.latencyUs = max(total.latencyUs, stats[c].latencyUs);
+    total.maxLatencyUs = max(total.maxLatencyUs, stats[c].maxLatencyUs);
+  }
+  return total;
+}
+
+void printOutboundStats() {
+  for (int c = 0; c < OUTBOUND_CLASS_COUNT; c++) {
+    const OutboundClassStats& s = stats[c];
+    Serial.print("Queue: ");
+    Serial.print(outboundClassName((OutboundClass)c));
+    Serial.print(" sent "); Serial.print(s.sent);
+    Serial.print(", coalesced "); Serial.print(s.coalesced);
+    Serial.print(", dropped "); Serial.print(s.dropped);
+    Serial.print(" ("); Serial.print(s.oversize); Serial.print(" too long)");
+    Serial.print(", depth "); Serial.print(s.depth);
+    Serial.print("/"); Serial.print(s.maxDepth);
+    Serial.print(", latency "); Serial.print(s.latencyUs / 1000.0, 1);
+    Serial.print(" ms (max "); Serial.print(s.maxLatencyUs / 1000.0, 1);
+    Serial.println(" ms)");
+  }
+
+  const BleTxStats& tx = bleTxStats();
+  Serial.print("BLE TX: notified "); Serial.print(tx.notified);
+  Serial.print(", refused "); Serial.print(tx.refused);
+  Serial.print(", failed "); Serial.print(tx.failed);
+  Serial.print(", congestion "); Serial.print(tx.congestion);
+  Serial.print(", in flight "); Serial.print(tx.inFlight);
+  Serial.print("/"); Serial.print(tx.maxInFlight);
+  Serial.print(", backpressure passes "); Serial.println(backpressurePasses);
+}
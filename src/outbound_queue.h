@@ -0,0 +1,72 @@
+/*
+ * Prioritised outbound notification queue
+ *
+ * Every notification goes through one of four priority classes and is sent
+ * from loop() highest class first, so a water status alert never waits
+ * behind routine telemetry or a history backfill. Payloads are copied in,
+ * so encoder buffers can be reused straight away. A notification carries
+ * at most bleNotifyMax() bytes (MTU - 3) and BLE would cut a longer one
+ * short, so longer payloads are refused and counted instead.
+ *
+ * Records are only handed to BLE while it reports room (see bleTxReady());
+ * a notification the stack refuses stays at the head of its queue and is
+ * retried on the next pass. Under congestion each class degrades in its
+ * own way:
+ *   alert, status  oldest entry dropped for the newest (never coalesced)
+ *   live           a newer record of the same stream replaces the queued one
+ *   bulk           refused while full; the producer retries later
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "ble_service.h"
+
+enum OutboundClass {
+  OUTBOUND_ALERT,       // Transitions into an unsafe state
+  OUTBOUND_STATUS,      // Other status transitions
+  OUTBOUND_LIVE,        // Periodic readings, stats and diagnostics
+  OUTBOUND_BULK,        // History backfill
+  OUTBOUND_CLASS_COUNT
+};
+
+struct OutboundClassStats {
+  uint32_t enqueued;
+  uint32_t sent;
+  uint32_t coalesced;        // Replaced by a newer record before sending
+  uint32_t dropped;          // Evicted, refused, unsubscribed, or discarded on disconnect
+  uint32_t oversize;         // Of those, refused as longer than the link's notification
+  uint8_t depth;             // Entries waiting now
+  uint8_t maxDepth;
+  uint32_t latencyUs;        // Moving average of enqueue-to-send time
+  uint32_t maxLatencyUs;
+};
+
+const char* outboundClassName(OutboundClass cls);
+
+// Largest payload the queue holds: the longest ATT attribute value
+#define OUTBOUND_PAYLOAD_MAX 512
+
+// Queue a notification for a stream (payload is copied). Returns false if
+// the record was refused (bulk class full, or payload longer than the
+// link's notification).
+bool outboundEnqueue(BleStream stream, OutboundClass cls, const uint8_t* data, size_t len);
+
+// True if an entry of the class can be queued without evicting or refusing
+bool outboundHasRoom(OutboundClass cls);
+
+// True if a notification of the stream is still waiting in the class
+bool outboundQueued(BleStream stream, OutboundClass cls);
+
+// Send queued notifications, highest class first; call every loop()
+void outboundUpdate();
+
+const OutboundClassStats& outboundStats(OutboundClass cls);
+
+// Sum over every class (depth and latency fields are maxima)
+OutboundClassStats outboundTotals();
+
+// Print per-class counters, depth and latency and the BLE flow control
+// counters to Serial
+void printOutboundStats();
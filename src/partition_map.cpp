@@ -0,0 +1,104 @@
+#include "partition_map.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+#define MMAP_DATA ESP_PARTITION_MMAP_DATA
+#define munmapWindow esp_partition_munmap
+#else
+#define MMAP_DATA SPI_FLASH_MMAP_DATA
+#define munmapWindow spi_flash_munmap
+#endif
+
+void partitionMapOpen(PartitionMap& map, const esp_partition_t* partition) {
+  memset(&map, 0, sizeof(map));
+  map.partition = partition;
+  map.size = partition ? partition->size : 0;
+}
+
+// Map the window holding `offset`
+static bool mapWindow(PartitionMap& map, uint32_t offset) {
+  if (map.window) {
+    munmapWindow(map.handle);
+    map.window = NULL;
+  }
+  uint32_t start = offset - offset % PARTITION_MAP_WINDOW;
+  uint32_t size = map.size - start < PARTITION_MAP_WINDOW ? map.size - start : PARTITION_MAP_WINDOW;
+  const void* window;
+  if (esp_partition_mmap(map.partition, start, size, MMAP_DATA, &window, &map.handle) != ESP_OK) {
+    return false;
+  }
+  map.window = (const uint8_t*)window;
+  map.windowOffset = start;
+  map.windowSize = size;
+  map.remaps++;
+  return true;
+}
+
+void partitionMapClose(PartitionMap& map) {
+  if (map.window) {
+    munmapWindow(map.handle);
+  }
+  memset(&map, 0, sizeof(map));
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool partitionMapOpenImage(PartitionMap& map, const char* path) {
+  memset(&map, 0, sizeof(map));
+  map.fd = open(path, O_RDONLY);
+  struct stat st;
+  if (map.fd < 0 || fstat(map.fd, &st) != 0 || st.st_size == 0) {
+    partitionMapClose(map);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, map.fd, 0);
+  if (data == MAP_FAILED) {
+    partitionMapClose(map);
+    return false;
+  }
+  map.size = st.st_size;
+  map.window = (const uint8_t*)data;
+  map.windowSize = map.size;
+  map.remaps = 1;
+  return true;
+}
+
+// The whole image is mapped at open
+static bool mapWindow(PartitionMap&, uint32_t) {
+  return false;
+}
+
+void partitionMapClose(PartitionMap& map) {
+  if (map.window) {
+    munmap((void*)map.window, map.windowSize);
+  }
+  if (map.fd >= 0) {
+    close(map.fd);
+  }
+  memset(&map, 0, sizeof(map));
+  map.fd = -1;
+}
+
+#endif
+
+const uint8_t* partitionMapAt(PartitionMap& map, uint32_t offset, uint32_t size) {
+  if (offset >= map.size || size > map.size - offset) {
+    return NULL;
+  }
+  bool inWindow = map.window && offset >= map.windowOffset && offset - map.windowOffset + size <= map.windowSize;
+  if (!inWindow && !mapWindow(map, offset)) {
+    return NULL;
+  }
+  if (offset - map.windowOffset + size > map.windowSize) {
+    return NULL;
+  }
+  return map.window + (offset - map.windowOffset);
+}
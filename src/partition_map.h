@@ -0,0 +1,64 @@
+/*
+ * Read-only memory-mapped access to a flash data partition
+ *
+ * On the ESP32 a window of the partition is mapped into the data address
+ * space with esp_partition_mmap(), so records are read in place through
+ * the flash cache instead of being copied into RAM by esp_partition_read().
+ * Windows are one 64 KB MMU page, aligned within the partition, and stay
+ * mapped until a read falls outside them; a sequential walk remaps once per
+ * 64 KB. Writes and erases through esp_partition_write() and
+ * esp_partition_erase_range() invalidate the cache, so a mapped window
+ * always shows the current contents.
+ *
+ * On a host the same interface maps a partition image file (e.g. one read
+ * back with `esptool.py read_flash`) with mmap(), whole, so tools decode
+ * the log with the same code.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_partition_mmap_handle_t PartitionMapHandle;
+#else
+typedef spi_flash_mmap_handle_t PartitionMapHandle;
+#endif
+#endif
+
+#define PARTITION_MAP_WINDOW 0x10000
+
+struct PartitionMap {
+#ifdef ESP_PLATFORM
+  const esp_partition_t* partition;
+  PartitionMapHandle handle;
+#else
+  int fd;                    // -1 while no image is open
+#endif
+  const uint8_t* window;     // Mapped bytes, NULL while nothing is mapped
+  uint32_t windowOffset;     // Partition offset of window[0]
+  uint32_t windowSize;
+  uint32_t size;             // Partition size
+  uint32_t remaps;           // Windows mapped so far
+};
+
+#ifdef ESP_PLATFORM
+// Map windows of a flash partition on demand
+void partitionMapOpen(PartitionMap& map, const esp_partition_t* partition);
+#else
+// Map a partition image file; false if it can't be opened
+bool partitionMapOpenImage(PartitionMap& map, const char* path);
+#endif
+
+// `size` bytes at `offset` in the partition, mapping another window if
+// needed. Valid until the next call that maps a different window, or
+// partitionMapClose(). NULL if the range is outside the partition, crosses
+// a window boundary or can't be mapped.
+const uint8_t* partitionMapAt(PartitionMap& map, uint32_t offset, uint32_t size);
+
+void partitionMapClose(PartitionMap& map);
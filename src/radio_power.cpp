@@ -0,0 +1,160 @@
+#include "radio_power.h"
+
+#include "ble_service.h"
+#include "config.h"
+#include "energy.h"
+
+// Link checks while connected
+#define LINK_CHECK_MS 2000
+
+// Estimated level of our signal at the central (see checkLink()): above
+// STRONG there is margin to give away, below WEAK the link needs more
+#define RSSI_STRONG_DBM -65
+#define RSSI_WEAK_DBM -80
+
+// Consecutive checks with margin before power is lowered
+#define STABLE_CHECKS 3
+
+#define TX_POWER_MIN_DBM -12
+#define TX_POWER_STEP_DB 3
+
+static RadioPowerStats stats;
+static bool wasConnected = false;
+static unsigned long lastCheck = 0;
+static unsigned long advertisingSince = 0;   // Fast advertising started
+static uint32_t lastRetries = 0;
+static uint8_t stableChecks = 0;
+static int64_t lastUpdateUs = 0;
+static uint64_t reducedPowerUs = 0;
+static double advEventsSaved = 0;
+
+static void setTxPower(int8_t dbm) {
+  bleSetTxPower(dbm);
+  stats.txPowerDbm = bleTxPower();
+}
+
+static uint32_t linkRetries() {
+  const BleTxStats& tx = bleTxStats();
+  return tx.failed + tx.congestion;
+}
+
+void radioPowerBegin() {
+  stats.maxTxPowerDbm = bleTxPower();
+  setTxPower(stats.maxTxPowerDbm);
+  bleSetAdvertisingInterval(config.radioAdvIntervalMs);
+  stats.advIntervalMs = bleAdvertisingIntervalMs();
+  advertisingSince = millis();
+  lastUpdateUs = esp_timer_get_time();
+}
+
+void radioPowerSetMaxTxPower(int8_t dbm) {
+  stats.maxTxPowerDbm = dbm;
+  // Advertising always runs at the ceiling; a connection only has to
+  // come down to it
+  if (!bleConnected() || stats.txPowerDbm > dbm) {
+    setTxPower(dbm);
+  }
+}
+
+// The RSSI we measure is the central's signal. Assuming a symmetric path
+// and a central transmitting at our ceiling, our signal arrives at the
+// central (ceiling - current power) dB weaker than that.
+static void checkLink() {
+  bleRequestRssi();  // Read at the next check
+
+  uint32_t retries = linkRetries();
+  uint32_t newRetries = retries - lastRetries;
+  lastRetries = retries;
+
+  int8_t rssi = 0;
+  bool haveRssi = bleLinkRssi(&rssi);
+  if (haveRssi) {
+    stats.rssi = rssi;
+  }
+  int estimated = rssi - (stats.maxTxPowerDbm - stats.txPowerDbm);
+
+  if (newRetries > 0 || (haveRssi && estimated < RSSI_WEAK_DBM)) {
+    stableChecks = 0;
+    if (stats.txPowerDbm < stats.maxTxPowerDbm) {
+      setTxPower(min(stats.txPowerDbm + TX_POWER_STEP_DB, (int)stats.maxTxPowerDbm));
+      stats.stepsUp++;
+    }
+  } else if (haveRssi && estimated - TX_POWER_STEP_DB >= RSSI_STRONG_DBM) {
+    if (++stableChecks >= STABLE_CHECKS && stats.txPowerDbm - TX_POWER_STEP_DB >= TX_POWER_MIN_DBM) {
+      setTxPower(stats.txPowerDbm - TX_POWER_STEP_DB);
+      stats.stepsDown++;
+      stableChecks = 0;
+    }
+  } else {
+    stableChecks = 0;
+  }
+}
+
+void radioPowerUpdate() {
+  unsigned long now = millis();
+  int64_t nowUs = esp_timer_get_time();
+  uint64_t elapsedUs = nowUs - lastUpdateUs;
+  lastUpdateUs = nowUs;
+
+  bool connected = bleConnected();
+  if (connected != wasConnected) {
+    wasConnected = connected;
+    // Every connection starts at full power and earns its reductions;
+    // after a disconnect, advertise fast at full power again
+    setTxPower(stats.maxTxPowerDbm);
+    stableChecks = 0;
+    if (connected) {
+      lastRetries = linkRetries();
+      lastCheck = now;
+      stats.rssi = 0;
+    } else {
+      bleSetAdvertisingInterval(config.radioAdvIntervalMs);
+      advertisingSince = now;
+    }
+  }
+
+  if (connected) {
+    if (stats.txPowerDbm < stats.maxTxPowerDbm) {
+      reducedPowerUs += elapsedUs;
+      stats.reducedPowerMs = reducedPowerUs / 1000;
+    }
+    if (now - lastCheck >= LINK_CHECK_MS) {
+      lastCheck = now;
+      checkLink();
+    }
+    return;
+  }
+
+  if (config.advSlowIntervalMs > config.radioAdvIntervalMs &&
+      bleAdvertisingIntervalMs() != config.advSlowIntervalMs &&
+      now - advertisingSince >= config.advFastDurationMs) {
+    bleSetAdvertisingInterval(config.advSlowIntervalMs);
+  }
+  stats.advIntervalMs = bleAdvertisingIntervalMs();
+
+  // Events fast advertising would have sent in this time, minus those sent
+  if (stats.advIntervalMs > config.radioAdvIntervalMs && config.radioAdvIntervalMs > 0) {
+    double elapsedMs = elapsedUs / 1000.0;
+    advEventsSaved += elapsedMs / config.radioAdvIntervalMs - elapsedMs / stats.advIntervalMs;
+    stats.advEventsSaved = advEventsSaved;
+    stats.radioOnSavedMs = advEventsSaved * energyAdvEventRadioUs() / 1000;
+  }
+}
+
+const RadioPowerStats& radioPowerStats() {
+  return stats;
+}
+
+void printRadioPowerStats() {
+  Serial.print("Radio: TX "); Serial.print(stats.txPowerDbm);
+  Serial.print(" dBm (max "); Serial.print(stats.maxTxPowerDbm);
+  Serial.print("), RSSI "); Serial.print(stats.rssi);
+  Serial.print(" dBm, advertising "); Serial.print(stats.advIntervalMs);
+  Serial.println(" ms");
+  Serial.print("Radio: steps down "); Serial.print(stats.stepsDown);
+  Serial.print(", up "); Serial.print(stats.stepsUp);
+  Serial.print(", reduced power "); Serial.print(stats.reducedPowerMs / 1000);
+  Serial.print(" s, advertising events saved "); Serial.print(stats.advEventsSaved);
+  Serial.print(" ("); Serial.print(stats.radioOnSavedMs);
+  Serial.println(" ms radio time)");
+}
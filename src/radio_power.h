@@ -0,0 +1,48 @@
+/*
+ * Adaptive BLE transmit power and advertising interval
+ *
+ * While connected, the link is checked every couple of seconds: the
+ * connection RSSI is read and the notifications the stack reported failed
+ * or congested since the last check are counted (Bluedroid doesn't expose
+ * link-layer retransmissions; these are the retries that reach the host).
+ * A link with margin (strong RSSI, no failures for a few checks) gets 3 dB
+ * less TX power; a weak or failing one gets 3 dB more, up to the ceiling
+ * set by the battery policy.
+ *
+ * Advertising is fast for a while after boot or a disconnect, so the app
+ * finds the sensor quickly, and slows down once nobody has connected for
+ * config.advFastDurationMs.
+ *
+ * Counters show the advertising events (and radio time) the slow interval
+ * avoided and how long the link ran below full power.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+struct RadioPowerStats {
+  int8_t rssi;               // Latest connection RSSI (dBm), 0 if unknown
+  int8_t txPowerDbm;         // Current TX power
+  int8_t maxTxPowerDbm;      // Ceiling from the battery policy
+  uint16_t advIntervalMs;    // Current advertising interval
+  uint32_t stepsDown;        // TX power reductions
+  uint32_t stepsUp;          // TX power increases (weak link or retries)
+  uint32_t advEventsSaved;   // Advertising events not sent thanks to slow advertising
+  uint32_t radioOnSavedMs;   // Radio time those events would have taken
+  uint32_t reducedPowerMs;   // Time connected below the ceiling
+};
+
+// Start fast advertising at the ceiling power
+void radioPowerBegin();
+
+// Highest TX power to use (battery policy); applied at once if lower
+void radioPowerSetMaxTxPower(int8_t dbm);
+
+// Check the link and advertising state; call every loop()
+void radioPowerUpdate();
+
+const RadioPowerStats& radioPowerStats();
+
+// Print the current state and counters to Serial
+void printRadioPowerStats();
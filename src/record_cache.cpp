@@ -0,0 +1,141 @@
+#include "record_cache.h"
+
+RecordCacheStats recordCacheStats = {0, 0, 0, 0, 0};
+
+RecordCache::RecordCache(Slot* slots, uint8_t capacity, uint8_t* out, size_t outCapacity)
+    : prefix(NULL), separator(NULL), suffix(NULL), slots(slots), capacity(capacity),
+      cursor(0), fieldCount(0), dirty(true), overflowed(false),
+      out(out), outCapacity(outCapacity), outLen(0) {
+  invalidate();
+}
+
+void RecordCache::frame(const char* newPrefix, const char* newSeparator, const char* newSuffix) {
+  if (newPrefix != prefix || newSeparator != separator || newSuffix != suffix) {
+    prefix = newPrefix;
+    separator = newSeparator;
+    suffix = newSuffix;
+    invalidate();
+  }
+}
+
+void RecordCache::invalidate() {
+  for (int i = 0; i < capacity; i++) {
+    slots[i].valid = false;
+    slots[i].present = false;
+    slots[i].len = 0;
+  }
+  dirty = true;
+}
+
+void RecordCache::begin() {
+  cursor = 0;
+}
+
+bool RecordCache::field(int32_t identity) {
+  if (cursor >= capacity) {
+    return false;  // Over capacity: field is silently left out
+  }
+
+  Slot& slot = slots[cursor];
+  if (slot.valid && slot.identity == identity) {
+    if (!slot.present) {
+      slot.present = true;
+      dirty = true;
+    }
+    cursor++;
+    recordCacheStats.fieldHits++;
+    return false;
+  }
+
+  slot.identity = identity;
+  slot.valid = false;  // Until commit()
+  dirty = true;
+  recordCacheStats.fieldEncodes++;
+  return true;
+}
+
+void RecordCache::skip() {
+  if (cursor >= capacity) {
+    return;
+  }
+  // The cached bytes stay valid for when the field is sent again
+  Slot& slot = slots[cursor++];
+  if (slot.present) {
+    slot.present = false;
+    dirty = true;
+  }
+}
+
+uint8_t* RecordCache::fragment() {
+  return slots[cursor].bytes;
+}
+
+void RecordCache::commit(size_t len) {
+  Slot& slot = slots[cursor];
+  slot.len = min(len, (size_t)RECORD_CACHE_FRAGMENT);
+  slot.valid = true;
+  slot.present = true;
+  cursor++;
+}
+
+// False if `len` more bytes don't fit after `pos`
+bool RecordCache::append(size_t& pos, const void* data, size_t len) {
+  if (pos + len > outCapacity) {
+    return false;
+  }
+  memcpy(out + pos, data, len);
+  pos += len;
+  return true;
+}
+
+bool RecordCache::appendText(size_t& pos, const char* text) {
+  return !text || append(pos, text, strlen(text));
+}
+
+const uint8_t* RecordCache::finish(size_t* len) {
+  recordCacheStats.records++;
+
+  // A different field count means the layout changed; treat as dirty
+  if (cursor != fieldCount) {
+    fieldCount = cursor;
+    dirty = true;
+  }
+
+  if (!dirty) {
+    recordCacheStats.recordHits++;
+    *len = outLen;
+    return outLen ? out : NULL;
+  }
+
+  size_t pos = 0;
+  bool fits = appendText(pos, prefix);
+  bool first = true;
+  for (uint8_t i = 0; i < fieldCount && fits; i++) {
+    if (!slots[i].present) {
+      continue;
+    }
+    if (!first) {
+      fits = appendText(pos, separator);
+    }
+    fits = fits && append(pos, slots[i].bytes, slots[i].len);
+    first = false;
+  }
+  fits = fits && appendText(pos, suffix);
+
+  dirty = false;
+  if (!fits) {
+    // A truncated record would not parse; send none and say so
+    recordCacheStats.overflows++;
+    if (!overflowed) {
+      Serial.print("RecordCache: record over "); Serial.print((unsigned)outCapacity);
+      Serial.println(" bytes, not sent");
+      overflowed = true;
+    }
+    outLen = 0;
+    *len = 0;
+    return NULL;
+  }
+  outLen = pos;
+  *len = outLen;
+  return out;
+}
@@ -0,0 +1,108 @@
+/*
+ * Encode-once record cache
+ *
+ * Keeps the last encoded bytes of every field of one record format. Each
+ * field is identified by its value after rounding to the precision it is
+ * sent with; a field is only re-encoded when that value changes, and the
+ * record is only re-assembled when at least one field changed. In steady
+ * state (readings identical after rounding) encoding costs a handful of
+ * integer compares.
+ *
+ * Slots are the record's schema fields in order, present or not: an
+ * optional field that is left out still takes its slot (skip()), so the
+ * fields after it keep their cached bytes and keys.
+ *
+ * The slots and the output buffer belong to the caller, sized for the
+ * record, and one cache serves every format: framing a record differently
+ * (another format) drops the cached fields.
+ *
+ * Usage per record:
+ *   rc.frame(prefix, separator, suffix);
+ *   rc.begin();
+ *   if (rc.field(quantizedValue)) { write rc.fragment(); rc.commit(len); }
+ *   rc.skip();  // for a field that isn't sent this time
+ *   ...
+ *   data = rc.finish(&len);  // NULL if the record doesn't fit
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// The largest record (diagnostics) plus the binary presence mask
+#define RECORD_CACHE_MAX_FIELDS 25
+#define RECORD_CACHE_FRAGMENT   48
+// No record is longer than this (diagnostics in JSON, at most about 670
+// bytes); each cache's output buffer is sized for its own record
+#define RECORD_CACHE_OUTPUT     768
+
+// Totals across every record cache, reported in diagnostics
+struct RecordCacheStats {
+  uint32_t records;        // finish() calls
+  uint32_t recordHits;     // records returned without re-assembly
+  uint32_t fieldHits;      // fields reused from the cache
+  uint32_t fieldEncodes;   // fields that had to be re-encoded
+  uint32_t overflows;      // records too long for the output, not sent
+};
+
+extern RecordCacheStats recordCacheStats;
+
+class RecordCache {
+ public:
+  struct Slot {
+    int32_t identity;
+    bool valid;
+    bool present;            // Sent in the current record
+    uint8_t len;
+    uint8_t bytes[RECORD_CACHE_FRAGMENT];
+  };
+
+  // `capacity` slots (one per schema field, plus the binary presence
+  // mask) and an output buffer for the longest record
+  RecordCache(Slot* slots, uint8_t capacity, uint8_t* out, size_t outCapacity);
+
+  // Bytes written before / after the fields (e.g. "{" and "}"), and
+  // between consecutive fields (e.g. ","); any may be NULL. Different
+  // framing from the last record's drops the cached fields.
+  void frame(const char* prefix, const char* separator, const char* suffix);
+
+  // Start a record; fields must then be added in the same order every time
+  void begin();
+
+  // Declare the next field with its identity (rounded value). Returns true
+  // if the field has to be re-encoded into fragment() and commit()ted.
+  bool field(int32_t identity);
+
+  // Declare the next field as left out of this record
+  void skip();
+
+  // Buffer for the current field's encoding (RECORD_CACHE_FRAGMENT bytes)
+  uint8_t* fragment();
+  void commit(size_t len);
+
+  // Assemble (if anything changed) and return the encoded record; NULL
+  // (and *len 0) if it is longer than the output buffer
+  const uint8_t* finish(size_t* len);
+
+  // Drop all cached fields, e.g. when the format's constants change
+  void invalidate();
+
+ private:
+  bool append(size_t& pos, const void* data, size_t len);
+  bool appendText(size_t& pos, const char* text);
+
+  const char* prefix;
+  const char* separator;
+  const char* suffix;
+
+  Slot* slots;
+  uint8_t capacity;
+  uint8_t cursor;
+  uint8_t fieldCount;
+  bool dirty;
+  bool overflowed;           // Reported once per cache
+
+  uint8_t* out;
+  size_t outCapacity;
+  size_t outLen;
+};
@@ -0,0 +1,166 @@
+/*
+ * Record schema: the single field list of every BLE record
+ *
+ * Each record is an X-macro list of
+ *
+ *   X(key, Kind, value, arg, present)
+ *
+ *   key      field name in JSON and CBOR
+ *   Kind     Fixed (arg = decimals), UInt, QuotedUInt (JSON string), Int,
+ *            Hex (text in JSON/CBOR), Bool, Status, Text (arg = an
+ *            identity that changes whenever the text does)
+ *   value    expression over the record `r` (and the encoder's arguments)
+ *   present  whether the field is sent this time
+ *
+ * telemetry.cpp expands every list into its JSON, CBOR and binary encoders
+ * at compile time; nothing is looked up at run time. tools/gen_record_schema.js
+ * reads this file and writes RecordSchema.js, the app's decoder for the
+ * binary format, so the firmware and the app can't disagree on a field.
+ * Keep one field per line, with the key (and a Fixed field's decimals) as
+ * literals; the generator parses them.
+ *
+ * Binary records are 0xB1, the record id, a 32-bit little-endian mask
+ * with a bit per field (set if present), then the present fields in order
+ * without keys: Fixed as int32 value * 10^decimals, UInt/QuotedUInt/Hex
+ * as uint32, Int as int32, Bool and Status (enum value) as one byte, Text
+ * as a length byte and the characters.
+ *
+ * Field order is wire order: append new fields, never reorder. Record ids
+ * identify binary payloads and must not change.
+ */
+
+#pragma once
+
+#define RECORD_ID_LEGACY      1
+#define RECORD_ID_LIVE        2
+#define RECORD_ID_VIBRATION   3
+#define RECORD_ID_ALERT       4
+#define RECORD_ID_STATS       5
+#define RECORD_ID_DIAGNOSTICS 6
+#define RECORD_ID_HISTORY     7
+
+// WaterStatus values and their names, in enum order
+#define WATER_STATUS_NAMES(X) \
+  X(STATUS_UNKNOWN, "unknown") \
+  X(STATUS_CLEAN, "clean") \
+  X(STATUS_UNSAFE, "unsafe") \
+  X(STATUS_EXTREMELY_UNSAFE, "extremely_unsafe") \
+  X(STATUS_VIBRATION_DETECTED, "vibration_detected")
+
+// Field names and precision must stay compatible with the React Native app
+#define LEGACY_RECORD_FIELDS(X) \
+  X("pH", Fixed, r.pH, 2, true) \
+  X("temperature", Fixed, r.temperature, 1, true) \
+  X("tds", Fixed, r.tds, 1, true) \
+  X("turbidity", Fixed, r.turbidity, 2, true) \
+  X("vibration", Fixed, r.vibration, 2, true) \
+  X("vibrationDetected", Bool, r.vibrationDetected, 0, true) \
+  X("waterStatus", Status, r.waterStatus, 0, true) \
+  X("timestamp", QuotedUInt, r.timestamp, 0, true) \
+  X("deviceId", Text, DEVICE_ID, 0, true) \
+  X("status", Text, "active", 0, true) \
+  X("configHash", Hex, configHash(), 0, true) \
+  X("seq", UInt, r.seq, 0, true) \
+  X("batteryLevel", UInt, r.batteryLevel, 0, true) \
+  X("batteryVoltage", Fixed, r.batteryVoltage, 2, true)
+
+// Per-probe values only with a multiplexed probe set
+#define LIVE_RECORD_FIELDS(X) \
+  X("pH", Fixed, r.pH, 2, true) \
+  X("temperature", Fixed, r.temperature, 1, true) \
+  X("tds", Fixed, r.tds, 1, true) \
+  X("turbidity", Fixed, r.turbidity, 2, true) \
+  X("waterStatus", Status, r.waterStatus, 0, true) \
+  X("timestamp", UInt, r.timestamp, 0, true) \
+  X("seq", UInt, r.seq, 0, true) \
+  X("batteryLevel", UInt, r.batteryLevel, 0, true) \
+  X("tdsAt", UInt, r.tdsAt, 0, true) \
+  X("tds0", Fixed, r.tdsProbe[0], 1, r.tdsProbes > 1) \
+  X("tds1", Fixed, r.tdsProbe[1], 1, r.tdsProbes > 1) \
+  X("tds2", Fixed, r.tdsProbe[2], 1, r.tdsProbes > 2) \
+  X("tds3", Fixed, r.tdsProbe[3], 1, r.tdsProbes > 3) \
+  X("tds4", Fixed, r.tdsProbe[4], 1, r.tdsProbes > 4) \
+  X("tds5", Fixed, r.tdsProbe[5], 1, r.tdsProbes > 5) \
+  X("tds6", Fixed, r.tdsProbe[6], 1, r.tdsProbes > 6) \
+  X("tds7", Fixed, r.tdsProbe[7], 1, r.tdsProbes > 7)
+
+// Features over every FIFO sample since the previous reading, per unit
+#define VIBRATION_RECORD_FIELDS(X) \
+  X("vibration", Fixed, r.vibration, 3, true) \
+  X("xAxis", Fixed, r.xAxis, 3, true) \
+  X("yAxis", Fixed, r.yAxis, 3, true) \
+  X("zAxis", Fixed, r.zAxis, 3, true) \
+  X("vibrationDetected", Bool, r.vibrationDetected, 0, true) \
+  X("vibRms0", Fixed, r.vibrationRms[0], 3, r.mpuUnits > 0) \
+  X("vibPeak0", Fixed, r.vibrationPeak[0], 3, r.mpuUnits > 0) \
+  X("vibPeakAt0", UInt, r.vibrationPeakAt[0], 0, r.mpuUnits > 0) \
+  X("vibRms1", Fixed, r.vibrationRms[1], 3, r.mpuUnits > 1) \
+  X("vibPeak1", Fixed, r.vibrationPeak[1], 3, r.mpuUnits > 1) \
+  X("vibPeakAt1", UInt, r.vibrationPeakAt[1], 0, r.mpuUnits > 1) \
+  X("timestamp", UInt, r.timestamp, 0, true)
+
+#define ALERT_RECORD_FIELDS(X) \
+  X("waterStatus", Status, r.waterStatus, 0, true) \
+  X("previousStatus", Status, previousStatus, 0, true) \
+  X("tds", Fixed, r.tds, 1, true) \
+  X("vibration", Fixed, r.vibration, 2, true) \
+  X("timestamp", UInt, r.timestamp, 0, true)
+
+#define STATS_RECORD_FIELDS(X) \
+  X("samples", UInt, r.samples, 0, true) \
+  X("tdsMin", Fixed, r.tdsMin, 1, true) \
+  X("tdsMax", Fixed, r.tdsMax, 1, true) \
+  X("tdsMean", Fixed, r.tdsMean, 1, true) \
+  X("vibrationMax", Fixed, r.vibrationMax, 2, true) \
+  X("vibrationEvents", UInt, r.vibrationEvents, 0, true) \
+  X("mAhDayCpu", Fixed, r.energyMahPerDay[0], 2, true) \
+  X("mAhDayRadio", Fixed, r.energyMahPerDay[1], 2, true) \
+  X("mAhDayAdc", Fixed, r.energyMahPerDay[2], 2, true) \
+  X("mAhDaySensors", Fixed, r.energyMahPerDay[3], 2, true) \
+  X("mAhDayLed", Fixed, r.energyMahPerDay[4], 2, true) \
+  X("mAhDayTotal", Fixed, r.energyTotalMahPerDay, 1, true) \
+  X("rssi", Int, r.rssi, 0, true) \
+  X("txPower", Int, r.txPowerDbm, 0, true) \
+  X("radioOnSavedMs", UInt, r.radioOnSavedMs, 0, true) \
+  X("timestamp", UInt, timestamp, 0, true)
+
+// Queue depth and latency per class (alert, status, live, bulk); CPU load
+// only when run-time stats are available
+#define DIAGNOSTICS_RECORD_FIELDS(X) \
+  X("uptime", UInt, r.uptime, 0, true) \
+  X("freeHeap", UInt, r.freeHeap, 0, true) \
+  X("bootMs", UInt, r.bootMs, 0, true) \
+  X("mpu", Text, r.mpuStatus, (int32_t)(intptr_t)r.mpuStatus, true) \
+  X("configHash", Hex, r.configHash, 0, true) \
+  X("payloadFormat", Text, payloadFormatName(format), format, true) \
+  X("cacheRecords", UInt, recordCacheStats.records, 0, true) \
+  X("cacheRecordHits", UInt, recordCacheStats.recordHits, 0, true) \
+  X("cacheFieldHits", UInt, recordCacheStats.fieldHits, 0, true) \
+  X("cacheFieldEncodes", UInt, recordCacheStats.fieldEncodes, 0, true) \
+  X("alertQueue", UInt, r.queueDepth[0], 0, true) \
+  X("alertLatencyMs", Fixed, r.queueLatencyUs[0] / 1000.0, 1, true) \
+  X("statusQueue", UInt, r.queueDepth[1], 0, true) \
+  X("statusLatencyMs", Fixed, r.queueLatencyUs[1] / 1000.0, 1, true) \
+  X("liveQueue", UInt, r.queueDepth[2], 0, true) \
+  X("liveLatencyMs", Fixed, r.queueLatencyUs[2] / 1000.0, 1, true) \
+  X("bulkQueue", UInt, r.queueDepth[3], 0, true) \
+  X("bulkLatencyMs", Fixed, r.queueLatencyUs[3] / 1000.0, 1, true) \
+  X("notifySent", UInt, r.notifySent, 0, true) \
+  X("notifyCoalesced", UInt, r.notifyCoalesced, 0, true) \
+  X("notifyDropped", UInt, r.notifyDropped, 0, true) \
+  X("notifyCongestion", UInt, r.notifyCongestion, 0, true) \
+  X("cpuLoad", Fixed, r.cpuLoad, 1, r.cpuLoadAvailable) \
+  X("cpuTasks", Text, r.cpuTasks, (int32_t)crc32Update(0, r.cpuTasks, strlen(r.cpuTasks)), r.cpuLoadAvailable && r.cpuTasks[0])
+
+// Same names and precision as the live record, so the app can merge both
+// (axes are not logged). Encoded straight from the HistoryRecord in flash.
+#define HISTORY_RECORD_FIELDS(X) \
+  X("seq", UInt, r.seq, 0, true) \
+  X("pH", Fixed, r.pH / 100.0, 2, true) \
+  X("temperature", Fixed, r.temperature / 10.0, 1, true) \
+  X("tds", Fixed, r.tds, 1, true) \
+  X("turbidity", Fixed, r.turbidity / 100.0, 2, true) \
+  X("vibration", Fixed, r.vibration, 2, true) \
+  X("vibrationDetected", Bool, (r.flags & HISTORY_FLAG_VIBRATION) != 0, 0, true) \
+  X("waterStatus", Status, (WaterStatus)r.waterStatus, 0, true) \
+  X("timestamp", UInt, r.timestamp, 0, true)
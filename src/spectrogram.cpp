@@ -0,0 +1,304 @@
+#include "spectrogram.h"
+
+#include <math.h>
+
+#include "ble_service.h"
+#include "board_memory.h"
+#include "config.h"
+#include "data_bus.h"
+#include "dsp.h"
+#include "fixed_point.h"
+#include "mpu_array.h"
+#include "outbound_queue.h"
+
+#define MAX_BINS (SPECTROGRAM_MAX_FFT / 2)
+#define HEADER_LEN 10
+
+// Longest notification; shorter links get fewer spectra per notification
+#define MESSAGE_MAX 244
+
+// Sample period change that restarts the stream, as a fraction; the clock
+// estimate wanders far less than this, a mode change moves it far more
+#define PERIOD_TOLERANCE 0.05f
+
+// Only allocated while the stream is subscribed: the segment, FFT scratch
+// and outgoing message in internal RAM, the spectra waiting for the link
+// in large memory (PSRAM when the board has it)
+struct SpectrogramBuffers {
+  int16_t segment[SPECTROGRAM_MAX_FFT];
+  int16_t work[2 * SPECTROGRAM_MAX_FFT];
+  uint16_t magnitude[MAX_BINS];
+  uint8_t message[MESSAGE_MAX];
+};
+
+typedef uint8_t Spectrum[MAX_BINS];
+
+static SpectrogramBuffers* buffers = NULL;
+static Spectrum* ring = NULL;
+static bool startFailed = false;       // Not retried until the client resubscribes
+static int subscription = -1;
+static bool highRate = false;
+static bool highRateTaken = false;     // Capture mode requested from mpu_array
+
+// Settings in effect
+static uint16_t fftSize = 64;
+static uint16_t bins = 32;
+static uint16_t hop = 32;
+static uint8_t axis = SPECTROGRAM_AXIS_MAGNITUDE;
+
+static uint16_t filled = 0;            // Samples in the segment
+static float periodUs = 0;             // Sample period of the latest block
+
+// Ring of quantised spectra, oldest at ringHead
+static uint16_t ringCapacity = 0;
+static uint16_t ringHead = 0;
+static uint16_t ringCount = 0;
+static uint16_t headSequence = 0;      // Sequence number of the oldest spectrum
+
+static SpectrogramStats stats;
+
+static const char* const AXIS_NAMES[] = { "X", "Y", "Z", "magnitude" };
+
+static void loadSettings() {
+  uint32_t size = constrain(config.spectrogramFftSize, (uint32_t)16, (uint32_t)SPECTROGRAM_MAX_FFT);
+  fftSize = 16;
+  while (fftSize * 2 <= size) {
+    fftSize *= 2;
+  }
+  bins = constrain(config.spectrogramBins, (uint32_t)1, (uint32_t)fftSize / 2);
+  uint32_t overlap = min(config.spectrogramOverlapPercent, (uint32_t)SPECTROGRAM_MAX_OVERLAP);
+  hop = max(fftSize * (100 - overlap) / 100, (uint32_t)1);
+  axis = min(config.spectrogramAxis, (uint32_t)SPECTROGRAM_AXIS_MAGNITUDE);
+}
+
+// Waiting spectra of an old rate or old settings are dropped; the
+// sequence moves past them, so the client sees the gap
+static void dropWaiting() {
+  headSequence += ringCount;
+  stats.dropped += ringCount;
+  ringHead = 0;
+  ringCount = 0;
+}
+
+static void resetStream() {
+  filled = 0;
+  dropWaiting();
+}
+
+static int16_t sampleValue(const BusBlock& block, uint16_t frame) {
+  if (axis < SPECTROGRAM_AXIS_MAGNITUDE) {
+    return busSample(block, frame, axis);
+  }
+  int32_t x = busSample(block, frame, 0);
+  int32_t y = busSample(block, frame, 1);
+  int32_t z = busSample(block, frame, 2);
+  uint16_t magnitude = isqrt32((uint32_t)(x * x) + (uint32_t)(y * y) + (uint32_t)(z * z));
+  return min(magnitude, (uint16_t)INT16_MAX);
+}
+
+// A slot for the newest spectrum; overwrites the oldest when the ring is full
+static uint8_t* pushSpectrum() {
+  if (ringCount == ringCapacity) {
+    ringHead = (ringHead + 1) % ringCapacity;
+    ringCount--;
+    headSequence++;
+    stats.dropped++;
+  }
+  uint8_t* slot = ring[(ringHead + ringCount) % ringCapacity];
+  ringCount++;
+  return slot;
+}
+
+// Window and transform the segment (mean removed, so gravity stays out
+// of the low bins) and quantise its magnitudes
+static void analyseSegment() {
+  int16_t* work = buffers->work;
+  int32_t mean = (int32_t)(dspSum(buffers->segment, fftSize) / fftSize);
+  for (uint16_t i = 0; i < fftSize; i++) {
+    work[i] = constrain(buffers->segment[i] - mean, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+  }
+  dspHann(work, fftSize);
+  for (int i = fftSize - 1; i >= 0; i--) {
+    work[2 * i] = work[i];
+    work[2 * i + 1] = 0;
+  }
+  dspFft(work, fftSize);
+  dspMagnitude(work, bins, buffers->magnitude);
+
+  uint8_t* spectrum = pushSpectrum();
+  for (uint16_t b = 0; b < bins; b++) {
+    spectrum[b] = dspLog8((uint32_t)buffers->magnitude[b] * 16);
+  }
+  stats.spectra++;
+}
+
+static void onAccel(const BusBlock& block, uint16_t first, uint16_t stride, void* context) {
+  if (!buffers || block.channels < 3) {
+    return;
+  }
+  // Someone else (a diagnostic capture) can change the sampling rate under
+  // the stream: don't mix rates within a segment, as in takeHighRate
+  if (periodUs > 0 && fabsf(block.time.periodUs - periodUs) > periodUs * PERIOD_TOLERANCE) {
+    resetStream();
+  }
+  periodUs = block.time.periodUs;
+  for (uint16_t f = 0; f < block.frames; f++) {
+    buffers->segment[filled++] = sampleValue(block, f);
+    if (filled == fftSize) {
+      analyseSegment();
+      memmove(buffers->segment, buffers->segment + hop, (fftSize - hop) * sizeof(int16_t));
+      filled = fftSize - hop;
+    }
+  }
+}
+
+static void takeHighRate(bool on) {
+  if (on != highRateTaken) {
+    mpuArraySetCaptureMode(on);
+    highRateTaken = on;
+    // Don't mix rates within a segment, or label spectra with the wrong one
+    resetStream();
+  }
+}
+
+// The ring: as long as large memory allows, down to the minimum
+static void allocateRing() {
+  ringCapacity = min(boardLargeMax() / sizeof(Spectrum), (size_t)SPECTROGRAM_RING_MAX);
+  while (ringCapacity >= SPECTROGRAM_RING_MIN &&
+         !(ring = (Spectrum*)boardAllocLarge(ringCapacity * sizeof(Spectrum)))) {
+    ringCapacity /= 2;
+  }
+  if (!ring) {
+    ringCapacity = 0;
+  }
+}
+
+static void start() {
+  buffers = (SpectrogramBuffers*)boardAllocInternal(sizeof(SpectrogramBuffers));
+  allocateRing();
+  if (!buffers || !ring) {
+    Serial.println("Spectrogram: not enough memory");
+    startFailed = true;
+    boardFree(buffers);
+    boardFree(ring);
+    buffers = NULL;
+    ring = NULL;
+    return;
+  }
+  loadSettings();
+  resetStream();
+  takeHighRate(highRate);
+  BusPolicy firstUnit = { BUS_EVERY, 1, 0, 0 };
+  subscription = busSubscribe(TOPIC_ACCEL, firstUnit, onAccel, NULL);
+}
+
+static void stop() {
+  busUnsubscribe(subscription);
+  subscription = -1;
+  // Nobody is left to miss what was waiting
+  ringHead = 0;
+  ringCount = 0;
+  takeHighRate(false);
+  boardFree(buffers);
+  boardFree(ring);
+  buffers = NULL;
+  ring = NULL;
+}
+
+// Pack the oldest waiting spectra into one notification, once the previous
+// one has left the queue
+static void sendSpectra() {
+  if (ringCount == 0 || periodUs <= 0 || outboundQueued(STREAM_SPECTROGRAM, OUTBOUND_LIVE) ||
+      !outboundHasRoom(OUTBOUND_LIVE)) {
+    return;
+  }
+  uint8_t* message = buffers->message;
+  size_t max = min(bleNotifyMax(), (size_t)MESSAGE_MAX);
+  // On a link too short for a whole spectrum, send its lowest bins
+  uint8_t sent = min((size_t)bins, max - HEADER_LEN);
+  uint8_t count = min((size_t)ringCount, (max - HEADER_LEN) / sent);
+
+  size_t len = 0;
+  message[len++] = headSequence;
+  message[len++] = headSequence >> 8;
+  message[len++] = count;
+  message[len++] = sent;
+  uint16_t rate = (uint16_t)(1e7f / periodUs + 0.5f);
+  message[len++] = rate;
+  message[len++] = rate >> 8;
+  message[len++] = fftSize;
+  message[len++] = fftSize >> 8;
+  message[len++] = hop;
+  message[len++] = hop >> 8;
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy(message + len, ring[(ringHead + i) % ringCapacity], sent);
+    len += sent;
+  }
+  ringHead = (ringHead + count) % ringCapacity;
+  ringCount -= count;
+  headSequence += count;
+
+  // Already out of the ring, so a refused message is counted as dropped
+  if (outboundEnqueue(STREAM_SPECTROGRAM, OUTBOUND_LIVE, message, len)) {
+    stats.sent += count;
+    stats.notifications++;
+  } else {
+    stats.dropped += count;
+  }
+}
+
+void spectrogramUpdate() {
+  bool subscribed = bleStreamSubscribed(STREAM_SPECTROGRAM);
+  if (!subscribed) {
+    startFailed = false;
+    if (buffers) {
+      stop();
+    }
+    return;
+  }
+  if (!buffers && !startFailed) {
+    start();
+  }
+  if (buffers) {
+    sendSpectra();
+  }
+}
+
+void spectrogramRestart() {
+  if (buffers) {
+    loadSettings();
+    resetStream();
+  }
+}
+
+void spectrogramSetHighRate(bool on) {
+  highRate = on;
+  if (buffers) {
+    takeHighRate(on);
+  }
+}
+
+const SpectrogramStats& spectrogramStats() {
+  return stats;
+}
+
+void printSpectrogramStats() {
+  if (!buffers) {
+    loadSettings();
+  }
+  Serial.print("Spectrogram: ");
+  if (buffers) {
+    Serial.print("streaming, ring of "); Serial.print(ringCapacity); Serial.print(" spectra");
+  } else {
+    Serial.print("idle");
+  }
+  Serial.print(", "); Serial.print(AXIS_NAMES[axis]);
+  Serial.print(", FFT "); Serial.print(fftSize);
+  Serial.print(", "); Serial.print(bins);
+  Serial.print(" bins, hop "); Serial.print(hop);
+  Serial.println(highRate ? " samples, 1 kHz" : " samples");
+  Serial.print("Spectrogram: spectra "); Serial.print(stats.spectra);
+  Serial.print(", sent "); Serial.print(stats.sent);
+  Serial.print(" in "); Serial.print(stats.notifications);
+  Serial.print(" notifications, dropped "); Serial.println(stats.dropped);
+}
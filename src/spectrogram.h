@@ -0,0 +1,65 @@
+/*
+ * Live spectrogram stream
+ *
+ * While a client is subscribed to the spectrogram characteristic, the first
+ * MPU6050's samples (one axis or the acceleration magnitude) are cut into
+ * Hann-windowed segments of spectrogramFftSize samples that overlap by
+ * spectrogramOverlapPercent. Each segment's FFT magnitude over the lowest
+ * spectrogramBins bins becomes one spectrum of one byte per bin: 8 log2(16
+ * x magnitude), the same 1/8 octave scale as the capture spectra.
+ *
+ * Spectra wait in a ring and go out packed, as many as fit, into one
+ * notification sized to the negotiated MTU. The next notification is only
+ * queued once the previous one has been sent, so the stream runs at the
+ * rate the link sustains. When the link falls behind, the ring overwrites
+ * its oldest spectra (counted as dropped): the view stays current instead
+ * of lagging further and further.
+ *
+ * Notification, little-endian: sequence of the first spectrum u16, spectra
+ * u8, bins u8, sample rate in 0.1 Hz u16, FFT size u16, hop in samples u16,
+ * then the spectra oldest first. A gap in the sequence is dropped spectra,
+ * whether overwritten or flushed by a change of rate or settings
+ * (SpectrogramDecoder.js decodes them).
+ *
+ * Clients write [FFT size log2, bins, overlap %, axis, flags] to change the
+ * settings (saved); flags bit 0 samples at 1 kHz (capture mode) while the
+ * stream is subscribed.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define SPECTROGRAM_MAX_FFT 256
+#define SPECTROGRAM_MAX_OVERLAP 87      // Hop of at least 1/8 window
+// Spectra waiting for the link, sized when the stream starts to what
+// large memory has room for: up to SPECTROGRAM_RING_MAX (a few seconds of
+// a stalled link at 1 kHz, with PSRAM), at least SPECTROGRAM_RING_MIN
+#define SPECTROGRAM_RING_MAX 256
+#define SPECTROGRAM_RING_MIN 16
+#define SPECTROGRAM_AXIS_MAGNITUDE 3
+
+#define SPECTROGRAM_FLAG_HIGH_RATE 0x01
+
+struct SpectrogramStats {
+  uint32_t spectra;          // Computed
+  uint32_t sent;             // Sent in notifications
+  uint32_t dropped;          // Overwritten, flushed or refused before the link took them
+  uint32_t notifications;
+};
+
+// Start or stop with the characteristic's subscription, and send waiting
+// spectra as the link has room; call every loop()
+void spectrogramUpdate();
+
+// Pick up changed config.spectrogram* settings (waiting spectra are
+// dropped)
+void spectrogramRestart();
+
+// Sample at 1 kHz while the stream is subscribed
+void spectrogramSetHighRate(bool on);
+
+const SpectrogramStats& spectrogramStats();
+
+// Print the settings and counters to Serial
+void printSpectrogramStats();
@@ -0,0 +1,92 @@
+#include "status_led.h"
+
+static uint8_t flashPin = 0;
+static uint8_t flashTogglesLeft = 0;   // 2 per flash (on + off)
+static uint16_t flashOnMs = 0;
+static uint16_t flashOffMs = 0;
+static unsigned long flashNextToggle = 0;
+static bool flashLevel = false;
+
+// LEDs seen by statusLedWrite(), for on-time accounting
+#define STATUS_LED_MAX 4
+
+struct LedTime {
+  uint8_t pin;
+  bool on;
+  int64_t onSince;           // esp_timer time it was last switched on
+};
+
+static LedTime leds[STATUS_LED_MAX];
+static uint8_t ledCount = 0;
+static uint64_t ledOnUs = 0;   // Completed on-periods
+
+static LedTime* ledFor(uint8_t pin) {
+  for (uint8_t i = 0; i < ledCount; i++) {
+    if (leds[i].pin == pin) {
+      return &leds[i];
+    }
+  }
+  if (ledCount == STATUS_LED_MAX) {
+    return NULL;
+  }
+  LedTime* led = &leds[ledCount++];
+  led->pin = pin;
+  led->on = false;
+  return led;
+}
+
+void statusLedWrite(uint8_t pin, bool on) {
+  digitalWrite(pin, on ? HIGH : LOW);
+
+  LedTime* led = ledFor(pin);
+  if (!led || led->on == on) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  if (on) {
+    led->onSince = now;
+  } else {
+    ledOnUs += now - led->onSince;
+  }
+  led->on = on;
+}
+
+uint64_t statusLedOnTime() {
+  int64_t now = esp_timer_get_time();
+  uint64_t total = ledOnUs;
+  for (uint8_t i = 0; i < ledCount; i++) {
+    if (leds[i].on) {
+      total += now - leds[i].onSince;
+    }
+  }
+  return total;
+}
+
+void statusLedFlash(uint8_t pin, uint8_t count, uint16_t onMs, uint16_t offMs) {
+  if (flashTogglesLeft > 0) {
+    statusLedWrite(flashPin, false);
+  }
+
+  flashPin = pin;
+  flashTogglesLeft = count * 2;
+  flashOnMs = onMs;
+  flashOffMs = offMs;
+  flashLevel = false;
+  flashNextToggle = millis();
+  statusLedUpdate();
+}
+
+bool statusLedBusy() {
+  return flashTogglesLeft > 0;
+}
+
+void statusLedUpdate() {
+  if (flashTogglesLeft == 0 || (long)(millis() - flashNextToggle) < 0) {
+    return;
+  }
+
+  flashLevel = !flashLevel;
+  statusLedWrite(flashPin, flashLevel);
+  flashNextToggle = millis() + (flashLevel ? flashOnMs : flashOffMs);
+  flashTogglesLeft--;
+}
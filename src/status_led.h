@@ -0,0 +1,30 @@
+/*
+ * Non-blocking status LED flashes
+ *
+ * Replaces the delay()-based LED sequences: a flash is scheduled and then
+ * advanced from loop() via statusLedUpdate(), so indication never holds up
+ * sensor reads or BLE.
+ *
+ * Every LED write goes through statusLedWrite() so the time LEDs spend lit
+ * can be charged to them in the energy estimate.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// Flash `pin` `count` times (on for onMs, off for offMs). Replaces any
+// flash that is still running.
+void statusLedFlash(uint8_t pin, uint8_t count, uint16_t onMs, uint16_t offMs);
+
+// True while a flash is running; water status LEDs should not be touched
+bool statusLedBusy();
+
+// Advance the running flash; call every loop()
+void statusLedUpdate();
+
+// Drive a status LED, tracking how long it is lit
+void statusLedWrite(uint8_t pin, bool on);
+
+// Microseconds LEDs have been lit since boot, summed over every LED
+uint64_t statusLedOnTime();
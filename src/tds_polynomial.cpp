@@ -0,0 +1,33 @@
+#include "tds_polynomial.h"
+
+static const float TDS_A = 133.42f;
+static const float TDS_B = -255.86f;
+static const float TDS_C = 857.39f;
+
+void tdsPolynomialInit(TdsPolynomial& poly, float vref, uint16_t fullScale, float factor,
+                       float tempCoefficient, float referenceTemp, float temperature) {
+  poly.compensation = 1.0f + tempCoefficient * (temperature - referenceTemp);
+  poly.voltsPerCount = vref / fullScale / poly.compensation;
+  poly.a = TDS_A * factor;
+  poly.b = TDS_B * factor;
+  poly.c = TDS_C * factor;
+
+  // Volts per count is well below 1 for any real reference, so Q31 keeps
+  // it to 9 significant digits where Q16.16 would keep barely two
+  poly.voltsPerCountQ31 = Q31::fromFloat(poly.voltsPerCount);
+  poly.aQ = Q16_16::fromFloat(poly.a);
+  poly.bQ = Q16_16::fromFloat(poly.b);
+  poly.cQ = Q16_16::fromFloat(poly.c);
+}
+
+float tdsPolynomialFloat(const TdsPolynomial& poly, float counts) {
+  float v = counts * poly.voltsPerCount;
+  return ((poly.a * v + poly.b) * v + poly.c) * v;
+}
+
+float tdsPolynomialFixed(const TdsPolynomial& poly, float counts) {
+  // Q16.16 counts times Q31 volts per count, rounded back to Q16.16
+  Q16_16 reading = Q16_16::fromFloat(counts);
+  Q16_16 v = Q16_16::fromRaw(((int64_t)reading.raw * poly.voltsPerCountQ31.raw + (1ll << 30)) >> 31);
+  return (((poly.aQ * v + poly.bQ) * v + poly.cQ) * v).toFloat();
+}
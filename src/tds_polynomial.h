@@ -0,0 +1,39 @@
+/*
+ * TDS probe-board polynomial
+ *
+ * Converts the probe board's filtered ADC reading to ppm:
+ *
+ *   v   = counts * vref / full scale / (1 + coefficient (T - Tref))
+ *   tds = (133.42 v^3 - 255.86 v^2 + 857.39 v) * factor
+ *
+ * Everything that only depends on the calibration (the volts per count with
+ * the temperature compensation folded in, and the coefficients scaled by
+ * the probe factor) is worked out once by tdsPolynomialInit(), after the
+ * config is loaded. A reading is then one scale and a Horner evaluation,
+ * in float on boards with an FPU and in Q16.16 without one (where the only
+ * soft-float work left is converting the reading in and the result out).
+ *
+ * Plain C++ with no Arduino dependency; test/test_tds_polynomial checks
+ * both versions against a double-precision reference.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "fixed_point.h"
+
+struct TdsPolynomial {
+  float compensation;        // 1 + coefficient (T - Tref)
+  float voltsPerCount;       // Compensated volts per ADC count
+  float a, b, c;             // Cubic, square and linear terms, times the factor
+  Q31 voltsPerCountQ31;
+  Q16_16 aQ, bQ, cQ;
+};
+
+void tdsPolynomialInit(TdsPolynomial& poly, float vref, uint16_t fullScale, float factor,
+                       float tempCoefficient, float referenceTemp, float temperature);
+
+// ppm for a filtered reading in ADC counts, not clamped
+float tdsPolynomialFloat(const TdsPolynomial& poly, float counts);
+float tdsPolynomialFixed(const TdsPolynomial& poly, float counts);
@@ -0,0 +1,278 @@
+#include "tds_scanner.h"
+
+#include <esp_timer.h>
+
+#include "config.h"
+#include "lock_in.h"
+#include "timebase.h"
+#include "trace.h"
+
+#define MUX_SELECT_LINES 3
+
+enum ScanState {
+  SCAN_IDLE,
+  SCAN_RUNNING,
+  SCAN_DONE
+};
+
+static uint8_t adcPin = 0;
+static uint8_t selectPins[MUX_SELECT_LINES];
+static esp_timer_handle_t scanTimer = NULL;
+static bool muxReady = false;          // Select lines configured as outputs
+static bool haveExcitation = false;
+static bool excitationReady = false;   // Excitation pins configured as outputs
+static uint8_t excitationA = 0;
+static uint8_t excitationB = 0;
+
+// Owned by the timer callback while SCAN_RUNNING, by loop() otherwise
+static volatile ScanState state = SCAN_IDLE;
+static uint8_t probeCount = 1;
+static uint8_t samplesPerProbe = 1;
+static uint8_t channel = 0;
+static int64_t scanStartedAt = 0;
+static uint32_t busyUs = 0;
+static uint16_t samples[TDS_MAX_SAMPLES];
+static TdsScan result;
+
+// Lock-in mode: halves per probe, conversions per half, the half being
+// excited, and the polarity the current probe started with
+static bool lockIn = false;
+static uint8_t halves = 0;
+static uint8_t samplesPerHalf = 1;
+static uint32_t halfUs = 0;
+static uint8_t half = 0;
+static bool positiveFirst = true;
+static int64_t windowStartUs = 0;      // First conversion of the probe's window
+static uint16_t halfSamples[TDS_MAX_HALVES * TDS_MAX_SAMPLES_PER_HALF];
+
+static void selectChannel(uint8_t ch) {
+  if (probeCount < 2) {
+    return;
+  }
+  for (int i = 0; i < MUX_SELECT_LINES; i++) {
+    digitalWrite(selectPins[i], (ch >> i) & 1 ? HIGH : LOW);
+  }
+}
+
+static void excite(bool positive) {
+  digitalWrite(excitationA, positive ? HIGH : LOW);
+  digitalWrite(excitationB, positive ? LOW : HIGH);
+}
+
+static void exciteOff() {
+  digitalWrite(excitationA, LOW);
+  digitalWrite(excitationB, LOW);
+}
+
+static void armTimer(uint32_t us) {
+  if (scanTimer) {
+    esp_timer_start_once(scanTimer, us);
+  }
+}
+
+// Mean of the middle half of the burst: a spike from a pump relay or the
+// mux switching can't pull the reading
+static float filterBurst(uint16_t* burst, uint8_t n) {
+  for (uint8_t i = 1; i < n; i++) {
+    uint16_t value = burst[i];
+    uint8_t j = i;
+    while (j > 0 && burst[j - 1] > value) {
+      burst[j] = burst[j - 1];
+      j--;
+    }
+    burst[j] = value;
+  }
+
+  uint8_t drop = n / 4;
+  uint32_t sum = 0;
+  for (uint8_t i = drop; i < n - drop; i++) {
+    sum += burst[i];
+  }
+  return (float)sum / (n - 2 * drop);
+}
+
+static void finishScan() {
+  result.probes = probeCount;
+  result.lockIn = lockIn;
+  result.durationUs = esp_timer_get_time() - scanStartedAt;
+  result.busyUs = busyUs;
+  state = SCAN_DONE;
+}
+
+// Start exciting the selected probe; the first half also lets the mux
+// settle
+static void startLockIn() {
+  half = 0;
+  excite(positiveFirst);
+  armTimer(max(halfUs, (uint32_t)config.tdsSettleUs));
+}
+
+// The end of a half-cycle: convert while the polarity is still applied,
+// flip it for the next half, and demodulate once the probe is done (while
+// the next probe's first half runs)
+static void onHalfCycle() {
+  TRACE_BEGIN(TRACE_TDS_ADC);
+  int64_t start = timebaseNowUs();
+  uint16_t* burst = halfSamples + (uint16_t)half * samplesPerHalf;
+  for (uint8_t i = 0; i < samplesPerHalf; i++) {
+    burst[i] = analogRead(adcPin);
+  }
+  int64_t end = timebaseNowUs();
+  busyUs += end - start;
+  TRACE_END(TRACE_TDS_ADC);
+  if (half == 0) {
+    windowStartUs = start;
+  }
+
+  if (++half < halves) {
+    excite((half % 2 == 0) == positiveFirst);
+    armTimer(halfUs);
+    return;
+  }
+
+  exciteOff();
+  uint8_t converted = channel;
+  bool startedPositive = positiveFirst;
+  // Alternate the starting polarity: the odd half count leaves one half of
+  // net charge, which the next measurement takes back
+  positiveFirst = !positiveFirst;
+  bool last = converted + 1 >= probeCount;
+  if (!last) {
+    channel++;
+    selectChannel(channel);
+    startLockIn();
+  }
+
+  // The next tick runs in this same timer task, so it can't overwrite the
+  // first half of `halfSamples` before this returns
+  LockInResult demod = lockInDemodulate(halfSamples, halves, samplesPerHalf, startedPositive);
+  result.raw[converted] = demod.offset > 0 ? demod.amplitude / demod.offset : 0;
+  result.atUs[converted] = windowStartUs + (end - windowStartUs) / 2;
+
+  if (last) {
+    finishScan();
+  }
+}
+
+// The selected probe has settled: convert it, move the mux on, then
+// filter while the next probe settles
+static void onSettled(void* arg) {
+  if (lockIn) {
+    onHalfCycle();
+    return;
+  }
+
+  TRACE_BEGIN(TRACE_TDS_ADC);
+  int64_t start = timebaseNowUs();
+  for (uint8_t i = 0; i < samplesPerProbe; i++) {
+    samples[i] = analogRead(adcPin);
+  }
+  int64_t end = timebaseNowUs();
+  busyUs += end - start;
+  TRACE_END(TRACE_TDS_ADC);
+
+  uint8_t converted = channel;
+  bool last = converted + 1 >= probeCount;
+  if (!last) {
+    channel++;
+    selectChannel(channel);
+    armTimer(config.tdsSettleUs);
+  }
+
+  // The next callback runs in this same timer task, so it can't touch
+  // `samples` before this returns
+  result.raw[converted] = filterBurst(samples, samplesPerProbe);
+  TimeBlock block = timeBlockSpan(start, end, samplesPerProbe);
+  result.atUs[converted] = block.firstUs + (int64_t)((samplesPerProbe - 1) * block.periodUs / 2);
+
+  if (last) {
+    finishScan();
+  }
+}
+
+void tdsScannerBegin(uint8_t pin, uint8_t s0, uint8_t s1, uint8_t s2) {
+  adcPin = pin;
+  selectPins[0] = s0;
+  selectPins[1] = s1;
+  selectPins[2] = s2;
+
+  esp_timer_create_args_t args = {};
+  args.callback = onSettled;
+  args.name = "tdsScan";
+  if (esp_timer_create(&args, &scanTimer) != ESP_OK) {
+    scanTimer = NULL;
+    Serial.println("TDS: scan timer unavailable, scanning in line");
+  }
+}
+
+void tdsScannerSetExcitation(uint8_t pinA, uint8_t pinB) {
+  excitationA = pinA;
+  excitationB = pinB;
+  haveExcitation = true;
+}
+
+bool tdsScanStart() {
+  if (state == SCAN_RUNNING) {
+    return false;
+  }
+
+  // Settings are read once per scan, so a config change applies to the next
+  probeCount = constrain(config.tdsProbeCount, (uint32_t)1, (uint32_t)TDS_MAX_PROBES);
+  samplesPerProbe = constrain(config.tdsSamplesPerProbe, (uint32_t)1, (uint32_t)TDS_MAX_SAMPLES);
+  lockIn = haveExcitation && config.tdsLockInHalves >= 3;
+  if (lockIn) {
+    // An odd count, so the window starts and ends on the same polarity
+    halves = min(config.tdsLockInHalves, (uint32_t)TDS_MAX_HALVES) | 1;
+    samplesPerHalf = constrain(config.tdsLockInSamplesPerHalf, (uint32_t)1, (uint32_t)TDS_MAX_SAMPLES_PER_HALF);
+    halfUs = config.tdsExcitationHalfUs;
+  }
+
+  // The select lines are only claimed once a mux is configured
+  if (probeCount > 1 && !muxReady) {
+    for (int i = 0; i < MUX_SELECT_LINES; i++) {
+      pinMode(selectPins[i], OUTPUT);
+    }
+    muxReady = true;
+  }
+  if (lockIn && !excitationReady) {
+    pinMode(excitationA, OUTPUT);
+    pinMode(excitationB, OUTPUT);
+    exciteOff();
+    excitationReady = true;
+  }
+
+  channel = 0;
+  busyUs = 0;
+  scanStartedAt = esp_timer_get_time();
+  state = SCAN_RUNNING;
+
+  selectChannel(0);
+  if (lockIn) {
+    startLockIn();
+  } else {
+    armTimer(config.tdsSettleUs);
+  }
+  if (scanTimer) {
+    return true;
+  }
+
+  // Without the timer, settle and convert in line
+  while (state == SCAN_RUNNING) {
+    delayMicroseconds(lockIn ? (half == 0 ? max(halfUs, (uint32_t)config.tdsSettleUs) : halfUs) : config.tdsSettleUs);
+    onSettled(NULL);
+  }
+  return true;
+}
+
+bool tdsScanBusy() {
+  return state == SCAN_RUNNING;
+}
+
+bool tdsScanTake(TdsScan& scan) {
+  if (state != SCAN_DONE) {
+    return false;
+  }
+  scan = result;
+  state = SCAN_IDLE;
+  return true;
+}
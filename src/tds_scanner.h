@@ -0,0 +1,70 @@
+/*
+ * Multi-probe TDS scanning through a CD4051 analog multiplexer
+ *
+ * Up to eight TDS probe boards feed one ADC pin through a CD4051 (select
+ * lines S0-S2, INH tied low). A scan steps through the probes from an
+ * esp_timer callback instead of blocking loop():
+ *
+ *   select probe 0 ... settle ... convert 0, select 1 ... settle ...
+ *                                 filter 0                convert 1, select 2 ...
+ *
+ * As soon as a probe's burst of conversions is taken the mux moves on, so
+ * filtering each probe's samples overlaps the next probe's settle time
+ * and the CPU is only busy for the conversions themselves. loop() starts
+ * a scan and picks up the result when it is complete.
+ *
+ * With config.tdsProbeCount = 1 no mux is needed: the probe is wired to
+ * the ADC pin directly and the select lines are left alone.
+ *
+ * Lock-in mode (config.tdsLockInHalves >= 3) is for bare probes: each
+ * probe is wired between excitation pin B and the ADC node, with a
+ * reference resistor from the node to excitation pin A. Instead of one
+ * burst, the probe gets tdsLockInHalves half-cycles of alternating
+ * polarity (A high/B low, then A low/B high, ...); every timer tick
+ * converts a short burst at the end of the half and flips the polarity,
+ * so each conversion's polarity is known exactly. lockInDemodulate()
+ * turns the bursts into the response, free of offset and drift. Between
+ * measurements both pins are low, and the starting polarity alternates,
+ * so the probe sees no net DC.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define TDS_MAX_PROBES 8
+
+// Longest burst of conversions per probe
+#define TDS_MAX_SAMPLES 16
+
+// Lock-in mode limits
+#define TDS_MAX_HALVES 15
+#define TDS_MAX_SAMPLES_PER_HALF 4
+
+struct TdsScan {
+  uint8_t probes;
+  bool lockIn;                 // Measured in lock-in mode
+  float raw[TDS_MAX_PROBES];   // Filtered ADC reading per probe (0-4095); in
+                               // lock-in mode the response amplitude over
+                               // its offset (-1 to 1)
+  int64_t atUs[TDS_MAX_PROBES];  // Timebase time each value stands for: the
+                                 // middle of its conversions
+  uint32_t durationUs;         // Scan start to last conversion
+  uint32_t busyUs;             // Time spent converting
+};
+
+// Set the pins and create the scan timer; the select lines become outputs
+// on the first scan with more than one probe
+void tdsScannerBegin(uint8_t adcPin, uint8_t s0, uint8_t s1, uint8_t s2);
+
+// Excitation pins for lock-in mode; they become outputs on the first
+// lock-in scan and are held low between measurements
+void tdsScannerSetExcitation(uint8_t pinA, uint8_t pinB);
+
+// Start a scan of config.tdsProbeCount probes; false while one is running
+bool tdsScanStart();
+
+bool tdsScanBusy();
+
+// Fetch a completed scan; true once per scan
+bool tdsScanTake(TdsScan& scan);
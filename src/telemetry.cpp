@@ -0,0 +1,415 @@
+#include "telemetry.h"
+
+#include "cbor.h"
+#include "config.h"
+#include "crc32.h"
+#include "record_cache.h"
+#include "record_schema.h"
+
+static const char* DEVICE_ID = "ESP32-WaterSensor";
+
+static const int32_t POW10[] = {1, 10, 100, 1000, 10000};
+
+// JSON objects, or CBOR indefinite-length maps so the field count never
+// has to be known up front
+#define JSON_FRAMING "{", ",", "}"
+#define CBOR_FRAMING "\xBF", NULL, "\xFF"
+
+// Binary records start with this byte and the record id
+#define BINARY_MAGIC 0xB1
+
+// Bytes around a Text field's characters at most: the quotes in JSON, a
+// CBOR text head for 24-255 characters, the length byte in binary
+#define TEXT_FRAMING 2
+
+// The longest Text field (the diagnostics' cpuTasks) fits whole, after its
+// key in the widest format (JSON)
+static_assert(sizeof("\"cpuTasks\":") - 1 + sizeof(DeviceDiagnostics::cpuTasks) - 1 + TEXT_FRAMING <= RECORD_CACHE_FRAGMENT,
+              "cpuTasks doesn't fit a record cache fragment");
+
+// Longest value of each field kind in JSON, the widest format (CBOR's
+// heads and binary's fixed widths are never longer). A Text field is
+// bounded by its fragment.
+#define VALUE_MAX_Fixed      12   // -2147483648 with a decimal point
+#define VALUE_MAX_UInt       10
+#define VALUE_MAX_QuotedUInt 12
+#define VALUE_MAX_Int        11
+#define VALUE_MAX_Hex        10   // Quoted, 8 digits
+#define VALUE_MAX_Bool       5
+#define VALUE_MAX_Status     20   // "vibration_detected"
+#define VALUE_MAX_Text       RECORD_CACHE_FRAGMENT
+
+#define COUNT_FIELD(key, kind, value, arg, present) + 1
+// Quoted key, colon, value and separator
+#define FIELD_MAX(key, kind, value, arg, present) + (sizeof(key) + 3 + VALUE_MAX_##kind)
+
+// One cache per record, shared by the formats (only one is in use at a
+// time), with a slot per field plus the binary presence mask and an
+// output buffer for the record at its longest: the framing and the mask
+// (binary's magic, id and mask are longer than the braces) and every field
+#define RECORD_CACHE(name, id, FIELDS) \
+  static const char name##BinaryPrefix[] = { (char)BINARY_MAGIC, (char)(id), 0 }; \
+  static RecordCache::Slot name##Slots[1 FIELDS(COUNT_FIELD)]; \
+  static uint8_t name##Output[6 FIELDS(FIELD_MAX)]; \
+  static_assert(sizeof(name##Output) <= RECORD_CACHE_OUTPUT, #name " records are longer than RECORD_CACHE_OUTPUT"); \
+  static RecordCache name##Cache(name##Slots, sizeof(name##Slots) / sizeof(RecordCache::Slot), \
+                                 name##Output, sizeof(name##Output));
+
+RECORD_CACHE(legacy, RECORD_ID_LEGACY, LEGACY_RECORD_FIELDS)
+RECORD_CACHE(live, RECORD_ID_LIVE, LIVE_RECORD_FIELDS)
+RECORD_CACHE(vibration, RECORD_ID_VIBRATION, VIBRATION_RECORD_FIELDS)
+RECORD_CACHE(alert, RECORD_ID_ALERT, ALERT_RECORD_FIELDS)
+RECORD_CACHE(stats, RECORD_ID_STATS, STATS_RECORD_FIELDS)
+RECORD_CACHE(diagnostics, RECORD_ID_DIAGNOSTICS, DIAGNOSTICS_RECORD_FIELDS)
+RECORD_CACHE(history, RECORD_ID_HISTORY, HISTORY_RECORD_FIELDS)
+
+const char* waterStatusName(WaterStatus status) {
+  switch (status) {
+#define STATUS_NAME_CASE(value, name) case value: return name;
+    WATER_STATUS_NAMES(STATUS_NAME_CASE)
+#undef STATUS_NAME_CASE
+    default: return "unknown";
+  }
+}
+
+const char* payloadFormatName(PayloadFormat format) {
+  switch (format) {
+    case PAYLOAD_CBOR:   return "cbor";
+    case PAYLOAD_BINARY: return "binary";
+    default:             return "json";
+  }
+}
+
+// === Field formatting ===
+
+// Value rounded to the precision it is sent with; this is also the
+// field's cache identity
+static int32_t quantize(float value, uint8_t decimals) {
+  return (int32_t)lroundf(value * POW10[decimals]);
+}
+
+// Write q / 10^decimals as decimal text. Formatting from the rounded
+// integer (not the float) keeps the text identical for equal identities.
+static size_t formatFixed(char* out, int32_t q, uint8_t decimals) {
+  char digits[12];
+  size_t n = 0;
+  bool negative = q < 0;
+  uint32_t magnitude = negative ? (uint32_t)(-(int64_t)q) : (uint32_t)q;
+
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0 || n <= decimals);
+
+  size_t len = 0;
+  if (negative) {
+    out[len++] = '-';
+  }
+  while (n > 0) {
+    out[len++] = digits[--n];
+    if (n == decimals && decimals > 0) {
+      out[len++] = '.';
+    }
+  }
+  return len;
+}
+
+static size_t writeLE32(uint8_t* out, uint32_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+  return 4;
+}
+
+// Binary fields carry no key: the schema gives their order
+static size_t writeKey(uint8_t* out, PayloadFormat format, const char* key) {
+  if (format == PAYLOAD_BINARY) {
+    return 0;
+  }
+  size_t keyLen = strlen(key);
+  if (format == PAYLOAD_CBOR) {
+    return cborText(out, key, keyLen);
+  }
+  out[0] = '"';
+  memcpy(out + 1, key, keyLen);
+  out[keyLen + 1] = '"';
+  out[keyLen + 2] = ':';
+  return keyLen + 3;
+}
+
+// Every put function takes the schema's `arg` (see record_schema.h);
+// only Fixed and Text use it
+
+static void putFixed(RecordCache& rc, PayloadFormat format, const char* key, float value, uint8_t decimals) {
+  int32_t q = quantize(value, decimals);
+  if (rc.field(q)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    if (format == PAYLOAD_BINARY) {
+      len += writeLE32(out + len, q);
+    } else if (format == PAYLOAD_CBOR) {
+      len += cborDecimal(out + len, q, decimals);
+    } else {
+      len += formatFixed((char*)out + len, q, decimals);
+    }
+    rc.commit(len);
+  }
+}
+
+static void putUIntField(RecordCache& rc, PayloadFormat format, const char* key, uint32_t value, bool quoted) {
+  if (rc.field((int32_t)value)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    if (format == PAYLOAD_BINARY) {
+      len += writeLE32(out + len, value);
+    } else if (format == PAYLOAD_CBOR) {
+      len += cborUInt(out + len, value);
+    } else {
+      len += snprintf((char*)out + len, RECORD_CACHE_FRAGMENT - len, quoted ? "\"%lu\"" : "%lu", (unsigned long)value);
+    }
+    rc.commit(len);
+  }
+}
+
+static void putUInt(RecordCache& rc, PayloadFormat format, const char* key, uint32_t value, int32_t) {
+  putUIntField(rc, format, key, value, false);
+}
+
+// A string in JSON (the legacy timestamp), a number otherwise
+static void putQuotedUInt(RecordCache& rc, PayloadFormat format, const char* key, uint32_t value, int32_t) {
+  putUIntField(rc, format, key, value, true);
+}
+
+static void putInt(RecordCache& rc, PayloadFormat format, const char* key, int32_t value, int32_t) {
+  if (rc.field(value)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    if (format == PAYLOAD_BINARY) {
+      len += writeLE32(out + len, (uint32_t)value);
+    } else if (format == PAYLOAD_CBOR) {
+      len += cborInt(out + len, value);
+    } else {
+      len += snprintf((char*)out + len, RECORD_CACHE_FRAGMENT - len, "%ld", (long)value);
+    }
+    rc.commit(len);
+  }
+}
+
+// Hashes travel as hex text in JSON and CBOR
+static void putHex(RecordCache& rc, PayloadFormat format, const char* key, uint32_t value, int32_t) {
+  if (rc.field((int32_t)value)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    if (format == PAYLOAD_BINARY) {
+      len += writeLE32(out + len, value);
+      rc.commit(len);
+      return;
+    }
+    char hex[9];
+    int hexLen = snprintf(hex, sizeof(hex), "%lx", (unsigned long)value);
+    if (format == PAYLOAD_CBOR) {
+      len += cborText(out + len, hex, hexLen);
+    } else {
+      len += snprintf((char*)out + len, RECORD_CACHE_FRAGMENT - len, "\"%s\"", hex);
+    }
+    rc.commit(len);
+  }
+}
+
+static void putBool(RecordCache& rc, PayloadFormat format, const char* key, bool value, int32_t) {
+  if (rc.field(value ? 1 : 0)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    if (format == PAYLOAD_BINARY) {
+      out[len++] = value ? 1 : 0;
+    } else if (format == PAYLOAD_CBOR) {
+      len += cborBool(out + len, value);
+    } else {
+      const char* text = value ? "true" : "false";
+      memcpy(out + len, text, strlen(text));
+      len += strlen(text);
+    }
+    rc.commit(len);
+  }
+}
+
+// `identity` must change whenever `text` does (enum value, 0 for constants).
+// Text that doesn't fit the fragment after its key is cut short.
+static void putText(RecordCache& rc, PayloadFormat format, const char* key, const char* text, int32_t identity) {
+  if (rc.field(identity)) {
+    uint8_t* out = rc.fragment();
+    size_t len = writeKey(out, format, key);
+    size_t textLen = min(strlen(text), (size_t)RECORD_CACHE_FRAGMENT - len - TEXT_FRAMING);
+    if (format == PAYLOAD_BINARY) {
+      out[len++] = textLen;
+      memcpy(out + len, text, textLen);
+      len += textLen;
+    } else if (format == PAYLOAD_CBOR) {
+      len += cborText(out + len, text, textLen);
+    } else {
+      out[len++] = '"';
+      memcpy(out + len, text, textLen);
+      len += textLen;
+      out[len++] = '"';
+    }
+    rc.commit(len);
+  }
+}
+
+// The name in JSON and CBOR, the enum value in binary
+static void putStatus(RecordCache& rc, PayloadFormat format, const char* key, WaterStatus status, int32_t) {
+  if (format == PAYLOAD_BINARY) {
+    if (rc.field(status)) {
+      rc.fragment()[0] = status;
+      rc.commit(1);
+    }
+    return;
+  }
+  putText(rc, format, key, waterStatusName(status), status);
+}
+
+// Binary records start with a bit per schema field, set if it is present
+static void putPresence(RecordCache& rc, uint32_t mask) {
+  if (rc.field((int32_t)mask)) {
+    rc.commit(writeLE32(rc.fragment(), mask));
+  }
+}
+
+// === Records ===
+// The field lists live in record_schema.h; each record expands its list
+// into calls of the put functions above, so the format only changes how
+// the fields are written.
+
+#define PUT_FIELD(key, kind, value, arg, present) \
+  if (present) { put##kind(rc, format, key, value, arg); } else { rc.skip(); }
+#define MASK_FIELD(key, kind, value, arg, present) \
+  if (present) { mask |= 1UL << bit; } bit++;
+static void frameRecord(RecordCache& rc, PayloadFormat format, const char* binaryPrefix) {
+  switch (format) {
+    case PAYLOAD_CBOR:   rc.frame(CBOR_FRAMING); break;
+    case PAYLOAD_BINARY: rc.frame(binaryPrefix, NULL, NULL); break;
+    default:             rc.frame(JSON_FRAMING); break;
+  }
+}
+
+#define ENCODE_RECORD(name, FIELDS) \
+  static_assert(0 FIELDS(COUNT_FIELD) < RECORD_CACHE_MAX_FIELDS, "Too many fields for the record cache"); \
+  RecordCache& rc = name##Cache; \
+  frameRecord(rc, format, name##BinaryPrefix); \
+  rc.begin(); \
+  if (format == PAYLOAD_BINARY) { \
+    uint32_t mask = 0; \
+    uint8_t bit = 0; \
+    FIELDS(MASK_FIELD) \
+    putPresence(rc, mask); \
+  } \
+  FIELDS(PUT_FIELD) \
+  return rc.finish(len);
+
+static const uint8_t* encodeFullRecord(const WaterReading& r, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(legacy, LEGACY_RECORD_FIELDS)
+}
+
+const uint8_t* encodeWaterQualityJSON(const WaterReading& reading, size_t* len) {
+  return encodeFullRecord(reading, PAYLOAD_JSON, len);
+}
+
+const uint8_t* encodeLive(const WaterReading& r, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(live, LIVE_RECORD_FIELDS)
+}
+
+const uint8_t* encodeVibration(const WaterReading& r, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(vibration, VIBRATION_RECORD_FIELDS)
+}
+
+const uint8_t* encodeAlert(const WaterReading& r, WaterStatus previousStatus, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(alert, ALERT_RECORD_FIELDS)
+}
+
+const uint8_t* encodeStats(const ReadingStats& r, uint32_t timestamp, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(stats, STATS_RECORD_FIELDS)
+}
+
+const uint8_t* encodeDiagnostics(const DeviceDiagnostics& r, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(diagnostics, DIAGNOSTICS_RECORD_FIELDS)
+}
+
+const uint8_t* encodeHistory(const HistoryRecord& r, PayloadFormat format, size_t* len) {
+  ENCODE_RECORD(history, HISTORY_RECORD_FIELDS)
+}
+
+// === Benchmark ===
+
+// The String-built JSON the firmware used before the encoders above, kept
+// as the benchmark baseline
+static String generateWaterQualityJSON(const WaterReading& reading) {
+  String jsonData = "{";
+  jsonData += "\"pH\":" + String(reading.pH, 2) + ",";
+  jsonData += "\"temperature\":" + String(reading.temperature, 1) + ",";
+  jsonData += "\"tds\":" + String(reading.tds, 1) + ",";
+  jsonData += "\"turbidity\":" + String(reading.turbidity, 2) + ",";
+  jsonData += "\"vibration\":" + String(reading.vibration, 2) + ",";
+  jsonData += "\"vibrationDetected\":" + String(reading.vibrationDetected ? "true" : "false") + ",";
+  jsonData += "\"waterStatus\":\"" + String(waterStatusName(reading.waterStatus)) + "\",";
+  jsonData += "\"timestamp\":\"" + String(reading.timestamp) + "\",";
+  jsonData += "\"deviceId\":\"ESP32-WaterSensor\",";
+  jsonData += "\"status\":\"active\",";
+  jsonData += "\"configHash\":\"" + String(configHash(), HEX) + "\"";
+  jsonData += "}";
+  return jsonData;
+}
+
+static void printBenchmarkLine(const char* name, size_t bytes, int64_t elapsedUs, uint32_t iterations) {
+  Serial.print("Bench: ");
+  Serial.print(name);
+  Serial.print(" ");
+  Serial.print((unsigned)bytes);
+  Serial.print(" bytes, ");
+  Serial.print((double)elapsedUs / iterations, 2);
+  Serial.println(" us/record");
+}
+
+void runPayloadBenchmark(const WaterReading& reading, uint32_t iterations) {
+  if (iterations == 0) {
+    return;
+  }
+
+  // Baseline: String concatenation with heap allocations
+  size_t baselineLen = 0;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    baselineLen = generateWaterQualityJSON(reading).length();
+  }
+  printBenchmarkLine("string-json", baselineLen, esp_timer_get_time() - start, iterations);
+
+  // Leave the caches as they were for the live streams
+  RecordCacheStats savedStats = recordCacheStats;
+
+  for (int f = 0; f < PAYLOAD_FORMAT_COUNT; f++) {
+    PayloadFormat format = (PayloadFormat)f;
+    size_t len = 0;
+    char name[24];
+
+    // Cold: every field re-encoded (a reading where everything changed)
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+      legacyCache.invalidate();
+      encodeFullRecord(reading, format, &len);
+    }
+    snprintf(name, sizeof(name), "%s-cold", payloadFormatName(format));
+    printBenchmarkLine(name, len, esp_timer_get_time() - start, iterations);
+
+    // Cached: steady state, nothing changed since the last reading
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+      encodeFullRecord(reading, format, &len);
+    }
+    snprintf(name, sizeof(name), "%s-cached", payloadFormatName(format));
+    printBenchmarkLine(name, len, esp_timer_get_time() - start, iterations);
+
+    legacyCache.invalidate();
+  }
+
+  recordCacheStats = savedStats;
+}
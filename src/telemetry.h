@@ -0,0 +1,123 @@
+/*
+ * Telemetry records and their encoders
+ *
+ * The sensor loop fills a WaterReading; the encoders here turn it into the
+ * payload of each BLE stream, as JSON, CBOR or compact binary. Every
+ * format is produced from the same field list (record_schema.h), so they
+ * always carry the same schema. Every format keeps its own RecordCache,
+ * so fields are only re-encoded when their rounded value changes and an
+ * unchanged record is returned as-is.
+ *
+ * Returned pointers refer to the format's cache buffer and stay valid
+ * until that format is encoded again.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "history_format.h"
+
+enum WaterStatus {
+  STATUS_UNKNOWN,
+  STATUS_CLEAN,
+  STATUS_UNSAFE,
+  STATUS_EXTREMELY_UNSAFE,
+  STATUS_VIBRATION_DETECTED
+};
+
+struct WaterReading {
+  float pH;                  // Simulated for now
+  float temperature;         // °C, from MPU6050
+  float tds;                 // ppm
+  float turbidity;           // NTU, simulated for now
+  float vibration;           // m/s², gravity removed
+  float xAxis;               // m/s² per axis, gravity removed from Z
+  float yAxis;
+  float zAxis;
+  bool vibrationDetected;
+  WaterStatus waterStatus;
+  uint32_t timestamp;        // millis() when the reading was taken
+  uint32_t seq;              // History sequence number, 0 if not logged
+  float batteryVoltage;      // V, 0 when running without a cell
+  uint8_t batteryLevel;      // % state of charge
+  uint8_t tdsProbes;         // Probes scanned; tds is tdsProbe[0]
+  float tdsProbe[8];         // ppm per probe (TDS_MAX_PROBES)
+  uint8_t mpuUnits;          // MPU6050s sampled; the axes and vibration are unit 0's
+  float vibrationRms[2];     // m/s² per unit since the previous reading (MPU_MAX_UNITS)
+  float vibrationPeak[2];
+  uint32_t tdsAt;            // Timebase ms the TDS value (probe 0) stands for
+  uint32_t vibrationPeakAt[2];  // Timebase ms of each unit's peak
+};
+
+// Aggregates for the stats stream
+struct ReadingStats {
+  uint32_t samples;
+  float tdsMin;
+  float tdsMax;
+  float tdsMean;
+  float vibrationMax;
+  uint32_t vibrationEvents;
+
+  // Estimated consumption over the same window (see energy.h), per
+  // subsystem: cpu, radio, adc, sensors, led
+  float energyMahPerDay[5];
+  float energyTotalMahPerDay;
+
+  // Radio power adaptation at the end of the window (see radio_power.h)
+  int8_t rssi;
+  int8_t txPowerDbm;
+  uint32_t radioOnSavedMs;     // Since boot
+};
+
+struct DeviceDiagnostics {
+  uint32_t uptime;           // ms
+  uint32_t freeHeap;         // bytes
+  uint32_t bootMs;           // Reset to first reading
+  const char* mpuStatus;     // "ready", "missing" or "pending"
+  uint32_t configHash;
+
+  // Outbound queue per class (alert, status, live, bulk)
+  uint8_t queueDepth[4];
+  uint32_t queueLatencyUs[4];  // Average enqueue-to-send time
+
+  // Notification totals over all classes
+  uint32_t notifySent;
+  uint32_t notifyCoalesced;
+  uint32_t notifyDropped;
+  uint32_t notifyCongestion;   // Link congestion events
+
+  // CPU use over the last run-time stats window; left out when unavailable
+  bool cpuLoadAvailable;
+  float cpuLoad;               // % of CPU time not spent idle
+  char cpuTasks[36];           // Busiest tasks, "name:percent,..." (fits a record cache fragment)
+};
+
+// Payload encodings for the per-stream characteristics
+enum PayloadFormat {
+  PAYLOAD_JSON,
+  PAYLOAD_CBOR,           // Same field names and precision as the JSON
+  PAYLOAD_BINARY,         // Schema order, no keys; decoded by RecordSchema.js
+  PAYLOAD_FORMAT_COUNT
+};
+
+// Status names as sent to the app ("clean", "unsafe", ...)
+const char* waterStatusName(WaterStatus status);
+
+const char* payloadFormatName(PayloadFormat format);
+
+// Full record on the legacy characteristic (always JSON for the app)
+const uint8_t* encodeWaterQualityJSON(const WaterReading& reading, size_t* len);
+
+const uint8_t* encodeLive(const WaterReading& reading, PayloadFormat format, size_t* len);
+const uint8_t* encodeVibration(const WaterReading& reading, PayloadFormat format, size_t* len);
+const uint8_t* encodeAlert(const WaterReading& reading, WaterStatus previousStatus, PayloadFormat format, size_t* len);
+const uint8_t* encodeStats(const ReadingStats& stats, uint32_t timestamp, PayloadFormat format, size_t* len);
+const uint8_t* encodeDiagnostics(const DeviceDiagnostics& diag, PayloadFormat format, size_t* len);
+
+// A record of the history log, read in place (axes are not logged)
+const uint8_t* encodeHistory(const HistoryRecord& record, PayloadFormat format, size_t* len);
+
+// Encode the legacy record with every format, cold and cached, and print
+// size and per-record encode time against the original String-built JSON
+void runPayloadBenchmark(const WaterReading& reading, uint32_t iterations);
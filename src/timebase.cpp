@@ -0,0 +1,61 @@
+#include "timebase.h"
+
+// How far each block pulls the prediction (phase) and the period towards
+// the observed read time; small, so read latency jitter averages out
+#define PHASE_GAIN 0.1f
+#define PERIOD_GAIN 0.01f
+
+// The estimate never strays further than this from nominal (oscillator
+// tolerance plus margin)
+#define PERIOD_TOLERANCE 0.05f
+
+TimeBlock timeBlockSpan(int64_t startUs, int64_t endUs, uint16_t count) {
+  TimeBlock block;
+  block.count = count;
+  // Each conversion is taken at the middle of its slot
+  block.periodUs = count > 0 ? (float)(endUs - startUs) / count : 0;
+  block.firstUs = startUs + (int64_t)(block.periodUs / 2);
+  return block;
+}
+
+void sampleClockBegin(SampleClock& clock, float nominalPeriodUs) {
+  clock.periodUs = nominalPeriodUs;
+  clock.nominalPeriodUs = nominalPeriodUs;
+  clock.lastSampleUs = 0;
+  clock.anchored = false;
+}
+
+void sampleClockRestart(SampleClock& clock) {
+  clock.anchored = false;
+}
+
+TimeBlock sampleClockStamp(SampleClock& clock, int64_t readUs, uint16_t count, uint16_t pending) {
+  TimeBlock block;
+  block.count = count;
+  block.periodUs = clock.periodUs;
+  if (count == 0) {
+    block.firstUs = clock.lastSampleUs + (int64_t)clock.periodUs;
+    return block;
+  }
+
+  // The newest sample in the FIFO was taken somewhere in the last period
+  // before the read; on average half a period
+  int64_t observedLastUs = readUs - (int64_t)(clock.periodUs * (pending + 0.5f));
+
+  if (!clock.anchored) {
+    clock.lastSampleUs = observedLastUs;
+    clock.anchored = true;
+  } else {
+    int64_t predictedUs = clock.lastSampleUs + (int64_t)(count * clock.periodUs);
+    float errorUs = observedLastUs - predictedUs;
+    clock.periodUs += PERIOD_GAIN * errorUs / count;
+    clock.periodUs = constrain(clock.periodUs,
+                               clock.nominalPeriodUs * (1 - PERIOD_TOLERANCE),
+                               clock.nominalPeriodUs * (1 + PERIOD_TOLERANCE));
+    clock.lastSampleUs = predictedUs + (int64_t)(PHASE_GAIN * errorUs);
+  }
+
+  block.periodUs = clock.periodUs;
+  block.firstUs = clock.lastSampleUs - (int64_t)((count - 1) * clock.periodUs);
+  return block;
+}
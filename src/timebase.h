@@ -0,0 +1,59 @@
+/*
+ * Common acquisition timebase
+ *
+ * Every acquisition is stamped in microseconds on esp_timer, the 64-bit
+ * monotonic clock millis() is derived from, so TDS conversions, MPU6050
+ * FIFO samples and reading timestamps can be compared directly.
+ *
+ * A block of samples is stamped as a whole (first sample time and sample
+ * period) and individual samples are interpolated from it. ADC bursts are
+ * stamped from the clock around the conversions. FIFO drains only know
+ * when the FIFO was read, not when each frame was taken, so a SampleClock
+ * follows the sensor's own oscillator: it predicts where each new block
+ * lands from the previous one and the estimated period, and pulls the
+ * prediction and the period gently towards the observed read times, which
+ * keeps I2C latency jitter out of the per-sample times.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+struct TimeBlock {
+  int64_t firstUs;           // Timebase time of the first sample
+  float periodUs;            // Time between samples
+  uint16_t count;
+};
+
+// The common timebase, in µs since boot
+inline int64_t timebaseNowUs() {
+  return esp_timer_get_time();
+}
+
+// Interpolated time of sample `index` of a block
+inline int64_t timeBlockSampleUs(const TimeBlock& block, uint16_t index) {
+  return block.firstUs + (int64_t)(index * block.periodUs);
+}
+
+// A block taken by conversions between startUs and endUs, evenly spaced
+TimeBlock timeBlockSpan(int64_t startUs, int64_t endUs, uint16_t count);
+
+// Tracks the sample clock of a FIFO-buffered sensor
+struct SampleClock {
+  float periodUs;            // Estimated actual sample period
+  float nominalPeriodUs;     // Configured period, the estimate's starting point
+  int64_t lastSampleUs;      // Time of the newest sample stamped
+  bool anchored;             // False until the first block after a restart
+};
+
+// Start tracking a sensor sampling every nominalPeriodUs
+void sampleClockBegin(SampleClock& clock, float nominalPeriodUs);
+
+// The sensor restarted sampling (e.g. FIFO reset); re-anchor at the next
+// block but keep the period estimate
+void sampleClockRestart(SampleClock& clock);
+
+// Stamp `count` samples read from the FIFO at readUs, with `pending`
+// newer samples left queued behind them
+TimeBlock sampleClockStamp(SampleClock& clock, int64_t readUs, uint16_t count, uint16_t pending);
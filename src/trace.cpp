@@ -0,0 +1,197 @@
+#include "trace.h"
+
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#define TRACE_EVENTS 256
+#define TRACE_TASKS 12
+#define TRACE_TASK_NAME 16
+#define TRACE_MAGIC 0x54524332  // "TRC2" (microsecond timestamps)
+
+// Longest event run per dump line
+#define TRACE_EVENTS_PER_LINE 8
+#define TRACE_EVENT_HEX 16
+
+struct TraceEvent {
+  uint32_t us;               // esp_timer_get_time(), wraps every 71 minutes
+  uint8_t point;             // TracePoint
+  uint8_t phase;             // TracePhase
+  uint8_t task;              // Index into taskNames
+  uint8_t arg;
+};
+
+struct TraceBuffer {
+  uint32_t magic;
+  uint32_t written;          // Events ever recorded; next slot is written % TRACE_EVENTS
+  uint32_t dropped;          // Events skipped while a dump was running
+  uint8_t taskCount;
+  char taskNames[TRACE_TASKS][TRACE_TASK_NAME];
+  TraceEvent events[TRACE_EVENTS];
+};
+
+static const char* const POINT_NAMES[TRACE_POINT_COUNT] = {
+  "reading", "mpu_init", "mpu_read", "tds_adc", "history_append", "backfill",
+  "ble_notify", "serial", "config_save", "ble_connect", "ble_disconnect", "ble_congested"
+};
+
+// Survives a software reset; checked against TRACE_MAGIC before use
+static RTC_NOINIT_ATTR TraceBuffer ring;
+
+// Task handles matching ring.taskNames (handles mean nothing after a reset)
+static TaskHandle_t taskHandles[TRACE_TASKS];
+
+static TraceBuffer* faultTrace = NULL;
+static volatile uint8_t paused = 0;     // Dumps of the live ring in progress
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+void traceBegin() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool fault = reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+               reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT;
+
+  if (fault && ring.magic == TRACE_MAGIC && ring.written > 0 && ring.taskCount <= TRACE_TASKS) {
+    faultTrace = (TraceBuffer*)malloc(sizeof(TraceBuffer));
+    if (faultTrace) {
+      memcpy(faultTrace, &ring, sizeof(TraceBuffer));
+    }
+  }
+
+  memset(&ring, 0, sizeof(ring));
+  ring.magic = TRACE_MAGIC;
+}
+
+// Index of the task in the name table, adding it on first use. Called with
+// traceMux held.
+static uint8_t taskIndex(TaskHandle_t task) {
+  for (uint8_t i = 0; i < ring.taskCount; i++) {
+    if (taskHandles[i] == task) {
+      return i;
+    }
+  }
+  if (ring.taskCount == TRACE_TASKS) {
+    return TRACE_TASKS - 1;  // Table full: share the last entry
+  }
+  uint8_t i = ring.taskCount++;
+  taskHandles[i] = task;
+  strncpy(ring.taskNames[i], pcTaskGetName(task), TRACE_TASK_NAME - 1);
+  ring.taskNames[i][TRACE_TASK_NAME - 1] = '\0';
+  return i;
+}
+
+void traceRecord(TracePoint point, TracePhase phase, uint8_t arg) {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&traceMux);
+  if (paused) {
+    ring.dropped++;
+  } else {
+    // Read inside the lock so events are stored in timestamp order
+    TraceEvent& event = ring.events[ring.written % TRACE_EVENTS];
+    event.us = (uint32_t)esp_timer_get_time();
+    event.point = point;
+    event.phase = phase;
+    event.task = taskIndex(task);
+    event.arg = arg;
+    ring.written++;
+  }
+  portEXIT_CRITICAL(&traceMux);
+}
+
+bool traceHasFault() {
+  return faultTrace != NULL;
+}
+
+// === Dump ===
+// BEGIN, one NAME line per trace point, one TASK line per task, EV lines
+// with the events oldest first, END.
+
+static const TraceBuffer* dumpBuffer(const TraceDumpCursor& cursor) {
+  return cursor.source == TRACE_SOURCE_FAULT ? faultTrace : &ring;
+}
+
+static uint32_t dumpEventCount(const TraceBuffer* buffer) {
+  return min(buffer->written, (uint32_t)TRACE_EVENTS);
+}
+
+bool traceDumpStart(TraceDumpCursor& cursor, TraceSource source) {
+  cursor.source = source;
+  cursor.line = 0;
+  cursor.event = 0;
+  cursor.done = false;
+  if (!dumpBuffer(cursor)) {
+    cursor.done = true;
+    return false;
+  }
+  if (source == TRACE_SOURCE_LIVE) {
+    paused++;  // Keep the ring still while it is read out
+  }
+  return true;
+}
+
+size_t traceDumpLine(TraceDumpCursor& cursor, char* out, size_t size) {
+  const TraceBuffer* buffer = dumpBuffer(cursor);
+  if (cursor.done || !buffer) {
+    return 0;
+  }
+
+  uint16_t line = cursor.line++;
+  int len = 0;
+
+  if (line == 0) {
+    len = snprintf(out, size, "TRACE BEGIN %s events=%lu dropped=%lu",
+                   cursor.source == TRACE_SOURCE_FAULT ? "fault" : "live",
+                   (unsigned long)dumpEventCount(buffer),
+                   (unsigned long)buffer->dropped);
+    return min((size_t)len, size - 1);
+  }
+  line--;
+
+  if (line < TRACE_POINT_COUNT) {
+    len = snprintf(out, size, "TRACE NAME %u %s", line, POINT_NAMES[line]);
+    return min((size_t)len, size - 1);
+  }
+  line -= TRACE_POINT_COUNT;
+
+  if (line < buffer->taskCount) {
+    len = snprintf(out, size, "TRACE TASK %u %s", line, buffer->taskNames[line]);
+    return min((size_t)len, size - 1);
+  }
+
+  uint32_t count = dumpEventCount(buffer);
+  if (cursor.event < count) {
+    uint32_t first = buffer->written - count;
+    len = snprintf(out, size, "TRACE EV ");
+    for (int i = 0; i < TRACE_EVENTS_PER_LINE && cursor.event < count &&
+                    len + TRACE_EVENT_HEX < (int)size; i++, cursor.event++) {
+      const TraceEvent& event = buffer->events[(first + cursor.event) % TRACE_EVENTS];
+      len += snprintf(out + len, size - len, "%08lx%02x%02x%02x%02x",
+                      (unsigned long)event.us, event.point, event.phase, event.task, event.arg);
+    }
+    return len;
+  }
+
+  traceDumpCancel(cursor);
+  len = snprintf(out, size, "TRACE END");
+  return len;
+}
+
+void traceDumpCancel(TraceDumpCursor& cursor) {
+  if (!cursor.done && cursor.source == TRACE_SOURCE_LIVE && paused > 0) {
+    paused--;
+  }
+  cursor.done = true;
+}
+
+void traceDumpSerial(TraceSource source) {
+  TraceDumpCursor cursor;
+  if (!traceDumpStart(cursor, source)) {
+    Serial.println(source == TRACE_SOURCE_FAULT ? "Trace: no fault trace" : "Trace: unavailable");
+    return;
+  }
+  char line[160];
+  size_t len;
+  while ((len = traceDumpLine(cursor, line, sizeof(line))) > 0) {
+    Serial.write((const uint8_t*)line, len);
+    Serial.println();
+  }
+}
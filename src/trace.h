@@ -0,0 +1,93 @@
+/*
+ * Flight-recorder event trace
+ *
+ * A small ring of 8-byte events (begin / end / instant, microsecond
+ * timestamp, task) that is always recording, so a stall or hang can be
+ * looked at after the fact. Timestamps are the low 32 bits of
+ * esp_timer_get_time(), one clock for every core (the cycle counter is per
+ * core). Recording an event is a timer read and a few stores under a
+ * spinlock; define TRACE_ENABLED=0 to compile every trace point out.
+ *
+ * The ring lives in RTC memory that survives a software reset. After a
+ * panic or watchdog reset the previous boot's ring is kept as the "fault"
+ * trace until the next reset.
+ *
+ * Dumps are plain text lines starting with "TRACE ", identical over Serial
+ * and BLE; tools/trace2chrome.js turns a captured dump into Chrome trace
+ * JSON for chrome://tracing or https://ui.perfetto.dev.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Trace points; names are listed in every dump
+enum TracePoint {
+  TRACE_READING,          // updateWaterQualityReadings()
+  TRACE_MPU_INIT,         // Background MPU6050 probe
+  TRACE_MPU_READ,         // I2C accelerometer/temperature read
+  TRACE_TDS_ADC,          // TDS analogRead()
+  TRACE_HISTORY_APPEND,   // Flash log write (and sector erase)
+  TRACE_BACKFILL,         // Reading and queueing missed records
+  TRACE_NOTIFY,           // One notification handed to the BLE stack
+  TRACE_SERIAL,           // Debug output on Serial
+  TRACE_CONFIG_SAVE,      // NVS write
+  TRACE_BLE_CONNECT,      // Instant, from the BLE task
+  TRACE_BLE_DISCONNECT,
+  TRACE_BLE_CONGESTED,
+  TRACE_POINT_COUNT
+};
+
+enum TracePhase {
+  TRACE_PHASE_BEGIN = 'B',
+  TRACE_PHASE_END = 'E',
+  TRACE_PHASE_INSTANT = 'i'
+};
+
+enum TraceSource {
+  TRACE_SOURCE_LIVE,      // The ring being recorded now
+  TRACE_SOURCE_FAULT      // The ring as it was when the last boot crashed
+};
+
+// Keep or discard the ring from before the reset, depending on why the
+// chip reset; call first thing in setup()
+void traceBegin();
+
+void traceRecord(TracePoint point, TracePhase phase, uint8_t arg);
+
+// True if the last reset was a fault and its trace was kept
+bool traceHasFault();
+
+// Text dump, one line per call. Recording pauses from traceDumpStart()
+// until the last line has been produced.
+struct TraceDumpCursor {
+  TraceSource source;
+  uint16_t line;
+  uint16_t event;
+  bool done;
+};
+
+bool traceDumpStart(TraceDumpCursor& cursor, TraceSource source);
+
+// Write the next line (no newline) and return its length, 0 when done
+size_t traceDumpLine(TraceDumpCursor& cursor, char* out, size_t size);
+
+// Abandon a dump before its last line, e.g. when the client disconnects
+void traceDumpCancel(TraceDumpCursor& cursor);
+
+// Dump the whole trace to Serial
+void traceDumpSerial(TraceSource source);
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(point)           traceRecord(point, TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(point)             traceRecord(point, TRACE_PHASE_END, 0)
+#define TRACE_INSTANT(point, arg)    traceRecord(point, TRACE_PHASE_INSTANT, arg)
+#else
+#define TRACE_BEGIN(point)
+#define TRACE_END(point)
+#define TRACE_INSTANT(point, arg)
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Host tests for the block DSP kernels (src/dsp.cpp)
+ *
+ * On the host these are the portable scalar versions, which every board
+ * without the S3 vector unit runs and which `bench dsp` holds the vector
+ * versions to bit for bit. Each is checked against a straightforward
+ * reference: exact integer arithmetic for the accumulating kernels,
+ * double precision for the window and the FFT. Run with:
+ * pio test -e native
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "dsp.h"
+
+static uint32_t rngState;
+
+static uint32_t nextRandom() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// Buffer with room to start the data at every alignment
+static int16_t buffer[DSP_FFT_MAX + 16] __attribute__((aligned(16)));
+static int16_t other[DSP_FFT_MAX + 16] __attribute__((aligned(16)));
+
+static void fillRandom(int16_t* x, size_t n, int16_t amplitude) {
+  for (size_t i = 0; i < n; i++) {
+    x[i] = (int16_t)((int32_t)(nextRandom() % (2u * amplitude + 1)) - amplitude);
+  }
+}
+
+void setUp(void) {
+  rngState = 88172645u;
+}
+
+void tearDown(void) {}
+
+// === Accumulating kernels: exact ===
+
+void test_dot_and_sums_are_exact(void) {
+  fillRandom(buffer, DSP_FFT_MAX + 16, 32767);
+  fillRandom(other, DSP_FFT_MAX + 16, 32767);
+  buffer[3] = other[3] = INT16_MIN;
+  for (size_t offset = 0; offset < 8; offset++) {
+    for (size_t n = 0; n <= 300; n += 37) {
+      const int16_t* a = buffer + offset;
+      const int16_t* b = other + (offset * 3) % 8;
+      int64_t dot = 0, sum = 0;
+      uint64_t squares = 0;
+      for (size_t i = 0; i < n; i++) {
+        dot += (int64_t)a[i] * b[i];
+        sum += a[i];
+        squares += (uint64_t)((int64_t)a[i] * a[i]);
+      }
+      TEST_ASSERT_EQUAL_INT64(dot, dspDot(a, b, n));
+      TEST_ASSERT_EQUAL_INT64(sum, dspSum(a, n));
+      TEST_ASSERT_EQUAL_UINT64(squares, dspSumSquares(a, n));
+    }
+  }
+}
+
+void test_block_stats_are_exact(void) {
+  fillRandom(buffer, DSP_FFT_MAX + 16, 20000);
+  buffer[100] = INT16_MAX;
+  buffer[200] = INT16_MIN;
+  for (size_t offset = 0; offset < 8; offset++) {
+    const int16_t* x = buffer + offset;
+    size_t n = 250;
+    int16_t lo = INT16_MAX, hi = INT16_MIN;
+    int64_t sum = 0;
+    uint64_t squares = 0;
+    for (size_t i = 0; i < n; i++) {
+      lo = x[i] < lo ? x[i] : lo;
+      hi = x[i] > hi ? x[i] : hi;
+      sum += x[i];
+      squares += (uint64_t)((int64_t)x[i] * x[i]);
+    }
+    DspBlockStats stats;
+    dspBlockStats(x, n, stats);
+    TEST_ASSERT_EQUAL_INT16(lo, stats.min);
+    TEST_ASSERT_EQUAL_INT16(hi, stats.max);
+    TEST_ASSERT_EQUAL_INT64(sum, stats.sum);
+    TEST_ASSERT_EQUAL_UINT64(squares, stats.sumSquares);
+  }
+
+  // Empty block: the identities
+  DspBlockStats empty;
+  dspBlockStats(buffer, 0, empty);
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, empty.min);
+  TEST_ASSERT_EQUAL_INT16(INT16_MIN, empty.max);
+  TEST_ASSERT_EQUAL_INT64(0, empty.sum);
+}
+
+// === FIR filter: exact, rounded and saturated ===
+
+static int16_t referenceFirOutput(const int16_t* taps, uint8_t count, const int16_t* x) {
+  int64_t sum = 0;
+  for (uint8_t k = 0; k < count; k++) {
+    sum += (int64_t)taps[k] * x[k];
+  }
+  // Round half up in Q15, then saturate
+  int64_t value = (int64_t)floor((double)sum / 32768.0 + 0.5);
+  return (int16_t)(value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value);
+}
+
+void test_fir_matches_the_reference(void) {
+  static DspFir fir;
+  int16_t taps[DSP_FIR_MAX_TAPS];
+  int16_t out[DSP_FFT_MAX];
+  fillRandom(buffer, DSP_FFT_MAX + 16, 32767);
+  const uint8_t COUNTS[] = { 1, 5, 16, 31, DSP_FIR_MAX_TAPS };
+  for (size_t c = 0; c < sizeof(COUNTS); c++) {
+    uint8_t count = COUNTS[c];
+    fillRandom(taps, count, 16000);
+    dspFirInit(fir, taps, count);
+    for (uint16_t decimation = 1; decimation <= 3; decimation++) {
+      const int16_t* x = buffer + c;
+      size_t n = 200 + c;
+      size_t outputs = dspFir(fir, x, n, decimation, out);
+      TEST_ASSERT_EQUAL_UINT32((n - count) / decimation + 1, outputs);
+      for (size_t i = 0; i < outputs; i++) {
+        TEST_ASSERT_EQUAL_INT16(referenceFirOutput(taps, count, x + i * decimation), out[i]);
+      }
+    }
+  }
+}
+
+void test_fir_edges(void) {
+  static DspFir fir;
+  int16_t out[64];
+  const int16_t HALF[2] = { 16384, 16384 };
+  dspFirInit(fir, HALF, 2);
+
+  // Too short for one output
+  TEST_ASSERT_EQUAL_UINT32(0, dspFir(fir, buffer, 1, 1, out));
+
+  // Two-point average, rounded half up: 3.5 -> 4, 0.5 -> 1, -3.5 -> -3
+  int16_t x[4] = { 3, 4, -3, -4 };
+  TEST_ASSERT_EQUAL_UINT32(3, dspFir(fir, x, 4, 1, out));
+  TEST_ASSERT_EQUAL_INT16(4, out[0]);
+  TEST_ASSERT_EQUAL_INT16(1, out[1]);
+  TEST_ASSERT_EQUAL_INT16(-3, out[2]);
+
+  // Gain above 1 saturates
+  const int16_t GAIN[2] = { 32767, 32767 };
+  dspFirInit(fir, GAIN, 2);
+  int16_t loud[3] = { 30000, 30000, -30000 };
+  dspFir(fir, loud, 3, 1, out);
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, out[0]);
+  TEST_ASSERT_EQUAL_INT16(0, out[1]);
+
+  // In place, decimating
+  dspFirInit(fir, HALF, 2);
+  for (int i = 0; i < 64; i++) {
+    buffer[i] = (int16_t)(i * 100);
+  }
+  size_t outputs = dspFir(fir, buffer, 64, 4, buffer);
+  TEST_ASSERT_EQUAL_UINT32(16, outputs);
+  for (size_t i = 0; i < outputs; i++) {
+    TEST_ASSERT_EQUAL_INT16((int16_t)(i * 400 + 50), buffer[i]);
+  }
+
+  // Taps beyond the limit are dropped
+  int16_t many[DSP_FIR_MAX_TAPS + 4];
+  fillRandom(many, DSP_FIR_MAX_TAPS + 4, 1000);
+  dspFirInit(fir, many, DSP_FIR_MAX_TAPS + 4);
+  TEST_ASSERT_EQUAL_UINT8(DSP_FIR_MAX_TAPS, fir.taps);
+}
+
+// === Window and spectra: against double precision ===
+
+// The Q15 weights are within 1 LSB of the true window (the peak of exactly
+// 1 is held at 32767) and the product is truncated, so each sample is
+// within 2 LSB
+void test_hann_within_two_lsb(void) {
+  for (size_t n = 16; n <= DSP_FFT_MAX; n *= 2) {
+    for (size_t offset = 0; offset < 8; offset += 3) {
+      int16_t* x = buffer + offset;
+      fillRandom(x, n, 32767);
+      memcpy(other, x, n * sizeof(int16_t));
+      dspHann(x, n);
+      for (size_t i = 0; i < n; i++) {
+        double w = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+        TEST_ASSERT_DOUBLE_WITHIN(2.0, other[i] * w, x[i]);
+      }
+    }
+  }
+}
+
+void test_hann_rejects_unsupported_sizes(void) {
+  int16_t x[24];
+  for (int i = 0; i < 24; i++) {
+    x[i] = 1000;
+  }
+  dspHann(x, 24);
+  TEST_ASSERT_EQUAL_INT16(1000, x[0]);
+}
+
+// Largest difference between dspFft and the DFT divided by n, in LSB
+static double fftError(size_t n, int16_t amplitude) {
+  static int16_t data[2 * DSP_FFT_MAX];
+  static double input[2 * DSP_FFT_MAX];
+  fillRandom(data, 2 * n, amplitude);
+  for (size_t i = 0; i < 2 * n; i++) {
+    input[i] = data[i];
+  }
+  if (!dspFft(data, n)) {
+    return INFINITY;
+  }
+  double worst = 0;
+  for (size_t k = 0; k < n; k++) {
+    double re = 0, im = 0;
+    for (size_t t = 0; t < n; t++) {
+      double angle = -2 * M_PI * (double)((k * t) % n) / n;
+      re += input[2 * t] * cos(angle) - input[2 * t + 1] * sin(angle);
+      im += input[2 * t] * sin(angle) + input[2 * t + 1] * cos(angle);
+    }
+    worst = fmax(worst, fabs(data[2 * k] - re / n));
+    worst = fmax(worst, fabs(data[2 * k + 1] - im / n));
+  }
+  return worst;
+}
+
+void test_fft_matches_the_dft(void) {
+  // Each stage rounds, but also halves the error of the stages before it,
+  // so the total grows only slowly with the size (3 LSB at 512)
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(4.0, fftError(16, 32767));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(4.0, fftError(64, 32767));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(4.0, fftError(256, 32767));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(4.0, fftError(DSP_FFT_MAX, 32767));
+}
+
+void test_fft_finds_a_tone(void) {
+  const size_t n = 128;
+  static int16_t data[2 * n];
+  static uint16_t magnitude[n];
+  for (size_t t = 0; t < n; t++) {
+    data[2 * t] = (int16_t)lround(16000 * cos(2 * M_PI * 9 * t / n));
+    data[2 * t + 1] = 0;
+  }
+  TEST_ASSERT_TRUE(dspFft(data, n));
+  dspMagnitude(data, n / 2, magnitude);
+  // A cosine of amplitude A splits into A/2 at +9 and -9
+  TEST_ASSERT_INT_WITHIN(2, 8000, magnitude[9]);
+  for (size_t k = 0; k < n / 2; k++) {
+    if (k != 9) {
+      TEST_ASSERT_TRUE(magnitude[k] <= 2);
+    }
+  }
+  TEST_ASSERT_FALSE(dspFft(data, 96));
+  TEST_ASSERT_FALSE(dspFft(data, 2 * DSP_FFT_MAX));
+}
+
+void test_magnitude_is_the_exact_floor(void) {
+  int16_t data[2 * 64];
+  uint16_t out[64];
+  fillRandom(data, 2 * 64, 32767);
+  data[0] = data[1] = INT16_MIN;
+  dspMagnitude(data, 64, out);
+  for (int i = 0; i < 64; i++) {
+    double exact = sqrt((double)data[2 * i] * data[2 * i] + (double)data[2 * i + 1] * data[2 * i + 1]);
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)floor(exact), out[i]);
+  }
+}
+
+void test_log8_rounds_to_eighths_of_an_octave(void) {
+  TEST_ASSERT_EQUAL_UINT8(0, dspLog8(0));
+  TEST_ASSERT_EQUAL_UINT8(0, dspLog8(1));
+  TEST_ASSERT_EQUAL_UINT8(8, dspLog8(2));
+  TEST_ASSERT_EQUAL_UINT8(255, dspLog8(UINT32_MAX));   // 256, held to 8 bits
+  for (uint32_t v = 1; v < (1u << 22); v++) {
+    // The step table is rounded to Q16, so values within a hair of a
+    // rounding point may land either side of it
+    double exact = 8 * log2((double)v);
+    TEST_ASSERT_DOUBLE_WITHIN(0.5 + 1e-4, exact, dspLog8(v));
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_dot_and_sums_are_exact);
+  RUN_TEST(test_block_stats_are_exact);
+  RUN_TEST(test_fir_matches_the_reference);
+  RUN_TEST(test_fir_edges);
+  RUN_TEST(test_hann_within_two_lsb);
+  RUN_TEST(test_hann_rejects_unsupported_sizes);
+  RUN_TEST(test_fft_matches_the_dft);
+  RUN_TEST(test_fft_finds_a_tone);
+  RUN_TEST(test_magnitude_is_the_exact_floor);
+  RUN_TEST(test_log8_rounds_to_eighths_of_an_octave);
+  return UNITY_END();
+}
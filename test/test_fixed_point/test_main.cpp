@@ -0,0 +1,209 @@
+/*
+ * Host tests for the fixed-point types and kernels (src/fixed_point.cpp)
+ *
+ * Each operation is checked against a double-precision reference over
+ * edge cases and a few hundred thousand pseudo-random operands, with the
+ * error bound the header promises. Run with: pio test -e native
+ */
+
+#include <unity.h>
+#include <math.h>
+#include "fixed_point.h"
+
+static uint32_t rngState;
+
+static uint32_t nextRandom() {
+  // xorshift32: repeatable across hosts, unlike rand()
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+void setUp(void) {
+  rngState = 2463534242u;
+}
+
+void tearDown(void) {}
+
+// === Integer square roots ===
+
+static void assertIsqrt32(uint32_t x) {
+  uint64_t root = isqrt32(x);
+  TEST_ASSERT_TRUE(root * root <= x);
+  TEST_ASSERT_TRUE((root + 1) * (root + 1) > x);
+}
+
+static void assertIsqrt64(uint64_t x) {
+  // (root + 1)^2 can need 65 bits, so compare against x - root^2 instead
+  uint64_t root = isqrt64(x);
+  TEST_ASSERT_TRUE(root * root <= x);
+  TEST_ASSERT_TRUE(x - root * root < 2 * root + 1);
+}
+
+void test_isqrt32_is_the_exact_floor(void) {
+  assertIsqrt32(0);
+  assertIsqrt32(1);
+  assertIsqrt32(UINT32_MAX);
+  for (uint32_t r = 1; r < 65536; r += 97) {
+    assertIsqrt32(r * r - 1);
+    assertIsqrt32(r * r);
+    assertIsqrt32(r * r + 1);
+  }
+  for (int i = 0; i < 200000; i++) {
+    assertIsqrt32(nextRandom());
+  }
+}
+
+void test_isqrt64_is_the_exact_floor(void) {
+  assertIsqrt64((uint64_t)UINT32_MAX + 1);
+  assertIsqrt64(UINT64_MAX);
+  for (int i = 0; i < 200000; i++) {
+    uint64_t x = ((uint64_t)nextRandom() << 32) | nextRandom();
+    assertIsqrt64(x >> (i % 40));
+  }
+  uint64_t r = 4294967295ull;
+  assertIsqrt64(r * r);
+  assertIsqrt64(r * r - 1);
+}
+
+void test_q16_sqrt_is_the_exact_floor(void) {
+  for (int i = 0; i < 200000; i++) {
+    Q16_16 x = Q16_16::fromRaw(nextRandom() & 0x7fffffff);
+    double exact = sqrt(x.raw / 65536.0) * 65536.0;
+    TEST_ASSERT_EQUAL_INT32((int32_t)floor(exact), x.sqrt().raw);
+  }
+  TEST_ASSERT_EQUAL_INT32(0, Q16_16::fromInt(-4).sqrt().raw);
+}
+
+// === Reciprocal ===
+
+void test_reciprocal_mantissa_within_two_q30_lsb(void) {
+  double worst = 0;
+  for (uint64_t m = 1u << 30; m < (1ull << 31); m += 613) {
+    double exact = (double)(1ull << 61) / m;
+    worst = fmax(worst, fabs(reciprocalQ31((uint32_t)m) - exact));
+  }
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(2.0, worst);
+}
+
+// Half an LSB of rounding, plus the mantissa's error carried into results
+// too large for Q16.16 to absorb it (1/x for x below about 2^-8)
+void test_q16_reciprocal_within_half_lsb(void) {
+  for (int i = 0; i < 300000; i++) {
+    int32_t raw = (int32_t)nextRandom() >> (i % 24);
+    if (raw == 0) {
+      continue;
+    }
+    double exact = 4294967296.0 / raw;   // 1/x in Q16.16 raw units
+    if (fabs(exact) >= 2147483647.0) {
+      continue;
+    }
+    Q16_16 x = Q16_16::fromRaw(raw);
+    TEST_ASSERT_DOUBLE_WITHIN(0.5 + fabs(exact) / (1 << 29), exact, x.reciprocal().raw);
+  }
+}
+
+void test_reciprocal_saturates(void) {
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, Q16_16::fromRaw(0).reciprocal().raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, Q16_16::fromRaw(1).reciprocal().raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MIN, Q16_16::fromRaw(-1).reciprocal().raw);
+  TEST_ASSERT_EQUAL_INT32(Q16_16::fromFloat(0.5f).raw, Q16_16::fromInt(2).reciprocal().raw);
+}
+
+// === Arithmetic ===
+
+void test_q16_multiply_within_half_lsb(void) {
+  for (int i = 0; i < 300000; i++) {
+    Q16_16 a = Q16_16::fromRaw((int32_t)nextRandom() >> 8);
+    Q16_16 b = Q16_16::fromRaw((int32_t)nextRandom() >> 12);
+    double exact = (double)a.raw * b.raw / 65536.0;
+    TEST_ASSERT_DOUBLE_WITHIN(0.5, exact, (a * b).raw);
+  }
+}
+
+void test_q15_multiply_within_half_lsb(void) {
+  for (int i = 0; i < 100000; i++) {
+    Q15 a = Q15::fromRaw((int16_t)nextRandom());
+    Q15 b = Q15::fromRaw((int16_t)nextRandom());
+    double exact = (double)a.raw * b.raw / 32768.0;
+    if (exact >= 32767.5) {
+      TEST_ASSERT_EQUAL_INT16(INT16_MAX, (a * b).raw);   // -1 * -1
+    } else {
+      TEST_ASSERT_DOUBLE_WITHIN(0.5, exact, (a * b).raw);
+    }
+  }
+}
+
+void test_from_float_rounds_to_nearest(void) {
+  for (int i = 0; i < 100000; i++) {
+    float value = ((int32_t)nextRandom() >> 8) / 1024.0f;
+    Q16_16 x = Q16_16::fromFloat(value);
+    TEST_ASSERT_DOUBLE_WITHIN(0.5, (double)value * 65536.0, x.raw);
+  }
+  TEST_ASSERT_EQUAL_INT32(3, Q16_16::fromFloat(2.5f).toInt());
+  TEST_ASSERT_EQUAL_INT32(-2, Q16_16::fromFloat(-2.25f).toInt());
+}
+
+void test_saturation(void) {
+  Q16_16 big = Q16_16::fromInt(30000);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, (big + big).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MIN, (-big - big).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, (big * big).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, Q16_16::fromFloat(1e9f).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MIN, Q16_16::fromFloat(-1e9f).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, (big / Q16_16::fromRaw(0)).raw);
+  TEST_ASSERT_EQUAL_INT32(INT32_MIN, (-big / Q16_16::fromRaw(0)).raw);
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, (-Q15::fromRaw(INT16_MIN)).raw);
+  TEST_ASSERT_EQUAL_INT16(INT16_MIN, (Q15::fromRaw(INT16_MIN) - Q15::fromRaw(INT16_MAX)).raw);
+}
+
+// === Q15 vectors ===
+
+void test_q15_vectors_match_the_reference(void) {
+  int16_t a[256], b[256], out[256];
+  for (int i = 0; i < 256; i++) {
+    a[i] = (int16_t)nextRandom();
+    b[i] = (int16_t)nextRandom();
+  }
+  a[0] = b[0] = INT16_MIN;
+
+  int64_t dot = 0;
+  uint64_t squares = 0;
+  for (int i = 0; i < 256; i++) {
+    dot += (int64_t)a[i] * b[i];
+    squares += (uint64_t)((int64_t)a[i] * a[i]);
+  }
+  TEST_ASSERT_EQUAL_INT64(dot, q15Dot(a, b, 256));
+  TEST_ASSERT_EQUAL_UINT64(squares, q15SumSquares(a, 256));
+
+  Q15 gain = Q15::fromFloat(-0.75f);
+  q15Scale(a, gain, out, 256);
+  for (int i = 0; i < 256; i++) {
+    TEST_ASSERT_DOUBLE_WITHIN(0.5, a[i] * -0.75, out[i]);
+  }
+
+  q15Add(a, b, out, 256);
+  for (int i = 0; i < 256; i++) {
+    int32_t sum = (int32_t)a[i] + b[i];
+    TEST_ASSERT_EQUAL_INT16(sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum, out[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_isqrt32_is_the_exact_floor);
+  RUN_TEST(test_isqrt64_is_the_exact_floor);
+  RUN_TEST(test_q16_sqrt_is_the_exact_floor);
+  RUN_TEST(test_reciprocal_mantissa_within_two_q30_lsb);
+  RUN_TEST(test_q16_reciprocal_within_half_lsb);
+  RUN_TEST(test_reciprocal_saturates);
+  RUN_TEST(test_q16_multiply_within_half_lsb);
+  RUN_TEST(test_q15_multiply_within_half_lsb);
+  RUN_TEST(test_from_float_rounds_to_nearest);
+  RUN_TEST(test_saturation);
+  RUN_TEST(test_q15_vectors_match_the_reference);
+  return UNITY_END();
+}
@@ -0,0 +1,125 @@
+/*
+ * Host tests for the lock-in demodulator (src/lock_in.cpp)
+ *
+ * Synthetic square-wave responses: the probe answers each half-cycle with
+ * offset + amplitude (in phase) or offset - amplitude, plus whatever
+ * drift or pickup the case adds. Run with: pio test -e native
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "lock_in.h"
+
+static const uint8_t PER_HALF = 8;
+static const uint8_t MAX_HALVES = 16;
+static uint16_t samples[MAX_HALVES * PER_HALF];
+
+// offset and amplitude in counts, drift in counts per sample
+static void synthesise(uint8_t halves, bool positiveFirst, int offset, int amplitude, int drift) {
+  for (uint8_t half = 0; half < halves; half++) {
+    bool positive = (half % 2 == 0) == positiveFirst;
+    for (uint8_t i = 0; i < PER_HALF; i++) {
+      int n = half * PER_HALF + i;
+      samples[n] = (uint16_t)(offset + drift * n + (positive ? amplitude : -amplitude));
+    }
+  }
+}
+
+void setUp(void) {
+  memset(samples, 0, sizeof(samples));
+}
+
+void tearDown(void) {}
+
+void test_amplitude_and_offset_of_a_clean_response(void) {
+  synthesise(7, true, 2000, 300, 0);
+  LockInResult r = lockInDemodulate(samples, 7, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 300.0f, r.amplitude);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 2000.0f, r.offset);
+}
+
+void test_constant_offset_alone_gives_no_amplitude(void) {
+  synthesise(9, true, 1234, 0, 0);
+  LockInResult r = lockInDemodulate(samples, 9, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 0.0f, r.amplitude);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 1234.0f, r.offset);
+}
+
+void test_linear_drift_cancels_exactly(void) {
+  // 5 counts per sample is 320 counts over the window, larger than the
+  // response itself; a plain average of the halves would be off by 20
+  const uint8_t halves = 9;
+  synthesise(halves, true, 500, 150, 5);
+  LockInResult r = lockInDemodulate(samples, halves, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 150.0f, r.amplitude);
+
+  // The level is the drifting baseline at the middle of the window
+  float middle = (halves - 1) / 2.0f * PER_HALF + (PER_HALF - 1) / 2.0f;
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 500.0f + 5 * middle, r.offset);
+}
+
+void test_falling_drift_cancels_too(void) {
+  synthesise(11, false, 3500, 40, -3);
+  LockInResult r = lockInDemodulate(samples, 11, PER_HALF, false);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 40.0f, r.amplitude);
+}
+
+void test_starting_polarity_sets_the_sign(void) {
+  // Response built as if the first half were positive, demodulated as if
+  // it were negative: the response is in antiphase with the reference
+  synthesise(7, true, 1500, 200, 2);
+  LockInResult r = lockInDemodulate(samples, 7, PER_HALF, false);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -200.0f, r.amplitude);
+}
+
+void test_even_window_drops_the_last_half(void) {
+  synthesise(8, true, 2000, 100, 1);
+  LockInResult odd = lockInDemodulate(samples, 7, PER_HALF, true);
+
+  // Whatever lands in half 7 must not leak into the result
+  for (uint8_t i = 0; i < PER_HALF; i++) {
+    samples[7 * PER_HALF + i] = 4095;
+  }
+  LockInResult even = lockInDemodulate(samples, 8, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, odd.amplitude, even.amplitude);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, odd.offset, even.offset);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 100.0f, even.amplitude);
+}
+
+void test_short_windows_give_zero(void) {
+  synthesise(4, true, 2000, 300, 0);
+  LockInResult two = lockInDemodulate(samples, 2, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.0f, 0.0f, two.amplitude);
+  TEST_ASSERT_FLOAT_WITHIN(0.0f, 0.0f, two.offset);
+
+  // Four halves drop to three, which is the shortest usable window
+  LockInResult four = lockInDemodulate(samples, 4, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 300.0f, four.amplitude);
+
+  LockInResult empty = lockInDemodulate(samples, 7, 0, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.0f, 0.0f, empty.amplitude);
+}
+
+void test_full_scale_window_does_not_overflow(void) {
+  // Longest window the scanner allows (TDS_MAX_HALVES) swinging between
+  // the ends of the 12-bit range
+  synthesise(15, true, 2048, 2047, 0);
+  LockInResult r = lockInDemodulate(samples, 15, PER_HALF, true);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 2047.0f, r.amplitude);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 2048.0f, r.offset);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_amplitude_and_offset_of_a_clean_response);
+  RUN_TEST(test_constant_offset_alone_gives_no_amplitude);
+  RUN_TEST(test_linear_drift_cancels_exactly);
+  RUN_TEST(test_falling_drift_cancels_too);
+  RUN_TEST(test_starting_polarity_sets_the_sign);
+  RUN_TEST(test_even_window_drops_the_last_half);
+  RUN_TEST(test_short_windows_give_zero);
+  RUN_TEST(test_full_scale_window_does_not_overflow);
+  return UNITY_END();
+}
@@ -0,0 +1,95 @@
+/*
+ * Host tests for the TDS probe-board polynomial (src/tds_polynomial.cpp)
+ *
+ * Both the float and the Q16.16 evaluation are compared with the original
+ * formula in double precision over the whole 12-bit input range, for the
+ * default calibration and for a probe read away from its reference
+ * temperature. Run with: pio test -e native
+ */
+
+#include <unity.h>
+#include <math.h>
+#include "tds_polynomial.h"
+
+static const uint16_t FULL_SCALE = 4095;
+
+struct Calibration {
+  float vref, factor, coefficient, referenceTemp, temperature;
+};
+
+static const Calibration DEFAULTS = { 3.3f, 0.5f, 0.02f, 25.0f, 25.0f };
+static const Calibration COLD_PROBE = { 3.3f, 0.62f, 0.02f, 25.0f, 8.5f };
+static const Calibration WARM_PROBE = { 3.0f, 0.5f, 0.019f, 20.0f, 34.0f };
+
+static double reference(const Calibration& cal, double counts) {
+  double voltage = counts * cal.vref / FULL_SCALE;
+  double vComp = voltage / (1.0 + (double)cal.coefficient * ((double)cal.temperature - cal.referenceTemp));
+  return (133.42 * pow(vComp, 3) - 255.86 * pow(vComp, 2) + 857.39 * vComp) * cal.factor;
+}
+
+// Worst absolute error over every integer reading and a sweep of
+// fractional (filtered) ones
+static double worstError(const Calibration& cal, bool fixed) {
+  TdsPolynomial poly;
+  tdsPolynomialInit(poly, cal.vref, FULL_SCALE, cal.factor, cal.coefficient, cal.referenceTemp, cal.temperature);
+  double worst = 0;
+  for (uint32_t i = 0; i <= FULL_SCALE * 4u; i++) {
+    float counts = i / 4.0f;
+    float ppm = fixed ? tdsPolynomialFixed(poly, counts) : tdsPolynomialFloat(poly, counts);
+    worst = fmax(worst, fabs(ppm - reference(cal, counts)));
+  }
+  return worst;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_float_version_matches_the_formula(void) {
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.01, worstError(DEFAULTS, false));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.01, worstError(COLD_PROBE, false));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.01, worstError(WARM_PROBE, false));
+}
+
+// The README promises the fixed-point path within 0.1 ppm of float
+void test_fixed_version_within_a_tenth_of_a_ppm(void) {
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.1, worstError(DEFAULTS, true));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.1, worstError(COLD_PROBE, true));
+  TEST_ASSERT_LESS_OR_EQUAL_DOUBLE(0.1, worstError(WARM_PROBE, true));
+}
+
+void test_known_points(void) {
+  TdsPolynomial poly;
+  tdsPolynomialInit(poly, 3.3f, FULL_SCALE, 0.5f, 0.02f, 25.0f, 25.0f);
+
+  // 1 V at the reference temperature: (133.42 - 255.86 + 857.39) / 2
+  float oneVolt = FULL_SCALE / 3.3f;
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 367.475f, tdsPolynomialFloat(poly, oneVolt));
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 367.475f, tdsPolynomialFixed(poly, oneVolt));
+
+  TEST_ASSERT_FLOAT_WITHIN(0.0f, 0.0f, tdsPolynomialFloat(poly, 0));
+  TEST_ASSERT_FLOAT_WITHIN(0.0f, 0.0f, tdsPolynomialFixed(poly, 0));
+}
+
+void test_compensation_is_folded_in(void) {
+  TdsPolynomial poly;
+  tdsPolynomialInit(poly, 3.3f, FULL_SCALE, 0.5f, 0.02f, 25.0f, 35.0f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.2f, poly.compensation);
+
+  // Warmer water conducts better, so the same reading means fewer ppm
+  TdsPolynomial reference;
+  tdsPolynomialInit(reference, 3.3f, FULL_SCALE, 0.5f, 0.02f, 25.0f, 25.0f);
+  TEST_ASSERT_TRUE(tdsPolynomialFixed(poly, 2000) < tdsPolynomialFixed(reference, 2000));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, tdsPolynomialFloat(reference, 2000 / 1.2f), tdsPolynomialFloat(poly, 2000));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_float_version_matches_the_formula);
+  RUN_TEST(test_fixed_version_within_a_tenth_of_a_ppm);
+  RUN_TEST(test_known_points);
+  RUN_TEST(test_compensation_is_folded_in);
+  return UNITY_END();
+}
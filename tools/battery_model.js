@@ -0,0 +1,180 @@
+#!/usr/bin/env node
+/*
+ * Battery life model for the water sensor
+ *
+ * Predicts consumption per subsystem in mAh per day, and the resulting
+ * battery life, with the same current table and radio airtime model as the
+ * firmware's energy accounting (src/energy.cpp). Use it to see what a
+ * change of reading rate, notify intervals or connection time would do
+ * before flashing it.
+ *
+ * Usage: node tools/battery_model.js [--key=value ...]
+ *        node tools/battery_model.js --stats=record.json [--batteryMah=N]
+ *
+ * Every key of DEFAULTS can be overridden, e.g. --connectedFraction=0.1
+ * --liveIntervalMs=5000. With --stats, the mAhDay* fields of a stats
+ * record captured from the device are used instead of the model, which
+ * turns a measured day profile into a battery life.
+ */
+
+const fs = require('fs');
+
+// Currents and radio timing match configDefaults() in src/config.cpp
+const DEFAULTS = {
+  batteryMah: 2000,
+  usableFraction: 0.85,         // Capacity left above the brown-out voltage
+
+  cpuActiveMa: 28.0,
+  cpuIdleMa: 16.0,
+  radioTxMa: 24.0,
+  radioRxMa: 26.0,
+  adcMa: 1.0,
+  tdsProbeMa: 5.0,
+  mpuMa: 3.9,
+  ledMa: 8.0,
+  radioConnIntervalMs: 30,
+  radioAdvIntervalMs: 30,
+
+  // Workload
+  cpuActiveFraction: 0.05,      // "cpu active" from the `energy` command
+  connectedFraction: 1.0,       // Share of the day a client is connected
+  readingIntervalMs: 3000,
+  adcUsPerReading: 60,
+  mpuPresent: 1,
+  ledDuty: 1.0,                 // One status LED is lit whenever status is known
+
+  // Notifications while connected: interval and typical payload size
+  notifyIntervalMs: 1000, legacyBytes: 230,
+  liveIntervalMs: 1000, liveBytes: 120,
+  vibrationIntervalMs: 1000, vibrationBytes: 90,
+  statsIntervalMs: 60000, statsBytes: 300,
+  diagnosticsIntervalMs: 10000, diagnosticsBytes: 480,
+};
+
+const SUBSYSTEMS = ['cpu', 'radio', 'adc', 'sensors', 'led'];
+const STATS_KEYS = ['mAhDayCpu', 'mAhDayRadio', 'mAhDayAdc', 'mAhDaySensors', 'mAhDayLed'];
+
+// === Radio airtime model (see src/energy.cpp) ===
+const RADIO_US_PER_BYTE = 8;
+const RADIO_LL_PAYLOAD = 27;
+const RADIO_LL_OVERHEAD = 10;
+const RADIO_ATT_OVERHEAD = 7;
+const RADIO_RAMP_US = 140;
+const CONN_EVENT_TX_US = 220;
+const CONN_EVENT_RX_US = 300;
+const ADV_EVENT_TX_US = 3 * (RADIO_RAMP_US + 39 * RADIO_US_PER_BYTE);
+const ADV_EVENT_RX_US = 3 * 200;
+
+const US_PER_DAY = 86400e6;
+
+function notifyAirtimeUs(len) {
+  const bytes = len + RADIO_ATT_OVERHEAD;
+  const packets = Math.ceil(bytes / RADIO_LL_PAYLOAD);
+  return (bytes + packets * RADIO_LL_OVERHEAD) * RADIO_US_PER_BYTE + packets * RADIO_RAMP_US;
+}
+
+// Consumption per subsystem in mAh per day
+function modelDay(p) {
+  const connectedUs = US_PER_DAY * p.connectedFraction;
+  const advertisingUs = US_PER_DAY - connectedUs;
+
+  const streams = [
+    [p.notifyIntervalMs, p.legacyBytes],
+    [p.liveIntervalMs, p.liveBytes],
+    [p.vibrationIntervalMs, p.vibrationBytes],
+    [p.statsIntervalMs, p.statsBytes],
+    [p.diagnosticsIntervalMs, p.diagnosticsBytes],
+  ];
+  let notifyTxUs = 0;
+  for (const [intervalMs, bytes] of streams) {
+    if (intervalMs > 0) {
+      notifyTxUs += (connectedUs / 1000 / intervalMs) * notifyAirtimeUs(bytes);
+    }
+  }
+
+  const connEvents = p.radioConnIntervalMs > 0 ? connectedUs / 1000 / p.radioConnIntervalMs : 0;
+  const advEvents = p.radioAdvIntervalMs > 0 ? advertisingUs / 1000 / p.radioAdvIntervalMs : 0;
+  const txUs = notifyTxUs + connEvents * CONN_EVENT_TX_US + advEvents * ADV_EVENT_TX_US;
+  const rxUs = connEvents * CONN_EVENT_RX_US + advEvents * ADV_EVENT_RX_US;
+
+  const readings = US_PER_DAY / 1000 / p.readingIntervalMs;
+  const activeUs = US_PER_DAY * p.cpuActiveFraction;
+
+  // mA·µs per day, then mAh
+  const charge = {
+    cpu: activeUs * p.cpuActiveMa + (US_PER_DAY - activeUs) * p.cpuIdleMa,
+    radio: txUs * p.radioTxMa + rxUs * p.radioRxMa,
+    adc: readings * p.adcUsPerReading * p.adcMa,
+    sensors: US_PER_DAY * (p.tdsProbeMa + (p.mpuPresent ? p.mpuMa : 0)),
+    led: US_PER_DAY * p.ledDuty * p.ledMa,
+  };
+  const mAh = {};
+  for (const name of SUBSYSTEMS) {
+    mAh[name] = charge[name] / 3600e6;
+  }
+  return mAh;
+}
+
+function fromStatsRecord(record) {
+  const mAh = {};
+  SUBSYSTEMS.forEach((name, i) => {
+    mAh[name] = Number(record[STATS_KEYS[i]]) || 0;
+  });
+  return mAh;
+}
+
+function batteryDays(mAh, p) {
+  const total = SUBSYSTEMS.reduce((sum, name) => sum + mAh[name], 0);
+  return { total, days: total > 0 ? (p.batteryMah * p.usableFraction) / total : Infinity };
+}
+
+function parseArgs(argv) {
+  const params = { ...DEFAULTS };
+  let statsPath = null;
+  for (const arg of argv) {
+    const match = /^--([A-Za-z]+)=(.*)$/.exec(arg);
+    if (!match) {
+      throw new Error(`Unrecognised argument: ${arg}`);
+    }
+    const [, key, value] = match;
+    if (key === 'stats') {
+      statsPath = value;
+    } else if (key in DEFAULTS) {
+      params[key] = Number(value);
+    } else {
+      throw new Error(`Unknown parameter: ${key}`);
+    }
+  }
+  return { params, statsPath };
+}
+
+function main() {
+  let args;
+  try {
+    args = parseArgs(process.argv.slice(2));
+  } catch (err) {
+    console.error(err.message);
+    process.exit(1);
+  }
+  const { params, statsPath } = args;
+
+  const mAh = statsPath
+    ? fromStatsRecord(JSON.parse(fs.readFileSync(statsPath, 'utf8')))
+    : modelDay(params);
+  const { total, days } = batteryDays(mAh, params);
+
+  console.log(statsPath ? `Measured profile (${statsPath})` : 'Modelled profile');
+  for (const name of SUBSYSTEMS) {
+    const share = total > 0 ? (100 * mAh[name]) / total : 0;
+    console.log(`  ${name.padEnd(8)} ${mAh[name].toFixed(2).padStart(9)} mAh/day  ${share.toFixed(1).padStart(5)}%`);
+  }
+  console.log(`  ${'total'.padEnd(8)} ${total.toFixed(2).padStart(9)} mAh/day`);
+  console.log(`Battery ${params.batteryMah} mAh (${Math.round(params.usableFraction * 100)}% usable): ` +
+              `${days.toFixed(1)} days, average ${(total / 24).toFixed(2)} mA`);
+}
+
+if (require.main === module) {
+  main();
+}
+
+module.exports = { DEFAULTS, modelDay, fromStatsRecord, batteryDays, notifyAirtimeUs };
@@ -0,0 +1,193 @@
+#!/usr/bin/env node
+/*
+ * Generate the app's binary record decoder from the firmware schema
+ *
+ * Reads src/record_schema.h (the X-macro field list every encoder is
+ * expanded from) and writes RecordSchema.js: the record ids, the field
+ * list of every record and decodeBinaryRecord(), which turns a binary
+ * payload into the same object JSON.parse() gives for the JSON record.
+ * Run it after changing the schema and commit both files.
+ *
+ * Usage: node tools/gen_record_schema.js [src/record_schema.h] [RecordSchema.js]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const ROOT = path.join(__dirname, '..');
+const KINDS = ['Fixed', 'UInt', 'QuotedUInt', 'Int', 'Hex', 'Bool', 'Status', 'Text'];
+
+// Split a macro argument list on top-level commas, keeping parentheses
+// and string literals intact
+function splitArgs(text) {
+  const args = [];
+  let depth = 0;
+  let quoted = false;
+  let current = '';
+  for (let i = 0; i < text.length; i++) {
+    const c = text[i];
+    if (quoted) {
+      if (c === '\\') {
+        current += c + text[++i];
+        continue;
+      }
+      if (c === '"') quoted = false;
+    } else if (c === '"') {
+      quoted = true;
+    } else if (c === '(') {
+      depth++;
+    } else if (c === ')') {
+      depth--;
+    } else if (c === ',' && depth === 0) {
+      args.push(current.trim());
+      current = '';
+      continue;
+    }
+    current += c;
+  }
+  args.push(current.trim());
+  return args;
+}
+
+// The arguments of every X(...) line in a macro's continuation lines
+function macroEntries(lines, start) {
+  const entries = [];
+  for (let i = start + 1; i < lines.length; i++) {
+    const line = lines[i].replace(/\\\s*$/, '').trim();
+    const match = line.match(/^X\((.*)\)$/);
+    if (match) entries.push(splitArgs(match[1]));
+    if (!/\\\s*$/.test(lines[i])) break;
+  }
+  return entries;
+}
+
+function parseSchema(text) {
+  const lines = text.split(/\r?\n/);
+  const ids = {};
+  const statusNames = [];
+  const records = {};
+
+  lines.forEach((line, index) => {
+    let match = line.match(/^#define RECORD_ID_(\w+)\s+(\d+)/);
+    if (match) {
+      ids[match[1]] = Number(match[2]);
+      return;
+    }
+    if (/^#define WATER_STATUS_NAMES\(X\)/.test(line)) {
+      for (const [, name] of macroEntries(lines, index)) statusNames.push(JSON.parse(name));
+      return;
+    }
+    match = line.match(/^#define (\w+)_RECORD_FIELDS\(X\)/);
+    if (match) {
+      records[match[1]] = macroEntries(lines, index).map(([key, kind, , arg]) => {
+        if (!KINDS.includes(kind)) throw new Error(`${match[1]}: unknown kind ${kind}`);
+        const field = [JSON.parse(key), kind];
+        if (kind === 'Fixed') field.push(Number(arg));
+        return field;
+      });
+    }
+  });
+
+  const schemas = {};
+  for (const name of Object.keys(records)) {
+    if (!(name in ids)) throw new Error(`No RECORD_ID_${name}`);
+    schemas[ids[name]] = { name: name.toLowerCase(), fields: records[name] };
+  }
+  return { statusNames, schemas };
+}
+
+const DECODER = `
+export const BINARY_MAGIC = 0xb1;
+
+export function isBinaryPayload(bytes) {
+  return bytes.length >= 6 && bytes[0] === BINARY_MAGIC && RECORD_SCHEMAS[bytes[1]] !== undefined;
+}
+
+// Record name ('live', 'vibration', ...) of a binary payload
+export function binaryRecordName(bytes) {
+  return RECORD_SCHEMAS[bytes[1]].name;
+}
+
+// Decode a binary record into the object the JSON record parses to
+export function decodeBinaryRecord(bytes) {
+  const schema = RECORD_SCHEMAS[bytes[1]];
+  if (!schema) throw new Error(\`Unknown binary record \${bytes[1]}\`);
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const mask = view.getUint32(2, true);
+  let offset = 6;
+  const record = {};
+
+  schema.fields.forEach(([key, kind, decimals], bit) => {
+    if (!(mask & (1 << bit))) return;
+    switch (kind) {
+      case 'Fixed':
+        record[key] = view.getInt32(offset, true) / Math.pow(10, decimals);
+        offset += 4;
+        break;
+      case 'UInt':
+        record[key] = view.getUint32(offset, true);
+        offset += 4;
+        break;
+      case 'QuotedUInt':
+        record[key] = String(view.getUint32(offset, true));
+        offset += 4;
+        break;
+      case 'Int':
+        record[key] = view.getInt32(offset, true);
+        offset += 4;
+        break;
+      case 'Hex':
+        record[key] = view.getUint32(offset, true).toString(16);
+        offset += 4;
+        break;
+      case 'Bool':
+        record[key] = bytes[offset++] !== 0;
+        break;
+      case 'Status':
+        record[key] = STATUS_NAMES[bytes[offset++]] || 'unknown';
+        break;
+      case 'Text': {
+        const length = bytes[offset++];
+        record[key] = String.fromCharCode(...bytes.subarray(offset, offset + length));
+        offset += length;
+        break;
+      }
+    }
+  });
+  return record;
+}
+
+export default { RECORD_SCHEMAS, STATUS_NAMES, isBinaryPayload, binaryRecordName, decodeBinaryRecord };
+`;
+
+function generate({ statusNames, schemas }) {
+  const records = Object.keys(schemas).map(id => {
+    const { name, fields } = schemas[id];
+    const list = fields.map(field => `      ${JSON.stringify(field).replace(/"/g, "'").replace(/,/g, ', ')},`).join('\n');
+    return `  ${id}: {\n    name: '${name}',\n    fields: [\n${list}\n    ],\n  },`;
+  }).join('\n');
+
+  return [
+    '// Generated by tools/gen_record_schema.js from src/record_schema.h; do not edit.',
+    '// Decodes the firmware\'s binary payload format (see record_schema.h).',
+    '',
+    `export const STATUS_NAMES = [${statusNames.map(name => `'${name}'`).join(', ')}];`,
+    '',
+    '// Record id -> name and fields in wire order: [key, kind, decimals]',
+    `export const RECORD_SCHEMAS = {\n${records}\n};`,
+  ].join('\n') + '\n' + DECODER;
+}
+
+function main() {
+  const input = process.argv[2] || path.join(ROOT, 'src', 'record_schema.h');
+  const output = process.argv[3] || path.join(ROOT, 'RecordSchema.js');
+  const schema = parseSchema(fs.readFileSync(input, 'utf8'));
+  fs.writeFileSync(output, generate(schema));
+  console.log(`Wrote ${output}: ${Object.keys(schema.schemas).length} records`);
+}
+
+if (require.main === module) {
+  main();
+}
+
+module.exports = { parseSchema, generate };
@@ -0,0 +1,65 @@
+/*
+ * Dump the reading history from a flash image of the wlog partition
+ *
+ * Reads the image through the same memory-mapped access the firmware uses
+ * (partition_map.h, mmap() on a host) and prints every intact record,
+ * oldest first, as CSV. Records are decoded in place; nothing is copied
+ * out of the mapping.
+ *
+ * Usage:
+ *   esptool.py read_flash 0x290000 0x160000 wlog.bin
+ *   g++ -std=c++11 -I src tools/history_dump.cpp src/partition_map.cpp -o history_dump
+ *   ./history_dump wlog.bin > history.csv
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "history_format.h"
+#include "partition_map.h"
+#include "record_schema.h"
+
+#define STATUS_NAME(status, name) name,
+static const char* const STATUS_NAMES[] = { WATER_STATUS_NAMES(STATUS_NAME) };
+#define STATUS_COUNT (sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0]))
+
+static bool olderFirst(const HistoryRecord* a, const HistoryRecord* b) {
+  return a->seq < b->seq;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s wlog.bin\n", argv[0]);
+    return 2;
+  }
+  PartitionMap map;
+  if (!partitionMapOpenImage(map, argv[1])) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  // Every slot holding an intact record of the sequence number it belongs to
+  uint32_t slotCount = map.size / HISTORY_SECTOR_SIZE * HISTORY_SLOTS_PER_SECTOR;
+  std::vector<const HistoryRecord*> records;
+  for (uint32_t slot = 0; slot < slotCount; slot++) {
+    const HistoryRecord* record = (const HistoryRecord*)partitionMapAt(map, slot * sizeof(HistoryRecord), sizeof(HistoryRecord));
+    if (record && record->seq % slotCount == slot && historyRecordValid(*record, record->seq)) {
+      records.push_back(record);
+    }
+  }
+  std::sort(records.begin(), records.end(), olderFirst);
+
+  printf("seq,timestamp,pH,temperature,tds,turbidity,vibration,vibrationDetected,waterStatus\n");
+  for (size_t i = 0; i < records.size(); i++) {
+    const HistoryRecord& r = *records[i];
+    printf("%u,%u,%.2f,%.1f,%.1f,%.2f,%.2f,%d,%s\n", (unsigned)r.seq, (unsigned)r.timestamp,
+           r.pH / 100.0, r.temperature / 10.0, r.tds, r.turbidity / 100.0, r.vibration,
+           (r.flags & HISTORY_FLAG_VIBRATION) != 0, r.waterStatus < STATUS_COUNT ? STATUS_NAMES[r.waterStatus] : "unknown");
+  }
+  fprintf(stderr, "%zu records in %u slots\n", records.size(), (unsigned)slotCount);
+
+  partitionMapClose(map);
+  return 0;
+}
@@ -0,0 +1,135 @@
+#!/usr/bin/env node
+/*
+ * Convert a firmware trace dump to Chrome trace JSON
+ *
+ * Reads a serial log or BLE capture containing the "TRACE ..." lines
+ * printed by the `trace` / `trace fault` commands (other lines are
+ * ignored) and writes JSON that chrome://tracing and
+ * https://ui.perfetto.dev open directly. The last complete dump in the
+ * input is converted.
+ *
+ * Usage: node tools/trace2chrome.js capture.log > trace.json
+ *        node tools/trace2chrome.js < capture.log > trace.json
+ *
+ * Timestamps are the low 32 bits of the microsecond timer, shared by both
+ * cores. Consecutive events are assumed to be less than half a counter
+ * period apart (about 35 minutes); even the slowest reading interval keeps
+ * the trace well inside that. Dumps from older firmware carry `mhz=` and
+ * per-core cycle counts, which are converted with it.
+ */
+
+const fs = require('fs');
+
+const EVENT_HEX = 16;
+
+function parseDump(text) {
+  let dump = null;
+  let complete = null;
+
+  for (const rawLine of text.split(/\r?\n/)) {
+    const start = rawLine.indexOf('TRACE ');
+    if (start < 0) continue;
+    const fields = rawLine.slice(start).trim().split(/\s+/);
+
+    switch (fields[1]) {
+      case 'BEGIN': {
+        const options = {};
+        for (const field of fields.slice(3)) {
+          const [key, value] = field.split('=');
+          options[key] = Number(value);
+        }
+        dump = { source: fields[2], mhz: options.mhz || 0, dropped: options.dropped || 0, names: {}, tasks: {}, events: [] };
+        break;
+      }
+      case 'NAME':
+        if (dump) dump.names[Number(fields[2])] = fields[3];
+        break;
+      case 'TASK':
+        if (dump) dump.tasks[Number(fields[2])] = fields.slice(3).join(' ');
+        break;
+      case 'EV':
+        if (dump && fields[2]) {
+          const hex = fields[2];
+          for (let i = 0; i + EVENT_HEX <= hex.length; i += EVENT_HEX) {
+            dump.events.push({
+              time: parseInt(hex.slice(i, i + 8), 16),
+              point: parseInt(hex.slice(i + 8, i + 10), 16),
+              phase: String.fromCharCode(parseInt(hex.slice(i + 10, i + 12), 16)),
+              task: parseInt(hex.slice(i + 12, i + 14), 16),
+              arg: parseInt(hex.slice(i + 14, i + 16), 16),
+            });
+          }
+        }
+        break;
+      case 'END':
+        if (dump) complete = dump;
+        dump = null;
+        break;
+      default:
+        break;
+    }
+  }
+  return complete;
+}
+
+function toChromeTrace(dump) {
+  const traceEvents = [];
+
+  for (const [tid, name] of Object.entries(dump.tasks)) {
+    traceEvents.push({ name: 'thread_name', ph: 'M', pid: 1, tid: Number(tid), args: { name } });
+  }
+  traceEvents.push({ name: 'process_name', ph: 'M', pid: 1, tid: 0, args: { name: `ESP32-WaterSensor (${dump.source})` } });
+
+  // Unwrap the 32-bit timestamps into a running total
+  let previous = null;
+  let elapsed = 0;
+  const ticksPerUs = dump.mhz || 1;
+  const openSlices = {};  // Per task, so ends whose begin was overwritten are skipped
+  for (const event of dump.events) {
+    if (previous !== null) {
+      elapsed += (event.time - previous) | 0;
+    }
+    previous = event.time;
+
+    const depth = openSlices[event.task] || 0;
+    if (event.phase === 'E' && depth === 0) continue;
+    if (event.phase === 'B') openSlices[event.task] = depth + 1;
+    if (event.phase === 'E') openSlices[event.task] = depth - 1;
+
+    const out = {
+      name: dump.names[event.point] || `point_${event.point}`,
+      ph: event.phase,
+      ts: elapsed / ticksPerUs,
+      pid: 1,
+      tid: event.task,
+    };
+    if (event.phase === 'i') {
+      out.s = 't';
+      out.args = { arg: event.arg };
+    }
+    traceEvents.push(out);
+  }
+
+  return {
+    traceEvents,
+    displayTimeUnit: 'ms',
+    otherData: { source: dump.source, droppedWhileDumping: dump.dropped },
+  };
+}
+
+function main() {
+  const path = process.argv[2];
+  const text = path ? fs.readFileSync(path, 'utf8') : fs.readFileSync(0, 'utf8');
+  const dump = parseDump(text);
+  if (!dump) {
+    console.error('No complete TRACE BEGIN ... TRACE END block found');
+    process.exit(1);
+  }
+  process.stdout.write(JSON.stringify(toChromeTrace(dump), null, 1) + '\n');
+}
+
+if (require.main === module) {
+  main();
+}
+
+module.exports = { parseDump, toChromeTrace };